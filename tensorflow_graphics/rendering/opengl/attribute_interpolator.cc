@@ -0,0 +1,236 @@
+/* Copyright 2019 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#include "tensorflow_graphics/rendering/opengl/attribute_interpolator.h"
+
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace {
+
+// Returns the dot product of a and b.
+double Dot(const double a[3], const double b[3]) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Stores the cross product of a and b in result.
+void Cross(const double a[3], const double b[3], double result[3]) {
+  result[0] = a[1] * b[2] - a[2] * b[1];
+  result[1] = a[2] * b[0] - a[0] * b[2];
+  result[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+}  // namespace
+
+AttributeInterpolator::AttributeInterpolator(int width, int height,
+                                             int num_attributes)
+    : width_(width), height_(height), num_attributes_(num_attributes) {}
+
+tensorflow::Status AttributeInterpolator::Create(
+    int width, int height, int num_attributes,
+    std::unique_ptr<AttributeInterpolator>* interpolator) {
+  if (width <= 0 || height <= 0)
+    return tensorflow::errors::InvalidArgument(
+        "The image size must be positive, got ", width, "x", height, ".");
+  if (num_attributes <= 0)
+    return tensorflow::errors::InvalidArgument(
+        "The number of attributes must be positive, got ", num_attributes,
+        ".");
+  *interpolator = std::unique_ptr<AttributeInterpolator>(
+      new AttributeInterpolator(width, height, num_attributes));
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status AttributeInterpolator::ValidateInputs(
+    absl::Span<const int> triangle_index, absl::Span<const float> vertices,
+    absl::Span<const int> triangles, absl::Span<const float> attributes,
+    absl::Span<const float> view_projection_matrix, int64_t pixel_begin,
+    int64_t pixel_end) const {
+  if (triangle_index.size() != num_pixels())
+    return tensorflow::errors::InvalidArgument(
+        "The triangle index image must have ", num_pixels(),
+        " pixels, got ", triangle_index.size(), ".");
+  if (vertices.size() % 3 != 0 || triangles.size() % 3 != 0)
+    return tensorflow::errors::InvalidArgument(
+        "The vertices and triangles must have 3 values each.");
+  if (attributes.size() != vertices.size() / 3 * num_attributes_)
+    return tensorflow::errors::InvalidArgument(
+        "The attributes must have ", num_attributes_,
+        " values for each of the ", vertices.size() / 3, " vertices, got ",
+        attributes.size(), " values.");
+  if (view_projection_matrix.size() != 16)
+    return tensorflow::errors::InvalidArgument(
+        "The view projection matrix must have 16 values, got ",
+        view_projection_matrix.size(), ".");
+  if (pixel_begin < 0 || pixel_end < pixel_begin || pixel_end > num_pixels())
+    return tensorflow::errors::InvalidArgument(
+        "The range of pixels [", pixel_begin, ", ", pixel_end,
+        ") is not within the ", num_pixels(), " pixels of the image.");
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status AttributeInterpolator::SetupPixel(
+    absl::Span<const int> triangle_index, absl::Span<const float> vertices,
+    absl::Span<const int> triangles,
+    absl::Span<const float> view_projection_matrix, int64_t pixel,
+    PixelTriangle* pixel_triangle) const {
+  const int triangle = triangle_index[pixel];
+  if (triangle < 0 || triangle >= triangles.size() / 3)
+    return tensorflow::errors::InvalidArgument(
+        "Triangle index ", triangle, " of pixel ", pixel,
+        " is out of range [0, ", triangles.size() / 3, ").");
+  for (int v = 0; v < 3; ++v) {
+    const int vertex = triangles[triangle * 3 + v];
+    if (vertex < 0 || vertex >= vertices.size() / 3)
+      return tensorflow::errors::InvalidArgument(
+          "Vertex index ", vertex, " of triangle ", triangle,
+          " is out of range [0, ", vertices.size() / 3, ").");
+    pixel_triangle->vertex_indices[v] = vertex;
+    // Only the x, y and w rows of the matrix are needed to locate the pixel in
+    // the triangle.
+    const int rows[3] = {0, 1, 3};
+    for (int i = 0; i < 3; ++i) {
+      const float* row = view_projection_matrix.data() + rows[i] * 4;
+      pixel_triangle->clip[v][i] = double{row[0]} * vertices[vertex * 3] +
+                                   double{row[1]} * vertices[vertex * 3 + 1] +
+                                   double{row[2]} * vertices[vertex * 3 + 2] +
+                                   row[3];
+    }
+  }
+  // OpenGL samples the pixels at their center.
+  pixel_triangle->ndc[0] = 2.0 * (pixel % width_ + 0.5) / width_ - 1.0;
+  pixel_triangle->ndc[1] = 2.0 * (pixel / width_ + 0.5) / height_ - 1.0;
+  pixel_triangle->ndc[2] = 1.0;
+
+  // The perspective-correct barycentric coordinates are the solution of
+  // sum_i weights[i] * clip[i] = ndc, up to a scale. The solution is given by
+  // the rows of the adjugate of the matrix whose columns are the clip[i].
+  pixel_triangle->sum = 0.0;
+  for (int i = 0; i < 3; ++i) {
+    double edge[3];
+    Cross(pixel_triangle->clip[(i + 1) % 3], pixel_triangle->clip[(i + 2) % 3],
+          edge);
+    pixel_triangle->weights[i] = Dot(edge, pixel_triangle->ndc);
+    pixel_triangle->sum += pixel_triangle->weights[i];
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status AttributeInterpolator::Interpolate(
+    absl::Span<const int> triangle_index, absl::Span<const float> vertices,
+    absl::Span<const int> triangles, absl::Span<const float> attributes,
+    absl::Span<const float> view_projection_matrix, int64_t pixel_begin,
+    int64_t pixel_end, absl::Span<float> interpolated_attributes) const {
+  TF_RETURN_IF_ERROR(ValidateInputs(triangle_index, vertices, triangles,
+                                    attributes, view_projection_matrix,
+                                    pixel_begin, pixel_end));
+  if (interpolated_attributes.size() != num_pixels() * num_attributes_)
+    return tensorflow::errors::InvalidArgument(
+        "The interpolated attributes must have ",
+        num_pixels() * num_attributes_, " values, got ",
+        interpolated_attributes.size(), ".");
+
+  PixelTriangle pixel_triangle;
+  for (int64_t pixel = pixel_begin; pixel < pixel_end; ++pixel) {
+    TF_RETURN_IF_ERROR(SetupPixel(triangle_index, vertices, triangles,
+                                  view_projection_matrix, pixel,
+                                  &pixel_triangle));
+    float* output = interpolated_attributes.data() + pixel * num_attributes_;
+    for (int k = 0; k < num_attributes_; ++k) output[k] = 0.0f;
+    // Pixels of degenerate triangles get no attributes.
+    if (pixel_triangle.sum == 0.0) continue;
+    for (int v = 0; v < 3; ++v) {
+      const double barycentric = pixel_triangle.weights[v] / pixel_triangle.sum;
+      const int offset = pixel_triangle.vertex_indices[v] * num_attributes_;
+      for (int k = 0; k < num_attributes_; ++k)
+        output[k] += barycentric * attributes[offset + k];
+    }
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status AttributeInterpolator::InterpolateGrad(
+    absl::Span<const int> triangle_index, absl::Span<const float> vertices,
+    absl::Span<const int> triangles, absl::Span<const float> attributes,
+    absl::Span<const float> view_projection_matrix, int64_t pixel_begin,
+    int64_t pixel_end, absl::Span<const float> interpolated_attributes_grad,
+    absl::Span<float> vertices_grad, absl::Span<float> attributes_grad,
+    absl::Span<float> view_projection_matrix_grad) const {
+  TF_RETURN_IF_ERROR(ValidateInputs(triangle_index, vertices, triangles,
+                                    attributes, view_projection_matrix,
+                                    pixel_begin, pixel_end));
+  if (interpolated_attributes_grad.size() != num_pixels() * num_attributes_ ||
+      vertices_grad.size() != vertices.size() ||
+      attributes_grad.size() != attributes.size() ||
+      view_projection_matrix_grad.size() != 16)
+    return tensorflow::errors::InvalidArgument(
+        "The gradients must have the size of the corresponding values.");
+
+  PixelTriangle pixel_triangle;
+  const int rows[3] = {0, 1, 3};
+  for (int64_t pixel = pixel_begin; pixel < pixel_end; ++pixel) {
+    TF_RETURN_IF_ERROR(SetupPixel(triangle_index, vertices, triangles,
+                                  view_projection_matrix, pixel,
+                                  &pixel_triangle));
+    if (pixel_triangle.sum == 0.0) continue;
+    const float* output_grad =
+        interpolated_attributes_grad.data() + pixel * num_attributes_;
+
+    // The attributes are interpolated with barycentric coordinates
+    // weights[v] / sum, whose gradient is accumulated along with the one of
+    // the attributes.
+    double barycentric_grad[3];
+    double weighted_barycentric_grad = 0.0;
+    for (int v = 0; v < 3; ++v) {
+      const double barycentric = pixel_triangle.weights[v] / pixel_triangle.sum;
+      const int offset = pixel_triangle.vertex_indices[v] * num_attributes_;
+      barycentric_grad[v] = 0.0;
+      for (int k = 0; k < num_attributes_; ++k) {
+        attributes_grad[offset + k] += barycentric * output_grad[k];
+        barycentric_grad[v] += double{attributes[offset + k]} * output_grad[k];
+      }
+      weighted_barycentric_grad += barycentric_grad[v] * barycentric;
+    }
+
+    // weights[i] is the triple product of clip[i + 1], clip[i + 2] and ndc.
+    double clip_grad[3][3] = {};
+    for (int i = 0; i < 3; ++i) {
+      const double weight_grad =
+          (barycentric_grad[i] - weighted_barycentric_grad) /
+          pixel_triangle.sum;
+      const int j = (i + 1) % 3;
+      const int k = (i + 2) % 3;
+      double edge_grad[3];
+      Cross(pixel_triangle.clip[k], pixel_triangle.ndc, edge_grad);
+      for (int c = 0; c < 3; ++c) clip_grad[j][c] += weight_grad * edge_grad[c];
+      Cross(pixel_triangle.ndc, pixel_triangle.clip[j], edge_grad);
+      for (int c = 0; c < 3; ++c) clip_grad[k][c] += weight_grad * edge_grad[c];
+    }
+
+    // Backpropagate through the projection of the vertices.
+    for (int v = 0; v < 3; ++v) {
+      const int vertex = pixel_triangle.vertex_indices[v];
+      const float* position = vertices.data() + vertex * 3;
+      for (int i = 0; i < 3; ++i) {
+        const float* row = view_projection_matrix.data() + rows[i] * 4;
+        float* row_grad = view_projection_matrix_grad.data() + rows[i] * 4;
+        for (int c = 0; c < 3; ++c) {
+          vertices_grad[vertex * 3 + c] += clip_grad[v][i] * row[c];
+          row_grad[c] += clip_grad[v][i] * position[c];
+        }
+        row_grad[3] += clip_grad[v][i];
+      }
+    }
+  }
+  return tensorflow::Status::OK();
+}
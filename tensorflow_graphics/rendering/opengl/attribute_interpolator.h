@@ -0,0 +1,152 @@
+/* Copyright 2019 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_ATTRIBUTE_INTERPOLATOR_H_
+#define THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_ATTRIBUTE_INTERPOLATOR_H_
+
+#include <memory>
+
+#include "absl/types/span.h"
+#include "tensorflow/core/lib/core/status.h"
+
+// Interpolates per-vertex attributes over the pixels of a triangle index image,
+// such as the one produced by TriangleRasterizer, and computes the gradients of
+// the interpolated attributes with respect to the vertices, the attributes and
+// the view projection matrix.
+//
+// The attributes of a pixel are interpolated with the perspective-correct
+// barycentric coordinates of its center in its triangle, whose vertices are
+// projected by a row-major view projection matrix. The barycentric coordinates
+// of a pixel are recomputed from the vertices rather than read back from the
+// rasterizer, so that gradients flow through them to the geometry. Images are
+// stored row by row from the bottom, and can be processed by ranges of pixels,
+// e.g. on several threads.
+class AttributeInterpolator {
+ public:
+  // Creates an interpolator of images of a given size.
+  //
+  // Arguments:
+  // * width: width of the images.
+  // * height: height of the images.
+  // * num_attributes: number of attributes of each vertex.
+  // * interpolator: if the method succeeds, this variable returns an object
+  //   interpolating attributes over images of that size.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  static tensorflow::Status Create(
+      int width, int height, int num_attributes,
+      std::unique_ptr<AttributeInterpolator>* interpolator);
+
+  // Interpolates the attributes of the vertices over a range of pixels.
+  //
+  // Arguments:
+  // * triangle_index: the index of the triangle covering each pixel, of size
+  //   width * height.
+  // * vertices: the 3D positions of the vertices, stored as 3 consecutive
+  //   coordinates each.
+  // * triangles: the indices of the vertices of the triangles, stored as 3
+  //   consecutive indices each.
+  // * attributes: the attributes of the vertices, stored as num_attributes
+  //   consecutive values each.
+  // * view_projection_matrix: the 4x4 matrix transforming the vertices into
+  //   clip space, in row-major order.
+  // * pixel_begin: the first pixel to interpolate.
+  // * pixel_end: the pixel following the last one to interpolate.
+  // * interpolated_attributes: the attributes of each pixel, of size
+  //   width * height * num_attributes, of which only the range of pixels is
+  //   written.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  tensorflow::Status Interpolate(
+      absl::Span<const int> triangle_index, absl::Span<const float> vertices,
+      absl::Span<const int> triangles, absl::Span<const float> attributes,
+      absl::Span<const float> view_projection_matrix, int64_t pixel_begin,
+      int64_t pixel_end, absl::Span<float> interpolated_attributes) const;
+
+  // Backpropagates the gradient of the attributes interpolated over a range of
+  // pixels. The gradients are added to the values already stored in the
+  // outputs, so that the ranges of an image can be processed into separate
+  // buffers and summed.
+  //
+  // Arguments:
+  // * triangle_index, vertices, triangles, attributes, view_projection_matrix,
+  //   pixel_begin, pixel_end: the inputs of Interpolate.
+  // * interpolated_attributes_grad: the gradient of the interpolated
+  //   attributes, of size width * height * num_attributes.
+  // * vertices_grad: the gradient of the vertices, of the size of vertices.
+  // * attributes_grad: the gradient of the attributes, of the size of
+  //   attributes.
+  // * view_projection_matrix_grad: the gradient of the view projection matrix,
+  //   of size 16.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  tensorflow::Status InterpolateGrad(
+      absl::Span<const int> triangle_index, absl::Span<const float> vertices,
+      absl::Span<const int> triangles, absl::Span<const float> attributes,
+      absl::Span<const float> view_projection_matrix, int64_t pixel_begin,
+      int64_t pixel_end, absl::Span<const float> interpolated_attributes_grad,
+      absl::Span<float> vertices_grad, absl::Span<float> attributes_grad,
+      absl::Span<float> view_projection_matrix_grad) const;
+
+  int64_t num_pixels() const { return int64_t{width_} * height_; }
+
+ private:
+  // Triangle covering a pixel, projected onto the image plane.
+  struct PixelTriangle {
+    // Indices of the vertices of the triangle.
+    int vertex_indices[3];
+    // Clip space x, y and w of the vertices.
+    double clip[3][3];
+    // Homogeneous normalized device coordinates of the pixel center.
+    double ndc[3];
+    // Unnormalized perspective-correct barycentric coordinates of the pixel
+    // center, and their sum, which is 0 for degenerate triangles.
+    double weights[3];
+    double sum;
+  };
+
+  AttributeInterpolator() = delete;
+  AttributeInterpolator(int width, int height, int num_attributes);
+  AttributeInterpolator(const AttributeInterpolator&) = delete;
+  AttributeInterpolator(AttributeInterpolator&&) = delete;
+  AttributeInterpolator& operator=(const AttributeInterpolator&) = delete;
+  AttributeInterpolator& operator=(AttributeInterpolator&&) = delete;
+
+  // Checks the sizes of the inputs common to Interpolate and InterpolateGrad.
+  tensorflow::Status ValidateInputs(
+      absl::Span<const int> triangle_index, absl::Span<const float> vertices,
+      absl::Span<const int> triangles, absl::Span<const float> attributes,
+      absl::Span<const float> view_projection_matrix, int64_t pixel_begin,
+      int64_t pixel_end) const;
+
+  // Projects the triangle covering a pixel.
+  tensorflow::Status SetupPixel(absl::Span<const int> triangle_index,
+                                absl::Span<const float> vertices,
+                                absl::Span<const int> triangles,
+                                absl::Span<const float> view_projection_matrix,
+                                int64_t pixel,
+                                PixelTriangle* pixel_triangle) const;
+
+  const int width_;
+  const int height_;
+  const int num_attributes_;
+};
+
+#endif  // THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_ATTRIBUTE_INTERPOLATOR_H_
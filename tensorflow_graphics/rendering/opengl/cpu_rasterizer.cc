@@ -0,0 +1,323 @@
+/* Copyright 2019 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#include "tensorflow_graphics/rendering/opengl/cpu_rasterizer.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "third_party/eigen3/Eigen/Core"
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace {
+
+constexpr int kTilePixels = CpuRasterizer::kTileSize * CpuRasterizer::kTileSize;
+
+// Values of the pixels of a tile, row by row from the bottom. Operations on
+// these arrays are vectorized by Eigen.
+using TileArray = Eigen::Array<float, kTilePixels, 1>;
+using TileIndexArray = Eigen::Array<int, kTilePixels, 1>;
+using TileMask = Eigen::Array<bool, kTilePixels, 1>;
+
+// Returns the horizontal offsets of the pixels of a tile from its first pixel.
+const TileArray& GetTileOffsetsX() {
+  static const TileArray* offsets = [] {
+    auto* offsets = new TileArray();
+    for (int i = 0; i < kTilePixels; ++i)
+      (*offsets)[i] = i % CpuRasterizer::kTileSize;
+    return offsets;
+  }();
+  return *offsets;
+}
+
+// Returns the vertical offsets of the pixels of a tile from its first pixel.
+const TileArray& GetTileOffsetsY() {
+  static const TileArray* offsets = [] {
+    auto* offsets = new TileArray();
+    for (int i = 0; i < kTilePixels; ++i)
+      (*offsets)[i] = i / CpuRasterizer::kTileSize;
+    return offsets;
+  }();
+  return *offsets;
+}
+
+// Returns the pixels of a tile on the inner side of an edge.
+TileMask InsideEdge(const TileArray& edge, bool top_left) {
+  if (top_left) return edge >= 0.0f;
+  return edge > 0.0f;
+}
+
+}  // namespace
+
+CpuRasterizer::CpuRasterizer(int width, int height)
+    : width_(width),
+      height_(height),
+      num_tiles_x_((width + kTileSize - 1) / kTileSize),
+      num_tiles_y_((height + kTileSize - 1) / kTileSize) {}
+
+tensorflow::Status CpuRasterizer::Create(
+    int width, int height, std::unique_ptr<CpuRasterizer>* rasterizer) {
+  if (width <= 0 || height <= 0)
+    return tensorflow::errors::InvalidArgument(
+        "The image size must be positive, got ", width, "x", height, ".");
+  *rasterizer =
+      std::unique_ptr<CpuRasterizer>(new CpuRasterizer(width, height));
+  return tensorflow::Status::OK();
+}
+
+bool CpuRasterizer::SetupTriangle(const float* vertices[3],
+                                  const float* matrix, Triangle* triangle,
+                                  int* tile_x_begin, int* tile_x_end,
+                                  int* tile_y_begin, int* tile_y_end) const {
+  // Project the vertices in single precision, as the shaders do.
+  float clip[3][4];
+  for (int v = 0; v < 3; ++v) {
+    for (int row = 0; row < 4; ++row) {
+      clip[v][row] = matrix[row * 4] * vertices[v][0] +
+                     matrix[row * 4 + 1] * vertices[v][1] +
+                     matrix[row * 4 + 2] * vertices[v][2] + matrix[row * 4 + 3];
+    }
+  }
+
+  // Cull back-facing triangles with the test of the geometry shader, which
+  // divides by w even for vertices behind the camera.
+  const float ax = clip[1][0] / clip[1][3] - clip[0][0] / clip[0][3];
+  const float ay = clip[1][1] / clip[1][3] - clip[0][1] / clip[0][3];
+  const float bx = clip[2][0] / clip[2][3] - clip[0][0] / clip[0][3];
+  const float by = clip[2][1] / clip[2][3] - clip[0][1] / clip[0][3];
+  if (ax * by - bx * ay <= 0.0f) return false;
+
+  // Triangles entirely closer than the near plane or beyond the far plane are
+  // clipped.
+  if (std::all_of(clip, clip + 3, [](const float* v) { return v[2] < -v[3]; }))
+    return false;
+  if (std::all_of(clip, clip + 3, [](const float* v) { return v[2] > v[3]; }))
+    return false;
+
+  // The barycentric coordinates of the point of the triangle seen through
+  // normalized device coordinates (x, y) are w * M^-1 * (x, y, 1), where the
+  // columns of M are the (x, y, w) clip space coordinates of the vertices. The
+  // rows of M^-1 are the edge functions, which are therefore positive inside
+  // the triangle and in front of the camera, without clipping.
+  std::array<std::array<double, 3>, 3> xyw;
+  for (int v = 0; v < 3; ++v) xyw[v] = {clip[v][0], clip[v][1], clip[v][3]};
+  auto cross = [](const std::array<double, 3>& u,
+                  const std::array<double, 3>& v) -> std::array<double, 3> {
+    return {u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2],
+            u[0] * v[1] - u[1] * v[0]};
+  };
+  std::array<double, 3> rows[3] = {cross(xyw[1], xyw[2]),
+                                   cross(xyw[2], xyw[0]),
+                                   cross(xyw[0], xyw[1])};
+  const double determinant = xyw[0][0] * rows[0][0] +
+                             xyw[0][1] * rows[0][1] + xyw[0][2] * rows[0][2];
+  if (!std::isfinite(determinant) || determinant == 0.0) return false;
+
+  triangle->depth_a = 0.0;
+  triangle->depth_b = 0.0;
+  triangle->depth_c = 0.5;
+  for (int i = 0; i < 3; ++i) {
+    // Substitute x = 2 * px / width - 1 and y = 2 * py / height - 1.
+    const double a = rows[i][0] / determinant;
+    const double b = rows[i][1] / determinant;
+    const double c = rows[i][2] / determinant;
+    triangle->a[i] = 2.0 * a / width_;
+    triangle->b[i] = 2.0 * b / height_;
+    triangle->c[i] = c - a - b;
+    triangle->top_left[i] =
+        triangle->a[i] > 0.0 || (triangle->a[i] == 0.0 && triangle->b[i] > 0.0);
+    // The edge functions weighted by w sum to 1, so that those weighted by z
+    // sum to the normalized device depth.
+    triangle->depth_a += 0.5 * triangle->a[i] * clip[i][2];
+    triangle->depth_b += 0.5 * triangle->b[i] * clip[i][2];
+    triangle->depth_c += 0.5 * triangle->c[i] * clip[i][2];
+  }
+
+  // Vertices behind the camera project to the opposite side of the image, in
+  // which case the triangle may cover any pixel.
+  int x_begin = 0, x_end = width_, y_begin = 0, y_end = height_;
+  if (std::all_of(clip, clip + 3, [](const float* v) { return v[3] > 0.0f; })) {
+    double min_x = width_, max_x = 0.0, min_y = height_, max_y = 0.0;
+    for (int v = 0; v < 3; ++v) {
+      const double px = (clip[v][0] / double(clip[v][3]) + 1.0) * 0.5 * width_;
+      const double py =
+          (clip[v][1] / double(clip[v][3]) + 1.0) * 0.5 * height_;
+      min_x = std::min(min_x, px);
+      max_x = std::max(max_x, px);
+      min_y = std::min(min_y, py);
+      max_y = std::max(max_y, py);
+    }
+    // Pixels whose center is within the bounding box.
+    x_begin = std::max(0.0, std::ceil(min_x - 0.5));
+    x_end = std::min<double>(width_, std::floor(max_x - 0.5) + 1.0);
+    y_begin = std::max(0.0, std::ceil(min_y - 0.5));
+    y_end = std::min<double>(height_, std::floor(max_y - 0.5) + 1.0);
+    if (x_begin >= x_end || y_begin >= y_end) return false;
+  }
+  *tile_x_begin = x_begin / kTileSize;
+  *tile_x_end = (x_end - 1) / kTileSize + 1;
+  *tile_y_begin = y_begin / kTileSize;
+  *tile_y_end = (y_end - 1) / kTileSize + 1;
+  return true;
+}
+
+tensorflow::Status CpuRasterizer::SetupImage(
+    absl::Span<const float> vertices, absl::Span<const int> triangles,
+    absl::Span<const float> view_projection_matrix, Image* image) const {
+  if (view_projection_matrix.size() != 16)
+    return tensorflow::errors::InvalidArgument(
+        "The view projection matrix must have 16 elements, got ",
+        view_projection_matrix.size(), ".");
+  if (vertices.size() % 3 != 0 || triangles.size() % 3 != 0)
+    return tensorflow::errors::InvalidArgument(
+        "The vertices and triangles must have 3 elements each.");
+
+  const int num_vertices = vertices.size() / 3;
+  const int num_triangles = triangles.size() / 3;
+  // Range of tiles overlapped by each triangle kept.
+  std::vector<std::array<int, 4>> tile_ranges;
+  image->triangles.clear();
+  image->tile_offsets.assign(num_tiles() + 1, 0);
+  for (int index = 0; index < num_triangles; ++index) {
+    const float* triangle_vertices[3];
+    for (int v = 0; v < 3; ++v) {
+      const int vertex = triangles[index * 3 + v];
+      if (vertex < 0 || vertex >= num_vertices)
+        return tensorflow::errors::InvalidArgument(
+            "Triangle ", index, " has vertex index ", vertex,
+            ", which is not in [0, ", num_vertices, ").");
+      triangle_vertices[v] = &vertices[vertex * 3];
+    }
+
+    Triangle triangle;
+    std::array<int, 4> range;
+    if (!SetupTriangle(triangle_vertices, view_projection_matrix.data(),
+                       &triangle, &range[0], &range[1], &range[2], &range[3]))
+      continue;
+    triangle.index = index;
+    image->triangles.push_back(triangle);
+    tile_ranges.push_back(range);
+    for (int tile_y = range[2]; tile_y < range[3]; ++tile_y) {
+      for (int tile_x = range[0]; tile_x < range[1]; ++tile_x)
+        ++image->tile_offsets[tile_y * num_tiles_x_ + tile_x + 1];
+    }
+  }
+
+  // Bin the triangles, in the order they are drawn.
+  for (int tile = 0; tile < num_tiles(); ++tile)
+    image->tile_offsets[tile + 1] += image->tile_offsets[tile];
+  image->tile_triangles.resize(image->tile_offsets.back());
+  std::vector<int> tile_ends(image->tile_offsets.begin(),
+                             image->tile_offsets.end() - 1);
+  for (int triangle = 0; triangle < tile_ranges.size(); ++triangle) {
+    const std::array<int, 4>& range = tile_ranges[triangle];
+    for (int tile_y = range[2]; tile_y < range[3]; ++tile_y) {
+      for (int tile_x = range[0]; tile_x < range[1]; ++tile_x)
+        image->tile_triangles[tile_ends[tile_y * num_tiles_x_ + tile_x]++] =
+            triangle;
+    }
+  }
+  return tensorflow::Status::OK();
+}
+
+void CpuRasterizer::RasterizeTile(const Image& image, int tile_index,
+                                  absl::Span<int> triangle_index,
+                                  absl::Span<float> barycentric_coordinates,
+                                  absl::Span<float> depth) const {
+  const int tile_x = tile_index % num_tiles_x_ * kTileSize;
+  const int tile_y = tile_index / num_tiles_x_ * kTileSize;
+  // Center of the first pixel of the tile.
+  const double x = tile_x + 0.5;
+  const double y = tile_y + 0.5;
+  const TileArray& offsets_x = GetTileOffsetsX();
+  const TileArray& offsets_y = GetTileOffsetsY();
+
+  TileIndexArray tile_triangle_index = TileIndexArray::Zero();
+  TileArray tile_barycentrics[3] = {TileArray::Zero(), TileArray::Zero(),
+                                    TileArray::Zero()};
+  TileArray tile_depth = TileArray::Ones();
+  for (int k = image.tile_offsets[tile_index];
+       k < image.tile_offsets[tile_index + 1]; ++k) {
+    const Triangle& triangle = image.triangles[image.tile_triangles[k]];
+
+    TileArray edges[3];
+    TileMask inside = TileMask::Constant(true);
+    for (int i = 0; i < 3; ++i) {
+      edges[i] = static_cast<float>(triangle.a[i]) * offsets_x +
+                 static_cast<float>(triangle.b[i]) * offsets_y +
+                 static_cast<float>(triangle.a[i] * x + triangle.b[i] * y +
+                                    triangle.c[i]);
+      inside = inside && InsideEdge(edges[i], triangle.top_left[i]);
+    }
+    if (!inside.any()) continue;
+
+    const TileArray fragment_depth =
+        static_cast<float>(triangle.depth_a) * offsets_x +
+        static_cast<float>(triangle.depth_b) * offsets_y +
+        static_cast<float>(triangle.depth_a * x + triangle.depth_b * y +
+                           triangle.depth_c);
+    // Clip the fragments outside of the depth range, and test the others
+    // against the closest fragment so far.
+    const TileMask visible = inside && fragment_depth >= 0.0f &&
+                             fragment_depth <= 1.0f &&
+                             fragment_depth < tile_depth;
+    if (!visible.any()) continue;
+
+    tile_depth = visible.select(fragment_depth, tile_depth);
+    tile_triangle_index = visible.select(
+        TileIndexArray::Constant(triangle.index), tile_triangle_index);
+    const TileArray edge_sum = edges[0] + edges[1] + edges[2];
+    for (int i = 0; i < 3; ++i) {
+      tile_barycentrics[i] =
+          visible.select(edges[i] / edge_sum, tile_barycentrics[i]);
+    }
+  }
+
+  // Write the pixels of the tile which are within the image.
+  const int num_rows = std::min(kTileSize, height_ - tile_y);
+  const int num_columns = std::min(kTileSize, width_ - tile_x);
+  for (int row = 0; row < num_rows; ++row) {
+    for (int column = 0; column < num_columns; ++column) {
+      const int pixel = (tile_y + row) * width_ + tile_x + column;
+      const int tile_pixel = row * kTileSize + column;
+      triangle_index[pixel] = tile_triangle_index[tile_pixel];
+      for (int i = 0; i < 3; ++i) {
+        barycentric_coordinates[pixel * 3 + i] =
+            tile_barycentrics[i][tile_pixel];
+      }
+      depth[pixel] = tile_depth[tile_pixel];
+    }
+  }
+}
+
+tensorflow::Status CpuRasterizer::Rasterize(
+    absl::Span<const float> vertices, absl::Span<const int> triangles,
+    absl::Span<const float> view_projection_matrix,
+    absl::Span<int> triangle_index, absl::Span<float> barycentric_coordinates,
+    absl::Span<float> depth) const {
+  const int num_pixels = width_ * height_;
+  if (triangle_index.size() != num_pixels ||
+      barycentric_coordinates.size() != num_pixels * 3 ||
+      depth.size() != num_pixels)
+    return tensorflow::errors::InvalidArgument(
+        "The outputs do not match the image size ", width_, "x", height_, ".");
+
+  Image image;
+  TF_RETURN_IF_ERROR(
+      SetupImage(vertices, triangles, view_projection_matrix, &image));
+  for (int tile = 0; tile < num_tiles(); ++tile)
+    RasterizeTile(image, tile, triangle_index, barycentric_coordinates, depth);
+  return tensorflow::Status::OK();
+}
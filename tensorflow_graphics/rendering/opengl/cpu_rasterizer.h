@@ -0,0 +1,157 @@
+/* Copyright 2019 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_CPU_RASTERIZER_H_
+#define THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_CPU_RASTERIZER_H_
+
+#include <memory>
+#include <vector>
+
+#include "absl/types/span.h"
+#include "tensorflow/core/lib/core/status.h"
+
+// Rasterizes triangular meshes on the CPU, without OpenGL. The images match
+// those of the shaders of TriangleRasterizer: the vertices are projected by a
+// row-major view projection matrix, the triangles facing away from the camera
+// are culled, the fragments outside of the depth range are clipped, and each
+// pixel keeps the closest triangle whose center it covers, or the first one
+// drawn in case of a tie.
+//
+// The images are split into square tiles. SetupImage projects the triangles of
+// an image and bins them into the tiles they overlap, after which the tiles
+// can be rasterized independently, e.g. on several threads, by RasterizeTile.
+// A tile is rasterized by evaluating the edge functions of its triangles over
+// all of its pixels at once, which vectorizes into SIMD instructions.
+class CpuRasterizer {
+ public:
+  // Width and height of a tile, in pixels.
+  static constexpr int kTileSize = 8;
+
+  // Triangle projected onto the image. Coordinates are in pixels, the center
+  // of the bottom left pixel being (0.5, 0.5).
+  struct Triangle {
+    // Index of the triangle in the mesh.
+    int index;
+    // The edge functions a[i] * x + b[i] * y + c[i] are non-negative inside
+    // the triangle, and equal the perspective-correct barycentric coordinate of
+    // vertex i divided by the clip space w of the point.
+    double a[3];
+    double b[3];
+    double c[3];
+    // Whether a pixel center lying exactly on edge i is inside the triangle,
+    // so that pixels on the edge shared by two triangles belong to one of them.
+    bool top_left[3];
+    // Window space depth depth_a * x + depth_b * y + depth_c.
+    double depth_a;
+    double depth_b;
+    double depth_c;
+  };
+
+  // Triangles of an image, binned into the tiles overlapping their bounding
+  // box, in the order they are drawn.
+  struct Image {
+    std::vector<Triangle> triangles;
+    // The triangles of tile t are triangles[tile_triangles[k]] for k in
+    // [tile_offsets[t], tile_offsets[t + 1]).
+    std::vector<int> tile_offsets;
+    std::vector<int> tile_triangles;
+  };
+
+  // Creates a rasterizer of images of a given size.
+  //
+  // Arguments:
+  // * width: width of the images.
+  // * height: height of the images.
+  // * rasterizer: if the method succeeds, this variable returns an object
+  //   rasterizing images of that size.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  static tensorflow::Status Create(int width, int height,
+                                   std::unique_ptr<CpuRasterizer>* rasterizer);
+
+  // Projects the triangles of a mesh and bins them into tiles.
+  //
+  // Arguments:
+  // * vertices: the 3D positions of the vertices, stored as 3 consecutive
+  //   coordinates each.
+  // * triangles: the indices of the vertices of the triangles, stored as 3
+  //   consecutive indices each.
+  // * view_projection_matrix: the 4x4 matrix transforming the vertices into
+  //   clip space, in row-major order.
+  // * image: if the method succeeds, holds the projected triangles.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  tensorflow::Status SetupImage(absl::Span<const float> vertices,
+                                absl::Span<const int> triangles,
+                                absl::Span<const float> view_projection_matrix,
+                                Image* image) const;
+
+  // Rasterizes a tile of an image set up by SetupImage. Only the pixels of the
+  // tile are written to the outputs, which hold the whole image, row by row
+  // from the bottom. Pixels not covered by any triangle get a triangle index
+  // and barycentric coordinates of 0, and a depth of 1.
+  //
+  // Arguments:
+  // * image: the triangles of the image.
+  // * tile_index: the index of the tile, in [0, num_tiles()).
+  // * triangle_index: the index of the triangle covering each pixel, of size
+  //   width * height.
+  // * barycentric_coordinates: the perspective-correct barycentric
+  //   coordinates of each pixel in its triangle, of size width * height * 3.
+  // * depth: the window space depth of each pixel, of size width * height.
+  void RasterizeTile(const Image& image, int tile_index,
+                     absl::Span<int> triangle_index,
+                     absl::Span<float> barycentric_coordinates,
+                     absl::Span<float> depth) const;
+
+  // Sets up an image and rasterizes all of its tiles.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  tensorflow::Status Rasterize(absl::Span<const float> vertices,
+                               absl::Span<const int> triangles,
+                               absl::Span<const float> view_projection_matrix,
+                               absl::Span<int> triangle_index,
+                               absl::Span<float> barycentric_coordinates,
+                               absl::Span<float> depth) const;
+
+  int num_tiles() const { return num_tiles_x_ * num_tiles_y_; }
+
+ private:
+  CpuRasterizer() = delete;
+  CpuRasterizer(int width, int height);
+  CpuRasterizer(const CpuRasterizer&) = delete;
+  CpuRasterizer(CpuRasterizer&&) = delete;
+  CpuRasterizer& operator=(const CpuRasterizer&) = delete;
+  CpuRasterizer& operator=(CpuRasterizer&&) = delete;
+
+  // Projects a triangle, and returns false if it is culled or cannot cover any
+  // pixel. Otherwise, the range of tiles overlapping its bounding box is
+  // returned in [tile_x_begin, tile_x_end) x [tile_y_begin, tile_y_end).
+  bool SetupTriangle(const float* vertices[3], const float* matrix,
+                     Triangle* triangle, int* tile_x_begin, int* tile_x_end,
+                     int* tile_y_begin, int* tile_y_end) const;
+
+  const int width_;
+  const int height_;
+  const int num_tiles_x_;
+  const int num_tiles_y_;
+};
+
+#endif  // THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_CPU_RASTERIZER_H_
@@ -0,0 +1,236 @@
+/* Copyright 2019 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "tensorflow_graphics/rendering/opengl/cpu_rasterizer.h"
+#include "tensorflow/core/framework/op.h"
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/framework/shape_inference.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/types.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/util/work_sharder.h"
+
+REGISTER_OP("RasterizeTriangles")
+    .Input("vertices: float")
+    .Input("triangles: int32")
+    .Input("view_projection_matrix: float")
+    .Input("output_resolution: int32")
+    .Output("triangle_index: int32")
+    .Output("barycentric_coordinates: float")
+    .Output("depth: float")
+    .Doc(R"doc(
+Rasterization OP that renders triangular meshes on the CPU, without OpenGL, into
+the images that `Rasterize` produces with the shaders of `TriangleRasterizer`.
+Back-facing triangles are culled, the fragments outside of the depth range are
+clipped, and each pixel keeps the closest triangle covering its center, or the
+first one in case of a tie. The images are rendered by tiles, which are spread
+over the intra-op thread pool along with the tiles of the other batch elements.
+
+Note that in the following, A1 to An are optional batch dimensions.
+
+vertices: A tensor of shape `[A1, ..., An, V, 3]` containing the positions of
+  the vertices of each mesh.
+triangles: An int32 tensor of shape `[A1, ..., An, T, 3]` containing the
+  indices of the vertices of the triangles of each mesh, or of shape `[T, 3]`
+  for triangles shared by all the meshes.
+view_projection_matrix: A tensor of shape `[A1, ..., An, 4, 4]` containing the
+  matrix transforming the vertices of each mesh into clip space.
+output_resolution: A tensor of shape `[2]` containing the width and height of
+  the resulting images.
+triangle_index: A tensor of shape `[A1, ..., An, height, width, 1]` containing
+  the index of the triangle rendered at each pixel, or 0 where no triangle is.
+barycentric_coordinates: A tensor of shape `[A1, ..., An, height, width, 3]`
+  containing the perspective-correct barycentric coordinates of each pixel in
+  its triangle, or 0 where no triangle is.
+depth: A tensor of shape `[A1, ..., An, height, width, 1]` containing the
+  window-space depth of each pixel, in [0, 1], which is 1 where no triangle is.
+    )doc")
+    .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      tensorflow::shape_inference::ShapeHandle vertices_shape;
+      tensorflow::shape_inference::ShapeHandle batch_shape;
+      tensorflow::shape_inference::DimensionHandle unused;
+      TF_RETURN_IF_ERROR(c->WithRankAtLeast(c->input(0), 2, &vertices_shape));
+      TF_RETURN_IF_ERROR(c->WithValue(c->Dim(vertices_shape, -1), 3, &unused));
+      TF_RETURN_IF_ERROR(c->Subshape(vertices_shape, 0, -2, &batch_shape));
+
+      tensorflow::shape_inference::ShapeHandle resolution_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 1, &resolution_shape));
+      TF_RETURN_IF_ERROR(
+          c->WithValue(c->Dim(resolution_shape, 0), 2, &unused));
+      // The size of the images is only known if the resolution is constant.
+      tensorflow::shape_inference::DimensionHandle width = c->UnknownDim();
+      tensorflow::shape_inference::DimensionHandle height = c->UnknownDim();
+      const tensorflow::Tensor* resolution = c->input_tensor(3);
+      if (resolution != nullptr) {
+        width = c->MakeDim(resolution->flat<int32>()(0));
+        height = c->MakeDim(resolution->flat<int32>()(1));
+      }
+
+      tensorflow::shape_inference::ShapeHandle output_shape;
+      TF_RETURN_IF_ERROR(c->Concatenate(
+          batch_shape, c->MakeShape({height, width, 1}), &output_shape));
+      c->set_output(0, output_shape);
+      c->set_output(2, output_shape);
+      TF_RETURN_IF_ERROR(c->Concatenate(
+          batch_shape, c->MakeShape({height, width, 3}), &output_shape));
+      c->set_output(1, output_shape);
+      return tensorflow::Status::OK();
+    });
+
+class RasterizeTrianglesOp : public tensorflow::OpKernel {
+ public:
+  explicit RasterizeTrianglesOp(tensorflow::OpKernelConstruction* context)
+      : OpKernel(context) {}
+
+  void Compute(tensorflow::OpKernelContext* context) override {
+    const tensorflow::Tensor& vertices = context->input(0);
+    const tensorflow::Tensor& triangles = context->input(1);
+    const tensorflow::Tensor& view_projection_matrix = context->input(2);
+    const tensorflow::Tensor& resolution = context->input(3);
+    OP_REQUIRES(context,
+                vertices.dims() >= 2 &&
+                    vertices.dim_size(vertices.dims() - 1) == 3,
+                tensorflow::errors::InvalidArgument(
+                    "vertices must have shape [A1, ..., An, V, 3], got shape ",
+                    vertices.shape().DebugString()));
+    tensorflow::TensorShape batch_shape = vertices.shape();
+    batch_shape.RemoveLastDims(2);
+    tensorflow::TensorShape triangles_batch_shape = triangles.shape();
+    if (triangles.dims() >= 2) triangles_batch_shape.RemoveLastDims(2);
+    OP_REQUIRES(context,
+                triangles.dims() >= 2 &&
+                    triangles.dim_size(triangles.dims() - 1) == 3 &&
+                    (triangles.dims() == 2 ||
+                     triangles_batch_shape == batch_shape),
+                tensorflow::errors::InvalidArgument(
+                    "triangles must have shape [A1, ..., An, T, 3] or [T, 3], "
+                    "got shape ",
+                    triangles.shape().DebugString()));
+    tensorflow::TensorShape matrix_shape = batch_shape;
+    matrix_shape.AddDim(4);
+    matrix_shape.AddDim(4);
+    OP_REQUIRES(context, view_projection_matrix.shape() == matrix_shape,
+                tensorflow::errors::InvalidArgument(
+                    "view_projection_matrix must have shape ",
+                    matrix_shape.DebugString(), ", got shape ",
+                    view_projection_matrix.shape().DebugString()));
+    OP_REQUIRES(context,
+                resolution.dims() == 1 && resolution.NumElements() == 2,
+                tensorflow::errors::InvalidArgument(
+                    "output_resolution must have shape [2], got shape ",
+                    resolution.shape().DebugString()));
+    const int width = resolution.flat<int32>()(0);
+    const int height = resolution.flat<int32>()(1);
+    std::unique_ptr<CpuRasterizer> rasterizer;
+    OP_REQUIRES_OK(context, CpuRasterizer::Create(width, height, &rasterizer));
+
+    // Allocate the outputs.
+    tensorflow::Tensor* triangle_index;
+    tensorflow::Tensor* barycentric_coordinates;
+    tensorflow::Tensor* depth;
+    tensorflow::TensorShape output_shape = batch_shape;
+    output_shape.AddDim(height);
+    output_shape.AddDim(width);
+    output_shape.AddDim(1);
+    OP_REQUIRES_OK(context,
+                   context->allocate_output(0, output_shape, &triangle_index));
+    OP_REQUIRES_OK(context, context->allocate_output(2, output_shape, &depth));
+    output_shape.set_dim(output_shape.dims() - 1, 3);
+    OP_REQUIRES_OK(context, context->allocate_output(
+                                1, output_shape, &barycentric_coordinates));
+
+    const int num_elements = batch_shape.num_elements();
+    const int64 num_vertices = vertices.dim_size(vertices.dims() - 2);
+    const int64 num_triangles = triangles.dim_size(triangles.dims() - 2);
+    const int64 image_size = int64{width} * height;
+    auto* worker_threads = context->device()->tensorflow_cpu_worker_threads();
+    absl::Mutex status_mutex;
+    tensorflow::Status status;
+
+    // Project and bin the triangles of each batch element.
+    std::vector<CpuRasterizer::Image> images(num_elements);
+    auto setup_images = [&](int64 begin, int64 end) {
+      for (int64 element = begin; element < end; ++element) {
+        const int64 triangles_offset =
+            triangles.dims() == 2 ? 0 : element * num_triangles * 3;
+        tensorflow::Status element_status = rasterizer->SetupImage(
+            absl::MakeConstSpan(
+                vertices.flat<float>().data() + element * num_vertices * 3,
+                num_vertices * 3),
+            absl::MakeConstSpan(
+                triangles.flat<int32>().data() + triangles_offset,
+                num_triangles * 3),
+            absl::MakeConstSpan(
+                view_projection_matrix.flat<float>().data() + element * 16,
+                16),
+            &images[element]);
+        if (!element_status.ok()) {
+          absl::MutexLock lock(&status_mutex);
+          status.Update(element_status);
+        }
+      }
+    };
+    tensorflow::Shard(worker_threads->num_threads, worker_threads->workers,
+                      num_elements, num_triangles * kCostPerTriangle,
+                      setup_images);
+    OP_REQUIRES_OK(context, status);
+
+    // The tiles of all the batch elements are taken in turn by the threads, so
+    // that threads done with cheap tiles take over the remaining ones instead
+    // of idling while others rasterize a dense part of an image.
+    const int64 num_tasks = int64{num_elements} * rasterizer->num_tiles();
+    std::atomic<int64> next_task(0);
+    auto rasterize_tiles = [&](int64 begin, int64 end) {
+      for (int64 task = next_task++; task < num_tasks; task = next_task++) {
+        const int64 element = task / rasterizer->num_tiles();
+        rasterizer->RasterizeTile(
+            images[element], task % rasterizer->num_tiles(),
+            absl::MakeSpan(
+                triangle_index->flat<int32>().data() + element * image_size,
+                image_size),
+            absl::MakeSpan(barycentric_coordinates->flat<float>().data() +
+                               element * image_size * 3,
+                           image_size * 3),
+            absl::MakeSpan(depth->flat<float>().data() + element * image_size,
+                           image_size));
+      }
+    };
+    const int num_workers =
+        std::min<int64>(worker_threads->num_threads, num_tasks);
+    tensorflow::Shard(num_workers, worker_threads->workers, num_workers,
+                      kCostPerWorker, rasterize_tiles);
+  }
+
+ private:
+  // Projecting and binning a triangle is cheap, so that small meshes are set up
+  // on few threads.
+  static constexpr int64 kCostPerTriangle = 100;
+  // Each worker rasterizes many tiles, which is costly compared to the
+  // overhead of a shard.
+  static constexpr int64 kCostPerWorker = 1 << 20;
+};
+
+// Register kernel with TF
+REGISTER_KERNEL_BUILDER(
+    Name("RasterizeTriangles").Device(tensorflow::DEVICE_CPU),
+    RasterizeTrianglesOp);
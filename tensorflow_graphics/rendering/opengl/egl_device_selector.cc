@@ -0,0 +1,99 @@
+/* Copyright 2019 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#include "tensorflow_graphics/rendering/opengl/egl_device_selector.h"
+
+#include "tensorflow_graphics/rendering/opengl/egl_util.h"
+#include "tensorflow_graphics/rendering/opengl/macros.h"
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace {
+
+// Devices reported by egl_util.
+class DefaultEGLDevices : public EGLDevices {
+ public:
+  int GetNumDevices() override { return GetNumEGLDevices(); }
+
+  int GetNumContexts(int device_index) override {
+    return GetEGLDisplayRefCountAtIndex(device_index);
+  }
+};
+
+}  // namespace
+
+EGLDevices* EGLDevices::Default() {
+  static EGLDevices* default_devices = new DefaultEGLDevices();
+  return default_devices;
+}
+
+EGLDeviceSelector::EGLDeviceSelector(Policy policy, int device_index,
+                                     int num_devices, EGLDevices* devices)
+    : policy_(policy),
+      num_devices_(num_devices),
+      devices_(devices),
+      next_device_(device_index) {}
+
+tensorflow::Status EGLDeviceSelector::Create(
+    Policy policy, int device_index, EGLDevices* devices,
+    std::unique_ptr<EGLDeviceSelector>* device_selector) {
+  if (device_index < 0)
+    return tensorflow::errors::InvalidArgument("EGL device index ",
+                                               device_index, " is negative.");
+  // Enumerating the devices initializes all of them, which a pinned selector
+  // does not need; its device is validated when its display is created.
+  if (policy == Policy::kPinned) {
+    *device_selector = std::unique_ptr<EGLDeviceSelector>(
+        new EGLDeviceSelector(policy, device_index, 0, devices));
+    return tensorflow::Status::OK();
+  }
+
+  const int num_devices = devices->GetNumDevices();
+  if (num_devices < 0)
+    return TFG_INTERNAL_ERROR("The EGL devices could not be enumerated.");
+  if (num_devices == 0) return TFG_INTERNAL_ERROR("No usable EGL device.");
+  if (device_index >= num_devices)
+    return tensorflow::errors::InvalidArgument(
+        "EGL device index ", device_index, " is out of range, ", num_devices,
+        " devices are usable.");
+
+  *device_selector = std::unique_ptr<EGLDeviceSelector>(
+      new EGLDeviceSelector(policy, device_index, num_devices, devices));
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status EGLDeviceSelector::SelectDevice(int* device_index) {
+  absl::MutexLock lock(&mutex_);
+
+  if (policy_ == Policy::kPinned) {
+    *device_index = next_device_;
+    return tensorflow::Status::OK();
+  }
+  int selected_device = next_device_;
+  if (policy_ == Policy::kLeastLoaded) {
+    int min_num_contexts = -1;
+    for (int i = 0; i < num_devices_; ++i) {
+      const int device = (next_device_ + i) % num_devices_;
+      const int num_contexts = devices_->GetNumContexts(device);
+      if (num_contexts < 0)
+        return TFG_INTERNAL_ERROR("Invalid EGL device index ", device, ".");
+      if (min_num_contexts < 0 || num_contexts < min_num_contexts) {
+        min_num_contexts = num_contexts;
+        selected_device = device;
+      }
+    }
+  }
+  *device_index = selected_device;
+  next_device_ = (selected_device + 1) % num_devices_;
+  return tensorflow::Status::OK();
+}
@@ -0,0 +1,109 @@
+/* Copyright 2019 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_EGL_DEVICE_SELECTOR_H_
+#define THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_EGL_DEVICE_SELECTOR_H_
+
+#include <memory>
+
+#include "absl/synchronization/mutex.h"
+#include "tensorflow/core/lib/core/status.h"
+
+// The EGL devices which can be rendered with, indexed as by
+// CreateInitializedEGLDisplayAtIndex. The default implementation queries
+// egl_util, and tests may provide another one.
+class EGLDevices {
+ public:
+  virtual ~EGLDevices() = default;
+
+  // Returns the number of devices, or -1 if they cannot be enumerated.
+  virtual int GetNumDevices() = 0;
+
+  // Returns the number of contexts alive on the device at device_index, each
+  // of which holds a reference to the display of the device.
+  virtual int GetNumContexts(int device_index) = 0;
+
+  // Returns the devices reported by egl_util. The object is shared, and must
+  // not be deleted.
+  static EGLDevices* Default();
+};
+
+// Picks the EGL device of each new context, e.g. to spread the contexts of a
+// resource pool over the devices of the machine.
+class EGLDeviceSelector {
+ public:
+  enum class Policy {
+    // Always select the same device.
+    kPinned,
+    // Select each device in turn.
+    kRoundRobin,
+    // Select the device with the fewest contexts alive in the process, ties
+    // being broken in turn.
+    kLeastLoaded,
+  };
+
+  // Creates a device selector.
+  //
+  // Arguments:
+  // * policy: how the devices are selected.
+  // * device_index: the device selected by the kPinned policy, and the first
+  //   device selected by the others. The devices are only enumerated, which
+  //   initializes all of them, by the other policies; the device of the
+  //   kPinned policy is validated when a context is created on it.
+  // * devices: the devices to select from, which must outlive the selector.
+  // * device_selector: if the method is successful, this object holds a valid
+  //   device selector.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  static tensorflow::Status Create(
+      Policy policy, int device_index, EGLDevices* devices,
+      std::unique_ptr<EGLDeviceSelector>* device_selector);
+
+  // Selects the device of the next context. Selections may happen
+  // concurrently, in which case the kLeastLoaded policy does not account for
+  // the contexts that are not created yet.
+  //
+  // Arguments:
+  // * device_index: if the method is successful, holds the index of the
+  //   selected device.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  tensorflow::Status SelectDevice(int* device_index);
+
+  // Returns the number of devices selected from, or 0 for the kPinned policy,
+  // which does not enumerate them.
+  int num_devices() const { return num_devices_; }
+
+ private:
+  EGLDeviceSelector() = delete;
+  EGLDeviceSelector(Policy policy, int device_index, int num_devices,
+                    EGLDevices* devices);
+  EGLDeviceSelector(const EGLDeviceSelector&) = delete;
+  EGLDeviceSelector(EGLDeviceSelector&&) = delete;
+  EGLDeviceSelector& operator=(const EGLDeviceSelector&) = delete;
+  EGLDeviceSelector& operator=(EGLDeviceSelector&&) = delete;
+
+  const Policy policy_;
+  const int num_devices_;
+  EGLDevices* const devices_;
+  absl::Mutex mutex_;
+  // Device from which the next selection starts looking.
+  int next_device_ ABSL_GUARDED_BY(mutex_);
+};
+
+#endif  // THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_EGL_DEVICE_SELECTOR_H_
@@ -16,44 +16,96 @@ limitations under the License.
 
 #include <EGL/egl.h>
 
+#include <array>
+#include <mutex>
+#include <unordered_map>
+
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
 #include "tensorflow_graphics/rendering/opengl/egl_util.h"
 #include "tensorflow_graphics/rendering/opengl/macros.h"
 #include "tensorflow_graphics/util/cleanup.h"
 #include "tensorflow/core/lib/core/status.h"
 
+namespace {
+
+constexpr std::array<int, 13> kDefaultConfigurationAttributes = {
+    EGL_SURFACE_TYPE,
+    EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE,
+    EGL_OPENGL_ES2_BIT,
+    EGL_BLUE_SIZE,
+    8,
+    EGL_GREEN_SIZE,
+    8,
+    EGL_RED_SIZE,
+    8,
+    EGL_DEPTH_SIZE,
+    24,
+    EGL_NONE  // The array must be terminated with that value.
+};
+constexpr std::array<int, 3> kDefaultContextAttributes = {
+    EGL_CONTEXT_CLIENT_VERSION,
+    2,
+    EGL_NONE,
+};
+
+// Parent context of the share group of a display, and number of contexts
+// created in that share group by EGLOffscreenContext::CreateShared.
+struct ShareGroup {
+  EGLContext parent_context = EGL_NO_CONTEXT;
+  int num_contexts = 0;
+};
+
+// Mutex used to lock the share group map, which is held while contexts are
+// added to or removed from a share group.
+std::mutex* get_share_group_mutex() {
+  static std::mutex* share_group_mutex = new std::mutex();
+  return share_group_mutex;
+}
+
+std::unordered_map<EGLDisplay, ShareGroup>* get_share_group_map() {
+  static std::unordered_map<EGLDisplay, ShareGroup>* share_group_map =
+      new std::unordered_map<EGLDisplay, ShareGroup>();
+  return share_group_map;
+}
+
+// Returns whether contexts of the display can be made current without surface.
+bool SupportsSurfacelessContext(EGLDisplay display) {
+  const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+  if (extensions == nullptr) return false;
+  for (absl::string_view extension : absl::StrSplit(extensions, ' ')) {
+    if (extension == "EGL_KHR_surfaceless_context") return true;
+  }
+  return false;
+}
+
+}  // namespace
+
 EGLOffscreenContext::EGLOffscreenContext(EGLContext context, EGLDisplay display,
-                                         EGLSurface pixel_buffer_surface)
+                                         EGLSurface pixel_buffer_surface,
+                                         bool shared)
     : context_(context),
       display_(display),
-      pixel_buffer_surface_(pixel_buffer_surface) {}
+      pixel_buffer_surface_(pixel_buffer_surface),
+      shared_(shared) {}
 
 EGLOffscreenContext::~EGLOffscreenContext() { TF_CHECK_OK(Destroy()); }
 
 tensorflow::Status EGLOffscreenContext::Create(
-    std::unique_ptr<EGLOffscreenContext>* egl_offscreen_context) {
-  constexpr std::array<int, 13> kDefaultConfigurationAttributes = {
-      EGL_SURFACE_TYPE,
-      EGL_PBUFFER_BIT,
-      EGL_RENDERABLE_TYPE,
-      EGL_OPENGL_ES2_BIT,
-      EGL_BLUE_SIZE,
-      8,
-      EGL_GREEN_SIZE,
-      8,
-      EGL_RED_SIZE,
-      8,
-      EGL_DEPTH_SIZE,
-      24,
-      EGL_NONE  // The array must be terminated with that value.
-  };
-  constexpr std::array<int, 3> kDefaultContextAttributes = {
-      EGL_CONTEXT_CLIENT_VERSION,
-      2,
-      EGL_NONE,
-  };
+    std::unique_ptr<EGLOffscreenContext>* egl_offscreen_context,
+    const int device_index) {
+  return Create(0, 0, EGL_OPENGL_API, kDefaultConfigurationAttributes.data(),
+                kDefaultContextAttributes.data(), false, device_index,
+                egl_offscreen_context);
+}
 
+tensorflow::Status EGLOffscreenContext::CreateShared(
+    std::unique_ptr<EGLOffscreenContext>* egl_offscreen_context,
+    const int device_index) {
   return Create(0, 0, EGL_OPENGL_API, kDefaultConfigurationAttributes.data(),
-                kDefaultContextAttributes.data(), egl_offscreen_context);
+                kDefaultContextAttributes.data(), true, device_index,
+                egl_offscreen_context);
 }
 
 tensorflow::Status EGLOffscreenContext::Create(
@@ -61,11 +113,23 @@ tensorflow::Status EGLOffscreenContext::Create(
     const EGLenum rendering_api, const EGLint* configuration_attributes,
     const EGLint* context_attributes,
     std::unique_ptr<EGLOffscreenContext>* egl_offscreen_context) {
-  // Create an EGL display at device index 0.
+  return Create(pixel_buffer_width, pixel_buffer_height, rendering_api,
+                configuration_attributes, context_attributes, false, 0,
+                egl_offscreen_context);
+}
+
+tensorflow::Status EGLOffscreenContext::Create(
+    const int pixel_buffer_width, const int pixel_buffer_height,
+    const EGLenum rendering_api, const EGLint* configuration_attributes,
+    const EGLint* context_attributes, bool shared, const int device_index,
+    std::unique_ptr<EGLOffscreenContext>* egl_offscreen_context) {
+  // Create an EGL display at the requested device index.
   EGLDisplay display;
 
-  display = CreateInitializedEGLDisplay();
-  if (display == EGL_NO_DISPLAY) return TFG_INTERNAL_ERROR("EGL_NO_DISPLAY");
+  display = CreateInitializedEGLDisplayAtIndex(device_index);
+  if (display == EGL_NO_DISPLAY)
+    return TFG_INTERNAL_ERROR("EGL_NO_DISPLAY: no usable EGL device at index ",
+                              device_index);
   auto initialize_cleanup =
       MakeCleanup([display]() { TerminateInitializedEGLDisplay(display); });
 
@@ -87,31 +151,68 @@ tensorflow::Status EGLOffscreenContext::Create(
   if (!success || returned_num_configs != kRequestedNumConfigs)
     return TFG_INTERNAL_ERROR("returned_num_configs != kRequestedNumConfigs");
 
-  // Create a pixel buffer surface.
+  // Create a pixel buffer surface, unless it would be empty and the context
+  // can do without.
   EGLint pixel_buffer_attributes[] = {
       EGL_WIDTH, pixel_buffer_width, EGL_HEIGHT, pixel_buffer_height, EGL_NONE,
   };
-  EGLSurface pixel_buffer_surface;
+  EGLSurface pixel_buffer_surface = EGL_NO_SURFACE;
 
-  TFG_RETURN_IF_EGL_ERROR(
-      pixel_buffer_surface = eglCreatePbufferSurface(
-          display, frame_buffer_configuration, pixel_buffer_attributes));
+  if (pixel_buffer_width != 0 || pixel_buffer_height != 0 ||
+      !SupportsSurfacelessContext(display)) {
+    TFG_RETURN_IF_EGL_ERROR(
+        pixel_buffer_surface = eglCreatePbufferSurface(
+            display, frame_buffer_configuration, pixel_buffer_attributes));
+  }
   auto surface_cleanup = MakeCleanup([display, pixel_buffer_surface]() {
-    eglDestroySurface(display, pixel_buffer_surface);
+    if (pixel_buffer_surface != EGL_NO_SURFACE)
+      eglDestroySurface(display, pixel_buffer_surface);
   });
 
-  // Create the EGL rendering context.
+  // Create the EGL rendering context, in the share group of the display if
+  // requested. The share group is locked until the context is created, so that
+  // its parent context is not destroyed in the meantime.
   EGLContext context;
+  EGLContext share_context = EGL_NO_CONTEXT;
+  std::unique_lock<std::mutex> share_group_lock(*get_share_group_mutex(),
+                                                std::defer_lock);
 
+  if (shared) {
+    share_group_lock.lock();
+    ShareGroup& share_group = (*get_share_group_map())[display];
+    if (share_group.parent_context == EGL_NO_CONTEXT) {
+      TFG_RETURN_IF_EGL_ERROR(
+          share_group.parent_context =
+              eglCreateContext(display, frame_buffer_configuration,
+                               EGL_NO_CONTEXT, context_attributes));
+      if (share_group.parent_context == EGL_NO_CONTEXT) {
+        get_share_group_map()->erase(display);
+        return TFG_INTERNAL_ERROR("EGL_NO_CONTEXT");
+      }
+    }
+    share_context = share_group.parent_context;
+  }
+  auto share_group_cleanup = MakeCleanup([display, share_context]() {
+    // Destroy the parent context if it was only created for this context.
+    auto share_group = get_share_group_map()->find(display);
+    if (share_context != EGL_NO_CONTEXT &&
+        share_group->second.num_contexts == 0) {
+      eglDestroyContext(display, share_context);
+      get_share_group_map()->erase(share_group);
+    }
+  });
   TFG_RETURN_IF_EGL_ERROR(
       context = eglCreateContext(display, frame_buffer_configuration,
-                                 EGL_NO_CONTEXT, context_attributes));
+                                 share_context, context_attributes));
   if (context == EGL_NO_CONTEXT) return TFG_INTERNAL_ERROR("EGL_NO_CONTEXT");
+  if (shared) ++(*get_share_group_map())[display].num_contexts;
+  share_group_cleanup.release();
 
   initialize_cleanup.release();
   surface_cleanup.release();
-  *egl_offscreen_context = std::unique_ptr<EGLOffscreenContext>(
-      new EGLOffscreenContext(context, display, pixel_buffer_surface));
+  *egl_offscreen_context =
+      std::unique_ptr<EGLOffscreenContext>(new EGLOffscreenContext(
+          context, display, pixel_buffer_surface, shared));
   return tensorflow::Status::OK();
 }
 
@@ -120,9 +221,23 @@ tensorflow::Status EGLOffscreenContext::Destroy() {
   if (eglDestroyContext(display_, context_) == false) {
     return TFG_INTERNAL_ERROR("an error occured in eglDestroyContext.");
   }
-  if (eglDestroySurface(display_, pixel_buffer_surface_) == false) {
+  if (pixel_buffer_surface_ != EGL_NO_SURFACE &&
+      eglDestroySurface(display_, pixel_buffer_surface_) == false) {
     return TFG_INTERNAL_ERROR("an error occured in eglDestroySurface.");
   }
+  if (shared_) {
+    // The parent context is destroyed along with the last context of its share
+    // group, before the display is terminated.
+    std::lock_guard<std::mutex> share_group_guard(*get_share_group_mutex());
+    auto share_group = get_share_group_map()->find(display_);
+    if (share_group != get_share_group_map()->end() &&
+        --share_group->second.num_contexts == 0) {
+      const EGLContext parent_context = share_group->second.parent_context;
+      get_share_group_map()->erase(share_group);
+      if (eglDestroyContext(display_, parent_context) == false)
+        return TFG_INTERNAL_ERROR("an error occured in eglDestroyContext.");
+    }
+  }
   if (TerminateInitializedEGLDisplay(display_) == false) {
     return TFG_INTERNAL_ERROR(
         "an error occured in TerminateInitializedEGLDisplay.");
@@ -34,15 +34,20 @@ class EGLOffscreenContext {
   // Arguments:
   // * egl_offscreen_context: if the method is successful, this object holds a
   // valid offscreen context.
+  // * device_index: index of the EGL device rendering with the context; see
+  //   CreateInitializedEGLDisplayAtIndex.
   //
   // Returns:
   //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
   //   and an object of type tensorflow::errors otherwise.
   static tensorflow::Status Create(
-      std::unique_ptr<EGLOffscreenContext>* egl_offscreen_context);
+      std::unique_ptr<EGLOffscreenContext>* egl_offscreen_context,
+      int device_index = 0);
 
   // Creates an EGL display, pixel buffer surface, and context that can be used
-  // for rendering.
+  // for rendering. An empty pixel buffer surface is not created if the display
+  // supports EGL_KHR_surfaceless_context, and the context is made current
+  // without surface instead.
   //
   // Arguments:
   // * pixel_buffer_width: width of the pixel buffer surface.
@@ -67,6 +72,29 @@ class EGLOffscreenContext {
       const EGLint* context_attributes,
       std::unique_ptr<EGLOffscreenContext>* egl_offscreen_context);
 
+  // Creates an EGL display, pixel buffer surface, and context with default
+  // parameters, the context sharing its objects with all the other contexts
+  // created by this method on the same display.
+  //
+  // The contexts of a display belong to the share group of a parent context,
+  // which is created along with the first of them and destroyed along with the
+  // last one. Objects such as programs and buffers created in any of these
+  // contexts can then be used from all the others. Each device has its own
+  // display, and therefore its own share group.
+  //
+  // Arguments:
+  // * egl_offscreen_context: if the method is successful, this object holds a
+  // valid offscreen context.
+  // * device_index: index of the EGL device rendering with the context; see
+  //   CreateInitializedEGLDisplayAtIndex.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  static tensorflow::Status CreateShared(
+      std::unique_ptr<EGLOffscreenContext>* egl_offscreen_context,
+      int device_index = 0);
+
   // Binds the EGL context to the current rendering thread and to the pixel
   // buffer surface. Note that this context must not be current in any other
   // thread.
@@ -84,19 +112,30 @@ class EGLOffscreenContext {
   //   and an object of type tensorflow::errors otherwise.
   tensorflow::Status Release();
 
+  // Returns whether the context shares its objects with the other contexts
+  // created by CreateShared.
+  bool IsShared() const { return shared_; }
+
  private:
   EGLOffscreenContext() = delete;
   EGLOffscreenContext(EGLContext context, EGLDisplay display,
-                      EGLSurface pixel_buffer_surface);
+                      EGLSurface pixel_buffer_surface, bool shared);
   EGLOffscreenContext(const EGLOffscreenContext&) = delete;
   EGLOffscreenContext(EGLOffscreenContext&&) = delete;
   EGLOffscreenContext& operator=(const EGLOffscreenContext&) = delete;
   EGLOffscreenContext& operator=(EGLOffscreenContext&&) = delete;
+  static tensorflow::Status Create(
+      const int pixel_buffer_width, const int pixel_buffer_height,
+      const EGLenum rendering_api, const EGLint* configuration_attributes,
+      const EGLint* context_attributes, bool shared, int device_index,
+      std::unique_ptr<EGLOffscreenContext>* egl_offscreen_context);
   tensorflow::Status Destroy();
 
   EGLContext context_;
   EGLDisplay display_;
+  // EGL_NO_SURFACE for a surfaceless context.
   EGLSurface pixel_buffer_surface_;
+  bool shared_;
 };
 
 #endif  // THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_EGL_OFFSCREEN_CONTEXT_H_
@@ -17,11 +17,14 @@ limitations under the License.
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 
+#include <algorithm>
 #include <ios>
 #include <iostream>
+#include <limits>
 #include <mutex>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 namespace {
 
@@ -47,6 +50,29 @@ std::mutex* get_display_mutex() {
   return display_reference_mutex;
 }
 
+// EGL device, and whether its display can be initialized.
+struct CachedDevice {
+  enum class State { kUnknown, kUsable, kUnusable };
+
+  EGLDisplay display;
+  State state;
+};
+
+// Displays of the devices of the machine, in the order of the devices. The
+// devices are enumerated once while displays are in use, and each display is
+// only probed with eglInitialize the first time a call goes past it, so that
+// creating a display does not re-query the devices nor re-initialize the
+// displays of the other devices.
+struct DeviceCache {
+  bool enumerated = false;
+  std::vector<CachedDevice> devices;
+};
+
+DeviceCache* get_device_cache() {
+  static DeviceCache* device_cache = new DeviceCache();
+  return device_cache;
+}
+
 std::unordered_map<EGLDisplay, int>* get_display_reference_map() {
   static std::unordered_map<EGLDisplay, int>* display_reference_map =
       new std::unordered_map<EGLDisplay, int>();
@@ -91,20 +117,20 @@ EGLBoolean TerminateInitializedEGLDisplayNoLock(EGLDisplay display) {
   }
 }
 
-}  // namespace
-
-extern "C" EGLDisplay CreateInitializedEGLDisplayAtIndex(int device_index) {
+// Enumerates the devices of the machine into the device cache. Must be called
+// with the display mutex held.
+bool EnumerateDevicesNoLock(DeviceCache* device_cache) {
   // Load EGL extension functions for querying EGL devices manually. This
   // extension isn't officially supported in EGL 1.4, so try and manually
   // load them using eglGetProcAddress.
   auto eglQueryDevicesEXT =
       LoadEGLFunction<PFNEGLQUERYDEVICESEXTPROC>("eglQueryDevicesEXT");
-  if (eglQueryDevicesEXT == nullptr) return EGL_NO_DISPLAY;
+  if (eglQueryDevicesEXT == nullptr) return false;
 
   auto eglGetPlatformDisplayEXT =
       LoadEGLFunction<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
           "eglGetPlatformDisplayEXT");
-  if (eglGetPlatformDisplayEXT == nullptr) return EGL_NO_DISPLAY;
+  if (eglGetPlatformDisplayEXT == nullptr) return false;
 
   EGLDeviceEXT egl_devices[kMaxDevices];
   EGLint num_devices = 0;
@@ -113,42 +139,126 @@ extern "C" EGLDisplay CreateInitializedEGLDisplayAtIndex(int device_index) {
       egl_error != EGL_SUCCESS) {
     std::cerr << "eglQueryDevicesEXT Failed. EGL error " << std::hex
                << eglGetError() << "\n";
-    return EGL_NO_DISPLAY;
+    return false;
   }
 
-  // Go through each device and try to initialize the display.
+  // Get the EGL display of each device.
   for (EGLint i = 0; i < num_devices; ++i) {
-    // First try and get a valid EGL display.
     auto display = eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT,
                                             egl_devices[i], nullptr);
     if (eglGetError() == EGL_SUCCESS && display != EGL_NO_DISPLAY) {
-      // Aquire lock before calling eglInitialize() and incrementing ref count.
-      std::lock_guard<std::mutex> display_guard(*get_display_mutex());
+      device_cache->devices.push_back(
+          {display, CachedDevice::State::kUnknown});
+    }
+  }
+  device_cache->enumerated = true;
+  return true;
+}
+
+// Returns the display of the device at device_index among those whose display
+// can be initialized, or EGL_NO_DISPLAY if there is none. initialized is set
+// to whether the display is already initialized. Must be called with the
+// display mutex held.
+EGLDisplay FindDisplayNoLock(int device_index, bool* initialized) {
+  DeviceCache* device_cache = get_device_cache();
+  auto* display_map = get_display_reference_map();
+
+  // Enumerate the devices again once no display is in use, e.g. in case some
+  // became available.
+  if (display_map->empty()) {
+    device_cache->enumerated = false;
+    device_cache->devices.clear();
+  }
+  if (!device_cache->enumerated && !EnumerateDevicesNoLock(device_cache))
+    return EGL_NO_DISPLAY;
 
-      // Now try to initialize the display. This can fail when we don't have
+  for (CachedDevice& device : device_cache->devices) {
+    const bool referenced = display_map->count(device.display) != 0;
+    bool probed = false;
+    if (device.state == CachedDevice::State::kUnknown && referenced) {
+      device.state = CachedDevice::State::kUsable;
+    } else if (device.state == CachedDevice::State::kUnknown) {
+      // Try to initialize the display. This can fail when we don't have
       // access to the device.
       int major, minor;
-      EGLBoolean initialized = eglInitialize(display, &major, &minor);
-      if (eglGetError() == EGL_SUCCESS && initialized == EGL_TRUE) {
-        IncrementDisplayRefCount(display);
-        if (--device_index < 0) {
-          return display;
-        } else {
-          TerminateInitializedEGLDisplayNoLock(display);
-        }
-      }
+      EGLBoolean success = eglInitialize(device.display, &major, &minor);
+      probed = eglGetError() == EGL_SUCCESS && success == EGL_TRUE;
+      device.state = probed ? CachedDevice::State::kUsable
+                            : CachedDevice::State::kUnusable;
+    }
+    if (device.state != CachedDevice::State::kUsable) continue;
+    if (device_index-- == 0) {
+      *initialized = referenced || probed;
+      return device.display;
     }
+    if (probed) eglTerminate(device.display);
   }
-
-  std::cerr << "Failed to create and initialize a valid EGL display! "
-             << "Devices tried: " << num_devices << "\n";
   return EGL_NO_DISPLAY;
 }
 
+}  // namespace
+
+extern "C" EGLDisplay CreateInitializedEGLDisplayAtIndex(int device_index) {
+  // Aquire lock before calling eglInitialize() and incrementing ref count.
+  std::lock_guard<std::mutex> display_guard(*get_display_mutex());
+
+  bool initialized = false;
+  EGLDisplay display = device_index < 0
+                           ? EGL_NO_DISPLAY
+                           : FindDisplayNoLock(device_index, &initialized);
+  if (display != EGL_NO_DISPLAY && !initialized) {
+    int major, minor;
+    EGLBoolean success = eglInitialize(display, &major, &minor);
+    if (eglGetError() != EGL_SUCCESS || success != EGL_TRUE)
+      display = EGL_NO_DISPLAY;
+  }
+  if (display == EGL_NO_DISPLAY) {
+    std::cerr << "Failed to create and initialize a valid EGL display! "
+               << "Devices tried: " << get_device_cache()->devices.size()
+               << "\n";
+    return EGL_NO_DISPLAY;
+  }
+  IncrementDisplayRefCount(display);
+  return display;
+}
+
 extern "C" EGLDisplay CreateInitializedEGLDisplay() {
   return CreateInitializedEGLDisplayAtIndex(0);
 }
 
+extern "C" int GetNumEGLDevices() {
+  std::lock_guard<std::mutex> display_guard(*get_display_mutex());
+  DeviceCache* device_cache = get_device_cache();
+
+  // Go past the last device, so that all the displays get probed.
+  bool initialized = false;
+  FindDisplayNoLock(std::numeric_limits<int>::max(), &initialized);
+  if (!device_cache->enumerated) return -1;
+  return std::count_if(device_cache->devices.begin(),
+                       device_cache->devices.end(),
+                       [](const CachedDevice& device) {
+                         return device.state == CachedDevice::State::kUsable;
+                       });
+}
+
+extern "C" int GetEGLDisplayRefCountAtIndex(int device_index) {
+  if (device_index < 0) return -1;
+  std::lock_guard<std::mutex> display_guard(*get_display_mutex());
+  auto* display_map = get_display_reference_map();
+
+  // The devices before a display in use have all been probed, so stopping at
+  // the first device which was not does not miss any reference.
+  for (const CachedDevice& device : get_device_cache()->devices) {
+    if (device.state == CachedDevice::State::kUnknown) break;
+    if (device.state != CachedDevice::State::kUsable) continue;
+    if (device_index-- == 0) {
+      auto it = display_map->find(device.display);
+      return it == display_map->end() ? 0 : it->second;
+    }
+  }
+  return 0;
+}
+
 extern "C" EGLBoolean TerminateInitializedEGLDisplay(EGLDisplay display) {
   // Acquire lock before terminating and decrementing display ref count.
   std::lock_guard<std::mutex> display_guard(*get_display_mutex());
@@ -156,6 +266,7 @@ extern "C" EGLBoolean TerminateInitializedEGLDisplay(EGLDisplay display) {
 }
 
 extern "C" void ShutDownEGLSubsystem() {
+  delete get_device_cache();
   delete get_display_reference_map();
   delete get_display_mutex();
 }
@@ -26,13 +26,26 @@ extern "C" {
 // through all the available devices on the machine using EGL extensions, and
 // returns the Nth successfully initialized EGLDisplay. This allows us to get a
 // valid EGL display on multi-GPU machines, where we limit access to a sub-set
-// of the available GPU devices. Returns an initialized EGLDisplay or
-// EGL_NO_DISPLAY on error.
+// of the available GPU devices. The devices are enumerated once while any
+// display is in use, and only the displays up to device_index are probed, so
+// that creating further displays is cheap. Returns an initialized EGLDisplay
+// or EGL_NO_DISPLAY on error.
 EGLDisplay CreateInitializedEGLDisplayAtIndex(int device_index);
 
 // Helper function to create EGL display at device index 0.
 EGLDisplay CreateInitializedEGLDisplay(void);
 
+// Returns the number of devices whose display can be initialized, which are
+// the valid indices of CreateInitializedEGLDisplayAtIndex(), or -1 if the
+// devices cannot be enumerated. The displays of all the devices are probed.
+int GetNumEGLDevices(void);
+
+// Returns the number of references to the display of the device at the
+// specified device_index, i.e. the number of instances created from
+// CreateInitializedEGLDisplayAtIndex() and not terminated yet, which is 0 if
+// the display is not in use. Returns -1 if device_index is negative.
+int GetEGLDisplayRefCountAtIndex(int device_index);
+
 // Helper function to only call eglTerminate() once all instances created from
 // CreateInitializedEGLDisplay() have been terminated. This is necessary because
 // calling eglTerminate will invalidate *all* contexts associated with a given
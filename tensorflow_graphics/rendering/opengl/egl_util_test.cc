@@ -242,6 +242,8 @@ TEST_F(EGLUtilTest, CheckUnavailableDevices) {
   auto display = CreateInitializedEGLDisplay();
   ASSERT_NE(EGL_NO_DISPLAY, display);
   EXPECT_EQ(kTestDeviceId1, static_cast<EGLTestDisplay*>(display)->id);
+  // The devices are only enumerated again once no display is in use.
+  EXPECT_EQ(EGL_TRUE, TerminateInitializedEGLDisplay(display));
 
   // Now test EGLInitialize only succeeds for device2. This is the usual way to
   // determine if an EGLDisplay is actually usable, as eglGetPlatformDisplayEXT
@@ -296,4 +298,66 @@ TEST_F(EGLUtilTest, CheckInitializeDisplayAtIndex) {
   EXPECT_EQ(EGL_TRUE, TerminateInitializedEGLDisplay(d1));
 }
 
+TEST_F(EGLUtilTest, CheckDevicesEnumeratedOnce) {
+  static int query_count = 0;
+  static int initialize_count = 0;
+  query_count = 0;
+  initialize_count = 0;
+  egl_query_devices_ext_proc = [](EGLint max_devices, EGLDeviceEXT* devices,
+                                  EGLint* num_devices) -> EGLBoolean {
+    query_count++;
+    return DefaultEGLQueryDevicesEXT(max_devices, devices, num_devices);
+  };
+  egl_initialize_func = [](EGLDisplay display, EGLint* major,
+                           EGLint* minor) -> EGLBoolean {
+    initialize_count++;
+    return DefaultEGLInitialize(display, major, minor);
+  };
+
+  auto d0 = CreateInitializedEGLDisplayAtIndex(0);
+  ASSERT_NE(EGL_NO_DISPLAY, d0);
+  auto d1 = CreateInitializedEGLDisplayAtIndex(1);
+  ASSERT_NE(EGL_NO_DISPLAY, d1);
+  auto d2 = CreateInitializedEGLDisplayAtIndex(0);
+  EXPECT_EQ(d0, d2);
+
+  // Each display is only initialized once while it is in use.
+  EXPECT_EQ(1, query_count);
+  EXPECT_EQ(2, initialize_count);
+
+  EXPECT_EQ(EGL_TRUE, TerminateInitializedEGLDisplay(d0));
+  EXPECT_EQ(EGL_TRUE, TerminateInitializedEGLDisplay(d1));
+  EXPECT_EQ(EGL_TRUE, TerminateInitializedEGLDisplay(d2));
+}
+
+TEST_F(EGLUtilTest, CheckDeviceCounts) {
+  // Device1 cannot be initialized.
+  egl_initialize_func = [](EGLDisplay display, EGLint* major,
+                           EGLint* minor) -> EGLBoolean {
+    auto* test_display = static_cast<EGLTestDisplay*>(display);
+    if (test_display && test_display->id == kTestDeviceId1) return EGL_FALSE;
+    return DefaultEGLInitialize(display, major, minor);
+  };
+  EXPECT_EQ(2, GetNumEGLDevices());
+  EXPECT_EQ(0, GetEGLDisplayRefCountAtIndex(1));
+
+  auto d0 = CreateInitializedEGLDisplayAtIndex(1);
+  ASSERT_NE(EGL_NO_DISPLAY, d0);
+  EXPECT_EQ(kTestDeviceId2, static_cast<EGLTestDisplay*>(d0)->id);
+  auto d1 = CreateInitializedEGLDisplayAtIndex(1);
+  EXPECT_EQ(0, GetEGLDisplayRefCountAtIndex(0));
+  EXPECT_EQ(2, GetEGLDisplayRefCountAtIndex(1));
+  EXPECT_EQ(0, GetEGLDisplayRefCountAtIndex(2));
+  EXPECT_EQ(-1, GetEGLDisplayRefCountAtIndex(-1));
+
+  EXPECT_EQ(EGL_TRUE, TerminateInitializedEGLDisplay(d0));
+  EXPECT_EQ(1, GetEGLDisplayRefCountAtIndex(1));
+  EXPECT_EQ(EGL_TRUE, TerminateInitializedEGLDisplay(d1));
+  EXPECT_EQ(0, GetEGLDisplayRefCountAtIndex(1));
+
+  egl_query_devices_ext_proc = [](EGLint, EGLDeviceEXT*,
+                                  EGLint*) -> EGLBoolean { return EGL_FALSE; };
+  EXPECT_EQ(-1, GetNumEGLDevices());
+}
+
 }  // namespace
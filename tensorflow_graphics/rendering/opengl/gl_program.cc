@@ -14,9 +14,19 @@ limitations under the License.
 ==============================================================================*/
 #include "tensorflow_graphics/rendering/opengl/gl_program.h"
 
+#include <unistd.h>
+
+#include <array>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+#include "absl/strings/match.h"
 #include "tensorflow_graphics/rendering/opengl/macros.h"
 #include "tensorflow_graphics/util/cleanup.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/hash/hash.h"
 
 namespace gl_utils {
 
@@ -65,6 +75,144 @@ tensorflow::Status Program::CompileShader(const std::string& shader_code,
 tensorflow::Status Program::Create(
     const std::vector<std::pair<std::string, GLenum>>& shaders,
     std::unique_ptr<Program>* program) {
+  return CreateFromSource(shaders, false, program);
+}
+
+tensorflow::Status Program::CreateWithBinaryCache(
+    const std::vector<std::pair<std::string, GLenum>>& shaders,
+    const std::string& binary_cache_directory,
+    std::unique_ptr<Program>* program) {
+  if (binary_cache_directory.empty())
+    return CreateFromSource(shaders, false, program);
+
+  std::string path;
+  TF_RETURN_IF_ERROR(
+      GetBinaryCachePath(shaders, binary_cache_directory, &path));
+  // Binaries that are missing, truncated, or rejected by the implementation,
+  // for instance after a driver update, fall back to the shader sources.
+  if (LoadBinary(path, program) == tensorflow::Status::OK())
+    return tensorflow::Status::OK();
+  TF_RETURN_IF_ERROR(CreateFromSource(shaders, true, program));
+  // The program is usable even if its binary cannot be cached.
+  (*program)->SaveBinary(path).IgnoreError();
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status Program::CreateRetrievable(
+    const std::vector<std::pair<std::string, GLenum>>& shaders,
+    std::unique_ptr<Program>* program) {
+  return CreateFromSource(shaders, true, program);
+}
+
+tensorflow::Status Program::GetBinaryCachePath(
+    const std::vector<std::pair<std::string, GLenum>>& shaders,
+    const std::string& binary_cache_directory, std::string* path) {
+  tensorflow::uint64 key = 0;
+  for (const GLenum name :
+       {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION}) {
+    const GLubyte* value;
+    TFG_RETURN_IF_GL_ERROR(value = glGetString(name));
+    if (value == nullptr) return TFG_INTERNAL_ERROR("glGetString failed");
+    const std::string value_string(reinterpret_cast<const char*>(value));
+    key = tensorflow::Hash64Combine(
+        key, tensorflow::Hash64(value_string.data(), value_string.size()));
+  }
+  for (const auto& shader : shaders) {
+    key = tensorflow::Hash64Combine(key, shader.second);
+    key = tensorflow::Hash64Combine(
+        key, tensorflow::Hash64(shader.first.data(), shader.first.size()));
+  }
+  *path = absl::StrCat(binary_cache_directory, "/",
+                       absl::Hex(key, absl::kZeroPad16), ".bin");
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status Program::LoadBinary(const std::string& path,
+                                       std::unique_ptr<Program>* program) {
+  // A cached binary stores its format followed by the binary itself.
+  std::ifstream file(path, std::ios::binary);
+  if (!file) return TFG_INTERNAL_ERROR("Cannot open ", path);
+  ProgramBinary binary;
+  if (!file.read(reinterpret_cast<char*>(&binary.format),
+                 sizeof(binary.format)))
+    return TFG_INTERNAL_ERROR("Cannot read ", path);
+  binary.data.assign(std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>());
+  if (binary.data.empty()) return TFG_INTERNAL_ERROR("Empty binary in ", path);
+  return CreateFromBinary(binary, program);
+}
+
+tensorflow::Status Program::CreateFromBinary(
+    const ProgramBinary& binary, std::unique_ptr<Program>* program) {
+  GLuint program_handle;
+  TFG_RETURN_IF_GL_ERROR(program_handle = glCreateProgram());
+  if (program_handle == 0)
+    return TFG_INTERNAL_ERROR("Error while creating the program object.");
+  auto program_cleanup =
+      MakeCleanup([program_handle]() { glDeleteProgram(program_handle); });
+  TFG_RETURN_IF_GL_ERROR(glProgramBinary(program_handle, binary.format,
+                                         binary.data.data(),
+                                         binary.data.size()));
+  GLint link_status;
+  TFG_RETURN_IF_GL_ERROR(
+      glGetProgramiv(program_handle, GL_LINK_STATUS, &link_status));
+  if (link_status != GL_TRUE)
+    return TFG_INTERNAL_ERROR("The program binary was rejected.");
+
+  *program = std::unique_ptr<Program>(new Program(program_handle));
+  program_cleanup.release();
+  return (*program)->Reflect();
+}
+
+tensorflow::Status Program::GetBinary(ProgramBinary* binary) const {
+  GLint link_status;
+  GLint binary_length;
+  TFG_RETURN_IF_GL_ERROR(
+      glGetProgramiv(program_handle_, GL_LINK_STATUS, &link_status));
+  if (link_status != GL_TRUE)
+    return TFG_INTERNAL_ERROR("The program is not linked.");
+  TFG_RETURN_IF_GL_ERROR(glGetProgramiv(
+      program_handle_, GL_PROGRAM_BINARY_LENGTH, &binary_length));
+  if (binary_length == 0)
+    return TFG_INTERNAL_ERROR("Program binaries are not supported.");
+
+  binary->data.resize(binary_length);
+  TFG_RETURN_IF_GL_ERROR(glGetProgramBinary(program_handle_, binary_length,
+                                            &binary_length, &binary->format,
+                                            binary->data.data()));
+  binary->data.resize(binary_length);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status Program::SaveBinary(const std::string& path) const {
+  ProgramBinary binary;
+  TF_RETURN_IF_ERROR(GetBinary(&binary));
+
+  // Several processes or contexts may write the same binary concurrently, so
+  // it is written to a file of its own before being moved to path.
+  const std::string temporary_path =
+      absl::StrCat(path, ".", getpid(), ".",
+                   std::hash<std::thread::id>()(std::this_thread::get_id()));
+  {
+    std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&binary.format),
+               sizeof(binary.format));
+    file.write(binary.data.data(), binary.data.size());
+    if (!file) {
+      std::remove(temporary_path.c_str());
+      return TFG_INTERNAL_ERROR("Cannot write ", temporary_path);
+    }
+  }
+  if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+    std::remove(temporary_path.c_str());
+    return TFG_INTERNAL_ERROR("Cannot move ", temporary_path, " to ", path);
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status Program::CreateFromSource(
+    const std::vector<std::pair<std::string, GLenum>>& shaders,
+    bool retrievable, std::unique_ptr<Program>* program) {
   // Create an empty program object.
   GLuint program_handle;
 
@@ -91,12 +239,17 @@ tensorflow::Status Program::Create(
     shader_cleanups.push_back(MakeCleanup(attach_cleanup));
   }
 
+  if (retrievable)
+    TFG_RETURN_IF_GL_ERROR(glProgramParameteri(
+        program_handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+
   // Link the program to the executable that will run on the programmable
   // vertex/fragment processors.
   TFG_RETURN_IF_EGL_ERROR(glLinkProgram(program_handle));
   *program = std::unique_ptr<Program>(new Program(program_handle));
 
   program_cleanup.release();
+  TF_RETURN_IF_ERROR((*program)->Reflect());
   // The content of shader_cleanups needs cleanup and hence is not released; see
   // https://www.khronos.org/registry/OpenGL-Refpages/gl4/html/glDeleteProgram.xhtml.
   return tensorflow::Status::OK();
@@ -160,4 +313,78 @@ tensorflow::Status Program::Use() const {
   return tensorflow::Status::OK();
 }
 
+tensorflow::Status Program::Reflect() {
+  GLint link_status;
+  TFG_RETURN_IF_GL_ERROR(
+      glGetProgramiv(program_handle_, GL_LINK_STATUS, &link_status));
+  // Programs that failed to link do not have any active resource.
+  if (link_status != GL_TRUE) return tensorflow::Status::OK();
+
+  const std::array<std::pair<GLenum, std::vector<GLenum>>, 3> kInterfaces = {{
+      {GL_UNIFORM, {GL_TYPE, GL_LOCATION, GL_ARRAY_SIZE, GL_BLOCK_INDEX}},
+      {GL_SHADER_STORAGE_BLOCK, {GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE}},
+      {GL_PROGRAM_INPUT, {GL_TYPE, GL_LOCATION, GL_ARRAY_SIZE}},
+  }};
+  for (const auto& interface : kInterfaces) {
+    const GLenum program_interface = interface.first;
+    const std::vector<GLenum>& properties = interface.second;
+    GLint num_resources;
+    GLint max_name_length;
+    TFG_RETURN_IF_GL_ERROR(glGetProgramInterfaceiv(
+        program_handle_, program_interface, GL_ACTIVE_RESOURCES,
+        &num_resources));
+    TFG_RETURN_IF_GL_ERROR(glGetProgramInterfaceiv(
+        program_handle_, program_interface, GL_MAX_NAME_LENGTH,
+        &max_name_length));
+
+    std::vector<char> name(max_name_length + 1);
+    std::vector<GLint> values(properties.size());
+    for (GLint index = 0; index < num_resources; ++index) {
+      GLsizei length;
+      TFG_RETURN_IF_GL_ERROR(
+          glGetProgramResourceName(program_handle_, program_interface, index,
+                                   name.size(), &length, name.data()));
+      TF_RETURN_IF_ERROR(GetProgramResourceiv(
+          program_interface, index, properties.size(), properties.data(),
+          values.size(), &length, values.data()));
+
+      std::string resource_name(name.data());
+      if (program_interface == GL_UNIFORM) {
+        // Uniforms of named blocks are not set individually.
+        if (values[3] != -1) continue;
+        // Arrays are reported as "name[0]", but can be referred to as "name".
+        if (absl::EndsWith(resource_name, "[0]"))
+          resource_name.resize(resource_name.size() - 3);
+        uniforms_[resource_name] = ProgramResource{
+            static_cast<GLenum>(values[0]), values[1], -1, values[2]};
+      } else if (program_interface == GL_SHADER_STORAGE_BLOCK) {
+        shader_storage_blocks_[resource_name] =
+            ProgramResource{GL_NONE, -1, values[0], values[1]};
+      } else if (values[1] != -1) {
+        // Built-in inputs do not have a location.
+        vertex_attributes_[resource_name] = ProgramResource{
+            static_cast<GLenum>(values[0]), values[1], -1, values[2]};
+      }
+    }
+  }
+  return tensorflow::Status::OK();
+}
+
+const ProgramResource* Program::GetUniform(const std::string& name) const {
+  auto uniform = uniforms_.find(name);
+  return uniform == uniforms_.end() ? nullptr : &uniform->second;
+}
+
+const ProgramResource* Program::GetVertexAttribute(
+    const std::string& name) const {
+  auto attribute = vertex_attributes_.find(name);
+  return attribute == vertex_attributes_.end() ? nullptr : &attribute->second;
+}
+
+const ProgramResource* Program::GetShaderStorageBlock(
+    const std::string& name) const {
+  auto block = shader_storage_blocks_.find(name);
+  return block == shader_storage_blocks_.end() ? nullptr : &block->second;
+}
+
 }  // namespace gl_utils
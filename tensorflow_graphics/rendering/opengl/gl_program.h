@@ -17,10 +17,37 @@ limitations under the License.
 
 #include <GLES3/gl32.h>
 
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include "tensorflow/core/lib/core/status.h"
 
 namespace gl_utils {
 
+// Properties of an active uniform, shader storage block, or vertex attribute
+// of a program.
+struct ProgramResource {
+  // Type of a uniform or vertex attribute, e.g. GL_FLOAT_MAT4, or GL_NONE for
+  // storage blocks.
+  GLenum type;
+  // Location of a uniform or vertex attribute, or -1 for storage blocks.
+  GLint location;
+  // Binding point of a storage block, or -1 for uniforms and vertex
+  // attributes.
+  GLint binding;
+  // Number of array elements of a uniform or vertex attribute, or minimum size
+  // in bytes of the buffer bound to a storage block.
+  GLint size;
+};
+
+// Binary of a linked program, as returned by glGetProgramBinary.
+struct ProgramBinary {
+  GLenum format;
+  std::vector<char> data;
+};
+
 class Program {
  public:
   ~Program();
@@ -44,6 +71,76 @@ class Program {
       const std::vector<std::pair<std::string, GLenum>>& shaders,
       std::unique_ptr<Program>* program);
 
+  // Creates a program consisting of the supplied shaders, going through an
+  // on-disk cache of program binaries.
+  //
+  // The binaries are keyed by a hash of the shaders and of the vendor,
+  // renderer and version strings of the OpenGL implementation. When the cache
+  // holds a binary accepted by the implementation, the program is loaded from
+  // it; otherwise the shaders are compiled and linked as in Create, and the
+  // binary of the resulting program is written to the cache. Failures to read
+  // or write the cache only disable it.
+  //
+  // Arguments:
+  // * shaders: a vector of shaders to compile and attach to the program; see
+  //   Create.
+  // * binary_cache_directory: an existing directory storing the cached program
+  //   binaries. An empty string disables the cache.
+  // * program: if the method succeeds, this variable returns an object storing
+  //   a valid OpenGL program.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  static tensorflow::Status CreateWithBinaryCache(
+      const std::vector<std::pair<std::string, GLenum>>& shaders,
+      const std::string& binary_cache_directory,
+      std::unique_ptr<Program>* program);
+
+  // Creates a program consisting of the supplied shaders as Create does, whose
+  // binary can be retrieved with GetBinary.
+  //
+  // Arguments:
+  // * shaders: a vector of shaders to compile and attach to the program; see
+  //   Create.
+  // * program: if the method succeeds, this variable returns an object storing
+  //   a valid OpenGL program.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  static tensorflow::Status CreateRetrievable(
+      const std::vector<std::pair<std::string, GLenum>>& shaders,
+      std::unique_ptr<Program>* program);
+
+  // Creates a program from the binary of another one, which may have been
+  // linked in another context of the same OpenGL implementation. The program
+  // has uniforms of its own, with their default values.
+  //
+  // Arguments:
+  // * binary: the binary of the program, as returned by GetBinary.
+  // * program: if the method succeeds, this variable returns an object storing
+  //   a valid OpenGL program.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise, e.g. if the
+  //   implementation rejects the binary.
+  static tensorflow::Status CreateFromBinary(const ProgramBinary& binary,
+                                             std::unique_ptr<Program>* program);
+
+  // Retrieves the binary of the program, which must have been created by
+  // CreateRetrievable, CreateWithBinaryCache, or CreateFromBinary.
+  //
+  // Arguments:
+  // * binary: if the method succeeds, stores the binary of the program.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise, e.g. if the
+  //   implementation does not support program binaries.
+  tensorflow::Status GetBinary(ProgramBinary* binary) const;
+
   // Sets the current rendering state to an invalid program object.
   tensorflow::Status Detach() const;
 
@@ -76,6 +173,48 @@ class Program {
   // Installs the program as part of current rendering state.
   tensorflow::Status Use() const;
 
+  // Looks up the properties of an active uniform in the default uniform block
+  // of the program. The properties of all the active uniforms and storage
+  // blocks are queried once, when the program is created.
+  //
+  // Arguments:
+  // * name: name of the uniform.
+  //
+  // Returns:
+  //   The properties of the uniform, or nullptr if the program does not have
+  //   an active uniform with that name.
+  const ProgramResource* GetUniform(const std::string& name) const;
+
+  // Looks up the properties of an active shader storage block of the program;
+  // see GetUniform.
+  //
+  // Arguments:
+  // * name: name of the shader storage block.
+  //
+  // Returns:
+  //   The properties of the storage block, or nullptr if the program does not
+  //   have an active storage block with that name.
+  const ProgramResource* GetShaderStorageBlock(const std::string& name) const;
+
+  // Looks up the properties of an active input of the vertex shader of the
+  // program; see GetUniform. Built-in inputs, such as gl_VertexID, are not
+  // reported.
+  //
+  // Arguments:
+  // * name: name of the vertex attribute.
+  //
+  // Returns:
+  //   The properties of the vertex attribute, or nullptr if the program does
+  //   not have an active vertex attribute with that name.
+  const ProgramResource* GetVertexAttribute(const std::string& name) const;
+
+  // Returns the properties of all the active shader storage blocks of the
+  // program, keyed by their names.
+  const std::unordered_map<std::string, ProgramResource>&
+  GetShaderStorageBlocks() const {
+    return shader_storage_blocks_;
+  }
+
  private:
   Program() = delete;
   explicit Program(GLuint program_handle);
@@ -97,6 +236,28 @@ class Program {
   static tensorflow::Status CompileShader(const std::string& shader_code,
                                           const GLenum& shader_type,
                                           GLuint* shader_idx);
+
+  // Compiles and links the shaders; see Create. When retrievable is true, the
+  // binary of the program can be queried with glGetProgramBinary.
+  static tensorflow::Status CreateFromSource(
+      const std::vector<std::pair<std::string, GLenum>>& shaders,
+      bool retrievable, std::unique_ptr<Program>* program);
+
+  // Returns the path of the cached binary of a program made of the shaders.
+  static tensorflow::Status GetBinaryCachePath(
+      const std::vector<std::pair<std::string, GLenum>>& shaders,
+      const std::string& binary_cache_directory, std::string* path);
+
+  // Creates a program from the binary stored at path.
+  static tensorflow::Status LoadBinary(const std::string& path,
+                                       std::unique_ptr<Program>* program);
+
+  // Writes the binary of the program to path.
+  tensorflow::Status SaveBinary(const std::string& path) const;
+
+  // Fills the tables of uniforms, storage blocks, and vertex attributes of a
+  // linked program.
+  tensorflow::Status Reflect();
   tensorflow::Status GetProgramResourceIndex(GLenum program_interface,
                                              absl::string_view resource_name,
                                              GLuint* resource_index) const;
@@ -106,6 +267,9 @@ class Program {
       GLint* property_value) const;
 
   GLuint program_handle_;
+  std::unordered_map<std::string, ProgramResource> uniforms_;
+  std::unordered_map<std::string, ProgramResource> shader_storage_blocks_;
+  std::unordered_map<std::string, ProgramResource> vertex_attributes_;
 };
 
 }  // namespace gl_utils
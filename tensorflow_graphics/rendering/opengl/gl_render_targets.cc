@@ -16,26 +16,88 @@ limitations under the License.
 
 #include <GLES3/gl32.h>
 
+#include <cstring>
+#include <unordered_map>
+
 #include "tensorflow_graphics/rendering/opengl/macros.h"
 #include "tensorflow_graphics/util/cleanup.h"
 #include "tensorflow/core/lib/core/status.h"
 
 namespace gl_utils {
 
+namespace {
+
+// Properties of the supported color buffer internal formats.
+struct ColorFormatInfo {
+  GLint num_channels;
+  // Whether the format stores unnormalized integers, which must be read back
+  // and cleared as integers.
+  bool is_integer;
+};
+
+const std::unordered_map<GLenum, ColorFormatInfo>& ColorFormats() {
+  static const auto* kColorFormats =
+      new std::unordered_map<GLenum, ColorFormatInfo>({
+          {GL_R8, {1, false}},
+          {GL_RG8, {2, false}},
+          {GL_RGBA8, {4, false}},
+          {GL_R32F, {1, false}},
+          {GL_RG32F, {2, false}},
+          {GL_RGBA32F, {4, false}},
+          {GL_R16F, {1, false}},
+          {GL_RG16F, {2, false}},
+          {GL_RGBA16F, {4, false}},
+          {GL_R32I, {1, true}},
+          {GL_RG32I, {2, true}},
+          {GL_RGBA32I, {4, true}},
+      });
+  return *kColorFormats;
+}
+
+// Format passed to glReadPixels to read the given number of channels.
+GLenum ReadFormat(GLint num_channels, bool is_integer) {
+  static const GLenum kReadFormats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+  static const GLenum kIntegerReadFormats[] = {
+      GL_RED_INTEGER, GL_RG_INTEGER, GL_RGB_INTEGER, GL_RGBA_INTEGER};
+  return is_integer ? kIntegerReadFormats[num_channels - 1]
+                    : kReadFormats[num_channels - 1];
+}
+
+}  // namespace
+
 RenderTargets::RenderTargets(const GLsizei width, const GLsizei height,
-                             const GLuint color_buffer,
+                             const GLsizei num_layers,
+                             const std::vector<GLenum>& color_formats,
+                             const std::vector<GLuint>& color_buffers,
                              const GLuint depth_buffer,
-                             const GLuint frame_buffer)
+                             const GLuint frame_buffer,
+                             const GLuint read_frame_buffer)
     : width_(width),
       height_(height),
-      color_buffer_(color_buffer),
+      num_layers_(num_layers),
+      color_formats_(color_formats),
+      color_buffers_(color_buffers),
       depth_buffer_(depth_buffer),
-      frame_buffer_(frame_buffer) {}
+      frame_buffer_(frame_buffer),
+      read_frame_buffer_(read_frame_buffer),
+      pixel_buffers_(kNumPixelBuffers * (color_buffers.size() + 1), 0),
+      pixel_buffer_sizes_(kNumPixelBuffers * (color_buffers.size() + 1), 0),
+      pending_copies_(kNumPixelBuffers * (color_buffers.size() + 1)),
+      next_pixel_buffers_(color_buffers.size() + 1, 0) {}
 
 RenderTargets::~RenderTargets() {
-  glDeleteRenderbuffers(1, &color_buffer_);
-  glDeleteRenderbuffers(1, &depth_buffer_);
+  if (num_layers_ == 1) {
+    glDeleteRenderbuffers(color_buffers_.size(), color_buffers_.data());
+  } else {
+    glDeleteTextures(color_buffers_.size(), color_buffers_.data());
+    glDeleteFramebuffers(1, &read_frame_buffer_);
+  }
+  glDeleteTextures(1, &depth_buffer_);
   glDeleteFramebuffers(1, &frame_buffer_);
+  // Copies that were never completed are dropped.
+  for (const PendingCopy& copy : pending_copies_)
+    if (copy.fence != nullptr) glDeleteSync(copy.fence);
+  glDeleteBuffers(pixel_buffers_.size(), pixel_buffers_.data());
 }
 
 tensorflow::Status RenderTargets::BindFramebuffer() const {
@@ -43,34 +105,63 @@ tensorflow::Status RenderTargets::BindFramebuffer() const {
   return tensorflow::Status::OK();
 }
 
-tensorflow::Status RenderTargets::CreateValidInternalFormat(
-    GLenum internalformat, GLsizei width, GLsizei height,
+tensorflow::Status RenderTargets::Create(
+    GLsizei width, GLsizei height, GLsizei num_layers,
+    const std::vector<GLenum>& color_formats,
+    std::unique_ptr<RenderTargets>* render_targets) {
+  if (num_layers < 1) return TFG_INTERNAL_ERROR("num_layers < 1");
+  if (color_formats.empty())
+    return TFG_INTERNAL_ERROR("At least one color format is required");
+  for (const GLenum color_format : color_formats) {
+    if (ColorFormats().count(color_format) == 0)
+      return TFG_INTERNAL_ERROR("Unsupported color format 0x",
+                                absl::Hex(color_format, absl::kZeroPad4));
+  }
+
+  GLint max_draw_buffers;
+  TFG_RETURN_IF_GL_ERROR(glGetIntegerv(GL_MAX_DRAW_BUFFERS, &max_draw_buffers));
+  if (color_formats.size() > size_t(max_draw_buffers))
+    return TFG_INTERNAL_ERROR("Number of color formats > GL_MAX_DRAW_BUFFERS: ",
+                              color_formats.size(), " > ", max_draw_buffers);
+
+  if (num_layers == 1)
+    return CreateRenderbuffers(width, height, color_formats, render_targets);
+  return CreateTextureArrays(width, height, num_layers, color_formats,
+                             render_targets);
+}
+
+tensorflow::Status RenderTargets::CreateRenderbuffers(
+    GLsizei width, GLsizei height, const std::vector<GLenum>& color_formats,
     std::unique_ptr<RenderTargets>* render_targets) {
-  GLuint color_buffer;
+  const GLsizei num_color_buffers = color_formats.size();
+  std::vector<GLuint> color_buffers(num_color_buffers);
   GLuint depth_buffer;
   GLuint frame_buffer;
 
-  // Generate one render buffer for color.
-  TFG_RETURN_IF_GL_ERROR(glGenRenderbuffers(1, &color_buffer));
-  auto gen_color_cleanup =
-      MakeCleanup([color_buffer]() { glDeleteFramebuffers(1, &color_buffer); });
-  // Bind the color buffer.
-  TFG_RETURN_IF_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, color_buffer));
-  // Define the data storage, format, and dimensions of a render buffer
-  // object's image.
+  // Generate one render buffer per color attachment.
   TFG_RETURN_IF_GL_ERROR(
-      glRenderbufferStorage(GL_RENDERBUFFER, internalformat, width, height));
+      glGenRenderbuffers(num_color_buffers, color_buffers.data()));
+  auto gen_color_cleanup = MakeCleanup([&color_buffers]() {
+    glDeleteRenderbuffers(color_buffers.size(), color_buffers.data());
+  });
+  for (GLsizei index = 0; index < num_color_buffers; ++index) {
+    // Bind the color buffer.
+    TFG_RETURN_IF_GL_ERROR(
+        glBindRenderbuffer(GL_RENDERBUFFER, color_buffers[index]));
+    // Define the data storage, format, and dimensions of a render buffer
+    // object's image.
+    TFG_RETURN_IF_GL_ERROR(glRenderbufferStorage(
+        GL_RENDERBUFFER, color_formats[index], width, height));
+  }
 
-  // Generate one render buffer for depth.
-  TFG_RETURN_IF_GL_ERROR(glGenRenderbuffers(1, &depth_buffer));
+  // Generate one texture for depth, as in the layered case.
+  TFG_RETURN_IF_GL_ERROR(glGenTextures(1, &depth_buffer));
   auto gen_depth_cleanup =
-      MakeCleanup([depth_buffer]() { glDeleteFramebuffers(1, &depth_buffer); });
-  // Bind the depth buffer.
-  TFG_RETURN_IF_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer));
-  // Defines the data storage, format, and dimensions of a render buffer
-  // object's image.
-  TFG_RETURN_IF_GL_ERROR(glRenderbufferStorage(
-      GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height));
+      MakeCleanup([depth_buffer]() { glDeleteTextures(1, &depth_buffer); });
+  TFG_RETURN_IF_GL_ERROR(glBindTexture(GL_TEXTURE_2D, depth_buffer));
+  TFG_RETURN_IF_GL_ERROR(glTexStorage2D(GL_TEXTURE_2D, 1,
+                                        GL_DEPTH_COMPONENT32F, width, height));
+  TFG_RETURN_IF_GL_ERROR(glBindTexture(GL_TEXTURE_2D, 0));
 
   // Generate one frame buffer.
   TFG_RETURN_IF_GL_ERROR(glGenFramebuffers(1, &frame_buffer));
@@ -78,27 +169,394 @@ tensorflow::Status RenderTargets::CreateValidInternalFormat(
       MakeCleanup([frame_buffer]() { glDeleteFramebuffers(1, &frame_buffer); });
   // Bind the frame buffer to both read and draw frame buffer targets.
   TFG_RETURN_IF_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, frame_buffer));
-  // Attach the color buffer to the frame buffer.
-  TFG_RETURN_IF_GL_ERROR(glFramebufferRenderbuffer(
-      GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_buffer));
+  // Attach the color buffers to the frame buffer, and draw to all of them.
+  std::vector<GLenum> draw_buffers(num_color_buffers);
+  for (GLsizei index = 0; index < num_color_buffers; ++index) {
+    draw_buffers[index] = GL_COLOR_ATTACHMENT0 + index;
+    TFG_RETURN_IF_GL_ERROR(
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, draw_buffers[index],
+                                  GL_RENDERBUFFER, color_buffers[index]));
+  }
+  TFG_RETURN_IF_GL_ERROR(
+      glDrawBuffers(num_color_buffers, draw_buffers.data()));
   // Attach the depth buffer to the frame buffer.
-  TFG_RETURN_IF_GL_ERROR(glFramebufferRenderbuffer(
-      GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_buffer));
+  TFG_RETURN_IF_GL_ERROR(glFramebufferTexture2D(
+      GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_buffer, 0));
+
+  *render_targets = std::unique_ptr<RenderTargets>(
+      new RenderTargets(width, height, 1, color_formats, color_buffers,
+                        depth_buffer, frame_buffer, 0));
+
+  // Release all Cleanup objects.
+  gen_color_cleanup.release();
+  gen_depth_cleanup.release();
+  gen_frame_cleanup.release();
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RenderTargets::CreateTextureArrays(
+    GLsizei width, GLsizei height, GLsizei num_layers,
+    const std::vector<GLenum>& color_formats,
+    std::unique_ptr<RenderTargets>* render_targets) {
+  GLint max_layers;
+  TFG_RETURN_IF_GL_ERROR(
+      glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers));
+  if (num_layers > max_layers)
+    return TFG_INTERNAL_ERROR("num_layers > GL_MAX_ARRAY_TEXTURE_LAYERS: ",
+                              num_layers, " > ", max_layers);
+
+  const GLsizei num_color_buffers = color_formats.size();
+  std::vector<GLuint> color_buffers(num_color_buffers);
+  GLuint depth_buffer;
+  GLuint frame_buffer;
+  GLuint read_frame_buffer;
+
+  // Generate one texture array per color attachment.
+  TFG_RETURN_IF_GL_ERROR(
+      glGenTextures(num_color_buffers, color_buffers.data()));
+  auto gen_color_cleanup = MakeCleanup([&color_buffers]() {
+    glDeleteTextures(color_buffers.size(), color_buffers.data());
+  });
+  for (GLsizei index = 0; index < num_color_buffers; ++index) {
+    TFG_RETURN_IF_GL_ERROR(
+        glBindTexture(GL_TEXTURE_2D_ARRAY, color_buffers[index]));
+    TFG_RETURN_IF_GL_ERROR(glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1,
+                                          color_formats[index], width, height,
+                                          num_layers));
+  }
+
+  // Generate one texture array for depth.
+  TFG_RETURN_IF_GL_ERROR(glGenTextures(1, &depth_buffer));
+  auto gen_depth_cleanup =
+      MakeCleanup([depth_buffer]() { glDeleteTextures(1, &depth_buffer); });
+  TFG_RETURN_IF_GL_ERROR(glBindTexture(GL_TEXTURE_2D_ARRAY, depth_buffer));
+  TFG_RETURN_IF_GL_ERROR(glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1,
+                                        GL_DEPTH_COMPONENT32F, width, height,
+                                        num_layers));
+  TFG_RETURN_IF_GL_ERROR(glBindTexture(GL_TEXTURE_2D_ARRAY, 0));
+
+  // Generate the frame buffer used for reading back individual layers.
+  TFG_RETURN_IF_GL_ERROR(glGenFramebuffers(1, &read_frame_buffer));
+  auto gen_read_frame_cleanup = MakeCleanup(
+      [read_frame_buffer]() { glDeleteFramebuffers(1, &read_frame_buffer); });
+
+  // Generate one frame buffer, and attach all the layers of the color and
+  // depth textures to it.
+  TFG_RETURN_IF_GL_ERROR(glGenFramebuffers(1, &frame_buffer));
+  auto gen_frame_cleanup =
+      MakeCleanup([frame_buffer]() { glDeleteFramebuffers(1, &frame_buffer); });
+  TFG_RETURN_IF_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, frame_buffer));
+  std::vector<GLenum> draw_buffers(num_color_buffers);
+  for (GLsizei index = 0; index < num_color_buffers; ++index) {
+    draw_buffers[index] = GL_COLOR_ATTACHMENT0 + index;
+    TFG_RETURN_IF_GL_ERROR(glFramebufferTexture(
+        GL_FRAMEBUFFER, draw_buffers[index], color_buffers[index], 0));
+  }
+  TFG_RETURN_IF_GL_ERROR(
+      glDrawBuffers(num_color_buffers, draw_buffers.data()));
+  TFG_RETURN_IF_GL_ERROR(glFramebufferTexture(
+      GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_buffer, 0));
+  GLenum status;
+  TFG_RETURN_IF_GL_ERROR(status = glCheckFramebufferStatus(GL_FRAMEBUFFER));
+  if (status != GL_FRAMEBUFFER_COMPLETE)
+    return TFG_INTERNAL_ERROR("Incomplete layered frame buffer: 0x",
+                              absl::Hex(status, absl::kZeroPad4));
 
   *render_targets = std::unique_ptr<RenderTargets>(new RenderTargets(
-      width, height, color_buffer, depth_buffer, frame_buffer));
+      width, height, num_layers, color_formats, color_buffers, depth_buffer,
+      frame_buffer, read_frame_buffer));
 
   // Release all Cleanup objects.
   gen_color_cleanup.release();
   gen_depth_cleanup.release();
+  gen_read_frame_cleanup.release();
   gen_frame_cleanup.release();
   return tensorflow::Status::OK();
 }
 
+tensorflow::Status RenderTargets::GetNumChannels(int attachment,
+                                                 GLint* num_channels) const {
+  if (attachment < 0 || attachment >= color_formats_.size())
+    return TFG_INTERNAL_ERROR("Invalid color attachment ", attachment);
+  *num_channels = ColorFormats().at(color_formats_[attachment]).num_channels;
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RenderTargets::Clear(GLfloat red, GLfloat green,
+                                        GLfloat blue, GLfloat alpha,
+                                        GLfloat depth) const {
+  const GLfloat color[] = {red, green, blue, alpha};
+  // glClear leaves integer color buffers undefined, hence each buffer is
+  // cleared on its own.
+  const GLint integer_color[] = {GLint(red), GLint(green), GLint(blue),
+                                 GLint(alpha)};
+  for (GLint index = 0; index < color_formats_.size(); ++index) {
+    if (ColorFormats().at(color_formats_[index]).is_integer) {
+      TFG_RETURN_IF_GL_ERROR(glClearBufferiv(GL_COLOR, index, integer_color));
+    } else {
+      TFG_RETURN_IF_GL_ERROR(glClearBufferfv(GL_COLOR, index, color));
+    }
+  }
+  TFG_RETURN_IF_GL_ERROR(glClearBufferfv(GL_DEPTH, 0, &depth));
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RenderTargets::CheckReadable(int attachment,
+                                                GLint num_channels,
+                                                GLenum pixel_type,
+                                                size_t num_elements,
+                                                bool* is_integer) const {
+  if (attachment < 0 || attachment >= color_buffers_.size())
+    return TFG_INTERNAL_ERROR("Invalid color attachment ", attachment);
+  if (num_channels < 1 || num_channels > 4)
+    return TFG_INTERNAL_ERROR("Invalid number of channels ", num_channels);
+  if (num_elements != size_t(width_ * height_ * num_channels) * num_layers_)
+    return TFG_INTERNAL_ERROR(
+        "Buffer size is not equal to width * height * num_layers * "
+        "num_channels");
+
+  // Integer color buffers can only be read as integers, and conversely.
+  *is_integer = ColorFormats().at(color_formats_[attachment]).is_integer;
+  if (*is_integer != (pixel_type == GL_INT))
+    return TFG_INTERNAL_ERROR(
+        "Integer color buffers must be read into int buffers, and other "
+        "color buffers into float or unsigned char buffers");
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RenderTargets::ReadPixels(int attachment,
+                                             GLint num_channels,
+                                             GLenum pixel_type,
+                                             size_t num_elements,
+                                             size_t element_size,
+                                             void* data) const {
+  bool is_integer;
+  TF_RETURN_IF_ERROR(
+      CheckReadable(attachment, num_channels, pixel_type, num_elements,
+                    &is_integer));
+  const size_t layer_size = size_t(width_ * height_ * num_channels);
+
+  return ReadLayers(GL_COLOR_ATTACHMENT0 + attachment,
+                    color_buffers_[attachment],
+                    ReadFormat(num_channels, is_integer), pixel_type,
+                    layer_size * element_size, data);
+}
+
+tensorflow::Status RenderTargets::ReadPixelsAsync(int attachment,
+                                                  GLint num_channels,
+                                                  GLenum pixel_type,
+                                                  size_t num_elements,
+                                                  size_t element_size,
+                                                  void* data) {
+  bool is_integer;
+  TF_RETURN_IF_ERROR(
+      CheckReadable(attachment, num_channels, pixel_type, num_elements,
+                    &is_integer));
+  const size_t layer_size = size_t(width_ * height_ * num_channels);
+
+  return ReadLayersAsync(GL_COLOR_ATTACHMENT0 + attachment,
+                         color_buffers_[attachment],
+                         ReadFormat(num_channels, is_integer), pixel_type,
+                         layer_size * element_size,
+                         num_elements * element_size, data);
+}
+
+tensorflow::Status RenderTargets::CheckDepthReadable() {
+  const GLubyte* version;
+  TFG_RETURN_IF_GL_ERROR(version = glGetString(GL_VERSION));
+  if (version == nullptr) return TFG_INTERNAL_ERROR("glGetString failed");
+  // Only OpenGL ES versions are prefixed.
+  if (std::strncmp(reinterpret_cast<const char*>(version), "OpenGL ES", 9) !=
+      0)
+    return tensorflow::Status::OK();
+
+  GLint num_extensions;
+  TFG_RETURN_IF_GL_ERROR(glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions));
+  for (GLint index = 0; index < num_extensions; ++index) {
+    const GLubyte* extension;
+    TFG_RETURN_IF_GL_ERROR(extension = glGetStringi(GL_EXTENSIONS, index));
+    if (extension != nullptr &&
+        std::strcmp(reinterpret_cast<const char*>(extension),
+                    "GL_NV_read_depth") == 0)
+      return tensorflow::Status::OK();
+  }
+  return TFG_INTERNAL_ERROR(
+      "Reading the depth buffer requires the GL_NV_read_depth extension with "
+      "OpenGL ES");
+}
+
+tensorflow::Status RenderTargets::CopyDepthPixelsInto(
+    absl::Span<float> buffer) const {
+  const size_t layer_size = size_t(width_ * height_);
+  if (buffer.size() != layer_size * num_layers_)
+    return TFG_INTERNAL_ERROR(
+        "Buffer size is not equal to width * height * num_layers");
+  TF_RETURN_IF_ERROR(CheckDepthReadable());
+
+  return ReadLayers(GL_DEPTH_ATTACHMENT, depth_buffer_, GL_DEPTH_COMPONENT,
+                    GL_FLOAT, layer_size * sizeof(float), buffer.data());
+}
+
+tensorflow::Status RenderTargets::CopyDepthPixelsIntoAsync(
+    absl::Span<float> buffer) {
+  const size_t layer_size = size_t(width_ * height_);
+  if (buffer.size() != layer_size * num_layers_)
+    return TFG_INTERNAL_ERROR(
+        "Buffer size is not equal to width * height * num_layers");
+  TF_RETURN_IF_ERROR(CheckDepthReadable());
+
+  return ReadLayersAsync(GL_DEPTH_ATTACHMENT, depth_buffer_,
+                         GL_DEPTH_COMPONENT, GL_FLOAT,
+                         layer_size * sizeof(float),
+                         buffer.size() * sizeof(float), buffer.data());
+}
+
+tensorflow::Status RenderTargets::ReadLayersAsync(GLenum attachment_point,
+                                                  GLuint buffer,
+                                                  GLenum format,
+                                                  GLenum pixel_type,
+                                                  size_t layer_stride,
+                                                  size_t size, void* data) {
+  // Each attachment has its own ring of pixel buffers, so that their sizes
+  // never change between frames. The depth buffer comes after the colors.
+  const int attachment = attachment_point == GL_DEPTH_ATTACHMENT
+                             ? color_buffers_.size()
+                             : attachment_point - GL_COLOR_ATTACHMENT0;
+  // Recycle the oldest pixel buffer, completing the copy it may still hold.
+  int& frame = next_pixel_buffers_[attachment];
+  const int index = attachment * kNumPixelBuffers + frame;
+  TF_RETURN_IF_ERROR(FinishPendingCopy(index));
+
+  TF_RETURN_IF_ERROR(BindPixelBuffer(index, size));
+  auto bind_cleanup =
+      MakeCleanup([]() { glBindBuffer(GL_PIXEL_PACK_BUFFER, 0); });
+  TF_RETURN_IF_ERROR(ReadLayers(attachment_point, buffer, format, pixel_type,
+                                layer_stride, nullptr));
+
+  PendingCopy& copy = pending_copies_[index];
+  TFG_RETURN_IF_GL_ERROR(
+      copy.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+  copy.destination = data;
+  copy.size = size;
+  frame = (frame + 1) % kNumPixelBuffers;
+
+  // Submit the commands so that the GPU starts working while the caller
+  // proceeds with the next frame.
+  TFG_RETURN_IF_GL_ERROR(glFlush());
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RenderTargets::ReadLayers(GLenum attachment_point,
+                                             GLuint buffer, GLenum format,
+                                             GLenum pixel_type,
+                                             size_t layer_stride,
+                                             void* data) const {
+  // Rows of single channel 8 bit buffers are not 4 bytes aligned.
+  TFG_RETURN_IF_GL_ERROR(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+
+  if (num_layers_ == 1) {
+    // Depth is read from the depth buffer regardless of the read buffer.
+    if (attachment_point != GL_DEPTH_ATTACHMENT)
+      TFG_RETURN_IF_GL_ERROR(glReadBuffer(attachment_point));
+    TFG_RETURN_IF_GL_ERROR(
+        glReadPixels(0, 0, width_, height_, format, pixel_type, data));
+    return tensorflow::Status::OK();
+  }
+
+  // glReadPixels only reads from the first layer of a layered attachment;
+  // each layer is hence attached in turn to a dedicated read frame buffer.
+  GLint previous_read_frame_buffer;
+  TFG_RETURN_IF_GL_ERROR(
+      glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previous_read_frame_buffer));
+  TFG_RETURN_IF_GL_ERROR(
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, read_frame_buffer_));
+  auto bind_cleanup = MakeCleanup([previous_read_frame_buffer]() {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, previous_read_frame_buffer);
+  });
+  // Color attachments are all read through the first color attachment point
+  // of the read frame buffer.
+  const GLenum read_attachment_point = attachment_point == GL_DEPTH_ATTACHMENT
+                                           ? GL_DEPTH_ATTACHMENT
+                                           : GL_COLOR_ATTACHMENT0;
+  for (GLsizei layer = 0; layer < num_layers_; ++layer) {
+    TFG_RETURN_IF_GL_ERROR(glFramebufferTextureLayer(
+        GL_READ_FRAMEBUFFER, read_attachment_point, buffer, 0, layer));
+    TFG_RETURN_IF_GL_ERROR(glReadPixels(
+        0, 0, width_, height_, format, pixel_type,
+        static_cast<char*>(data) + layer * layer_stride));
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RenderTargets::BindPixelBuffer(int index, size_t size) {
+  if (pixel_buffers_[index] == 0)
+    TFG_RETURN_IF_GL_ERROR(glGenBuffers(1, &pixel_buffers_[index]));
+  TFG_RETURN_IF_GL_ERROR(
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffers_[index]));
+  if (pixel_buffer_sizes_[index] != size) {
+    TFG_RETURN_IF_GL_ERROR(
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ));
+    pixel_buffer_sizes_[index] = size;
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RenderTargets::FinishPendingCopy(int index) {
+  PendingCopy& copy = pending_copies_[index];
+  if (copy.destination == nullptr) return tensorflow::Status::OK();
+  // The copy is dropped if it cannot be completed.
+  auto copy_cleanup = MakeCleanup([&copy]() {
+    glDeleteSync(copy.fence);
+    copy = PendingCopy();
+  });
+
+  GLenum wait_status = GL_TIMEOUT_EXPIRED;
+  while (wait_status == GL_TIMEOUT_EXPIRED) {
+    TFG_RETURN_IF_GL_ERROR(
+        wait_status = glClientWaitSync(copy.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                       GL_TIMEOUT_IGNORED));
+  }
+  if (wait_status == GL_WAIT_FAILED)
+    return TFG_INTERNAL_ERROR("glClientWaitSync failed");
+
+  TFG_RETURN_IF_GL_ERROR(
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffers_[index]));
+  auto bind_cleanup =
+      MakeCleanup([]() { glBindBuffer(GL_PIXEL_PACK_BUFFER, 0); });
+  void* pixels;
+  TFG_RETURN_IF_GL_ERROR(pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                                   copy.size, GL_MAP_READ_BIT));
+  if (pixels == nullptr) return TFG_INTERNAL_ERROR("glMapBufferRange failed");
+  std::memcpy(copy.destination, pixels, copy.size);
+  TFG_RETURN_IF_GL_ERROR(glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RenderTargets::FinishPendingCopies() {
+  // The copies of each attachment are completed from the oldest to the most
+  // recent.
+  for (int attachment = 0; attachment < next_pixel_buffers_.size();
+       ++attachment) {
+    for (int offset = 0; offset < kNumPixelBuffers; ++offset) {
+      const int frame =
+          (next_pixel_buffers_[attachment] + offset) % kNumPixelBuffers;
+      TF_RETURN_IF_ERROR(
+          FinishPendingCopy(attachment * kNumPixelBuffers + frame));
+    }
+  }
+  return tensorflow::Status::OK();
+}
+
 GLsizei RenderTargets::GetHeight() const { return height_; }
 
 GLsizei RenderTargets::GetWidth() const { return width_; }
 
+GLsizei RenderTargets::GetNumLayers() const { return num_layers_; }
+
+const std::vector<GLenum>& RenderTargets::GetColorFormats() const {
+  return color_formats_;
+}
+
 tensorflow::Status RenderTargets::UnbindFrameBuffer() const {
   TFG_RETURN_IF_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, 0));
   return tensorflow::Status::OK();
@@ -17,14 +17,17 @@ limitations under the License.
 
 #include <GLES3/gl32.h>
 
+#include <vector>
+
 #include "tensorflow_graphics/rendering/opengl/macros.h"
 #include "tensorflow_graphics/util/cleanup.h"
+#include "tensorflow/core/framework/numeric_types.h"
 #include "tensorflow/core/lib/core/status.h"
 
 namespace gl_utils {
 
-// Class that creates a frame buffer to which a depth render buffer, and a color
-// render and bound to.
+// Class that creates a frame buffer to which a depth texture, and one or more
+// color render buffers are bound to.
 class RenderTargets {
  public:
   ~RenderTargets();
@@ -32,13 +35,13 @@ class RenderTargets {
   // Binds the framebuffer to GL_FRAMEBUFFER.
   tensorflow::Status BindFramebuffer() const;
 
-  // Creates a depth render buffer and a color render buffer. After
-  // creation, these two render buffers are attached to the frame buffer.
+  // Creates a depth texture and a color render buffer. After creation, both
+  // are attached to the frame buffer.
   //
   // Note: The template type correspond to the data type stored in
-  // the color render buffer. The supported template types are float and
-  // unsigned char, which lead the internal format of the renderbuffer to be
-  // GL_RGBA32F and GL_RGBA8 respectively.
+  // the color render buffer. The supported template types are float,
+  // Eigen::half, and unsigned char, which lead the internal format of the
+  // renderbuffer to be GL_RGBA32F, GL_RGBA16F, and GL_RGBA8 respectively.
   //
   // Arguments:
   // * width: width of the rendering buffers; must be smaller than
@@ -55,12 +58,96 @@ class RenderTargets {
       GLsizei width, GLsizei height,
       std::unique_ptr<RenderTargets>* render_targets);
 
+  // Creates layered depth and color buffers, which are attached to the frame
+  // buffer. When num_layers is larger than one, the buffers are 2D texture
+  // arrays, and the layer written by each primitive is selected in the
+  // geometry shader through gl_Layer. A single draw call can hence render into
+  // all the layers at once.
+  //
+  // Arguments:
+  // * width: width of the rendering buffers.
+  // * height: height of the rendering buffers.
+  // * num_layers: number of layers of the rendering buffers; must be smaller
+  //   than GL_MAX_ARRAY_TEXTURE_LAYERS.
+  // * render_targets: a valid and usable instance of this class.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  template <typename T>
+  static tensorflow::Status Create(
+      GLsizei width, GLsizei height, GLsizei num_layers,
+      std::unique_ptr<RenderTargets>* render_targets);
+
+  // Creates a depth buffer and one color buffer per entry of color_formats,
+  // the i-th color buffer being attached to GL_COLOR_ATTACHMENT0 + i. All the
+  // color attachments are enabled as draw buffers, so that a fragment shader
+  // output declared with layout(location = i) is written to the i-th one.
+  // The depth buffer is a texture, or a texture array when num_layers is larger
+  // than one, with the GL_DEPTH_COMPONENT32F internal format.
+  //
+  // Arguments:
+  // * width: width of the rendering buffers.
+  // * height: height of the rendering buffers.
+  // * num_layers: number of layers of the rendering buffers; see above.
+  // * color_formats: internal format of each color buffer, among GL_R8,
+  //   GL_RG8, GL_RGBA8, GL_R16F, GL_RG16F, GL_RGBA16F, GL_R32F, GL_RG32F,
+  //   GL_RGBA32F, GL_R32I, GL_RG32I, and GL_RGBA32I; must contain at least one
+  //   and at most GL_MAX_DRAW_BUFFERS formats. The fragment shader outputs
+  //   written to integer color buffers must be declared as int, ivec2, or
+  //   ivec4.
+  // * render_targets: a valid and usable instance of this class.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  static tensorflow::Status Create(
+      GLsizei width, GLsizei height, GLsizei num_layers,
+      const std::vector<GLenum>& color_formats,
+      std::unique_ptr<RenderTargets>* render_targets);
+
   // Returns the height of the internal render buffers.
   GLsizei GetHeight() const;
 
   // Returns the width of the internal render buffers.
   GLsizei GetWidth() const;
 
+  // Returns the number of layers of the internal render buffers.
+  GLsizei GetNumLayers() const;
+
+  // Returns the internal formats of the color buffers.
+  const std::vector<GLenum>& GetColorFormats() const;
+
+  // Returns the number of channels of a color buffer.
+  //
+  // Arguments:
+  // * attachment: index of the color buffer.
+  // * num_channels: the number of channels of the color buffer.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  tensorflow::Status GetNumChannels(int attachment, GLint* num_channels) const;
+
+  // Clears the color and depth buffers bound to the frame buffer, which must
+  // be bound to GL_FRAMEBUFFER.
+  //
+  // Note: integer color buffers are cleared with the clear color converted to
+  // integers.
+  //
+  // Arguments:
+  // * red: red component of the clear color.
+  // * green: green component of the clear color.
+  // * blue: blue component of the clear color.
+  // * alpha: alpha component of the clear color.
+  // * depth: value the depth buffer is cleared with.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  tensorflow::Status Clear(GLfloat red, GLfloat green, GLfloat blue,
+                           GLfloat alpha, GLfloat depth) const;
+
   // Reads pixels from the frame buffer.
   //
   // Note: if the type of T is not float, the buffer will contain values that
@@ -69,7 +156,8 @@ class RenderTargets {
   //
   // Arguments:
   // * buffer: the buffer where the read pixels are written to. Note that the
-  // size of this buffer must be equal to 4 * width * height.
+  // size of this buffer must be equal to 4 * width * height * num_layers.
+  // Layers are stored one after the other in the buffer.
   //
   // Returns:
   //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
@@ -77,6 +165,107 @@ class RenderTargets {
   template <typename T>
   tensorflow::Status CopyPixelsInto(absl::Span<T> buffer) const;
 
+  // Reads the first num_channels channels of the pixels of the frame buffer,
+  // so that channels that are not needed are not transferred.
+  //
+  // Arguments:
+  // * buffer: the buffer where the read pixels are written to. Its size must
+  //   be equal to num_channels * width * height * num_layers.
+  // * num_channels: the number of channels to read, between 1 and 4, which
+  //   are read with GL_RED, GL_RG, GL_RGB, and GL_RGBA respectively.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  template <typename T>
+  tensorflow::Status CopyPixelsInto(absl::Span<T> buffer,
+                                    int num_channels) const;
+
+  // Reads the pixels of a color buffer, with as many channels per pixel as the
+  // internal format of that buffer has.
+  //
+  // Note: integer color buffers must be read with T being int, and the other
+  // color buffers with T being float, Eigen::half, or unsigned char.
+  //
+  // Arguments:
+  // * attachment: index of the color buffer to read.
+  // * buffer: the buffer where the read pixels are written to. Its size must
+  //   be equal to num_channels * width * height * num_layers.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  template <typename T>
+  tensorflow::Status CopyColorAttachmentPixelsInto(int attachment,
+                                                   absl::Span<T> buffer) const;
+
+  // Starts reading pixels from the frame buffer into a pixel buffer object,
+  // without waiting for the rendering to complete. The pixels are copied into
+  // the supplied buffer by a later call to this method or to
+  // FinishPendingCopies, which allows rendering the next frame while the
+  // current one is being read back.
+  //
+  // Note: up to kNumPixelBuffers copies per color and depth buffer can be in
+  // flight at once; issuing a new copy while all the pixel buffers are in use
+  // first completes the oldest pending copy.
+  //
+  // Arguments:
+  // * buffer: the buffer where the read pixels are eventually written to. Its
+  //   size must be equal to 4 * width * height * num_layers, and it must
+  //   remain valid until the copy is completed.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  template <typename T>
+  tensorflow::Status CopyPixelsIntoAsync(absl::Span<T> buffer);
+
+  // Asynchronous counterpart of CopyPixelsInto reading num_channels channels;
+  // see CopyPixelsIntoAsync for details.
+  template <typename T>
+  tensorflow::Status CopyPixelsIntoAsync(absl::Span<T> buffer,
+                                         int num_channels);
+
+  // Asynchronous counterpart of CopyColorAttachmentPixelsInto; see
+  // CopyPixelsIntoAsync for details.
+  template <typename T>
+  tensorflow::Status CopyColorAttachmentPixelsIntoAsync(int attachment,
+                                                        absl::Span<T> buffer);
+
+  // Checks that the depth buffer can be read back by CopyDepthPixelsInto with
+  // the context current on the calling thread. Desktop OpenGL always supports
+  // it, while OpenGL ES requires the GL_NV_read_depth extension.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  static tensorflow::Status CheckDepthReadable();
+
+  // Reads the depth buffer, which stores the window-space depth of the
+  // fragments, in [0, 1] with the default depth range, as 32 bit floats. See
+  // CheckDepthReadable for the supported contexts.
+  //
+  // Arguments:
+  // * buffer: the buffer where the depth values are written to. Its size must
+  //   be equal to width * height * num_layers.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  tensorflow::Status CopyDepthPixelsInto(absl::Span<float> buffer) const;
+
+  // Asynchronous counterpart of CopyDepthPixelsInto; see CopyPixelsIntoAsync
+  // for details.
+  tensorflow::Status CopyDepthPixelsIntoAsync(absl::Span<float> buffer);
+
+  // Waits for all the copies started by CopyPixelsIntoAsync to complete, and
+  // writes their pixels to the buffers they were issued with.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  tensorflow::Status FinishPendingCopies();
+
   // Breaks the existing binding between the framebuffer object and
   // GL_FRAMEBUFFER.
   tensorflow::Status UnbindFrameBuffer() const;
@@ -84,76 +273,210 @@ class RenderTargets {
  private:
   RenderTargets() = delete;
   RenderTargets(const GLsizei width, const GLsizei height,
-                const GLuint color_buffer, const GLuint depth_buffer,
-                const GLuint frame_buffer);
+                const GLsizei num_layers,
+                const std::vector<GLenum>& color_formats,
+                const std::vector<GLuint>& color_buffers,
+                const GLuint depth_buffer, const GLuint frame_buffer,
+                const GLuint read_frame_buffer);
   RenderTargets(const RenderTargets&) = delete;
   RenderTargets(RenderTargets&&) = delete;
   RenderTargets& operator=(const RenderTargets&) = delete;
   RenderTargets& operator=(RenderTargets&&) = delete;
-  static tensorflow::Status CreateValidInternalFormat(
-      GLenum internalformat, GLsizei width, GLsizei height,
+  static tensorflow::Status CreateRenderbuffers(
+      GLsizei width, GLsizei height, const std::vector<GLenum>& color_formats,
+      std::unique_ptr<RenderTargets>* render_targets);
+  static tensorflow::Status CreateTextureArrays(
+      GLsizei width, GLsizei height, GLsizei num_layers,
+      const std::vector<GLenum>& color_formats,
       std::unique_ptr<RenderTargets>* render_targets);
 
   template <typename T>
-  tensorflow::Status CopyPixelsIntoValidPixelType(GLenum pixel_type,
-                                                  absl::Span<T> buffer) const;
+  static tensorflow::Status GetPixelType(GLenum* pixel_type);
+
+  // Checks that num_elements elements of the given pixel type can be read
+  // from a color buffer, and returns whether that buffer stores integers.
+  tensorflow::Status CheckReadable(int attachment, GLint num_channels,
+                                   GLenum pixel_type, size_t num_elements,
+                                   bool* is_integer) const;
+  // Reads num_channels channels of all the layers of a color buffer into data,
+  // which must hold num_elements elements of element_size bytes.
+  tensorflow::Status ReadPixels(int attachment, GLint num_channels,
+                                GLenum pixel_type, size_t num_elements,
+                                size_t element_size, void* data) const;
+  // Same as ReadPixels, but through a pixel buffer object; see
+  // CopyPixelsIntoAsync.
+  tensorflow::Status ReadPixelsAsync(int attachment, GLint num_channels,
+                                     GLenum pixel_type, size_t num_elements,
+                                     size_t element_size, void* data);
+  // Issues the glReadPixels calls reading all the layers of the buffer
+  // attached to attachment_point, storing the layers layer_stride bytes apart
+  // starting at data; data is an offset when a pixel pack buffer is bound.
+  tensorflow::Status ReadLayers(GLenum attachment_point, GLuint buffer,
+                                GLenum format, GLenum pixel_type,
+                                size_t layer_stride, void* data) const;
+  // Same as ReadLayers, but into the next pixel buffer object of the ring of
+  // the attachment; size is the total number of bytes read.
+  tensorflow::Status ReadLayersAsync(GLenum attachment_point, GLuint buffer,
+                                     GLenum format, GLenum pixel_type,
+                                     size_t layer_stride, size_t size,
+                                     void* data);
+  // Binds the pixel buffer at index to GL_PIXEL_PACK_BUFFER, allocating it
+  // with the requested size if needed.
+  tensorflow::Status BindPixelBuffer(int index, size_t size);
+  // Waits for the copy stored in the pixel buffer at index, if any, and writes
+  // its pixels to their destination.
+  tensorflow::Status FinishPendingCopy(int index);
+
+  static constexpr int kNumPixelBuffers = 2;
+
+  // A copy issued by CopyPixelsIntoAsync that has not been written to its
+  // destination yet.
+  struct PendingCopy {
+    GLsync fence = nullptr;
+    void* destination = nullptr;
+    size_t size = 0;
+  };
 
   GLsizei width_;
   GLsizei height_;
-  GLuint color_buffer_;
+  GLsizei num_layers_;
+  std::vector<GLenum> color_formats_;
+  // Render buffers when num_layers_ is one, and texture arrays otherwise.
+  std::vector<GLuint> color_buffers_;
+  // Texture when num_layers_ is one, and texture array otherwise.
   GLuint depth_buffer_;
   GLuint frame_buffer_;
+  // Frame buffer used to read back the individual layers of color_buffers_;
+  // zero when num_layers_ is one.
+  GLuint read_frame_buffer_;
+  // Pixel buffer objects used by CopyPixelsIntoAsync, created on first use;
+  // kNumPixelBuffers consecutive ones per color buffer, followed by those of
+  // the depth buffer.
+  std::vector<GLuint> pixel_buffers_;
+  std::vector<size_t> pixel_buffer_sizes_;
+  std::vector<PendingCopy> pending_copies_;
+  // Frame index of the next pixel buffer to use, per color buffer and for the
+  // depth buffer.
+  std::vector<int> next_pixel_buffers_;
 };
 
 template <typename T>
 tensorflow::Status RenderTargets::Create(
     GLsizei width, GLsizei height,
     std::unique_ptr<RenderTargets>* render_targets) {
+  return Create<T>(width, height, 1, render_targets);
+}
+
+template <typename T>
+tensorflow::Status RenderTargets::Create(
+    GLsizei width, GLsizei height, GLsizei num_layers,
+    std::unique_ptr<RenderTargets>* render_targets) {
   return TFG_INTERNAL_ERROR("Unsupported type ", typeid(T).name());
 }
 
 template <>
 inline tensorflow::Status RenderTargets::Create<unsigned char>(
-    GLsizei width, GLsizei height,
+    GLsizei width, GLsizei height, GLsizei num_layers,
     std::unique_ptr<RenderTargets>* render_targets) {
-  return CreateValidInternalFormat(GL_RGBA8, width, height, render_targets);
+  return Create(width, height, num_layers, {GL_RGBA8}, render_targets);
+}
+
+template <>
+inline tensorflow::Status RenderTargets::Create<Eigen::half>(
+    GLsizei width, GLsizei height, GLsizei num_layers,
+    std::unique_ptr<RenderTargets>* render_targets) {
+  return Create(width, height, num_layers, {GL_RGBA16F}, render_targets);
 }
 
 template <>
 inline tensorflow::Status RenderTargets::Create<float>(
-    GLsizei width, GLsizei height,
+    GLsizei width, GLsizei height, GLsizei num_layers,
     std::unique_ptr<RenderTargets>* render_targets) {
-  return CreateValidInternalFormat(GL_RGBA32F, width, height, render_targets);
+  return Create(width, height, num_layers, {GL_RGBA32F}, render_targets);
 }
 
 template <typename T>
-tensorflow::Status RenderTargets::CopyPixelsInto(absl::Span<T> buffer) const {
+tensorflow::Status RenderTargets::GetPixelType(GLenum* pixel_type) {
   return TFG_INTERNAL_ERROR("Unsupported type ", typeid(T).name());
 }
 
 template <>
-inline tensorflow::Status RenderTargets::CopyPixelsInto<float>(
-    absl::Span<float> buffer) const {
-  return CopyPixelsIntoValidPixelType(GL_FLOAT, buffer);
+inline tensorflow::Status RenderTargets::GetPixelType<float>(
+    GLenum* pixel_type) {
+  *pixel_type = GL_FLOAT;
+  return tensorflow::Status::OK();
 }
 
 template <>
-inline tensorflow::Status RenderTargets::CopyPixelsInto<unsigned char>(
-    absl::Span<unsigned char> buffer) const {
-  return CopyPixelsIntoValidPixelType(GL_UNSIGNED_BYTE, buffer);
+inline tensorflow::Status RenderTargets::GetPixelType<Eigen::half>(
+    GLenum* pixel_type) {
+  *pixel_type = GL_HALF_FLOAT;
+  return tensorflow::Status::OK();
 }
 
-template <typename T>
-tensorflow::Status RenderTargets::CopyPixelsIntoValidPixelType(
-    GLenum pixel_type, absl::Span<T> buffer) const {
-  if (buffer.size() != size_t(width_ * height_ * 4))
-    return TFG_INTERNAL_ERROR("Buffer size is not equal to width * height * 4");
+template <>
+inline tensorflow::Status RenderTargets::GetPixelType<unsigned char>(
+    GLenum* pixel_type) {
+  *pixel_type = GL_UNSIGNED_BYTE;
+  return tensorflow::Status::OK();
+}
 
-  TFG_RETURN_IF_GL_ERROR(
-      glReadPixels(0, 0, width_, height_, GL_RGBA, pixel_type, buffer.data()));
+template <>
+inline tensorflow::Status RenderTargets::GetPixelType<int>(GLenum* pixel_type) {
+  *pixel_type = GL_INT;
   return tensorflow::Status::OK();
 }
 
+template <typename T>
+tensorflow::Status RenderTargets::CopyPixelsInto(absl::Span<T> buffer) const {
+  return CopyPixelsInto(buffer, 4);
+}
+
+template <typename T>
+tensorflow::Status RenderTargets::CopyPixelsInto(absl::Span<T> buffer,
+                                                 int num_channels) const {
+  GLenum pixel_type;
+  TF_RETURN_IF_ERROR(GetPixelType<T>(&pixel_type));
+  return ReadPixels(0, num_channels, pixel_type, buffer.size(), sizeof(T),
+                    buffer.data());
+}
+
+template <typename T>
+tensorflow::Status RenderTargets::CopyColorAttachmentPixelsInto(
+    int attachment, absl::Span<T> buffer) const {
+  GLenum pixel_type;
+  GLint num_channels;
+  TF_RETURN_IF_ERROR(GetPixelType<T>(&pixel_type));
+  TF_RETURN_IF_ERROR(GetNumChannels(attachment, &num_channels));
+  return ReadPixels(attachment, num_channels, pixel_type, buffer.size(),
+                    sizeof(T), buffer.data());
+}
+
+template <typename T>
+tensorflow::Status RenderTargets::CopyPixelsIntoAsync(absl::Span<T> buffer) {
+  return CopyPixelsIntoAsync(buffer, 4);
+}
+
+template <typename T>
+tensorflow::Status RenderTargets::CopyPixelsIntoAsync(absl::Span<T> buffer,
+                                                      int num_channels) {
+  GLenum pixel_type;
+  TF_RETURN_IF_ERROR(GetPixelType<T>(&pixel_type));
+  return ReadPixelsAsync(0, num_channels, pixel_type, buffer.size(),
+                         sizeof(T), buffer.data());
+}
+
+template <typename T>
+tensorflow::Status RenderTargets::CopyColorAttachmentPixelsIntoAsync(
+    int attachment, absl::Span<T> buffer) {
+  GLenum pixel_type;
+  GLint num_channels;
+  TF_RETURN_IF_ERROR(GetPixelType<T>(&pixel_type));
+  TF_RETURN_IF_ERROR(GetNumChannels(attachment, &num_channels));
+  return ReadPixelsAsync(attachment, num_channels, pixel_type, buffer.size(),
+                         sizeof(T), buffer.data());
+}
+
 }  // namespace gl_utils
 
 #endif  // THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_GL_RENDER_TARGETS_H_
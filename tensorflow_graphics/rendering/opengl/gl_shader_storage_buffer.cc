@@ -14,15 +14,86 @@ limitations under the License.
 ==============================================================================*/
 #include "tensorflow_graphics/rendering/opengl/gl_shader_storage_buffer.h"
 
+#include <EGL/egl.h>
 #include <GLES3/gl32.h>
+#include <GLES2/gl2ext.h>
+
+#include <cstring>
 
 #include "tensorflow/core/lib/core/status.h"
 
 namespace gl_utils {
+namespace {
+
+// Flags of the data store of persistent buffers, which are also used to map
+// it. Coherent mapping makes the copies visible to the commands issued after
+// them without explicit flushes or barriers.
+constexpr GLbitfield kPersistentFlags =
+    GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT_EXT | GL_MAP_COHERENT_BIT_EXT;
+
+// Returns whether the context current on the calling thread supports an
+// extension.
+tensorflow::Status HasExtension(const char* name, bool* has_extension) {
+  GLint num_extensions;
+  TFG_RETURN_IF_GL_ERROR(glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions));
+  *has_extension = false;
+  for (GLint index = 0; index < num_extensions && !*has_extension; ++index) {
+    const GLubyte* extension;
+    TFG_RETURN_IF_GL_ERROR(extension = glGetStringi(GL_EXTENSIONS, index));
+    *has_extension =
+        extension != nullptr &&
+        std::strcmp(reinterpret_cast<const char*>(extension), name) == 0;
+  }
+  return tensorflow::Status::OK();
+}
+
+// glBufferStorage is not part of the OpenGL ES headers, and is therefore
+// loaded at runtime; it is glBufferStorageEXT with OpenGL ES, and is core in
+// OpenGL 4.4. eglGetProcAddress may return a function for any name, hence the
+// extensions are checked first.
+tensorflow::Status GetBufferStorageFunction(
+    PFNGLBUFFERSTORAGEEXTPROC* buffer_storage) {
+  const char* function_name = nullptr;
+  bool has_extension;
+  TF_RETURN_IF_ERROR(HasExtension("GL_EXT_buffer_storage", &has_extension));
+  if (has_extension) {
+    function_name = "glBufferStorageEXT";
+  } else {
+    TF_RETURN_IF_ERROR(HasExtension("GL_ARB_buffer_storage", &has_extension));
+    if (has_extension) function_name = "glBufferStorage";
+  }
+  if (function_name == nullptr)
+    return TFG_INTERNAL_ERROR(
+        "Immutable buffer storage is not supported: neither "
+        "GL_EXT_buffer_storage nor GL_ARB_buffer_storage is available");
+  *buffer_storage = reinterpret_cast<PFNGLBUFFERSTORAGEEXTPROC>(
+      eglGetProcAddress(function_name));
+  if (*buffer_storage == nullptr)
+    return TFG_INTERNAL_ERROR("Failed to load ", function_name);
+  return tensorflow::Status::OK();
+}
 
-ShaderStorageBuffer::ShaderStorageBuffer(GLuint buffer) : buffer_(buffer) {}
+}  // namespace
 
-ShaderStorageBuffer::~ShaderStorageBuffer() { glDeleteBuffers(1, &buffer_); }
+ShaderStorageBuffer::ShaderStorageBuffer(
+    GLuint buffer, int num_segments, GLint offset_alignment,
+    PFNGLBUFFERSTORAGEEXTPROC buffer_storage)
+    : buffer_(buffer),
+      capacity_(0),
+      size_(0),
+      num_segments_(num_segments),
+      offset_alignment_(offset_alignment),
+      segment_(0),
+      segment_stride_(0),
+      mapped_data_(nullptr),
+      segment_fences_(num_segments, nullptr),
+      buffer_storage_(buffer_storage) {}
+
+ShaderStorageBuffer::~ShaderStorageBuffer() {
+  DeleteFences();
+  // Deleting the buffer also unmaps it.
+  glDeleteBuffers(1, &buffer_);
+}
 
 tensorflow::Status ShaderStorageBuffer::Create(
     std::unique_ptr<ShaderStorageBuffer>* shader_storage_buffer) {
@@ -30,15 +101,146 @@ tensorflow::Status ShaderStorageBuffer::Create(
 
   // Generate one buffer object.
   TFG_RETURN_IF_EGL_ERROR(glGenBuffers(1, &buffer));
-  *shader_storage_buffer =
-      std::unique_ptr<ShaderStorageBuffer>(new ShaderStorageBuffer(buffer));
+  *shader_storage_buffer = std::unique_ptr<ShaderStorageBuffer>(
+      new ShaderStorageBuffer(buffer, 0, 1, nullptr));
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status ShaderStorageBuffer::CreatePersistent(
+    int num_segments,
+    std::unique_ptr<ShaderStorageBuffer>* shader_storage_buffer) {
+  GLuint buffer;
+  GLint offset_alignment;
+  PFNGLBUFFERSTORAGEEXTPROC buffer_storage = nullptr;
+
+  if (num_segments < 1)
+    return TFG_INTERNAL_ERROR("num_segments must be positive");
+  TF_RETURN_IF_ERROR(GetBufferStorageFunction(&buffer_storage));
+  TFG_RETURN_IF_GL_ERROR(glGetIntegerv(
+      GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &offset_alignment));
+  // The data store is allocated by the first upload, once its size is known.
+  TFG_RETURN_IF_GL_ERROR(glGenBuffers(1, &buffer));
+  *shader_storage_buffer = std::unique_ptr<ShaderStorageBuffer>(
+      new ShaderStorageBuffer(buffer, num_segments, offset_alignment,
+                              buffer_storage));
   return tensorflow::Status::OK();
 }
 
 tensorflow::Status ShaderStorageBuffer::BindBufferBase(GLuint index) const {
-  TFG_RETURN_IF_EGL_ERROR(
-      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, buffer_));
+  // glBindBufferRange cannot bind an empty range, so the binding point is
+  // cleared rather than exposing the data of a previous upload.
+  if (size_ == 0) {
+    TFG_RETURN_IF_GL_ERROR(
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, 0));
+    return tensorflow::Status::OK();
+  }
+  // Only the uploaded data is bound when the data store is larger, so that the
+  // length of runtime-sized arrays is the one of the uploaded data.
+  if (num_segments_ > 0 || size_ < capacity_) {
+    const GLintptr offset = segment_ * segment_stride_;
+    TFG_RETURN_IF_GL_ERROR(glBindBufferRange(GL_SHADER_STORAGE_BUFFER, index,
+                                             buffer_, offset, size_));
+  } else {
+    TFG_RETURN_IF_EGL_ERROR(
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, buffer_));
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status ShaderStorageBuffer::UploadBytes(const void* data,
+                                                    GLsizeiptr size) {
+  if (num_segments_ > 0) return UploadPersistent(data, size);
+
+  // Bind the buffer to the read/write storage for shaders.
+  TFG_RETURN_IF_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer_));
+  auto bind_cleanup =
+      MakeCleanup([]() { glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0); });
+  if (size > capacity_) {
+    // Create a new data store for the bound buffer and initializes it with the
+    // input data.
+    TFG_RETURN_IF_GL_ERROR(
+        glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_DYNAMIC_COPY));
+    capacity_ = size;
+  } else if (size > 0) {
+    // Overwrite the beginning of the existing data store.
+    TFG_RETURN_IF_GL_ERROR(
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data));
+  }
+  size_ = size;
+  // bind_cleanup is not released, leading the buffer to be unbound.
   return tensorflow::Status::OK();
 }
 
+tensorflow::Status ShaderStorageBuffer::UploadPersistent(const void* data,
+                                                         GLsizeiptr size) {
+  if (size > capacity_) {
+    TF_RETURN_IF_ERROR(AllocatePersistent(size));
+  } else if (mapped_data_ != nullptr) {
+    // Fence the segment of the previous upload, which may be read by any of
+    // the commands issued so far, and move on to the next one.
+    if (segment_fences_[segment_] != nullptr)
+      glDeleteSync(segment_fences_[segment_]);
+    TFG_RETURN_IF_GL_ERROR(segment_fences_[segment_] = glFenceSync(
+                               GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+    segment_ = (segment_ + 1) % num_segments_;
+
+    GLsync& fence = segment_fences_[segment_];
+    if (fence != nullptr) {
+      GLenum wait_status = GL_TIMEOUT_EXPIRED;
+      while (wait_status == GL_TIMEOUT_EXPIRED) {
+        TFG_RETURN_IF_GL_ERROR(
+            wait_status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                           GL_TIMEOUT_IGNORED));
+      }
+      glDeleteSync(fence);
+      fence = nullptr;
+      if (wait_status == GL_WAIT_FAILED)
+        return TFG_INTERNAL_ERROR("glClientWaitSync failed");
+    }
+  }
+  if (size > 0)
+    std::memcpy(mapped_data_ + segment_ * segment_stride_, data, size);
+  size_ = size;
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status ShaderStorageBuffer::AllocatePersistent(
+    GLsizeiptr segment_size) {
+  // The storage of persistent buffers is immutable, so a new buffer replaces
+  // the current one. Draw calls still reading the current buffer keep its data
+  // store alive until they complete.
+  DeleteFences();
+  TFG_RETURN_IF_GL_ERROR(glDeleteBuffers(1, &buffer_));
+  mapped_data_ = nullptr;
+  capacity_ = 0;
+  segment_ = 0;
+  TFG_RETURN_IF_GL_ERROR(glGenBuffers(1, &buffer_));
+
+  // Segments start at multiples of the offset alignment of glBindBufferRange.
+  segment_stride_ = (segment_size + offset_alignment_ - 1) /
+                    offset_alignment_ * offset_alignment_;
+  const GLsizeiptr storage_size = segment_stride_ * num_segments_;
+  TFG_RETURN_IF_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer_));
+  auto bind_cleanup =
+      MakeCleanup([]() { glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0); });
+  TFG_RETURN_IF_GL_ERROR(buffer_storage_(GL_SHADER_STORAGE_BUFFER, storage_size,
+                                         nullptr, kPersistentFlags));
+  void* mapped_data;
+  TFG_RETURN_IF_GL_ERROR(
+      mapped_data = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, storage_size,
+                                     kPersistentFlags));
+  if (mapped_data == nullptr)
+    return TFG_INTERNAL_ERROR("glMapBufferRange failed");
+  mapped_data_ = static_cast<char*>(mapped_data);
+  capacity_ = segment_size;
+  return tensorflow::Status::OK();
+}
+
+void ShaderStorageBuffer::DeleteFences() {
+  for (GLsync& fence : segment_fences_) {
+    if (fence != nullptr) glDeleteSync(fence);
+    fence = nullptr;
+  }
+}
+
 }  // namespace gl_utils
@@ -16,6 +16,9 @@ limitations under the License.
 #define THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_GL_SHADER_STORAGE_BUFFER_H_
 
 #include <GLES3/gl32.h>
+#include <GLES2/gl2ext.h>
+
+#include <vector>
 
 #include "tensorflow_graphics/rendering/opengl/macros.h"
 #include "tensorflow_graphics/util/cleanup.h"
@@ -24,6 +27,11 @@ limitations under the License.
 namespace gl_utils {
 
 // Class for creating and uploading data to storage buffers.
+//
+// The data store of a buffer is only reallocated when an upload does not fit
+// in it; smaller uploads overwrite the beginning of the existing store, and
+// BindBufferBase only exposes the uploaded data to the shaders, clearing the
+// binding point after an empty upload.
 class ShaderStorageBuffer {
  public:
   ~ShaderStorageBuffer();
@@ -31,34 +39,61 @@ class ShaderStorageBuffer {
   static tensorflow::Status Create(
       std::unique_ptr<ShaderStorageBuffer>* shader_storage_buffer);
 
+  // Creates a storage buffer whose data store is persistently mapped and split
+  // into num_segments segments. Each upload is copied into the segment
+  // following the one of the previous upload, once the commands issued before
+  // that segment was last written to have completed, so that uploads do not
+  // synchronize with draw calls still reading earlier data.
+  //
+  // Arguments:
+  // * num_segments: number of segments of the ring, which must be positive.
+  // * shader_storage_buffer: the created storage buffer.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise, notably when
+  //   neither GL_EXT_buffer_storage nor GL_ARB_buffer_storage is supported.
+  static tensorflow::Status CreatePersistent(
+      int num_segments,
+      std::unique_ptr<ShaderStorageBuffer>* shader_storage_buffer);
+
   // Uploads data to the buffer.
   template <typename T>
-  tensorflow::Status Upload(absl::Span<T> data) const;
+  tensorflow::Status Upload(absl::Span<T> data);
 
  private:
   ShaderStorageBuffer() = delete;
-  ShaderStorageBuffer(GLuint buffer);
+  ShaderStorageBuffer(GLuint buffer, int num_segments, GLint offset_alignment,
+                      PFNGLBUFFERSTORAGEEXTPROC buffer_storage);
   ShaderStorageBuffer(const ShaderStorageBuffer&) = delete;
   ShaderStorageBuffer(ShaderStorageBuffer&&) = delete;
   ShaderStorageBuffer& operator=(const ShaderStorageBuffer&) = delete;
   ShaderStorageBuffer& operator=(ShaderStorageBuffer&&) = delete;
+  tensorflow::Status UploadBytes(const void* data, GLsizeiptr size);
+  tensorflow::Status UploadPersistent(const void* data, GLsizeiptr size);
+  tensorflow::Status AllocatePersistent(GLsizeiptr segment_size);
+  void DeleteFences();
 
   GLuint buffer_;
+  // Size in bytes of the data store, or of each segment for persistent
+  // buffers.
+  GLsizeiptr capacity_;
+  // Size in bytes of the last upload.
+  GLsizeiptr size_;
+  // Persistent buffers only; num_segments_ is 0 for other buffers.
+  int num_segments_;
+  GLint offset_alignment_;
+  int segment_;
+  GLintptr segment_stride_;
+  char* mapped_data_;
+  std::vector<GLsync> segment_fences_;
+  // glBufferStorage or glBufferStorageEXT, loaded by CreatePersistent.
+  PFNGLBUFFERSTORAGEEXTPROC buffer_storage_;
 };
 
 template <typename T>
-tensorflow::Status ShaderStorageBuffer::Upload(absl::Span<T> data) const {
-  // Bind the buffer to the read/write storage for shaders.
-  TFG_RETURN_IF_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer_));
-  auto bind_cleanup =
-      MakeCleanup([]() { glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0); });
-  // Create a new data store for the bound buffer and initializes it with the
-  // input data.
-  TFG_RETURN_IF_GL_ERROR(glBufferData(GL_SHADER_STORAGE_BUFFER,
-                                      data.size() * sizeof(T), data.data(),
-                                      GL_DYNAMIC_COPY));
-  // bind_cleanup is not released, leading the buffer to be unbound.
-  return tensorflow::Status::OK();
+tensorflow::Status ShaderStorageBuffer::Upload(absl::Span<T> data) {
+  return UploadBytes(data.data(), data.size() * sizeof(T));
 }
 
 }  // namespace gl_utils
@@ -0,0 +1,102 @@
+/* Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#include "tensorflow_graphics/rendering/opengl/gl_vertex_array.h"
+
+#include <GLES3/gl32.h>
+
+#include "tensorflow_graphics/rendering/opengl/macros.h"
+#include "tensorflow_graphics/util/cleanup.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace gl_utils {
+
+VertexArray::VertexArray(GLuint vertex_array)
+    : vertex_array_(vertex_array), index_buffer_{0, 0} {}
+
+VertexArray::~VertexArray() {
+  glDeleteVertexArrays(1, &vertex_array_);
+  for (auto& attribute_buffer : attribute_buffers_)
+    glDeleteBuffers(1, &attribute_buffer.second.buffer);
+  if (index_buffer_.buffer != 0) glDeleteBuffers(1, &index_buffer_.buffer);
+}
+
+tensorflow::Status VertexArray::Create(
+    std::unique_ptr<VertexArray>* vertex_array) {
+  GLuint vertex_array_name;
+
+  TFG_RETURN_IF_GL_ERROR(glGenVertexArrays(1, &vertex_array_name));
+  *vertex_array =
+      std::unique_ptr<VertexArray>(new VertexArray(vertex_array_name));
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status VertexArray::Bind() const {
+  TFG_RETURN_IF_GL_ERROR(glBindVertexArray(vertex_array_));
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status VertexArray::Unbind() const {
+  TFG_RETURN_IF_GL_ERROR(glBindVertexArray(0));
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status VertexArray::SetAttribute(GLuint location,
+                                             GLint num_components,
+                                             absl::Span<const float> data) {
+  if (num_components < 1 || num_components > 4)
+    return TFG_INTERNAL_ERROR("Invalid number of components ", num_components);
+
+  TF_RETURN_IF_ERROR(Bind());
+  auto bind_cleanup = MakeCleanup([this]() { return this->Unbind(); });
+  auto attribute_buffer =
+      attribute_buffers_.insert({location, Buffer{0, 0}}).first;
+  TF_RETURN_IF_ERROR(Upload(GL_ARRAY_BUFFER, data.data(),
+                            data.size() * sizeof(float),
+                            &attribute_buffer->second));
+  auto array_buffer_cleanup =
+      MakeCleanup([]() { glBindBuffer(GL_ARRAY_BUFFER, 0); });
+  // The attribute sources its values from the buffer bound to
+  // GL_ARRAY_BUFFER.
+  TFG_RETURN_IF_GL_ERROR(glVertexAttribPointer(location, num_components,
+                                               GL_FLOAT, GL_FALSE, 0, 0));
+  TFG_RETURN_IF_GL_ERROR(glEnableVertexAttribArray(location));
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status VertexArray::SetIndices(absl::Span<const int> indices) {
+  TF_RETURN_IF_ERROR(Bind());
+  auto bind_cleanup = MakeCleanup([this]() { return this->Unbind(); });
+  // The element array buffer binding is part of the state of the vertex array
+  // object, and is left bound.
+  TF_RETURN_IF_ERROR(Upload(GL_ELEMENT_ARRAY_BUFFER, indices.data(),
+                            indices.size() * sizeof(int), &index_buffer_));
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status VertexArray::Upload(GLenum target, const void* data,
+                                       GLsizeiptr size, Buffer* buffer) {
+  if (buffer->buffer == 0)
+    TFG_RETURN_IF_GL_ERROR(glGenBuffers(1, &buffer->buffer));
+  TFG_RETURN_IF_GL_ERROR(glBindBuffer(target, buffer->buffer));
+  if (size > buffer->capacity) {
+    TFG_RETURN_IF_GL_ERROR(glBufferData(target, size, data, GL_DYNAMIC_DRAW));
+    buffer->capacity = size;
+  } else if (size > 0) {
+    TFG_RETURN_IF_GL_ERROR(glBufferSubData(target, 0, size, data));
+  }
+  return tensorflow::Status::OK();
+}
+
+}  // namespace gl_utils
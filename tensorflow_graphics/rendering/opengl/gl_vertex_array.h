@@ -0,0 +1,100 @@
+/* Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_GL_VERTEX_ARRAY_H_
+#define THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_GL_VERTEX_ARRAY_H_
+
+#include <GLES3/gl32.h>
+
+#include <memory>
+#include <unordered_map>
+
+#include "absl/types/span.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace gl_utils {
+
+// Class for creating a vertex array object, and uploading data to the buffers
+// of its vertex attributes and to its element array buffer.
+//
+// As for storage buffers, the data store of a buffer is only reallocated when
+// an upload does not fit in it. Vertex array objects are not shared between
+// contexts, and must be used in the context that created them.
+class VertexArray {
+ public:
+  ~VertexArray();
+  static tensorflow::Status Create(std::unique_ptr<VertexArray>* vertex_array);
+
+  // Binds the vertex array object, so that draw calls source their vertex
+  // attributes and indices from it.
+  tensorflow::Status Bind() const;
+
+  // Unbinds the vertex array object.
+  tensorflow::Status Unbind() const;
+
+  // Uploads the values of a float vertex attribute, and enables it.
+  //
+  // Arguments:
+  // * location: location of the vertex attribute.
+  // * num_components: number of components of the attribute, between 1 and 4.
+  // * data: the values of the attribute, num_components per vertex.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  tensorflow::Status SetAttribute(GLuint location, GLint num_components,
+                                  absl::Span<const float> data);
+
+  // Uploads the indices of the vertices drawn by indexed draw calls, which
+  // must be issued with type GL_UNSIGNED_INT.
+  //
+  // Arguments:
+  // * indices: the indices, which must not be negative.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  tensorflow::Status SetIndices(absl::Span<const int> indices);
+
+  // Returns whether indices were uploaded by SetIndices.
+  bool HasIndices() const { return index_buffer_.buffer != 0; }
+
+ private:
+  // Buffer object and size in bytes of its data store.
+  struct Buffer {
+    GLuint buffer;
+    GLsizeiptr capacity;
+  };
+
+  VertexArray() = delete;
+  explicit VertexArray(GLuint vertex_array);
+  VertexArray(const VertexArray&) = delete;
+  VertexArray(VertexArray&&) = delete;
+  VertexArray& operator=(const VertexArray&) = delete;
+  VertexArray& operator=(VertexArray&&) = delete;
+
+  // Uploads data to the buffer bound to target, creating it if needed. The
+  // vertex array object must be bound.
+  static tensorflow::Status Upload(GLenum target, const void* data,
+                                   GLsizeiptr size, Buffer* buffer);
+
+  GLuint vertex_array_;
+  // Buffers of the vertex attributes, keyed by their locations.
+  std::unordered_map<GLuint, Buffer> attribute_buffers_;
+  Buffer index_buffer_;
+};
+
+}  // namespace gl_utils
+
+#endif  // THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_GL_VERTEX_ARRAY_H_
@@ -0,0 +1,422 @@
+/* Copyright 2019 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#include <algorithm>
+#include <memory>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "tensorflow_graphics/rendering/opengl/attribute_interpolator.h"
+#include "tensorflow/core/framework/op.h"
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/framework/shape_inference.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/types.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/util/work_sharder.h"
+
+REGISTER_OP("InterpolateAttributes")
+    .Input("triangle_index: int32")
+    .Input("vertices: float")
+    .Input("triangles: int32")
+    .Input("attributes: float")
+    .Input("view_projection_matrix: float")
+    .Output("interpolated_attributes: float")
+    .Doc(R"doc(
+Interpolates per-vertex attributes over the pixels of triangle index images, in
+a single pass. The attributes of each pixel are interpolated with the
+perspective-correct barycentric coordinates of its center in the triangle it
+shows, which are computed from the projected vertices of the triangle, so that
+gradients flow to the vertices, the attributes and the view projection matrix.
+
+Note that in the following, A1 to An are optional batch dimensions.
+
+triangle_index: An int32 tensor of shape `[A1, ..., An, height, width]`
+  containing the index of the triangle shown at each pixel, with rows ordered
+  from the bottom of the images as in the output of `RasterizeTriangles`.
+vertices: A tensor of shape `[A1, ..., An, V, 3]` containing the positions of
+  the vertices of each mesh.
+triangles: An int32 tensor of shape `[A1, ..., An, T, 3]` containing the
+  indices of the vertices of the triangles of each mesh, or of shape `[T, 3]`
+  for triangles shared by all the meshes.
+attributes: A tensor of shape `[A1, ..., An, V, K]` containing the attributes
+  of the vertices of each mesh.
+view_projection_matrix: A tensor of shape `[A1, ..., An, 4, 4]` containing the
+  matrix transforming the vertices of each mesh into clip space.
+interpolated_attributes: A tensor of shape `[A1, ..., An, height, width, K]`
+  containing the attributes interpolated at each pixel.
+    )doc")
+    .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      tensorflow::shape_inference::ShapeHandle triangle_index_shape;
+      tensorflow::shape_inference::ShapeHandle attributes_shape;
+      TF_RETURN_IF_ERROR(
+          c->WithRankAtLeast(c->input(0), 2, &triangle_index_shape));
+      TF_RETURN_IF_ERROR(c->WithRankAtLeast(c->input(3), 2, &attributes_shape));
+      tensorflow::shape_inference::ShapeHandle output_shape;
+      TF_RETURN_IF_ERROR(
+          c->Concatenate(triangle_index_shape,
+                         c->Vector(c->Dim(attributes_shape, -1)),
+                         &output_shape));
+      c->set_output(0, output_shape);
+      return tensorflow::Status::OK();
+    });
+
+REGISTER_OP("InterpolateAttributesGrad")
+    .Input("triangle_index: int32")
+    .Input("vertices: float")
+    .Input("triangles: int32")
+    .Input("attributes: float")
+    .Input("view_projection_matrix: float")
+    .Input("interpolated_attributes_grad: float")
+    .Output("vertices_grad: float")
+    .Output("attributes_grad: float")
+    .Output("view_projection_matrix_grad: float")
+    .Doc(R"doc(
+Gradient of `InterpolateAttributes` with respect to its float inputs.
+
+triangle_index: The triangle index images passed to `InterpolateAttributes`.
+vertices: The vertices passed to `InterpolateAttributes`.
+triangles: The triangles passed to `InterpolateAttributes`.
+attributes: The attributes passed to `InterpolateAttributes`.
+view_projection_matrix: The matrix passed to `InterpolateAttributes`.
+interpolated_attributes_grad: A tensor of shape
+  `[A1, ..., An, height, width, K]` containing the gradient of the interpolated
+  attributes.
+vertices_grad: The gradient of the vertices.
+attributes_grad: The gradient of the attributes.
+view_projection_matrix_grad: The gradient of the view projection matrix.
+    )doc")
+    .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      c->set_output(0, c->input(1));
+      c->set_output(1, c->input(3));
+      c->set_output(2, c->input(4));
+      return tensorflow::Status::OK();
+    });
+
+namespace {
+
+// Checks the shapes of the inputs shared by InterpolateAttributes and its
+// gradient, and creates an interpolator of their images.
+tensorflow::Status ValidateInputs(
+    tensorflow::OpKernelContext* context,
+    tensorflow::TensorShape* batch_shape,
+    std::unique_ptr<AttributeInterpolator>* interpolator) {
+  const tensorflow::Tensor& triangle_index = context->input(0);
+  const tensorflow::Tensor& vertices = context->input(1);
+  const tensorflow::Tensor& triangles = context->input(2);
+  const tensorflow::Tensor& attributes = context->input(3);
+  const tensorflow::Tensor& view_projection_matrix = context->input(4);
+  if (vertices.dims() < 2 || vertices.dim_size(vertices.dims() - 1) != 3)
+    return tensorflow::errors::InvalidArgument(
+        "vertices must have shape [A1, ..., An, V, 3], got shape ",
+        vertices.shape().DebugString());
+  *batch_shape = vertices.shape();
+  batch_shape->RemoveLastDims(2);
+
+  tensorflow::TensorShape triangles_batch_shape = triangles.shape();
+  if (triangles.dims() >= 2) triangles_batch_shape.RemoveLastDims(2);
+  if (triangles.dims() < 2 || triangles.dim_size(triangles.dims() - 1) != 3 ||
+      (triangles.dims() != 2 && triangles_batch_shape != *batch_shape))
+    return tensorflow::errors::InvalidArgument(
+        "triangles must have shape [A1, ..., An, T, 3] or [T, 3], got shape ",
+        triangles.shape().DebugString());
+
+  tensorflow::TensorShape attributes_batch_shape = attributes.shape();
+  if (attributes.dims() >= 2) attributes_batch_shape.RemoveLastDims(2);
+  if (attributes.dims() < 2 || attributes_batch_shape != *batch_shape ||
+      attributes.dim_size(attributes.dims() - 2) !=
+          vertices.dim_size(vertices.dims() - 2) ||
+      attributes.dim_size(attributes.dims() - 1) == 0)
+    return tensorflow::errors::InvalidArgument(
+        "attributes must have shape [A1, ..., An, V, K] with K > 0, got shape ",
+        attributes.shape().DebugString());
+
+  tensorflow::TensorShape matrix_shape = *batch_shape;
+  matrix_shape.AddDim(4);
+  matrix_shape.AddDim(4);
+  if (view_projection_matrix.shape() != matrix_shape)
+    return tensorflow::errors::InvalidArgument(
+        "view_projection_matrix must have shape ", matrix_shape.DebugString(),
+        ", got shape ", view_projection_matrix.shape().DebugString());
+
+  tensorflow::TensorShape image_batch_shape = triangle_index.shape();
+  if (triangle_index.dims() >= 2) image_batch_shape.RemoveLastDims(2);
+  if (triangle_index.dims() < 2 || image_batch_shape != *batch_shape)
+    return tensorflow::errors::InvalidArgument(
+        "triangle_index must have shape [A1, ..., An, height, width], got "
+        "shape ",
+        triangle_index.shape().DebugString());
+  return AttributeInterpolator::Create(
+      triangle_index.dim_size(triangle_index.dims() - 1),
+      triangle_index.dim_size(triangle_index.dims() - 2),
+      attributes.dim_size(attributes.dims() - 1), interpolator);
+}
+
+}  // namespace
+
+class InterpolateAttributesOp : public tensorflow::OpKernel {
+ public:
+  explicit InterpolateAttributesOp(tensorflow::OpKernelConstruction* context)
+      : OpKernel(context) {}
+
+  void Compute(tensorflow::OpKernelContext* context) override {
+    tensorflow::TensorShape batch_shape;
+    std::unique_ptr<AttributeInterpolator> interpolator;
+    OP_REQUIRES_OK(context,
+                   ValidateInputs(context, &batch_shape, &interpolator));
+    const tensorflow::Tensor& triangle_index = context->input(0);
+    const tensorflow::Tensor& vertices = context->input(1);
+    const tensorflow::Tensor& triangles = context->input(2);
+    const tensorflow::Tensor& attributes = context->input(3);
+    const tensorflow::Tensor& view_projection_matrix = context->input(4);
+
+    tensorflow::Tensor* interpolated_attributes;
+    tensorflow::TensorShape output_shape = triangle_index.shape();
+    const int64 num_attributes = attributes.dim_size(attributes.dims() - 1);
+    output_shape.AddDim(num_attributes);
+    OP_REQUIRES_OK(context, context->allocate_output(0, output_shape,
+                                                     &interpolated_attributes));
+
+    const int64 num_pixels = interpolator->num_pixels();
+    const int64 num_vertices = vertices.dim_size(vertices.dims() - 2);
+    const int64 num_triangles = triangles.dim_size(triangles.dims() - 2);
+    auto* worker_threads = context->device()->tensorflow_cpu_worker_threads();
+    absl::Mutex status_mutex;
+    tensorflow::Status status;
+
+    // The pixels of all the batch elements are spread over the threads, each
+    // range being split at the boundaries of the images.
+    auto interpolate = [&](int64 begin, int64 end) {
+      while (begin < end) {
+        const int64 element = begin / num_pixels;
+        const int64 pixel_begin = begin % num_pixels;
+        const int64 pixel_end =
+            std::min(num_pixels, pixel_begin + end - begin);
+        const int64 triangles_offset =
+            triangles.dims() == 2 ? 0 : element * num_triangles * 3;
+        tensorflow::Status element_status = interpolator->Interpolate(
+            absl::MakeConstSpan(
+                triangle_index.flat<int32>().data() + element * num_pixels,
+                num_pixels),
+            absl::MakeConstSpan(
+                vertices.flat<float>().data() + element * num_vertices * 3,
+                num_vertices * 3),
+            absl::MakeConstSpan(
+                triangles.flat<int32>().data() + triangles_offset,
+                num_triangles * 3),
+            absl::MakeConstSpan(attributes.flat<float>().data() +
+                                    element * num_vertices * num_attributes,
+                                num_vertices * num_attributes),
+            absl::MakeConstSpan(
+                view_projection_matrix.flat<float>().data() + element * 16,
+                16),
+            pixel_begin, pixel_end,
+            absl::MakeSpan(interpolated_attributes->flat<float>().data() +
+                               element * num_pixels * num_attributes,
+                           num_pixels * num_attributes));
+        if (!element_status.ok()) {
+          absl::MutexLock lock(&status_mutex);
+          status.Update(element_status);
+          return;
+        }
+        begin += pixel_end - pixel_begin;
+      }
+    };
+    tensorflow::Shard(worker_threads->num_threads, worker_threads->workers,
+                      batch_shape.num_elements() * num_pixels,
+                      kCostPerPixel + kCostPerAttribute * num_attributes,
+                      interpolate);
+    OP_REQUIRES_OK(context, status);
+  }
+
+ private:
+  // Projecting the triangle of a pixel costs more than interpolating each of
+  // its attributes.
+  static constexpr int64 kCostPerPixel = 200;
+  static constexpr int64 kCostPerAttribute = 10;
+};
+
+class InterpolateAttributesGradOp : public tensorflow::OpKernel {
+ public:
+  explicit InterpolateAttributesGradOp(
+      tensorflow::OpKernelConstruction* context)
+      : OpKernel(context) {}
+
+  void Compute(tensorflow::OpKernelContext* context) override {
+    tensorflow::TensorShape batch_shape;
+    std::unique_ptr<AttributeInterpolator> interpolator;
+    OP_REQUIRES_OK(context,
+                   ValidateInputs(context, &batch_shape, &interpolator));
+    const tensorflow::Tensor& triangle_index = context->input(0);
+    const tensorflow::Tensor& vertices = context->input(1);
+    const tensorflow::Tensor& triangles = context->input(2);
+    const tensorflow::Tensor& attributes = context->input(3);
+    const tensorflow::Tensor& view_projection_matrix = context->input(4);
+    const tensorflow::Tensor& interpolated_attributes_grad = context->input(5);
+    const int64 num_attributes = attributes.dim_size(attributes.dims() - 1);
+    tensorflow::TensorShape output_shape = triangle_index.shape();
+    output_shape.AddDim(num_attributes);
+    OP_REQUIRES(context, interpolated_attributes_grad.shape() == output_shape,
+                tensorflow::errors::InvalidArgument(
+                    "interpolated_attributes_grad must have shape ",
+                    output_shape.DebugString(), ", got shape ",
+                    interpolated_attributes_grad.shape().DebugString()));
+
+    tensorflow::Tensor* vertices_grad;
+    tensorflow::Tensor* attributes_grad;
+    tensorflow::Tensor* view_projection_matrix_grad;
+    OP_REQUIRES_OK(context, context->allocate_output(0, vertices.shape(),
+                                                     &vertices_grad));
+    OP_REQUIRES_OK(context, context->allocate_output(1, attributes.shape(),
+                                                     &attributes_grad));
+    OP_REQUIRES_OK(context,
+                   context->allocate_output(2, view_projection_matrix.shape(),
+                                            &view_projection_matrix_grad));
+
+    const int num_elements = batch_shape.num_elements();
+    const int64 num_pixels = interpolator->num_pixels();
+    const int64 num_vertices = vertices.dim_size(vertices.dims() - 2);
+    const int64 num_triangles = triangles.dim_size(triangles.dims() - 2);
+    auto* worker_threads = context->device()->tensorflow_cpu_worker_threads();
+
+    std::fill_n(vertices_grad->flat<float>().data(),
+                vertices_grad->NumElements(), 0.0f);
+    std::fill_n(attributes_grad->flat<float>().data(),
+                attributes_grad->NumElements(), 0.0f);
+    std::fill_n(view_projection_matrix_grad->flat<float>().data(),
+                view_projection_matrix_grad->NumElements(), 0.0f);
+    if (num_elements == 0) return;
+
+    // The gradients of a batch element are accumulated over its pixels. When
+    // there are fewer elements than threads, the images are split into ranges
+    // of pixels whose gradients are accumulated into separate buffers, and
+    // summed afterwards.
+    const int64 num_ranges = std::max<int64>(
+        1, std::min<int64>(num_pixels,
+                           worker_threads->num_threads / num_elements));
+    const int64 num_tasks = num_elements * num_ranges;
+    const int64 vertices_size = num_vertices * 3;
+    const int64 attributes_size = num_vertices * num_attributes;
+    const int64 buffer_size = vertices_size + attributes_size + 16;
+    tensorflow::Tensor buffers;
+    if (num_ranges > 1) {
+      OP_REQUIRES_OK(context,
+                     context->allocate_temp(
+                         tensorflow::DT_FLOAT,
+                         tensorflow::TensorShape({num_tasks, buffer_size}),
+                         &buffers));
+      std::fill_n(buffers.flat<float>().data(), num_tasks * buffer_size,
+                  0.0f);
+    }
+    absl::Mutex status_mutex;
+    tensorflow::Status status;
+
+    auto backpropagate = [&](int64 begin, int64 end) {
+      for (int64 task = begin; task < end; ++task) {
+        const int64 element = task / num_ranges;
+        const int64 range = task % num_ranges;
+        const int64 triangles_offset =
+            triangles.dims() == 2 ? 0 : element * num_triangles * 3;
+        float* task_vertices_grad =
+            vertices_grad->flat<float>().data() + element * vertices_size;
+        float* task_attributes_grad =
+            attributes_grad->flat<float>().data() + element * attributes_size;
+        float* task_view_projection_matrix_grad =
+            view_projection_matrix_grad->flat<float>().data() + element * 16;
+        if (num_ranges > 1) {
+          task_vertices_grad =
+              buffers.flat<float>().data() + task * buffer_size;
+          task_attributes_grad = task_vertices_grad + vertices_size;
+          task_view_projection_matrix_grad =
+              task_attributes_grad + attributes_size;
+        }
+        tensorflow::Status task_status = interpolator->InterpolateGrad(
+            absl::MakeConstSpan(
+                triangle_index.flat<int32>().data() + element * num_pixels,
+                num_pixels),
+            absl::MakeConstSpan(
+                vertices.flat<float>().data() + element * vertices_size,
+                vertices_size),
+            absl::MakeConstSpan(
+                triangles.flat<int32>().data() + triangles_offset,
+                num_triangles * 3),
+            absl::MakeConstSpan(
+                attributes.flat<float>().data() + element * attributes_size,
+                attributes_size),
+            absl::MakeConstSpan(
+                view_projection_matrix.flat<float>().data() + element * 16,
+                16),
+            num_pixels * range / num_ranges,
+            num_pixels * (range + 1) / num_ranges,
+            absl::MakeConstSpan(
+                interpolated_attributes_grad.flat<float>().data() +
+                    element * num_pixels * num_attributes,
+                num_pixels * num_attributes),
+            absl::MakeSpan(task_vertices_grad, vertices_size),
+            absl::MakeSpan(task_attributes_grad, attributes_size),
+            absl::MakeSpan(task_view_projection_matrix_grad, 16));
+        if (!task_status.ok()) {
+          absl::MutexLock lock(&status_mutex);
+          status.Update(task_status);
+        }
+      }
+    };
+    tensorflow::Shard(worker_threads->num_threads, worker_threads->workers,
+                      num_tasks,
+                      num_pixels / num_ranges *
+                          (kCostPerPixel + kCostPerAttribute * num_attributes),
+                      backpropagate);
+    OP_REQUIRES_OK(context, status);
+    if (num_ranges == 1) return;
+
+    // Sum the gradients of the ranges of each batch element.
+    auto reduce = [&](int64 begin, int64 end) {
+      for (int64 element = begin; element < end; ++element) {
+        const float* buffer =
+            buffers.flat<float>().data() + element * num_ranges * buffer_size;
+        float* outputs[3] = {
+            vertices_grad->flat<float>().data() + element * vertices_size,
+            attributes_grad->flat<float>().data() + element * attributes_size,
+            view_projection_matrix_grad->flat<float>().data() + element * 16};
+        const int64 sizes[3] = {vertices_size, attributes_size, 16};
+        for (int output = 0; output < 3; ++output) {
+          for (int64 range = 0; range < num_ranges; ++range) {
+            const float* range_buffer = buffer + range * buffer_size;
+            for (int64 i = 0; i < sizes[output]; ++i)
+              outputs[output][i] += range_buffer[i];
+          }
+          buffer += sizes[output];
+        }
+      }
+    };
+    tensorflow::Shard(worker_threads->num_threads, worker_threads->workers,
+                      num_elements, num_ranges * buffer_size, reduce);
+  }
+
+ private:
+  // Backpropagating through a pixel costs about twice as much as interpolating
+  // it.
+  static constexpr int64 kCostPerPixel = 400;
+  static constexpr int64 kCostPerAttribute = 20;
+};
+
+// Register kernels with TF
+REGISTER_KERNEL_BUILDER(
+    Name("InterpolateAttributes").Device(tensorflow::DEVICE_CPU),
+    InterpolateAttributesOp);
+REGISTER_KERNEL_BUILDER(
+    Name("InterpolateAttributesGrad").Device(tensorflow::DEVICE_CPU),
+    InterpolateAttributesGradOp);
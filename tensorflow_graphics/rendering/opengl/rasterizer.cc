@@ -14,23 +14,43 @@ limitations under the License.
 ==============================================================================*/
 #include "tensorflow_graphics/rendering/opengl/rasterizer.h"
 
+#include "tensorflow/core/lib/hash/hash.h"
+
 Rasterizer::Rasterizer(
     std::unique_ptr<gl_utils::Program>&& program,
     std::unique_ptr<gl_utils::RenderTargets>&& render_targets, float clear_r,
     float clear_g, float clear_b, float clear_depth)
     : program_(std::move(program)),
       render_targets_(std::move(render_targets)),
+      last_render_targets_(nullptr),
+      index_buffer_fingerprint_{false, 0, 0},
+      skipped_upload_bytes_(0),
       clear_r_(clear_r),
       clear_g_(clear_g),
       clear_b_(clear_b),
-      clear_depth_(clear_depth) {}
+      clear_depth_(clear_depth),
+      pipelined_readback_(false),
+      persistent_uploads_(false),
+      full_upload_hashing_(false),
+      depth_only_(false),
+      num_channels_(4),
+      element_index_(0),
+      num_elements_(1),
+      draw_mode_(DrawMode::kPoints) {}
 
 Rasterizer::~Rasterizer() {}
 
 void Rasterizer::Reset() {
   program_.reset();
   render_targets_.reset();
+  layered_render_targets_.reset();
+  cached_render_targets_.clear();
+  vertex_array_.reset();
+  last_render_targets_ = nullptr;
   for (auto&& buffer : shader_storage_buffers_) buffer.second.reset();
+  shader_storage_buffer_fingerprints_.clear();
+  vertex_attribute_fingerprints_.clear();
+  index_buffer_fingerprint_ = UploadFingerprint{false, nullptr, 0, 0};
 }
 
 tensorflow::Status Rasterizer::Render(int num_points,
@@ -38,22 +58,246 @@ tensorflow::Status Rasterizer::Render(int num_points,
   return RenderImpl(num_points, result);
 }
 
+tensorflow::Status Rasterizer::Render(int num_points,
+                                      absl::Span<Eigen::half> result) {
+  return RenderImpl(num_points, result);
+}
+
 tensorflow::Status Rasterizer::Render(int num_points,
                                       absl::Span<unsigned char> result) {
   return RenderImpl(num_points, result);
 }
 
+tensorflow::Status Rasterizer::RenderLayered(int num_points, int num_layers,
+                                             absl::Span<float> result) {
+  return RenderLayeredImpl(num_points, num_layers, result);
+}
+
+tensorflow::Status Rasterizer::RenderLayered(int num_points, int num_layers,
+                                             absl::Span<Eigen::half> result) {
+  return RenderLayeredImpl(num_points, num_layers, result);
+}
+
+tensorflow::Status Rasterizer::RenderLayered(
+    int num_points, int num_layers, absl::Span<unsigned char> result) {
+  return RenderLayeredImpl(num_points, num_layers, result);
+}
+
+tensorflow::Status Rasterizer::ReadColorAttachment(int attachment,
+                                                   absl::Span<float> result) {
+  return ReadColorAttachmentImpl(attachment, result);
+}
+
+tensorflow::Status Rasterizer::ReadColorAttachment(
+    int attachment, absl::Span<Eigen::half> result) {
+  return ReadColorAttachmentImpl(attachment, result);
+}
+
+tensorflow::Status Rasterizer::ReadColorAttachment(
+    int attachment, absl::Span<unsigned char> result) {
+  return ReadColorAttachmentImpl(attachment, result);
+}
+
+tensorflow::Status Rasterizer::ReadColorAttachment(int attachment,
+                                                   absl::Span<int> result) {
+  return ReadColorAttachmentImpl(attachment, result);
+}
+
+tensorflow::Status Rasterizer::ReadDepth(absl::Span<float> result) {
+  if (last_render_targets_ == nullptr)
+    return TFG_INTERNAL_ERROR("Nothing was rendered");
+
+  TF_RETURN_IF_ERROR(last_render_targets_->BindFramebuffer());
+  auto framebuffer_cleanup = MakeCleanup(
+      [this]() { return last_render_targets_->UnbindFrameBuffer(); });
+  if (pipelined_readback_) {
+    TF_RETURN_IF_ERROR(last_render_targets_->CopyDepthPixelsIntoAsync(result));
+  } else {
+    TF_RETURN_IF_ERROR(last_render_targets_->CopyDepthPixelsInto(result));
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status Rasterizer::CheckDepthReadable() {
+  return gl_utils::RenderTargets::CheckDepthReadable();
+}
+
+tensorflow::Status Rasterizer::SetNumChannels(int num_channels) {
+  if (num_channels < 1 || num_channels > 4)
+    return TFG_INTERNAL_ERROR("Invalid number of channels ", num_channels);
+  num_channels_ = num_channels;
+  return tensorflow::Status::OK();
+}
+
+void Rasterizer::SetDepthOnly(bool depth_only) { depth_only_ = depth_only; }
+
+void Rasterizer::SetPipelinedReadback(bool pipelined_readback) {
+  pipelined_readback_ = pipelined_readback;
+}
+
+void Rasterizer::SetShaderStorageBuffer(
+    const std::string& name,
+    std::shared_ptr<gl_utils::ShaderStorageBuffer> shader_storage_buffer) {
+  shader_storage_buffers_[name] = std::move(shader_storage_buffer);
+  // The content of a buffer provided by the caller is not tracked.
+  shader_storage_buffer_fingerprints_.erase(name);
+}
+
+void Rasterizer::SetPersistentUploads(bool persistent_uploads) {
+  persistent_uploads_ = persistent_uploads;
+}
+
+void Rasterizer::SetFullUploadHashing(bool full_upload_hashing) {
+  full_upload_hashing_ = full_upload_hashing;
+  // Fingerprints computed the other way cannot be compared.
+  shader_storage_buffer_fingerprints_.clear();
+  vertex_attribute_fingerprints_.clear();
+  index_buffer_fingerprint_ = UploadFingerprint{false, nullptr, 0, 0};
+}
+
+void Rasterizer::SetDrawMode(DrawMode draw_mode) { draw_mode_ = draw_mode; }
+
+tensorflow::Status Rasterizer::SetVertexAttribute(
+    const std::string& name, absl::Span<const float> data) {
+  static const auto* kNumComponents = new std::unordered_map<GLenum, int>({
+      {GL_FLOAT, 1},
+      {GL_FLOAT_VEC2, 2},
+      {GL_FLOAT_VEC3, 3},
+      {GL_FLOAT_VEC4, 4},
+  });
+
+  const gl_utils::ProgramResource* attribute =
+      program_->GetVertexAttribute(name);
+  if (attribute == nullptr)
+    return TFG_INTERNAL_ERROR("Unknown vertex attribute ", name);
+  auto num_components = kNumComponents->find(attribute->type);
+  if (num_components == kNumComponents->end())
+    return TFG_INTERNAL_ERROR("Unsupported type of vertex attribute ", name);
+
+  if (vertex_array_ == nullptr)
+    TF_RETURN_IF_ERROR(gl_utils::VertexArray::Create(&vertex_array_));
+  UploadFingerprint& fingerprint = vertex_attribute_fingerprints_.insert(
+      {name, UploadFingerprint{false, nullptr, 0, 0}}).first->second;
+  if (IsUploaded(data.data(), data.size() * sizeof(float), &fingerprint))
+    return tensorflow::Status::OK();
+  auto fingerprint_cleanup = MakeCleanup(
+      [&fingerprint]() {
+        fingerprint = UploadFingerprint{false, nullptr, 0, 0};
+      });
+  TF_RETURN_IF_ERROR(vertex_array_->SetAttribute(
+      attribute->location, num_components->second, data));
+  fingerprint_cleanup.release();
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status Rasterizer::SetIndexBuffer(absl::Span<const int> indices) {
+  if (vertex_array_ == nullptr)
+    TF_RETURN_IF_ERROR(gl_utils::VertexArray::Create(&vertex_array_));
+  if (IsUploaded(indices.data(), indices.size() * sizeof(int),
+                 &index_buffer_fingerprint_))
+    return tensorflow::Status::OK();
+  auto fingerprint_cleanup = MakeCleanup([this]() {
+    this->index_buffer_fingerprint_ = UploadFingerprint{false, nullptr, 0, 0};
+  });
+  TF_RETURN_IF_ERROR(vertex_array_->SetIndices(indices));
+  fingerprint_cleanup.release();
+  return tensorflow::Status::OK();
+}
+
+bool Rasterizer::IsUploaded(const void* data, size_t size,
+                            UploadFingerprint* fingerprint) {
+  const char* bytes = static_cast<const char*>(data);
+  uint64_t hash;
+  if (full_upload_hashing_ || size <= kNumHashedChunks * kHashedChunkSize) {
+    hash = tensorflow::Hash64(bytes, size);
+  } else {
+    // The first and last chunks are at the ends of the data.
+    const size_t stride = (size - kHashedChunkSize) / (kNumHashedChunks - 1);
+    hash = 0;
+    for (size_t chunk = 0; chunk < kNumHashedChunks; ++chunk)
+      hash = tensorflow::Hash64Combine(
+          hash, tensorflow::Hash64(bytes + chunk * stride, kHashedChunkSize));
+  }
+  // Without full hashing, data at another address is assumed to differ.
+  if (fingerprint->known && fingerprint->size == size &&
+      fingerprint->hash == hash &&
+      (full_upload_hashing_ || fingerprint->data == data)) {
+    skipped_upload_bytes_ += size;
+    return true;
+  }
+  *fingerprint = UploadFingerprint{true, data, size, hash};
+  return false;
+}
+
+void Rasterizer::SetBatchElement(int element_index, int num_elements) {
+  element_index_ = element_index;
+  num_elements_ = num_elements;
+}
+
+tensorflow::Status Rasterizer::FinishPendingRenders() {
+  TF_RETURN_IF_ERROR(render_targets_->FinishPendingCopies());
+  if (layered_render_targets_ != nullptr)
+    TF_RETURN_IF_ERROR(layered_render_targets_->FinishPendingCopies());
+  // Images may have been rendered before a change of size.
+  for (auto& render_targets : cached_render_targets_)
+    TF_RETURN_IF_ERROR(render_targets->FinishPendingCopies());
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status Rasterizer::SetResolution(int width, int height) {
+  if (width < 1 || height < 1)
+    return TFG_INTERNAL_ERROR("Invalid resolution ", width, "x", height);
+  if (render_targets_->GetWidth() == width &&
+      render_targets_->GetHeight() == height)
+    return tensorflow::Status::OK();
+
+  std::unique_ptr<gl_utils::RenderTargets> render_targets;
+  TF_RETURN_IF_ERROR(AcquireRenderTargets(width, height, 1, &render_targets));
+  std::swap(render_targets, render_targets_);
+  return ReleaseRenderTargets(std::move(render_targets));
+}
+
+tensorflow::Status Rasterizer::AcquireRenderTargets(
+    int width, int height, int num_layers,
+    std::unique_ptr<gl_utils::RenderTargets>* render_targets) {
+  const std::vector<GLenum>& color_formats = render_targets_->GetColorFormats();
+
+  for (auto cached = cached_render_targets_.begin();
+       cached != cached_render_targets_.end(); ++cached) {
+    if ((*cached)->GetWidth() == width && (*cached)->GetHeight() == height &&
+        (*cached)->GetNumLayers() == num_layers &&
+        (*cached)->GetColorFormats() == color_formats) {
+      *render_targets = std::move(*cached);
+      cached_render_targets_.erase(cached);
+      return tensorflow::Status::OK();
+    }
+  }
+  return gl_utils::RenderTargets::Create(width, height, num_layers,
+                                         color_formats, render_targets);
+}
+
+tensorflow::Status Rasterizer::ReleaseRenderTargets(
+    std::unique_ptr<gl_utils::RenderTargets> render_targets) {
+  cached_render_targets_.push_front(std::move(render_targets));
+  while (cached_render_targets_.size() > kMaxCachedRenderTargets) {
+    std::unique_ptr<gl_utils::RenderTargets>& evicted =
+        cached_render_targets_.back();
+    // Pending copies write into the result buffers of earlier renders.
+    TF_RETURN_IF_ERROR(evicted->FinishPendingCopies());
+    if (last_render_targets_ == evicted.get()) last_render_targets_ = nullptr;
+    cached_render_targets_.pop_back();
+  }
+  return tensorflow::Status::OK();
+}
+
 tensorflow::Status Rasterizer::SetUniformMatrix(
     const std::string& name, int num_columns, int num_rows, bool transpose,
     absl::Span<const float> matrix) {
   if (size_t(num_rows * num_columns) != matrix.size())
     return TFG_INTERNAL_ERROR("num_rows * num_columns != matrix.size()");
 
-  typedef void (*setter_fn)(GLint location, GLsizei count, GLboolean transpose,
-                            const GLfloat* value);
-
   static const auto type_mapping =
-      std::unordered_map<int, std::tuple<int, int, setter_fn>>({
+      std::unordered_map<int, std::tuple<int, int, UniformMatrixSetter>>({
           {GL_FLOAT_MAT2, std::make_tuple(2, 2, glUniformMatrix2fv)},
           {GL_FLOAT_MAT3, std::make_tuple(3, 3, glUniformMatrix3fv)},
           {GL_FLOAT_MAT4, std::make_tuple(4, 4, glUniformMatrix4fv)},
@@ -65,35 +309,20 @@ tensorflow::Status Rasterizer::SetUniformMatrix(
           {GL_FLOAT_MAT4x3, std::make_tuple(4, 3, glUniformMatrix4x3fv)},
       });
 
-  GLint uniform_type;
-  GLenum property = GL_TYPE;
-
-  TF_RETURN_IF_ERROR(program_->GetResourceProperty(
-      name, GL_UNIFORM, 1, &property, 1, &uniform_type));
-
   // Is a resource active under that name?
-  if (uniform_type == GLint(GL_INVALID_INDEX))
-    return TFG_INTERNAL_ERROR("GL_INVALID_INDEX");
+  const gl_utils::ProgramResource* uniform = program_->GetUniform(name);
+  if (uniform == nullptr) return TFG_INTERNAL_ERROR("GL_INVALID_INDEX");
 
-  auto type_info = type_mapping.find(uniform_type);
+  auto type_info = type_mapping.find(uniform->type);
   if (type_info == type_mapping.end())
     return TFG_INTERNAL_ERROR("Unsupported type");
   if (std::get<0>(type_info->second) != num_columns ||
       std::get<1>(type_info->second) != num_rows)
     return TFG_INTERNAL_ERROR("Invalid dimensions");
 
-  GLint uniform_location;
-  property = GL_LOCATION;
-  TF_RETURN_IF_ERROR(program_->GetResourceProperty(
-      name, GL_UNIFORM, 1, &property, 1, &uniform_location));
-
-  TF_RETURN_IF_ERROR(program_->Use());
-  auto program_cleanup = MakeCleanup([this]() { return program_->Detach(); });
-
-  // Specify the value of the uniform in the current program.
-  TFG_RETURN_IF_GL_ERROR(std::get<2>(type_info->second)(
-      uniform_location, 1, transpose ? GL_TRUE : GL_FALSE, matrix.data()));
-
-  // Cleanup the program; no program is active at this point.
+  // The value is specified in the program right before drawing.
+  uniform_matrices_[name] = UniformMatrix{
+      uniform->location, std::get<2>(type_info->second), transpose,
+      std::vector<float>(matrix.begin(), matrix.end())};
   return tensorflow::Status::OK();
 }
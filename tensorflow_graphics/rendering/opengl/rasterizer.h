@@ -15,6 +15,7 @@ limitations under the License.
 #ifndef THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_TESTS_RASTERIZER_H_
 #define THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_TESTS_RASTERIZER_H_
 
+#include <list>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -22,6 +23,7 @@ limitations under the License.
 #include "tensorflow_graphics/rendering/opengl/gl_program.h"
 #include "tensorflow_graphics/rendering/opengl/gl_render_targets.h"
 #include "tensorflow_graphics/rendering/opengl/gl_shader_storage_buffer.h"
+#include "tensorflow_graphics/rendering/opengl/gl_vertex_array.h"
 #include "tensorflow_graphics/util/cleanup.h"
 
 class RasterizerWithContext;
@@ -39,7 +41,8 @@ class Rasterizer {
   // * width: width of the render buffers.
   // * height: height of the render buffers.
   // * vertex_shader_source: source code of a GLSL vertex shader.
-  // * geometry_shader_source: source code of a GLSL geometry shader.
+  // * geometry_shader_source: source code of a GLSL geometry shader, or an
+  //   empty string for programs without geometry shader.
   // * fragment_shader_source: source code of a GLSL fragment shader.
   // * rasterizer: if the method succeeds, this variable returns an object
   //   storing a ready to use rasterizer.
@@ -60,7 +63,8 @@ class Rasterizer {
   // * width: width of the render buffers.
   // * height: height of the render buffers.
   // * vertex_shader_source: source code of a GLSL vertex shader.
-  // * geometry_shader_source: source code of a GLSL geometry shader.
+  // * geometry_shader_source: source code of a GLSL geometry shader, or an
+  //   empty string for programs without geometry shader.
   // * fragment_shader_source: source code of a GLSL fragment shader.
   // * clear_r: red component used when clearing the color buffers.
   // * clear_g: green component used when clearing the color buffers.
@@ -81,23 +85,296 @@ class Rasterizer {
                                    float clear_depth,
                                    std::unique_ptr<Rasterizer>* rasterizer);
 
+  // Creates a Rasterizer holding a valid OpenGL program and render buffers
+  // with one or more color attachments.
+  //
+  // Arguments:
+  // * width: width of the render buffers.
+  // * height: height of the render buffers.
+  // * vertex_shader_source: source code of a GLSL vertex shader.
+  // * geometry_shader_source: source code of a GLSL geometry shader, or an
+  //   empty string for programs without geometry shader.
+  // * fragment_shader_source: source code of a GLSL fragment shader.
+  // * color_formats: internal format of each color attachment. See the
+  //   documentation of RenderTargets::Create for the supported formats. The
+  //   fragment shader output with layout(location = i) is written to the i-th
+  //   attachment; Render reads back the first one.
+  // * clear_r: red component used when clearing the color buffers.
+  // * clear_g: green component used when clearing the color buffers.
+  // * clear_b: blue component used when clearing the color buffers.
+  // * clear_depth: depth value used when clearing the depth buffer
+  // * rasterizer: if the method succeeds, this variable returns an object
+  //   storing a ready to use rasterizer.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  static tensorflow::Status Create(const int width, const int height,
+                                   const std::string& vertex_shader_source,
+                                   const std::string& geometry_shader_source,
+                                   const std::string& fragment_shader_source,
+                                   const std::vector<GLenum>& color_formats,
+                                   float clear_r, float clear_g, float clear_b,
+                                   float clear_depth,
+                                   std::unique_ptr<Rasterizer>* rasterizer);
+
   // Rasterizes the scenes.
   //
   // Arguments:
-  // * num_points: the number of primitives to render.
+  // * num_points: the number of primitives to render; see SetDrawMode.
   // * result: if the method succeeds, a buffer that stores the rendering
   //   result. This buffer must be of size 4 * width * height, where the values
   //   of width and height must at least match those used in when calling Create.
+  //   See SetNumChannels to read fewer channels.
   //
   // Returns:
   //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
   //   and an object of type tensorflow::errors otherwise.
   virtual tensorflow::Status Render(int num_points, absl::Span<float> result);
+  virtual tensorflow::Status Render(int num_points,
+                                    absl::Span<Eigen::half> result);
   virtual tensorflow::Status Render(int num_points,
                                     absl::Span<unsigned char> result);
 
+  // Rasterizes a batch of scenes with a single draw call, each scene being
+  // rendered in its own layer of a layered render target.
+  //
+  // The primitives are drawn num_layers times using instanced rendering. The
+  // shaders are expected to use gl_InstanceID to fetch the data associated
+  // with the current batch element, and to route the emitted primitives to
+  // the matching layer by writing gl_Layer in the geometry shader. If the
+  // program declares an int uniform named num_layers, it is set to the number
+  // of layers before drawing.
+  //
+  // Arguments:
+  // * num_points: the number of primitives to render in each layer; see
+  //   SetDrawMode.
+  // * num_layers: the number of layers to render, which is typically the
+  //   number of elements in the batch.
+  // * result: if the method succeeds, a buffer that stores the rendering
+  //   result. This buffer must be of size 4 * width * height * num_layers, and
+  //   stores the layers one after the other. See SetNumChannels to read fewer
+  //   channels.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  virtual tensorflow::Status RenderLayered(int num_points, int num_layers,
+                                           absl::Span<float> result);
+  virtual tensorflow::Status RenderLayered(int num_points, int num_layers,
+                                           absl::Span<Eigen::half> result);
+  virtual tensorflow::Status RenderLayered(int num_points, int num_layers,
+                                           absl::Span<unsigned char> result);
+
+  // Reads a color attachment of the images rendered by the last call to
+  // Render or RenderLayered.
+  //
+  // Arguments:
+  // * attachment: index of the color attachment to read.
+  // * result: if the method succeeds, a buffer that stores the content of the
+  //   attachment. This buffer must be of size num_channels * width * height *
+  //   num_layers, where num_channels is the number of channels of the
+  //   attachment, and num_layers is one for images rendered by Render.
+  //   Integer attachments must be read into int buffers.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  virtual tensorflow::Status ReadColorAttachment(int attachment,
+                                                 absl::Span<float> result);
+  virtual tensorflow::Status ReadColorAttachment(
+      int attachment, absl::Span<Eigen::half> result);
+  virtual tensorflow::Status ReadColorAttachment(
+      int attachment, absl::Span<unsigned char> result);
+  virtual tensorflow::Status ReadColorAttachment(int attachment,
+                                                 absl::Span<int> result);
+
+  // Reads the depth buffer of the images rendered by the last call to Render
+  // or RenderLayered.
+  //
+  // Arguments:
+  // * result: if the method succeeds, a buffer that stores the window-space
+  //   depth of each pixel, in [0, 1]. This buffer must be of size width *
+  //   height * num_layers, where num_layers is one for images rendered by
+  //   Render.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  virtual tensorflow::Status ReadDepth(absl::Span<float> result);
+
+  // Checks that ReadDepth is supported by the context of the rasterizer; see
+  // gl_utils::RenderTargets::CheckDepthReadable.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  virtual tensorflow::Status CheckDepthReadable();
+
+  // Selects the size of the images rendered by subsequent calls to Render and
+  // RenderLayered, which is the one passed to Create by default.
+  //
+  // The render targets of the previous size are kept in a cache of up to
+  // kMaxCachedRenderTargets idle render targets, so that switching between a
+  // few sizes, e.g. in multi-scale training, does not re-create them. The
+  // least recently used ones are destroyed when the cache is full.
+  //
+  // Arguments:
+  // * width: width of the render buffers.
+  // * height: height of the render buffers.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  virtual tensorflow::Status SetResolution(int width, int height);
+
+  // Selects the number of channels of the images read back by Render and
+  // RenderLayered, which is four by default. The first num_channels channels
+  // of the first color attachment are read, and the size of their result
+  // buffer must be num_channels * width * height * num_layers.
+  //
+  // Arguments:
+  // * num_channels: the number of channels to read, between 1 and 4.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  tensorflow::Status SetNumChannels(int num_channels);
+
+  // Selects whether only the depth buffer is rendered.
+  //
+  // In depth-only mode, writes to the color attachments are disabled, and
+  // Render and RenderLayered do not read back any color; their result buffer
+  // must then be empty, and depth is read with ReadDepth.
+  //
+  // Arguments:
+  // * depth_only: whether to only render the depth buffer.
+  void SetDepthOnly(bool depth_only);
+
+  // Selects how rendered images are read back.
+  //
+  // With synchronous readback, the default, Render and RenderLayered wait for
+  // the rendering to complete and return with the pixels written to result.
+  // With pipelined readback, they return as soon as the readback is queued in
+  // a pixel buffer object, so that the next image is rendered while the
+  // current one is copied. The pixels of an image are only guaranteed to be in
+  // result after FinishPendingRenders is called, and result must remain valid
+  // until then.
+  //
+  // Arguments:
+  // * pipelined_readback: whether to use pipelined readback.
+  void SetPipelinedReadback(bool pipelined_readback);
+
+  // Selects how data is uploaded to the shader storage buffers created by
+  // subsequent calls to SetShaderStorageBuffer.
+  //
+  // By default, uploads reuse the data store of a buffer when the data fits in
+  // it. With persistent uploads, buffers are persistently mapped rings of
+  // kNumShaderStorageBufferSegments segments, so that uploads do not wait for
+  // the draw calls reading previous uploads, which is useful with pipelined
+  // readback. Buffers fall back to the default when persistent mapping is not
+  // supported.
+  //
+  // Arguments:
+  // * persistent_uploads: whether to use persistent uploads.
+  void SetPersistentUploads(bool persistent_uploads);
+
+  // Selects how SetShaderStorageBuffer, SetVertexAttribute, and SetIndexBuffer
+  // detect data identical to the one last uploaded.
+  //
+  // By default, data is identified by its address, its size, and a hash of 64
+  // evenly spaced chunks of 64 bytes, which costs the same for any size of
+  // data. Changes that fall between the
+  // chunks of data kept at the same address then go unnoticed. With full
+  // upload hashing, the whole data is hashed instead, which detects any change
+  // and identical data at another address, but reads all of the data on every
+  // call.
+  //
+  // Arguments:
+  // * full_upload_hashing: whether to hash the whole data.
+  void SetFullUploadHashing(bool full_upload_hashing);
+
+  // Primitives drawn by Render and RenderLayered.
+  enum class DrawMode {
+    // num_points points, the default, which are typically expanded into
+    // triangles by a geometry shader fetching them from storage buffers.
+    kPoints,
+    // num_points triangles made of consecutive vertices.
+    kTriangles,
+    // num_points triangles made of the vertices indexed by SetIndexBuffer.
+    kIndexedTriangles,
+  };
+
+  // Selects the primitives drawn by Render and RenderLayered.
+  //
+  // In the triangle modes, the vertices are fed to the vertex shader through
+  // the vertex attributes set by SetVertexAttribute, or fetched by the shader
+  // itself using gl_VertexID, which spares the program a geometry shader.
+  //
+  // Arguments:
+  // * draw_mode: the primitives to draw.
+  void SetDrawMode(DrawMode draw_mode);
+
+  // Uploads the values of a vertex attribute of the program, which must be of
+  // type float, vec2, vec3, or vec4. As for SetShaderStorageBuffer, unchanged
+  // values are not uploaded again.
+  //
+  // Arguments:
+  // * name: name of the vertex attribute.
+  // * data: the values of the attribute, one to four per vertex depending on
+  //   its type.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  virtual tensorflow::Status SetVertexAttribute(const std::string& name,
+                                                absl::Span<const float> data);
+
+  // Uploads the indices of the vertices of the triangles drawn in the
+  // DrawMode::kIndexedTriangles mode, three per triangle. As for
+  // SetShaderStorageBuffer, unchanged indices are not uploaded again.
+  //
+  // Arguments:
+  // * indices: the indices of the vertices.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  virtual tensorflow::Status SetIndexBuffer(absl::Span<const int> indices);
+
+  // Returns the number of bytes whose upload was skipped by
+  // SetShaderStorageBuffer, SetVertexAttribute, and SetIndexBuffer because
+  // they were already uploaded.
+  int64_t GetSkippedUploadBytes() const { return skipped_upload_bytes_; }
+
+  // Selects the batch element rendered by the subsequent calls to Render.
+  //
+  // This lets the variables of several batch elements be uploaded at once to
+  // shader storage buffers, the shaders fetching the data of the current
+  // element from them. If the program declares int uniforms named
+  // element_index and num_elements, they are set to the matching arguments
+  // before drawing.
+  //
+  // Arguments:
+  // * element_index: index of the element to render, between 0 and
+  //   num_elements - 1.
+  // * num_elements: the number of batch elements stored in the buffers.
+  void SetBatchElement(int element_index, int num_elements);
+
+  // Waits for the images rendered with pipelined readback to be copied into
+  // the result buffers passed to Render or RenderLayered.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  virtual tensorflow::Status FinishPendingRenders();
+
   // Uploads data to a shader storage buffer.
   //
+  // The upload is skipped when the data is identical to the one last uploaded
+  // to the buffer, as detected by SetFullUploadHashing; see
+  // GetSkippedUploadBytes.
+  //
   // Arguments:
   // * name: name of the shader storage buffer.
   // * data: data to upload to the shader storage buffer.
@@ -109,8 +386,27 @@ class Rasterizer {
   tensorflow::Status SetShaderStorageBuffer(const std::string& name,
                                             absl::Span<const T> data);
 
+  // Uses an existing buffer as a shader storage buffer.
+  //
+  // The buffer may have been created and filled in another context of the
+  // share group of the current one (see EGLOffscreenContext::CreateShared), so
+  // that read-only data is stored once for all the contexts. It is not modified
+  // by the rasterizer: a later call to SetShaderStorageBuffer uploading data
+  // under the same name replaces it with a buffer of the rasterizer's own.
+  //
+  // Arguments:
+  // * name: name of the shader storage buffer.
+  // * shader_storage_buffer: the buffer, which must be destroyed while a
+  //   context of its share group is current.
+  void SetShaderStorageBuffer(
+      const std::string& name,
+      std::shared_ptr<gl_utils::ShaderStorageBuffer> shader_storage_buffer);
+
   // Specifies the value of a uniform matrix.
   //
+  // The value is applied to the program by the subsequent calls to Render and
+  // RenderLayered.
+  //
   // Note: The input matrix is expected to be in column-major format. Both glm
   //       and OpenGL store matrices in column major format.
   //
@@ -130,6 +426,43 @@ class Rasterizer {
                                               absl::Span<const float> matrix);
 
  private:
+  typedef void (*UniformMatrixSetter)(GLint location, GLsizei count,
+                                      GLboolean transpose,
+                                      const GLfloat* value);
+  // Value of a uniform matrix set by SetUniformMatrix.
+  struct UniformMatrix {
+    GLint location;
+    UniformMatrixSetter setter;
+    bool transpose;
+    std::vector<float> value;
+  };
+
+  // Address, size and hash of the data last uploaded to a buffer, if known.
+  struct UploadFingerprint {
+    bool known;
+    const void* data;
+    size_t size;
+    uint64_t hash;
+  };
+
+  // Number and size in bytes of the chunks hashed by default to fingerprint
+  // uploaded data; see SetFullUploadHashing.
+  static constexpr size_t kNumHashedChunks = 64;
+  static constexpr size_t kHashedChunkSize = 64;
+
+  // Returns whether data of the given size in bytes matches fingerprint, and
+  // updates fingerprint to the data otherwise. Matching data is counted as
+  // skipped.
+  bool IsUploaded(const void* data, size_t size,
+                  UploadFingerprint* fingerprint);
+
+  // Number of uploads to a shader storage buffer that can be in use by pending
+  // draw calls with persistent uploads.
+  static constexpr int kNumShaderStorageBufferSegments = 3;
+  // Maximum number of idle render targets kept for later use; see
+  // SetResolution.
+  static constexpr int kMaxCachedRenderTargets = 8;
+
   Rasterizer() = delete;
   Rasterizer(std::unique_ptr<gl_utils::Program>&& program,
              std::unique_ptr<gl_utils::RenderTargets>&& render_targets,
@@ -140,14 +473,60 @@ class Rasterizer {
   Rasterizer& operator=(Rasterizer&&) = delete;
   template <typename T>
   tensorflow::Status RenderImpl(int num_points, absl::Span<T> result);
+  template <typename T>
+  tensorflow::Status RenderLayeredImpl(int num_points, int num_layers,
+                                       absl::Span<T> result);
+  template <typename T>
+  tensorflow::Status ReadColorAttachmentImpl(int attachment,
+                                             absl::Span<T> result);
+  template <typename T>
+  tensorflow::Status DrawAndReadPixels(gl_utils::RenderTargets* render_targets,
+                                       int num_points, int num_instances,
+                                       absl::Span<T> result);
   void Reset();
+  // Takes render targets of the given size and number of layers from the
+  // cache, or creates them if there are none. Their color formats are those of
+  // render_targets_.
+  tensorflow::Status AcquireRenderTargets(
+      int width, int height, int num_layers,
+      std::unique_ptr<gl_utils::RenderTargets>* render_targets);
+  // Stores render targets that are not used anymore in the cache.
+  tensorflow::Status ReleaseRenderTargets(
+      std::unique_ptr<gl_utils::RenderTargets> render_targets);
 
   std::unique_ptr<gl_utils::Program> program_;
   std::unique_ptr<gl_utils::RenderTargets> render_targets_;
+  // Created on the first call to RenderLayered, and replaced whenever the
+  // number of layers or the size of the images changes.
+  std::unique_ptr<gl_utils::RenderTargets> layered_render_targets_;
+  // Idle render targets, from the most to the least recently used.
+  std::list<std::unique_ptr<gl_utils::RenderTargets>> cached_render_targets_;
+  // Render targets drawn to by the last call to Render or RenderLayered.
+  gl_utils::RenderTargets* last_render_targets_;
   std::unordered_map<std::string,
-                     std::unique_ptr<gl_utils::ShaderStorageBuffer>>
+                     std::shared_ptr<gl_utils::ShaderStorageBuffer>>
       shader_storage_buffers_;
+  std::unordered_map<std::string, UniformMatrix> uniform_matrices_;
+  // Created by the first call to SetVertexAttribute or SetIndexBuffer.
+  std::unique_ptr<gl_utils::VertexArray> vertex_array_;
+  // Fingerprints of the data in the buffers, keyed by the names of the
+  // buffers or vertex attributes. They are reset whenever the content of a
+  // buffer is unknown, e.g. after a failed upload.
+  std::unordered_map<std::string, UploadFingerprint>
+      shader_storage_buffer_fingerprints_;
+  std::unordered_map<std::string, UploadFingerprint>
+      vertex_attribute_fingerprints_;
+  UploadFingerprint index_buffer_fingerprint_;
+  int64_t skipped_upload_bytes_;
   float clear_r_, clear_g_, clear_b_, clear_depth_;
+  bool pipelined_readback_;
+  bool persistent_uploads_;
+  bool full_upload_hashing_;
+  bool depth_only_;
+  int num_channels_;
+  int element_index_;
+  int num_elements_;
+  DrawMode draw_mode_;
 
   friend class RasterizerWithContext;
 };
@@ -174,8 +553,9 @@ tensorflow::Status Rasterizer::Create(const int width, const int height,
   std::unique_ptr<gl_utils::RenderTargets> render_targets;
   std::vector<std::pair<std::string, GLenum>> shaders = {
       {vertex_shader_source, GL_VERTEX_SHADER},
-      {geometry_shader_source, GL_GEOMETRY_SHADER},
       {fragment_shader_source, GL_FRAGMENT_SHADER}};
+  if (!geometry_shader_source.empty())
+    shaders.push_back({geometry_shader_source, GL_GEOMETRY_SHADER});
 
   TF_RETURN_IF_ERROR(gl_utils::Program::Create(shaders, &program));
   TF_RETURN_IF_ERROR(
@@ -187,45 +567,161 @@ tensorflow::Status Rasterizer::Create(const int width, const int height,
   return tensorflow::Status::OK();
 }
 
+inline tensorflow::Status Rasterizer::Create(
+    const int width, const int height, const std::string& vertex_shader_source,
+    const std::string& geometry_shader_source,
+    const std::string& fragment_shader_source,
+    const std::vector<GLenum>& color_formats, float clear_r, float clear_g,
+    float clear_b, float clear_depth, std::unique_ptr<Rasterizer>* rasterizer) {
+  std::unique_ptr<gl_utils::Program> program;
+  std::unique_ptr<gl_utils::RenderTargets> render_targets;
+  std::vector<std::pair<std::string, GLenum>> shaders = {
+      {vertex_shader_source, GL_VERTEX_SHADER},
+      {fragment_shader_source, GL_FRAGMENT_SHADER}};
+  if (!geometry_shader_source.empty())
+    shaders.push_back({geometry_shader_source, GL_GEOMETRY_SHADER});
+
+  TF_RETURN_IF_ERROR(gl_utils::Program::Create(shaders, &program));
+  TF_RETURN_IF_ERROR(gl_utils::RenderTargets::Create(
+      width, height, 1, color_formats, &render_targets));
+
+  *rasterizer = std::unique_ptr<Rasterizer>(
+      new Rasterizer(std::move(program), std::move(render_targets), clear_r,
+                     clear_g, clear_b, clear_depth));
+  return tensorflow::Status::OK();
+}
+
 template <typename T>
 tensorflow::Status Rasterizer::RenderImpl(int num_points,
                                           absl::Span<T> result) {
-  const GLenum kProperty = GL_BUFFER_BINDING;
+  return DrawAndReadPixels(render_targets_.get(), num_points, 1, result);
+}
+
+template <typename T>
+tensorflow::Status Rasterizer::RenderLayeredImpl(int num_points,
+                                                 int num_layers,
+                                                 absl::Span<T> result) {
+  if (num_layers < 1) return TFG_INTERNAL_ERROR("num_layers < 1");
 
+  if (layered_render_targets_ == nullptr ||
+      layered_render_targets_->GetNumLayers() != num_layers ||
+      layered_render_targets_->GetWidth() != render_targets_->GetWidth() ||
+      layered_render_targets_->GetHeight() != render_targets_->GetHeight()) {
+    if (layered_render_targets_ != nullptr)
+      TF_RETURN_IF_ERROR(
+          ReleaseRenderTargets(std::move(layered_render_targets_)));
+    TF_RETURN_IF_ERROR(AcquireRenderTargets(
+        render_targets_->GetWidth(), render_targets_->GetHeight(), num_layers,
+        &layered_render_targets_));
+  }
+  return DrawAndReadPixels(layered_render_targets_.get(), num_points,
+                           num_layers, result);
+}
+
+template <typename T>
+tensorflow::Status Rasterizer::ReadColorAttachmentImpl(int attachment,
+                                                       absl::Span<T> result) {
+  if (last_render_targets_ == nullptr)
+    return TFG_INTERNAL_ERROR("Nothing was rendered");
+
+  TF_RETURN_IF_ERROR(last_render_targets_->BindFramebuffer());
+  auto framebuffer_cleanup = MakeCleanup(
+      [this]() { return last_render_targets_->UnbindFrameBuffer(); });
+  if (pipelined_readback_) {
+    TF_RETURN_IF_ERROR(
+        last_render_targets_->CopyColorAttachmentPixelsIntoAsync(attachment,
+                                                                 result));
+  } else {
+    TF_RETURN_IF_ERROR(last_render_targets_->CopyColorAttachmentPixelsInto(
+        attachment, result));
+  }
+  return tensorflow::Status::OK();
+}
+
+template <typename T>
+tensorflow::Status Rasterizer::DrawAndReadPixels(
+    gl_utils::RenderTargets* render_targets, int num_points, int num_instances,
+    absl::Span<T> result) {
   TFG_RETURN_IF_GL_ERROR(glDisable(GL_BLEND));
   TFG_RETURN_IF_GL_ERROR(glEnable(GL_DEPTH_TEST));
   TFG_RETURN_IF_GL_ERROR(glDisable(GL_CULL_FACE));
 
   // Bind storage buffer to shader names
   for (const auto& buffer : shader_storage_buffers_) {
-    const std::string& name = buffer.first;
-    GLint slot;
-    if (program_->GetResourceProperty(name, GL_SHADER_STORAGE_BLOCK, 1,
-                                      &kProperty, 1,
-                                      &slot) != tensorflow::Status::OK())
-      // Buffer not found in program, so do nothing.
-      continue;
-    TF_RETURN_IF_ERROR(buffer.second->BindBufferBase(slot));
+    const gl_utils::ProgramResource* block =
+        program_->GetShaderStorageBlock(buffer.first);
+    // Buffer not found in program, so do nothing.
+    if (block == nullptr) continue;
+    TF_RETURN_IF_ERROR(buffer.second->BindBufferBase(block->binding));
   }
 
-  // Bind the program after the last call to SetUniform, since
-  // SetUniform binds program 0.
+  TF_RETURN_IF_ERROR(render_targets->BindFramebuffer());
+  auto framebuffer_cleanup = MakeCleanup(
+      [render_targets]() { return render_targets->UnbindFrameBuffer(); });
+
+  TFG_RETURN_IF_GL_ERROR(glViewport(0, 0, render_targets->GetWidth(),
+                                    render_targets->GetHeight()));
+  TF_RETURN_IF_ERROR(
+      render_targets->Clear(clear_r_, clear_g_, clear_b_, 1.0, clear_depth_));
+  if (depth_only_) {
+    if (!result.empty())
+      return TFG_INTERNAL_ERROR("result must be empty in depth-only mode");
+    TFG_RETURN_IF_GL_ERROR(glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE));
+  }
+  auto color_mask_cleanup = MakeCleanup(
+      []() { glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE); });
+
+  if (vertex_array_ != nullptr) TF_RETURN_IF_ERROR(vertex_array_->Bind());
+  auto vertex_array_cleanup = MakeCleanup([]() { glBindVertexArray(0); });
+
   TF_RETURN_IF_ERROR(program_->Use());
   auto program_cleanup = MakeCleanup([this]() { return program_->Detach(); });
 
-  TF_RETURN_IF_ERROR(render_targets_->BindFramebuffer());
-  auto framebuffer_cleanup =
-      MakeCleanup([this]() { return render_targets_->UnbindFrameBuffer(); });
+  for (const auto& uniform : uniform_matrices_) {
+    const UniformMatrix& matrix = uniform.second;
+    TFG_RETURN_IF_GL_ERROR(matrix.setter(matrix.location, 1,
+                                         matrix.transpose ? GL_TRUE : GL_FALSE,
+                                         matrix.value.data()));
+  }
+  auto set_uniform = [this](const std::string& name,
+                            int value) -> tensorflow::Status {
+    const gl_utils::ProgramResource* uniform = program_->GetUniform(name);
+    // The shaders do not ask for this value.
+    if (uniform == nullptr) return tensorflow::Status::OK();
+    TFG_RETURN_IF_GL_ERROR(glUniform1i(uniform->location, value));
+    return tensorflow::Status::OK();
+  };
 
-  TFG_RETURN_IF_GL_ERROR(glViewport(0, 0, render_targets_->GetWidth(),
-                                    render_targets_->GetHeight()));
-  TFG_RETURN_IF_GL_ERROR(glClearColor(clear_r_, clear_g_, clear_b_, 1.0));
-  TFG_RETURN_IF_GL_ERROR(glClearDepthf(clear_depth_));
-  TFG_RETURN_IF_GL_ERROR(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+  // Let the shaders know how many layers are rendered, if they ask for it.
+  TF_RETURN_IF_ERROR(set_uniform("num_layers", num_instances));
+  // Same for the batch element selected by SetBatchElement.
+  TF_RETURN_IF_ERROR(set_uniform("element_index", element_index_));
+  TF_RETURN_IF_ERROR(set_uniform("num_elements", num_elements_));
 
-  TFG_RETURN_IF_GL_ERROR(glDrawArrays(GL_POINTS, 0, num_points));
+  const GLenum mode =
+      draw_mode_ == DrawMode::kPoints ? GL_POINTS : GL_TRIANGLES;
+  const GLsizei count =
+      draw_mode_ == DrawMode::kPoints ? num_points : 3 * num_points;
+  if (draw_mode_ == DrawMode::kIndexedTriangles) {
+    if (vertex_array_ == nullptr || !vertex_array_->HasIndices())
+      return TFG_INTERNAL_ERROR("The index buffer is not set");
+    TFG_RETURN_IF_GL_ERROR(glDrawElementsInstanced(
+        mode, count, GL_UNSIGNED_INT, nullptr, num_instances));
+  } else if (num_instances == 1) {
+    TFG_RETURN_IF_GL_ERROR(glDrawArrays(mode, 0, count));
+  } else {
+    TFG_RETURN_IF_GL_ERROR(
+        glDrawArraysInstanced(mode, 0, count, num_instances));
+  }
 
-  TF_RETURN_IF_ERROR(render_targets_->CopyPixelsInto(result));
+  last_render_targets_ = render_targets;
+  if (depth_only_) return tensorflow::Status::OK();
+  if (pipelined_readback_) {
+    TF_RETURN_IF_ERROR(
+        render_targets->CopyPixelsIntoAsync(result, num_channels_));
+  } else {
+    TF_RETURN_IF_ERROR(render_targets->CopyPixelsInto(result, num_channels_));
+  }
 
   // The program and framebuffer and released here.
   return tensorflow::Status::OK();
@@ -234,16 +730,33 @@ tensorflow::Status Rasterizer::RenderImpl(int num_points,
 template <typename T>
 tensorflow::Status Rasterizer::SetShaderStorageBuffer(
     const std::string& name, absl::Span<const T> data) {
-  // If the buffer does not exist, create it.
-  if (shader_storage_buffers_.count(name) == 0) {
+  // If the buffer does not exist, or is also referenced outside of the
+  // rasterizer, create it.
+  auto buffer = shader_storage_buffers_.find(name);
+  UploadFingerprint& fingerprint = shader_storage_buffer_fingerprints_[name];
+  if (buffer == shader_storage_buffers_.end() ||
+      buffer->second.use_count() > 1) {
+    fingerprint = UploadFingerprint{false, nullptr, 0, 0};
     std::unique_ptr<gl_utils::ShaderStorageBuffer> shader_storage_buffer;
-    TF_RETURN_IF_ERROR(
-        gl_utils::ShaderStorageBuffer::Create(&shader_storage_buffer));
+    if (!persistent_uploads_ ||
+        gl_utils::ShaderStorageBuffer::CreatePersistent(
+            kNumShaderStorageBufferSegments, &shader_storage_buffer) !=
+            tensorflow::Status::OK())
+      TF_RETURN_IF_ERROR(
+          gl_utils::ShaderStorageBuffer::Create(&shader_storage_buffer));
     // Insert the buffer in the storage.
     shader_storage_buffers_[name] = std::move(shader_storage_buffer);
   }
-  // Upload the data to the shader storage buffer.
+  if (IsUploaded(data.data(), data.size() * sizeof(T), &fingerprint))
+    return tensorflow::Status::OK();
+  // Upload the data to the shader storage buffer, whose content is unknown if
+  // that fails.
+  auto fingerprint_cleanup = MakeCleanup(
+      [&fingerprint]() {
+        fingerprint = UploadFingerprint{false, nullptr, 0, 0};
+      });
   TF_RETURN_IF_ERROR(shader_storage_buffers_.at(name)->Upload(data));
+  fingerprint_cleanup.release();
 
   return tensorflow::Status::OK();
 }
@@ -12,9 +12,16 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
+#include <algorithm>
+#include <map>
 #include <memory>
+#include <utility>
+#include <vector>
 
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 #include "absl/types/span.h"
+#include "tensorflow_graphics/rendering/opengl/egl_device_selector.h"
 #include "tensorflow_graphics/rendering/opengl/macros.h"
 #include "tensorflow_graphics/rendering/opengl/rasterizer_with_context.h"
 #include "tensorflow_graphics/rendering/opengl/thread_safe_resource_pool.h"
@@ -23,8 +30,10 @@ limitations under the License.
 #include "tensorflow/core/framework/shape_inference.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/types.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/util/work_sharder.h"
 
 static tensorflow::Status GetVariablesRank(
     ::tensorflow::shape_inference::InferenceContext* c, int32* rank) {
@@ -52,7 +61,7 @@ static tensorflow::Status GetVariablesRank(
             "Matrix with name='", variable_names[index],
             "' has an invalid rank of ", batch_rank);
       batch_rank -= 2;
-    } else if (kind == "buffer") {
+    } else {
       if (batch_rank < 1)
         return tensorflow::errors::InvalidArgument(
             "Buffer with name='", variable_names[index],
@@ -70,8 +79,56 @@ static tensorflow::Status GetVariablesRank(
   return tensorflow::Status::OK();
 }
 
+// Returns the internal format of a color attachment storing num_channels
+// channels of the given type.
+static tensorflow::Status GetAttachmentFormat(tensorflow::DataType type,
+                                              int num_channels,
+                                              GLenum* format) {
+  static const auto* kFormats =
+      new std::map<std::pair<tensorflow::DataType, int>, GLenum>({
+          {{tensorflow::DT_FLOAT, 1}, GL_R32F},
+          {{tensorflow::DT_FLOAT, 2}, GL_RG32F},
+          {{tensorflow::DT_FLOAT, 4}, GL_RGBA32F},
+          {{tensorflow::DT_HALF, 1}, GL_R16F},
+          {{tensorflow::DT_HALF, 2}, GL_RG16F},
+          {{tensorflow::DT_HALF, 4}, GL_RGBA16F},
+          {{tensorflow::DT_UINT8, 1}, GL_R8},
+          {{tensorflow::DT_UINT8, 2}, GL_RG8},
+          {{tensorflow::DT_UINT8, 4}, GL_RGBA8},
+          {{tensorflow::DT_INT32, 1}, GL_R32I},
+          {{tensorflow::DT_INT32, 2}, GL_RG32I},
+          {{tensorflow::DT_INT32, 4}, GL_RGBA32I},
+      });
+
+  auto format_iterator = kFormats->find({type, num_channels});
+  if (format_iterator == kFormats->end())
+    return tensorflow::errors::InvalidArgument(
+        "Unsupported attachment with type=", tensorflow::DataTypeString(type),
+        " and ", num_channels, " channels; the number of channels must be 1, "
+        "2, or 4.");
+  *format = format_iterator->second;
+  return tensorflow::Status::OK();
+}
+
+static tensorflow::Status GetAttachmentFormats(
+    const tensorflow::DataTypeVector& attachment_types,
+    const std::vector<int>& attachment_channels,
+    std::vector<GLenum>* formats) {
+  if (attachment_types.size() != attachment_channels.size())
+    return tensorflow::errors::InvalidArgument(
+        "The attachment types and channels must have the same size.");
+
+  formats->clear();
+  for (int index = 0; index < attachment_types.size(); ++index) {
+    GLenum format;
+    TF_RETURN_IF_ERROR(GetAttachmentFormat(
+        attachment_types[index], attachment_channels[index], &format));
+    formats->push_back(format);
+  }
+  return tensorflow::Status::OK();
+}
+
 REGISTER_OP("Rasterize")
-    .Attr("output_resolution: shape")
     .Attr("red_clear: float = 0.0")
     .Attr("green_clear: float = 0.0")
     .Attr("blue_clear: float = 0.0")
@@ -80,11 +137,33 @@ REGISTER_OP("Rasterize")
     .Attr("fragment_shader: string")
     .Attr("geometry_shader: string")
     .Attr("variable_names: list(string)")
-    .Attr("variable_kinds: list({'mat', 'buffer'})")
-    .Attr("T: list({float})")
+    .Attr(
+        "variable_kinds: list({'mat', 'buffer', 'index_buffer', "
+        "'vertex_buffer'})")
+    .Attr("layered_batch: bool = false")
+    .Attr("batch_upload: bool = false")
+    .Attr("draw_mode: {'points', 'triangles', 'indexed_triangles'} = 'points'")
+    .Attr("pipelined_readback: bool = false")
+    .Attr("parallelism: int >= 1 = 1")
+    .Attr("max_contexts: int >= 0 = 0")
+    .Attr("acquire_timeout: float = 0.0")
+    .Attr("attachment_types: list({float, half, uint8, int32}) >= 0 = []")
+    .Attr("attachment_channels: list(int) = []")
+    .Attr("output_depth: bool = false")
+    .Attr("depth_only: bool = false")
+    .Attr("output_dtype: {float, half, uint8} = DT_FLOAT")
+    .Attr("num_channels: int >= 1 = 4")
+    .Attr("program_cache_directory: string = ''")
+    .Attr("shared_contexts: bool = false")
+    .Attr("device_policy: {'pinned', 'round_robin', 'least_loaded'} = 'pinned'")
+    .Attr("device_index: int >= 0 = 0")
+    .Attr("T: list({float, int32})")
     .Input("num_points: int32")
+    .Input("output_resolution: int32")
     .Input("variable_values: T")
-    .Output("rendered_image: float")
+    .Output("rendered_image: output_dtype")
+    .Output("depth: float")
+    .Output("attachments: attachment_types")
     .Doc(R"doc(
 Rasterization OP that runs the program specified by the supplied vertex,
 geometry and fragment shaders. Uniform variables and buffers can be passed to
@@ -92,49 +171,204 @@ the program using variable_names, variable_kinds, and variable_values.
 
 Note that in the following, A1 to An are optional batch dimensions.
 
-output_resolution: a 2D shape containing the width and height of the resulting
-  image.
 red_clear: the red component for glClear.
 green_clear: the green component for glClear.
 blue_clear: the blue component for glClear.
 depth_clear: the depth value for glClearDepthf.
 vertex_shader: A string containing a valid vertex shader.
 fragment_shader: A string containing a valid fragment shader.
-geometry_shader: A string containing a valid geometry shader.
+geometry_shader: A string containing a valid geometry shader, or an empty string
+  if the program does not have a geometry shader.
 variable_names: A list of strings describing the name of each variable passed
   to the shaders. These names must map to the name of uniforms or buffers in
   the supplied shaders.
 variable_kinds: A list of strings containing the type of each variable.
-  Possible values for each element are `mat` and `buffer`.
-num_points: The number of points to be rendered. When rasterizing a mesh, this
-  number should be set to the number of vertices in the mesh.
+  Possible values for each element are `mat`, `buffer`, `index_buffer`, and
+  `vertex_buffer`. Index buffers are uploaded to shader storage blocks of ints,
+  which lets the shaders fetch the vertices of indexed meshes from a vertex
+  buffer instead of receiving one copy of each vertex per triangle; with the
+  `indexed_triangles` draw mode, the index buffer provides the indices of the
+  drawn vertices instead. Vertex buffers are uploaded to the vertex attribute
+  of the vertex shader with the same name, which must be of type float, vec2,
+  vec3, or vec4.
+layered_batch: If true, the elements of the batch are rendered with a single
+  instanced draw call into the layers of a layered frame buffer, and are read
+  back once that draw call is over. In that mode, each variable is uploaded to
+  a single shader storage block storing the values of all the batch elements
+  one after the other, matrices being stored in row-major format. The shaders
+  must then use gl_InstanceID to identify the current batch element, and the
+  geometry shader must write it to gl_Layer. An int uniform named `num_layers`
+  receives the number of batch elements rendered by the draw call if the
+  program declares it.
+batch_upload: If true, the elements of the batch are rendered with one draw
+  call each as by default, but each variable is uploaded once for all of them,
+  to a shader storage block stored as with `layered_batch`. The shaders must
+  then fetch the values of the current batch element, whose index is stored in
+  an int uniform named `element_index`; an int uniform named `num_elements`
+  receives the number of batch elements in the block if the program declares
+  it. Ignored if `layered_batch` is set.
+draw_mode: The primitives drawn for each batch element. With `points`,
+  `num_points` points are drawn, and are typically expanded into triangles by
+  the geometry shader. With `triangles`, `num_points` triangles are made of
+  consecutive vertices, and with `indexed_triangles`, of the vertices indexed
+  by the only index buffer variable. The vertex shader then receives the
+  vertex buffer variables as vertex attributes, or fetches the vertices itself
+  using gl_VertexID, so that the program does not need a geometry shader.
+  Vertex buffers and indexed triangles are not supported with `layered_batch`
+  and `batch_upload`.
+pipelined_readback: If true, rendered images are read back asynchronously
+  through pixel buffer objects, so that the next batch element is rendered
+  while the previous one is copied into the output. Buffers are then uploaded
+  through persistently mapped rings when supported.
+parallelism: The maximum number of rasterizers, each with its own OpenGL
+  context, rendering disjoint slices of the batch concurrently on the
+  intra-op thread pool.
+max_contexts: The maximum number of rasterizers, and hence of OpenGL contexts,
+  alive at once for the op, or 0 for no limit. Shards that would exceed it wait
+  for a rasterizer to be released by another shard or a concurrent execution
+  of the op. The `parallelism` rasterizers used by the first execution are
+  created when the op is, within that limit.
+acquire_timeout: How long, in seconds, a shard waits for a rasterizer when
+  `max_contexts` are alive before the op fails, or 0 to wait indefinitely.
+attachment_types: The type of each additional color attachment rendered
+  alongside `rendered_image`. The i-th attachment receives the fragment shader
+  output declared with `layout(location = i + 1)`. `int32` attachments store
+  exact integers, such as triangle indices, and must be written by fragment
+  shader outputs of type int, ivec2, or ivec4. They are cleared with the clear
+  color converted to integers.
+attachment_channels: The number of channels of each additional color
+  attachment, which must be 1, 2, or 4.
+output_depth: If true, the content of the depth buffer is returned in `depth`.
+depth_only: If true, only the depth buffer is rendered and read back, color
+  writes being disabled; `output_depth` is then implied, `rendered_image` has
+  no channel, and there must not be any additional color attachment.
+output_dtype: The type of `rendered_image`, which is rendered into a color
+  attachment of the matching precision. With `uint8`, the fragment shader
+  outputs are clamped to [0, 1] and scaled to [0, 255].
+num_channels: The number of channels of `rendered_image`, between 1 and 4.
+  Only the first `num_channels` channels of the fragment shader output are
+  stored and read back, which saves memory and transfers when the shader
+  produces fewer than 4 values per pixel.
+program_cache_directory: An existing directory in which the binaries of the
+  linked shader programs are cached, so that rasterizers created later, even by
+  other processes, skip compiling and linking the shaders. Binaries are keyed
+  by the shader sources and the OpenGL driver, and the shaders are compiled
+  whenever no matching binary is accepted by the driver. The cache is disabled
+  if empty.
+shared_contexts: If true, the OpenGL contexts of the rasterizers of the op
+  belong to a single share group, so that the shader program is only compiled
+  and linked once for all of them; each rasterizer loads its own copy of the
+  linked binary. Rasterize ops with the same shaders then also share it.
+device_policy: How the EGL device of each new rasterizer is selected among
+  those usable by the process. With `pinned`, all the rasterizers render on the
+  device at `device_index`. With `round_robin`, the devices are selected in
+  turn, starting at `device_index`, so that the shards of a batch render on
+  different devices. With `least_loaded`, the device with the fewest OpenGL
+  contexts alive in the process is selected, which also accounts for the
+  rasterizers of the other ops.
+device_index: The index of the EGL device used by the `pinned` policy, and of
+  the first device selected by `round_robin`.
+output_resolution: A tensor of shape `[2]` containing the width and height of
+  the resulting image. The render targets of each size are kept by the
+  rasterizers of the op, so that alternating between a few sizes does not
+  re-create them, nor the contexts and programs of the rasterizers.
+num_points: The number of primitives to be rendered, as set by `draw_mode`,
+  either as a scalar applying to every batch element, or as a tensor of shape
+  `[A1, ..., An]` holding the number of primitives of each batch element, so
+  that batches of meshes of different sizes do not render padding primitives.
+  With `layered_batch`, each draw call renders the largest number of primitives
+  of its batch elements, and the shaders must discard the extra ones.
 variable_values: A list containing matrices of shape `[A1, ..., An, W, H]`
   and/or buffers of shape `[A1, ..., An, S]`, with `W` and `H` in `[1,4]` and S of
   arbitrary value. Using their associated name and kind, these values are
   mapped to the corresponding uniform or buffer in the program. Note that all
   variables must have the same batch dimensions `[A1, ..., An]`, and that
-  matrices are expected to be in row-major format.
-rendered_image: A tensor of shape `[A1, ..., An, width, height, 4]`, with the
-  width and height defined by `output_resolution`.
+  matrices are expected to be in row-major format. Index buffers are of type
+  int32, and the other variables of type float.
+rendered_image: A tensor of shape `[A1, ..., An, width, height, C]`, with the
+  width and height defined by `output_resolution`, and `C` being
+  `num_channels`, or 0 if `depth_only` is set.
+depth: A tensor of shape `[A1, ..., An, width, height, 1]` containing the
+  window-space depth of each pixel, in [0, 1], or of shape
+  `[A1, ..., An, width, height, 0]` if neither `output_depth` nor `depth_only`
+  is set.
+attachments: A list of tensors of shape `[A1, ..., An, width, height, C]`, one
+  per additional color attachment, where `C` is the number of channels of the
+  attachment.
     )doc")
     .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
       int32 variables_rank;
       TF_RETURN_IF_ERROR(GetVariablesRank(c, &variables_rank));
       auto batch_shape = c->UnknownShapeOfRank(variables_rank);
 
-      tensorflow::TensorShape resolution;
-      TF_RETURN_IF_ERROR(c->GetAttr("output_resolution", &resolution));
+      tensorflow::shape_inference::ShapeHandle resolution_shape;
+      tensorflow::shape_inference::DimensionHandle unused;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 1, &resolution_shape));
+      TF_RETURN_IF_ERROR(
+          c->WithValue(c->Dim(resolution_shape, 0), 2, &unused));
+      // The size of the images is only known if the resolution is constant.
+      tensorflow::shape_inference::DimensionHandle width = c->UnknownDim();
+      tensorflow::shape_inference::DimensionHandle height = c->UnknownDim();
+      const tensorflow::Tensor* resolution = c->input_tensor(1);
+      if (resolution != nullptr) {
+        width = c->MakeDim(resolution->flat<int32>()(0));
+        height = c->MakeDim(resolution->flat<int32>()(1));
+      }
+
+      bool output_depth;
+      bool depth_only;
+      int num_channels;
+      TF_RETURN_IF_ERROR(c->GetAttr("output_depth", &output_depth));
+      TF_RETURN_IF_ERROR(c->GetAttr("depth_only", &depth_only));
+      TF_RETURN_IF_ERROR(c->GetAttr("num_channels", &num_channels));
+      if (num_channels > 4)
+        return tensorflow::errors::InvalidArgument(
+            "num_channels must be between 1 and 4.");
       auto image_shape =
-          c->MakeShape({resolution.dim_size(1), resolution.dim_size(0), 4});
+          c->MakeShape({height, width, depth_only ? 0 : num_channels});
+      auto depth_shape =
+          c->MakeShape({height, width, output_depth || depth_only ? 1 : 0});
 
       tensorflow::shape_inference::ShapeHandle output_shape;
       TF_RETURN_IF_ERROR(
           c->Concatenate(batch_shape, image_shape, &output_shape));
       c->set_output(0, output_shape);
+      TF_RETURN_IF_ERROR(
+          c->Concatenate(batch_shape, depth_shape, &output_shape));
+      c->set_output(1, output_shape);
+
+      tensorflow::DataTypeVector attachment_types;
+      std::vector<int> attachment_channels;
+      std::vector<GLenum> attachment_formats;
+      TF_RETURN_IF_ERROR(c->GetAttr("attachment_types", &attachment_types));
+      TF_RETURN_IF_ERROR(
+          c->GetAttr("attachment_channels", &attachment_channels));
+      TF_RETURN_IF_ERROR(GetAttachmentFormats(
+          attachment_types, attachment_channels, &attachment_formats));
+      if (depth_only && !attachment_types.empty())
+        return tensorflow::errors::InvalidArgument(
+            "depth_only does not support additional color attachments.");
+      for (int index = 0; index < attachment_channels.size(); ++index) {
+        auto attachment_shape =
+            c->MakeShape({height, width, attachment_channels[index]});
+        TF_RETURN_IF_ERROR(
+            c->Concatenate(batch_shape, attachment_shape, &output_shape));
+        c->set_output(2 + index, output_shape);
+      }
 
       return tensorflow::Status::OK();
     });
 
+// Returns the span of tensor covering the batch elements in [begin, end), each
+// of them made of element_size values.
+template <typename T>
+static absl::Span<T> ElementSpan(tensorflow::Tensor* tensor,
+                                 const int64 element_size, const int begin,
+                                 const int end) {
+  return absl::MakeSpan(tensor->flat<T>().data() + element_size * begin,
+                        element_size * (end - begin));
+}
+
 class RasterizeOp : public tensorflow::OpKernel {
  public:
   explicit RasterizeOp(tensorflow::OpKernelConstruction* context)
@@ -142,6 +376,8 @@ class RasterizeOp : public tensorflow::OpKernel {
     std::string fragment_shader;
     std::string geometry_shader;
     std::string vertex_shader;
+    std::string program_cache_directory;
+    bool shared_contexts = false;
     float red_clear = 0.0;
     float green_clear = 0.0;
     float blue_clear = 0.0;
@@ -160,82 +396,431 @@ class RasterizeOp : public tensorflow::OpKernel {
                    context->GetAttr("variable_names", &variable_names_));
     OP_REQUIRES_OK(context,
                    context->GetAttr("variable_kinds", &variable_kinds_));
+    OP_REQUIRES_OK(context, context->GetAttr("program_cache_directory",
+                                             &program_cache_directory));
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("shared_contexts", &shared_contexts));
+    OP_REQUIRES_OK(context, context->GetAttr("layered_batch", &layered_batch_));
+    OP_REQUIRES_OK(context, context->GetAttr("batch_upload", &batch_upload_));
+    std::string draw_mode;
+    OP_REQUIRES_OK(context, context->GetAttr("draw_mode", &draw_mode));
+    if (draw_mode == "triangles") {
+      draw_mode_ = Rasterizer::DrawMode::kTriangles;
+    } else if (draw_mode == "indexed_triangles") {
+      draw_mode_ = Rasterizer::DrawMode::kIndexedTriangles;
+    } else {
+      draw_mode_ = Rasterizer::DrawMode::kPoints;
+    }
+    const int num_vertex_buffers = std::count(
+        variable_kinds_.begin(), variable_kinds_.end(), "vertex_buffer");
+    const int num_index_buffers = std::count(
+        variable_kinds_.begin(), variable_kinds_.end(), "index_buffer");
+    OP_REQUIRES(context,
+                draw_mode_ != Rasterizer::DrawMode::kIndexedTriangles ||
+                    num_index_buffers == 1,
+                tensorflow::errors::InvalidArgument(
+                    "The indexed_triangles draw mode requires exactly one "
+                    "index buffer."));
+    // Vertex attributes and element buffers are fed per batch element.
+    OP_REQUIRES(context,
+                !(layered_batch_ || batch_upload_) ||
+                    (num_vertex_buffers == 0 &&
+                     draw_mode_ != Rasterizer::DrawMode::kIndexedTriangles),
+                tensorflow::errors::InvalidArgument(
+                    "layered_batch and batch_upload do not support vertex "
+                    "buffers and indexed triangles."));
+    bool pipelined_readback = false;
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("pipelined_readback", &pipelined_readback));
+    OP_REQUIRES_OK(context, context->GetAttr("parallelism", &parallelism_));
+    int64 max_contexts = 0;
+    float acquire_timeout = 0.0;
+    OP_REQUIRES_OK(context, context->GetAttr("max_contexts", &max_contexts));
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("acquire_timeout", &acquire_timeout));
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("attachment_types", &attachment_types_));
+    OP_REQUIRES_OK(context, context->GetAttr("attachment_channels",
+                                             &attachment_channels_));
+    OP_REQUIRES_OK(context, context->GetAttr("output_depth", &output_depth_));
+    OP_REQUIRES_OK(context, context->GetAttr("depth_only", &depth_only_));
+    OP_REQUIRES(context, !depth_only_ || attachment_types_.empty(),
+                tensorflow::errors::InvalidArgument(
+                    "depth_only does not support additional color "
+                    "attachments."));
+    output_depth_ = output_depth_ || depth_only_;
+
+    // The first color attachment holds rendered_image.
+    std::vector<GLenum> color_formats;
     OP_REQUIRES_OK(context,
-                   context->GetAttr("output_resolution", &output_resolution_));
+                   GetAttachmentFormats(attachment_types_,
+                                        attachment_channels_, &color_formats));
+    tensorflow::DataType output_dtype = tensorflow::DT_FLOAT;
+    GLenum image_format;
+    OP_REQUIRES_OK(context, context->GetAttr("output_dtype", &output_dtype));
+    OP_REQUIRES_OK(context, context->GetAttr("num_channels", &num_channels_));
+    OP_REQUIRES(context, num_channels_ <= 4,
+                tensorflow::errors::InvalidArgument(
+                    "num_channels must be between 1 and 4."));
+    // Three channel formats are not required to be color-renderable.
+    OP_REQUIRES_OK(context, GetAttachmentFormat(
+                                output_dtype,
+                                num_channels_ == 3 ? 4 : num_channels_,
+                                &image_format));
+    color_formats.insert(color_formats.begin(), image_format);
+
+    std::string device_policy;
+    int64 device_index = 0;
+    OP_REQUIRES_OK(context, context->GetAttr("device_policy", &device_policy));
+    OP_REQUIRES_OK(context, context->GetAttr("device_index", &device_index));
+    EGLDeviceSelector::Policy policy = EGLDeviceSelector::Policy::kPinned;
+    if (device_policy == "round_robin") {
+      policy = EGLDeviceSelector::Policy::kRoundRobin;
+    } else if (device_policy == "least_loaded") {
+      policy = EGLDeviceSelector::Policy::kLeastLoaded;
+    }
+    OP_REQUIRES_OK(context,
+                   EGLDeviceSelector::Create(policy, device_index,
+                                             EGLDevices::Default(),
+                                             &device_selector_));
 
     auto rasterizer_creator =
         [vertex_shader, geometry_shader, fragment_shader, red_clear,
-         green_clear, blue_clear, depth_clear,
+         green_clear, blue_clear, depth_clear, pipelined_readback,
+         color_formats, program_cache_directory, shared_contexts,
          this](std::unique_ptr<RasterizerWithContext>* resource)
         -> tensorflow::Status {
-      return RasterizerWithContext::Create(
-          output_resolution_.dim_size(0), output_resolution_.dim_size(1),
-          vertex_shader, geometry_shader, fragment_shader, resource, red_clear,
-          green_clear, blue_clear, depth_clear);
+      int device = 0;
+      TF_RETURN_IF_ERROR(device_selector_->SelectDevice(&device));
+      // The render targets are sized by SetResolution before each use.
+      TF_RETURN_IF_ERROR(RasterizerWithContext::Create(
+          1, 1, vertex_shader, geometry_shader, fragment_shader, resource,
+          red_clear, green_clear, blue_clear, depth_clear, color_formats,
+          program_cache_directory, shared_contexts, device));
+      (*resource)->SetPipelinedReadback(pipelined_readback);
+      // Uploads must not wait for the draw calls whose results are still
+      // being read back.
+      (*resource)->SetPersistentUploads(pipelined_readback);
+      (*resource)->SetDepthOnly(depth_only_);
+      // Fail before rendering anything if the depth cannot be read back.
+      if (output_depth_) TF_RETURN_IF_ERROR((*resource)->CheckDepthReadable());
+      (*resource)->SetDrawMode(draw_mode_);
+      return (*resource)->SetNumChannels(num_channels_);
     };
+    // The pool keeps a rasterizer for each shard between executions.
     rasterizer_pool_ =
         std::unique_ptr<ThreadSafeResourcePool<RasterizerWithContext>>(
             new ThreadSafeResourcePool<RasterizerWithContext>(
-                rasterizer_creator));
+                rasterizer_creator,
+                std::max<int64>(parallelism_, kMinPoolSize), max_contexts,
+                acquire_timeout > 0.0 ? absl::Seconds(acquire_timeout)
+                                      : absl::InfiniteDuration()));
+    // The first execution does not pay for the creation of the contexts and
+    // the compilation of the shaders.
+    OP_REQUIRES_OK(context, rasterizer_pool_->Prewarm(parallelism_));
   }
 
   void Compute(tensorflow::OpKernelContext* context) override {
     tensorflow::TensorShape batch_shape;
     OP_REQUIRES_OK(context, ValidateVariables(context, &batch_shape));
+    const tensorflow::Tensor& resolution = context->input(1);
+    OP_REQUIRES(context,
+                resolution.dims() == 1 && resolution.NumElements() == 2,
+                tensorflow::errors::InvalidArgument(
+                    "output_resolution must have shape [2], got shape ",
+                    resolution.shape().DebugString()));
+    const tensorflow::TensorShape output_resolution(
+        {resolution.flat<int32>()(0), resolution.flat<int32>()(1)});
+    OP_REQUIRES(context,
+                output_resolution.dim_size(0) > 0 &&
+                    output_resolution.dim_size(1) > 0,
+                tensorflow::errors::InvalidArgument(
+                    "output_resolution must be positive, got ",
+                    output_resolution.DebugString()));
+    const tensorflow::Tensor& num_points = context->input(0);
+    OP_REQUIRES(context,
+                num_points.dims() == 0 || num_points.shape() == batch_shape,
+                tensorflow::errors::InvalidArgument(
+                    "num_points must be a scalar or have the batch shape of "
+                    "the variables, got shape ",
+                    num_points.shape().DebugString()));
 
     // Allocate the output images.
     tensorflow::Tensor* output_image;
     tensorflow::TensorShape output_image_shape;
 
     output_image_shape.AppendShape(batch_shape);
-    output_image_shape.AddDim(output_resolution_.dim_size(1));
-    output_image_shape.AddDim(output_resolution_.dim_size(0));
-    output_image_shape.AddDim(4);
+    output_image_shape.AddDim(output_resolution.dim_size(1));
+    output_image_shape.AddDim(output_resolution.dim_size(0));
+    output_image_shape.AddDim(depth_only_ ? 0 : num_channels_);
     OP_REQUIRES_OK(context, context->allocate_output(0, output_image_shape,
                                                      &output_image));
 
-    // Render.
-    std::unique_ptr<RasterizerWithContext> rasterizer;
-    float* image_data = output_image->flat<float>().data();
-    const int64 image_size =
-        output_resolution_.dim_size(0) * output_resolution_.dim_size(1) * 4;
-
-    OP_REQUIRES_OK(context, rasterizer_pool_->AcquireResource(&rasterizer));
-    for (int i = 0; i < batch_shape.num_elements(); ++i) {
-      OP_REQUIRES_OK(context, SetVariables(context, rasterizer, i));
-      OP_REQUIRES_OK(context, RenderImage(context, rasterizer, image_size,
-                                          image_data + i * image_size));
+    // Allocate the depth, which has no channel if it is not requested.
+    tensorflow::Tensor* depth;
+    tensorflow::TensorShape depth_shape;
+
+    depth_shape.AppendShape(batch_shape);
+    depth_shape.AddDim(output_resolution.dim_size(1));
+    depth_shape.AddDim(output_resolution.dim_size(0));
+    depth_shape.AddDim(output_depth_ ? 1 : 0);
+    OP_REQUIRES_OK(context, context->allocate_output(1, depth_shape, &depth));
+
+    // Allocate the additional attachments.
+    tensorflow::OpOutputList attachment_list;
+    std::vector<tensorflow::Tensor*> attachments(attachment_types_.size());
+    OP_REQUIRES_OK(context,
+                   context->output_list("attachments", &attachment_list));
+    for (int index = 0; index < attachments.size(); ++index) {
+      tensorflow::TensorShape attachment_shape;
+      attachment_shape.AppendShape(batch_shape);
+      attachment_shape.AddDim(output_resolution.dim_size(1));
+      attachment_shape.AddDim(output_resolution.dim_size(0));
+      attachment_shape.AddDim(attachment_channels_[index]);
+      OP_REQUIRES_OK(context, attachment_list.allocate(index, attachment_shape,
+                                                       &attachments[index]));
     }
-    OP_REQUIRES_OK(context, rasterizer_pool_->ReturnResource(rasterizer));
+
+    // Render.
+    const int64 image_size = output_resolution.dim_size(0) *
+                             output_resolution.dim_size(1) *
+                             (depth_only_ ? 0 : num_channels_);
+    const int num_elements = batch_shape.num_elements();
+
+    // Each shard renders a contiguous range of batch elements with its own
+    // rasterizer, and writes a disjoint slice of the output images.
+    absl::Mutex status_mutex;
+    tensorflow::Status status;
+    auto render_shard = [&](int64 begin, int64 end) {
+      tensorflow::Status shard_status = RenderElements(
+          context, begin, end, output_resolution, image_size, output_image,
+          output_depth_ ? depth : nullptr, attachments);
+      if (!shard_status.ok()) {
+        absl::MutexLock lock(&status_mutex);
+        status.Update(shard_status);
+      }
+    };
+    auto* worker_threads = context->device()->tensorflow_cpu_worker_threads();
+    tensorflow::Shard(parallelism_, worker_threads->workers, num_elements,
+                      kCostPerElement, render_shard);
+    OP_REQUIRES_OK(context, status);
   }
 
  private:
+  // Minimum value of GL_MAX_ARRAY_TEXTURE_LAYERS guaranteed by OpenGL ES 3.2;
+  // larger batches are rendered with several layered draw calls.
+  static constexpr int kMaxLayersPerDraw = 256;
+  // Rendering an element is costly compared to the overhead of a shard, which
+  // lets the batch be split in up to parallelism_ shards.
+  static constexpr int64 kCostPerElement = 1 << 20;
+  // Minimum number of idle rasterizers kept by the pool.
+  static constexpr int64 kMinPoolSize = 5;
+
+  // Returns the number of primitives of batch element index.
+  static int NumPoints(tensorflow::OpKernelContext* context, int index);
+  tensorflow::Status RenderElements(
+      tensorflow::OpKernelContext* context, int begin, int end,
+      const tensorflow::TensorShape& output_resolution, int64 image_size,
+      tensorflow::Tensor* image, tensorflow::Tensor* depth,
+      const std::vector<tensorflow::Tensor*>& attachments);
+  // Reads the depth, unless it is null, and the additional color attachments
+  // of the batch elements in [begin, end).
+  tensorflow::Status ReadAttachments(
+      std::unique_ptr<RasterizerWithContext>& rasterizer,
+      const tensorflow::TensorShape& output_resolution,
+      tensorflow::Tensor* depth,
+      const std::vector<tensorflow::Tensor*>& attachments, int begin, int end);
+
   tensorflow::Status SetVariables(
       tensorflow::OpKernelContext* context,
       std::unique_ptr<RasterizerWithContext>& rasterizer, int outer_dim);
+  // Uploads each variable of the batch elements in [begin, end) to a single
+  // shader storage buffer.
+  tensorflow::Status SetLayeredVariables(
+      tensorflow::OpKernelContext* context,
+      std::unique_ptr<RasterizerWithContext>& rasterizer, int begin, int end);
+  // Renders batch element index into image.
   tensorflow::Status RenderImage(
       tensorflow::OpKernelContext* context,
       std::unique_ptr<RasterizerWithContext>& rasterizer, int64 image_size,
-      float* image_data);
+      int index, tensorflow::Tensor* image);
+  // Renders the batch elements in [begin, end) into image with a single
+  // layered draw call.
+  tensorflow::Status RenderLayeredImages(
+      tensorflow::OpKernelContext* context,
+      std::unique_ptr<RasterizerWithContext>& rasterizer, int64 image_size,
+      int begin, int end, tensorflow::Tensor* image);
   tensorflow::Status ValidateVariables(tensorflow::OpKernelContext* context,
                                        tensorflow::TensorShape* batch_shape);
 
+  // Selects the device of each rasterizer created by the pool.
+  std::unique_ptr<EGLDeviceSelector> device_selector_;
   std::unique_ptr<ThreadSafeResourcePool<RasterizerWithContext>>
       rasterizer_pool_;
   std::vector<std::string> variable_names_;
   std::vector<std::string> variable_kinds_;
-  tensorflow::TensorShape output_resolution_;
+  bool layered_batch_;
+  bool batch_upload_;
+  Rasterizer::DrawMode draw_mode_;
+  int64 parallelism_;
+  tensorflow::DataTypeVector attachment_types_;
+  std::vector<int> attachment_channels_;
+  bool output_depth_;
+  bool depth_only_;
+  int num_channels_;
 };
 
+int RasterizeOp::NumPoints(tensorflow::OpKernelContext* context,
+                           const int index) {
+  const tensorflow::Tensor& num_points = context->input(0);
+  if (num_points.dims() == 0) return num_points.scalar<int>()();
+  return num_points.flat<int>()(index);
+}
+
+tensorflow::Status RasterizeOp::RenderElements(
+    tensorflow::OpKernelContext* context, const int begin, const int end,
+    const tensorflow::TensorShape& output_resolution, const int64 image_size,
+    tensorflow::Tensor* image, tensorflow::Tensor* depth,
+    const std::vector<tensorflow::Tensor*>& attachments) {
+  std::unique_ptr<RasterizerWithContext> rasterizer;
+
+  TF_RETURN_IF_ERROR(rasterizer_pool_->AcquireResource(&rasterizer));
+  // A rasterizer left in an unknown state by an error is deleted, which lets
+  // the pool create another one.
+  auto rasterizer_cleanup = MakeCleanup(
+      [this, &rasterizer]() { rasterizer_pool_->DiscardResource(rasterizer); });
+  // Keeps the context current for all the elements, and releases it before
+  // the rasterizer goes back to the pool, where another thread may get it.
+  TF_RETURN_IF_ERROR(rasterizer->BeginSession());
+  auto session_cleanup =
+      MakeCleanup([&rasterizer]() { return rasterizer->EndSession(); });
+  TF_RETURN_IF_ERROR(rasterizer->SetResolution(output_resolution.dim_size(0),
+                                               output_resolution.dim_size(1)));
+  if (layered_batch_) {
+    for (int first = begin; first < end; first += kMaxLayersPerDraw) {
+      const int last = std::min(first + kMaxLayersPerDraw, end);
+      TF_RETURN_IF_ERROR(SetLayeredVariables(context, rasterizer, first, last));
+      TF_RETURN_IF_ERROR(RenderLayeredImages(context, rasterizer, image_size,
+                                             first, last, image));
+      TF_RETURN_IF_ERROR(ReadAttachments(rasterizer, output_resolution, depth,
+                                         attachments, first, last));
+    }
+  } else if (batch_upload_) {
+    // One upload per variable, instead of one per variable and element.
+    TF_RETURN_IF_ERROR(SetLayeredVariables(context, rasterizer, begin, end));
+    for (int i = begin; i < end; ++i) {
+      rasterizer->SetBatchElement(i - begin, end - begin);
+      TF_RETURN_IF_ERROR(
+          RenderImage(context, rasterizer, image_size, i, image));
+      TF_RETURN_IF_ERROR(ReadAttachments(rasterizer, output_resolution, depth,
+                                         attachments, i, i + 1));
+    }
+  } else {
+    for (int i = begin; i < end; ++i) {
+      TF_RETURN_IF_ERROR(SetVariables(context, rasterizer, i));
+      TF_RETURN_IF_ERROR(
+          RenderImage(context, rasterizer, image_size, i, image));
+      TF_RETURN_IF_ERROR(ReadAttachments(rasterizer, output_resolution, depth,
+                                         attachments, i, i + 1));
+    }
+  }
+  TF_RETURN_IF_ERROR(rasterizer->FinishPendingRenders());
+  TF_RETURN_IF_ERROR(session_cleanup.release()());
+  rasterizer_cleanup.release();
+  TF_RETURN_IF_ERROR(rasterizer_pool_->ReturnResource(rasterizer));
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RasterizeOp::ReadAttachments(
+    std::unique_ptr<RasterizerWithContext>& rasterizer,
+    const tensorflow::TensorShape& output_resolution,
+    tensorflow::Tensor* depth,
+    const std::vector<tensorflow::Tensor*>& attachments, const int begin,
+    const int end) {
+  if (depth != nullptr) {
+    const int64 depth_size =
+        output_resolution.dim_size(0) * output_resolution.dim_size(1);
+    TF_RETURN_IF_ERROR(rasterizer->ReadDepth(
+        ElementSpan<float>(depth, depth_size, begin, end)));
+  }
+
+  // Color attachment 0 holds rendered_image; the additional attachments
+  // follow.
+  for (int index = 0; index < attachments.size(); ++index) {
+    const int64 attachment_size = output_resolution.dim_size(0) *
+                                  output_resolution.dim_size(1) *
+                                  attachment_channels_[index];
+    tensorflow::Tensor* attachment = attachments[index];
+
+    switch (attachment_types_[index]) {
+      case tensorflow::DT_FLOAT:
+        TF_RETURN_IF_ERROR(rasterizer->ReadColorAttachment(
+            index + 1,
+            ElementSpan<float>(attachment, attachment_size, begin, end)));
+        break;
+      case tensorflow::DT_HALF:
+        TF_RETURN_IF_ERROR(rasterizer->ReadColorAttachment(
+            index + 1,
+            ElementSpan<Eigen::half>(attachment, attachment_size, begin, end)));
+        break;
+      case tensorflow::DT_UINT8:
+        TF_RETURN_IF_ERROR(rasterizer->ReadColorAttachment(
+            index + 1,
+            ElementSpan<uint8>(attachment, attachment_size, begin, end)));
+        break;
+      default:
+        TF_RETURN_IF_ERROR(rasterizer->ReadColorAttachment(
+            index + 1,
+            ElementSpan<int32>(attachment, attachment_size, begin, end)));
+    }
+  }
+  return tensorflow::Status::OK();
+}
+
 tensorflow::Status RasterizeOp::RenderImage(
     tensorflow::OpKernelContext* context,
     std::unique_ptr<RasterizerWithContext>& rasterizer, const int64 image_size,
-    float* image_data) {
-  int num_points = context->input(0).scalar<int>()();
+    const int index, tensorflow::Tensor* image) {
+  const int num_points = NumPoints(context, index);
+
+  switch (image->dtype()) {
+    case tensorflow::DT_HALF:
+      return rasterizer->Render(
+          num_points,
+          ElementSpan<Eigen::half>(image, image_size, index, index + 1));
+    case tensorflow::DT_UINT8:
+      return rasterizer->Render(
+          num_points, ElementSpan<uint8>(image, image_size, index, index + 1));
+    default:
+      return rasterizer->Render(
+          num_points, ElementSpan<float>(image, image_size, index, index + 1));
+  }
+}
 
-  TF_RETURN_IF_ERROR(rasterizer->Render(
-      num_points, absl::MakeSpan(image_data, image_data + image_size)));
-  return tensorflow::Status::OK();
+tensorflow::Status RasterizeOp::RenderLayeredImages(
+    tensorflow::OpKernelContext* context,
+    std::unique_ptr<RasterizerWithContext>& rasterizer, const int64 image_size,
+    const int begin, const int end, tensorflow::Tensor* image) {
+  // All the layers are drawn by the same instanced draw call.
+  int num_points = 0;
+  for (int index = begin; index < end; ++index)
+    num_points = std::max(num_points, NumPoints(context, index));
+  const int num_layers = end - begin;
+
+  switch (image->dtype()) {
+    case tensorflow::DT_HALF:
+      return rasterizer->RenderLayered(
+          num_points, num_layers,
+          ElementSpan<Eigen::half>(image, image_size, begin, end));
+    case tensorflow::DT_UINT8:
+      return rasterizer->RenderLayered(
+          num_points, num_layers,
+          ElementSpan<uint8>(image, image_size, begin, end));
+    default:
+      return rasterizer->RenderLayered(
+          num_points, num_layers,
+          ElementSpan<float>(image, image_size, begin, end));
+  }
 }
 
 tensorflow::Status RasterizeOp::SetVariables(
@@ -268,6 +853,59 @@ tensorflow::Status RasterizeOp::SetVariables(
           name, absl::MakeConstSpan(
                     value_pointer + buffer_length * outer_dim,
                     value_pointer + buffer_length * (outer_dim + 1))));
+    } else if (kind == "index_buffer") {
+      const int32 buffer_length = value_shape.dim_size(value_shape.dims() - 1);
+
+      const auto value_pointer = value.flat<int32>().data();
+      const auto indices =
+          absl::MakeConstSpan(value_pointer + buffer_length * outer_dim,
+                              value_pointer + buffer_length * (outer_dim + 1));
+      if (draw_mode_ == Rasterizer::DrawMode::kIndexedTriangles) {
+        TF_RETURN_IF_ERROR(rasterizer->SetIndexBuffer(indices));
+      } else {
+        TF_RETURN_IF_ERROR(rasterizer->SetShaderStorageBuffer(name, indices));
+      }
+    } else if (kind == "vertex_buffer") {
+      const int32 buffer_length = value_shape.dim_size(value_shape.dims() - 1);
+
+      const auto value_pointer = value.flat<float>().data();
+      TF_RETURN_IF_ERROR(rasterizer->SetVertexAttribute(
+          name, absl::MakeConstSpan(
+                    value_pointer + buffer_length * outer_dim,
+                    value_pointer + buffer_length * (outer_dim + 1))));
+    }
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RasterizeOp::SetLayeredVariables(
+    tensorflow::OpKernelContext* context,
+    std::unique_ptr<RasterizerWithContext>& rasterizer, int begin, int end) {
+  tensorflow::OpInputList variable_values;
+  TF_RETURN_IF_ERROR(context->input_list("variable_values", &variable_values));
+
+  for (int index = 0; index < variable_names_.size(); ++index) {
+    const std::string name = variable_names_[index];
+    const std::string kind = variable_kinds_[index];
+    const tensorflow::Tensor& value = variable_values[index];
+    const tensorflow::TensorShape value_shape = value.shape();
+    int64 element_size = value_shape.dim_size(value_shape.dims() - 1);
+
+    if (kind == "mat")
+      element_size *= value_shape.dim_size(value_shape.dims() - 2);
+
+    // Matrices and buffers of all the batch elements in [begin, end) are
+    // contiguous in memory, and are uploaded in one go.
+    if (kind == "index_buffer") {
+      const auto value_pointer = value.flat<int32>().data();
+      TF_RETURN_IF_ERROR(rasterizer->SetShaderStorageBuffer(
+          name, absl::MakeConstSpan(value_pointer + element_size * begin,
+                                    value_pointer + element_size * end)));
+    } else {
+      const auto value_pointer = value.flat<float>().data();
+      TF_RETURN_IF_ERROR(rasterizer->SetShaderStorageBuffer(
+          name, absl::MakeConstSpan(value_pointer + element_size * begin,
+                                    value_pointer + element_size * end)));
     }
   }
   return tensorflow::Status::OK();
@@ -293,14 +931,21 @@ tensorflow::Status RasterizeOp::ValidateVariables(
     const std::string kind = variable_kinds_[index];
     const tensorflow::Tensor& value = variable_values[index];
     tensorflow::TensorShape value_batch_shape = value.shape();
+    const tensorflow::DataType expected_dtype = kind == "index_buffer"
+                                                    ? tensorflow::DT_INT32
+                                                    : tensorflow::DT_FLOAT;
 
+    if (value.dtype() != expected_dtype)
+      return tensorflow::errors::InvalidArgument(
+          "Variable with name='", name, "' and kind='", kind,
+          "' has an invalid type=", tensorflow::DataTypeString(value.dtype()));
     if (kind == "mat") {
       if (value_batch_shape.dims() < 2)
         return tensorflow::errors::InvalidArgument(
             "Matrix with name='", name,
             "' has an invalid shape=", value_batch_shape.DebugString());
       value_batch_shape.RemoveLastDims(2);
-    } else if (kind == "buffer") {
+    } else {
       if (value_batch_shape.dims() < 1)
         return tensorflow::errors::InvalidArgument(
             "Buffer with name='", name,
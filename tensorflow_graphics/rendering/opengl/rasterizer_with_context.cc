@@ -14,14 +14,45 @@ limitations under the License.
 ==============================================================================*/
 #include "tensorflow_graphics/rendering/opengl/rasterizer_with_context.h"
 
+#include <mutex>
+#include <unordered_map>
+
+#include "absl/strings/str_cat.h"
+
+namespace {
+
+// Mutex used to lock the shared binary map, which is held while binaries are
+// looked up and created in it.
+std::mutex* get_shared_binary_mutex() {
+  static std::mutex* shared_binary_mutex = new std::mutex();
+  return shared_binary_mutex;
+}
+
+// Binaries of the programs used by the rasterizers with shared contexts, keyed
+// by their device and shaders. The binaries are owned by the rasterizers, and
+// are deleted along with the last of them.
+std::unordered_map<std::string, std::weak_ptr<const gl_utils::ProgramBinary>>*
+get_shared_binary_map() {
+  static std::unordered_map<std::string,
+                            std::weak_ptr<const gl_utils::ProgramBinary>>*
+      shared_binary_map = new std::unordered_map<
+          std::string, std::weak_ptr<const gl_utils::ProgramBinary>>();
+  return shared_binary_map;
+}
+
+}  // namespace
+
 RasterizerWithContext::RasterizerWithContext(
     std::unique_ptr<EGLOffscreenContext>&& egl_context,
+    std::shared_ptr<const gl_utils::ProgramBinary> program_binary,
     std::unique_ptr<gl_utils::Program>&& program,
     std::unique_ptr<gl_utils::RenderTargets>&& render_targets, float clear_r,
     float clear_g, float clear_b, float clear_depth)
     : Rasterizer(std::move(program), std::move(render_targets), clear_r,
                  clear_g, clear_b, clear_depth),
-      egl_context_(std::move(egl_context)) {}
+      egl_context_(std::move(egl_context)),
+      program_binary_(std::move(program_binary)),
+      session_depth_(0) {}
 
 RasterizerWithContext::~RasterizerWithContext() {
   // Destroy the rasterizer in the correct EGL context.
@@ -42,48 +73,272 @@ tensorflow::Status RasterizerWithContext::Create(
     const std::string& geometry_shader_source,
     const std::string& fragment_shader_source,
     std::unique_ptr<RasterizerWithContext>* rasterizer_with_context,
-    float clear_r, float clear_g, float clear_b, float clear_depth) {
+    float clear_r, float clear_g, float clear_b, float clear_depth,
+    const std::vector<GLenum>& color_formats,
+    const std::string& program_cache_directory, bool shared_context,
+    int device_index) {
   std::unique_ptr<gl_utils::Program> program;
+  std::shared_ptr<const gl_utils::ProgramBinary> program_binary;
   std::unique_ptr<gl_utils::RenderTargets> render_targets;
   std::vector<std::pair<std::string, GLenum>> shaders;
   std::unique_ptr<EGLOffscreenContext> offscreen_context;
 
-  TF_RETURN_IF_ERROR(EGLOffscreenContext::Create(&offscreen_context));
+  if (shared_context) {
+    TF_RETURN_IF_ERROR(
+        EGLOffscreenContext::CreateShared(&offscreen_context, device_index));
+  } else {
+    TF_RETURN_IF_ERROR(
+        EGLOffscreenContext::Create(&offscreen_context, device_index));
+  }
   TF_RETURN_IF_ERROR(offscreen_context->MakeCurrent());
   // No need to have a MakeCleanup here as EGLOffscreenContext::Release()
   // would be called on destruction of the offscreen_context object, which
   // would happen here if the whole creation process was not successful.
 
   shaders.push_back(std::make_pair(vertex_shader_source, GL_VERTEX_SHADER));
-  shaders.push_back(std::make_pair(geometry_shader_source, GL_GEOMETRY_SHADER));
+  if (!geometry_shader_source.empty()) {
+    shaders.push_back(
+        std::make_pair(geometry_shader_source, GL_GEOMETRY_SHADER));
+  }
   shaders.push_back(std::make_pair(fragment_shader_source, GL_FRAGMENT_SHADER));
-  TF_RETURN_IF_ERROR(gl_utils::Program::Create(shaders, &program));
-  TF_RETURN_IF_ERROR(
-      gl_utils::RenderTargets::Create<float>(width, height, &render_targets));
+  if (shared_context) {
+    // Load the program from the binary linked by the other rasterizers with
+    // the same shaders on the device, or link it and share its binary with the
+    // next ones. Each rasterizer has a program of its own, since the uniforms
+    // of a program shared by several contexts would be shared as well.
+    const std::string key = absl::StrCat(
+        device_index, ";", vertex_shader_source.size(), ":",
+        vertex_shader_source, geometry_shader_source.size(), ":",
+        geometry_shader_source, fragment_shader_source.size(), ":",
+        fragment_shader_source);
+    {
+      std::lock_guard<std::mutex> shared_binary_guard(
+          *get_shared_binary_mutex());
+      std::weak_ptr<const gl_utils::ProgramBinary>& shared_binary =
+          (*get_shared_binary_map())[key];
+      program_binary = shared_binary.lock();
+      if (program_binary == nullptr) {
+        if (program_cache_directory.empty()) {
+          TF_RETURN_IF_ERROR(
+              gl_utils::Program::CreateRetrievable(shaders, &program));
+        } else {
+          TF_RETURN_IF_ERROR(gl_utils::Program::CreateWithBinaryCache(
+              shaders, program_cache_directory, &program));
+        }
+        // Without binary support, every rasterizer links its own program.
+        auto new_binary = std::make_shared<gl_utils::ProgramBinary>();
+        if (program->GetBinary(new_binary.get()).ok()) {
+          program_binary = std::move(new_binary);
+          shared_binary = program_binary;
+        }
+      }
+    }
+    // A binary rejected by the driver is linked again from the shaders.
+    if (program == nullptr &&
+        (program_binary == nullptr ||
+         !gl_utils::Program::CreateFromBinary(*program_binary, &program)
+              .ok())) {
+      TF_RETURN_IF_ERROR(gl_utils::Program::CreateWithBinaryCache(
+          shaders, program_cache_directory, &program));
+    }
+  } else {
+    TF_RETURN_IF_ERROR(gl_utils::Program::CreateWithBinaryCache(
+        shaders, program_cache_directory, &program));
+  }
+  TF_RETURN_IF_ERROR(gl_utils::RenderTargets::Create(
+      width, height, 1, color_formats, &render_targets));
   TF_RETURN_IF_ERROR(offscreen_context->Release());
   *rasterizer_with_context =
       std::unique_ptr<RasterizerWithContext>(new RasterizerWithContext(
-          std::move(offscreen_context), std::move(program),
+          std::move(offscreen_context), std::move(program_binary),
+          std::move(program),
           std::move(render_targets), clear_r, clear_g, clear_b, clear_depth));
   return tensorflow::Status::OK();
 }
 
 tensorflow::Status RasterizerWithContext::Render(int num_points,
                                                  absl::Span<float> result) {
-  TF_RETURN_IF_ERROR(egl_context_->MakeCurrent());
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
+  auto context_cleanup =
+      MakeCleanup([this]() { return this->ReleaseContext(); });
+  TF_RETURN_IF_ERROR(Rasterizer::Render(num_points, result));
+  // context_cleanup releases the context here, unless in a session.
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RasterizerWithContext::Render(
+    int num_points, absl::Span<Eigen::half> result) {
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
   auto context_cleanup =
-      MakeCleanup([this]() { return this->egl_context_->Release(); });
+      MakeCleanup([this]() { return this->ReleaseContext(); });
   TF_RETURN_IF_ERROR(Rasterizer::Render(num_points, result));
-  // context_cleanup calls EGLOffscreenContext::Release here.
+  // context_cleanup releases the context here, unless in a session.
   return tensorflow::Status::OK();
 }
 
 tensorflow::Status RasterizerWithContext::Render(
     int num_points, absl::Span<unsigned char> result) {
-  TF_RETURN_IF_ERROR(egl_context_->MakeCurrent());
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
   auto context_cleanup =
-      MakeCleanup([this]() { return this->egl_context_->Release(); });
+      MakeCleanup([this]() { return this->ReleaseContext(); });
   TF_RETURN_IF_ERROR(Rasterizer::Render(num_points, result));
-  // context_cleanup calls EGLOffscreenContext::Release here.
+  // context_cleanup releases the context here, unless in a session.
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RasterizerWithContext::RenderLayered(
+    int num_points, int num_layers, absl::Span<float> result) {
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
+  auto context_cleanup =
+      MakeCleanup([this]() { return this->ReleaseContext(); });
+  TF_RETURN_IF_ERROR(Rasterizer::RenderLayered(num_points, num_layers, result));
+  // context_cleanup releases the context here, unless in a session.
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RasterizerWithContext::RenderLayered(
+    int num_points, int num_layers, absl::Span<Eigen::half> result) {
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
+  auto context_cleanup =
+      MakeCleanup([this]() { return this->ReleaseContext(); });
+  TF_RETURN_IF_ERROR(Rasterizer::RenderLayered(num_points, num_layers, result));
+  // context_cleanup releases the context here, unless in a session.
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RasterizerWithContext::RenderLayered(
+    int num_points, int num_layers, absl::Span<unsigned char> result) {
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
+  auto context_cleanup =
+      MakeCleanup([this]() { return this->ReleaseContext(); });
+  TF_RETURN_IF_ERROR(Rasterizer::RenderLayered(num_points, num_layers, result));
+  // context_cleanup releases the context here, unless in a session.
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RasterizerWithContext::ReadColorAttachment(
+    int attachment, absl::Span<float> result) {
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
+  auto context_cleanup =
+      MakeCleanup([this]() { return this->ReleaseContext(); });
+  TF_RETURN_IF_ERROR(Rasterizer::ReadColorAttachment(attachment, result));
+  // context_cleanup releases the context here, unless in a session.
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RasterizerWithContext::ReadColorAttachment(
+    int attachment, absl::Span<Eigen::half> result) {
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
+  auto context_cleanup =
+      MakeCleanup([this]() { return this->ReleaseContext(); });
+  TF_RETURN_IF_ERROR(Rasterizer::ReadColorAttachment(attachment, result));
+  // context_cleanup releases the context here, unless in a session.
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RasterizerWithContext::ReadColorAttachment(
+    int attachment, absl::Span<unsigned char> result) {
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
+  auto context_cleanup =
+      MakeCleanup([this]() { return this->ReleaseContext(); });
+  TF_RETURN_IF_ERROR(Rasterizer::ReadColorAttachment(attachment, result));
+  // context_cleanup releases the context here, unless in a session.
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RasterizerWithContext::ReadColorAttachment(
+    int attachment, absl::Span<int> result) {
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
+  auto context_cleanup =
+      MakeCleanup([this]() { return this->ReleaseContext(); });
+  TF_RETURN_IF_ERROR(Rasterizer::ReadColorAttachment(attachment, result));
+  // context_cleanup releases the context here, unless in a session.
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RasterizerWithContext::ReadDepth(absl::Span<float> result) {
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
+  auto context_cleanup =
+      MakeCleanup([this]() { return this->ReleaseContext(); });
+  TF_RETURN_IF_ERROR(Rasterizer::ReadDepth(result));
+  // context_cleanup releases the context here, unless in a session.
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RasterizerWithContext::CheckDepthReadable() {
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
+  auto context_cleanup =
+      MakeCleanup([this]() { return this->ReleaseContext(); });
+  TF_RETURN_IF_ERROR(Rasterizer::CheckDepthReadable());
+  // context_cleanup releases the context here, unless in a session.
+  return tensorflow::Status::OK();
+}
+
+void RasterizerWithContext::SetShaderStorageBuffer(
+    const std::string& name,
+    std::shared_ptr<gl_utils::ShaderStorageBuffer> shader_storage_buffer) {
+  Rasterizer::SetShaderStorageBuffer(name, std::move(shader_storage_buffer));
+}
+
+tensorflow::Status RasterizerWithContext::SetVertexAttribute(
+    const std::string& name, absl::Span<const float> data) {
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
+  auto context_cleanup =
+      MakeCleanup([this]() { return this->ReleaseContext(); });
+  TF_RETURN_IF_ERROR(Rasterizer::SetVertexAttribute(name, data));
+  // context_cleanup releases the context here, unless in a session.
   return tensorflow::Status::OK();
 }
+
+tensorflow::Status RasterizerWithContext::SetIndexBuffer(
+    absl::Span<const int> indices) {
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
+  auto context_cleanup =
+      MakeCleanup([this]() { return this->ReleaseContext(); });
+  TF_RETURN_IF_ERROR(Rasterizer::SetIndexBuffer(indices));
+  // context_cleanup releases the context here, unless in a session.
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RasterizerWithContext::FinishPendingRenders() {
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
+  auto context_cleanup =
+      MakeCleanup([this]() { return this->ReleaseContext(); });
+  TF_RETURN_IF_ERROR(Rasterizer::FinishPendingRenders());
+  // context_cleanup releases the context here, unless in a session.
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RasterizerWithContext::SetResolution(int width,
+                                                        int height) {
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
+  auto context_cleanup =
+      MakeCleanup([this]() { return this->ReleaseContext(); });
+  TF_RETURN_IF_ERROR(Rasterizer::SetResolution(width, height));
+  // context_cleanup releases the context here, unless in a session.
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RasterizerWithContext::BeginSession() {
+  if (session_depth_ == 0) TF_RETURN_IF_ERROR(egl_context_->MakeCurrent());
+  ++session_depth_;
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RasterizerWithContext::EndSession() {
+  if (session_depth_ == 0)
+    return TFG_INTERNAL_ERROR("EndSession called without a session");
+  if (--session_depth_ == 0) TF_RETURN_IF_ERROR(egl_context_->Release());
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RasterizerWithContext::MakeContextCurrent() const {
+  // The context is already current for the whole session.
+  if (session_depth_ > 0) return tensorflow::Status::OK();
+  return egl_context_->MakeCurrent();
+}
+
+tensorflow::Status RasterizerWithContext::ReleaseContext() {
+  if (session_depth_ > 0) return tensorflow::Status::OK();
+  return egl_context_->Release();
+}
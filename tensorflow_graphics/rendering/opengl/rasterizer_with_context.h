@@ -31,7 +31,8 @@ class RasterizerWithContext : public Rasterizer {
   // * width: width of the render buffers.
   // * height: height of the render buffers.
   // * vertex_shader_source: source code of a GLSL vertex shader.
-  // * geometry_shader_source: source code of a GLSL geometry shader.
+  // * geometry_shader_source: source code of a GLSL geometry shader, or an
+  //   empty string for programs without geometry shader.
   // * fragment_shader_source: source code of a GLSL fragment shader.
   // * rasterizer_with_context: if the method succeeds, this variable returns an
   // object
@@ -40,6 +41,18 @@ class RasterizerWithContext : public Rasterizer {
   // * clear_g: green component used when clearing the color buffers.
   // * clear_b: blue component used when clearing the color buffers.
   // * clear_depth: depth value used when clearing the depth buffer
+  // * color_formats: internal format of each color attachment; see
+  //   Rasterizer::Create.
+  // * program_cache_directory: directory caching the binaries of the linked
+  //   programs, or an empty string to always compile the shaders. See
+  //   gl_utils::Program::CreateWithBinaryCache.
+  // * shared_context: whether to create the context with
+  //   EGLOffscreenContext::CreateShared. The rasterizers created with shared
+  //   contexts, the same shaders, and on the same device then only compile and
+  //   link the program once; each of them loads its own program from the
+  //   binary linked by the first one, so that their uniforms stay separate.
+  // * device_index: index of the EGL device rendering with the context; see
+  //   CreateInitializedEGLDisplayAtIndex.
   //
   // Returns:
   //   A boolean set to false if any error occured during the process, and set
@@ -50,7 +63,33 @@ class RasterizerWithContext : public Rasterizer {
       const std::string& fragment_shader_source,
       std::unique_ptr<RasterizerWithContext>* rasterizer_with_context,
       float clear_r = 0.0f, float clear_g = 0.0f, float clear_b = 0.0f,
-      float clear_depth = 1.0f);
+      float clear_depth = 1.0f,
+      const std::vector<GLenum>& color_formats = {GL_RGBA32F},
+      const std::string& program_cache_directory = "",
+      bool shared_context = false, int device_index = 0);
+
+  // Makes the context current in the calling thread until the matching call to
+  // EndSession.
+  //
+  // Each of the other methods makes the context current and releases it when
+  // called outside of a session, which flushes the state of the driver. A
+  // session spares these eglMakeCurrent calls to a sequence of calls, such as
+  // the uploads, renders, and readbacks of a batch. Sessions can be nested,
+  // and must begin and end in the same thread, which must not make other
+  // contexts current meanwhile.
+  //
+  // Returns:
+  //   A boolean set to false if any error occured during the process, and set
+  //   to true otherwise.
+  tensorflow::Status BeginSession();
+
+  // Ends a session started by BeginSession, which releases the context if the
+  // session is not nested in another one.
+  //
+  // Returns:
+  //   A boolean set to false if any error occured during the process, and set
+  //   to true otherwise.
+  tensorflow::Status EndSession();
 
   // Rasterizes the scenes.
   //
@@ -63,9 +102,90 @@ class RasterizerWithContext : public Rasterizer {
   //   A boolean set to false if any error occured during the process, and set
   //   to true otherwise.
   tensorflow::Status Render(int num_points, absl::Span<float> result) override;
+  tensorflow::Status Render(int num_points,
+                            absl::Span<Eigen::half> result) override;
   tensorflow::Status Render(int num_points,
                             absl::Span<unsigned char> result) override;
 
+  // Rasterizes a batch of scenes in a single draw call, each scene being
+  // rendered in its own layer. See Rasterizer::RenderLayered for details.
+  //
+  // Arguments:
+  // * num_points: the number of vertices to render in each layer.
+  // * num_layers: the number of layers to render.
+  // * result: if the method succeeds, a buffer that stores the rendering
+  //   result of all the layers.
+  //
+  // Returns:
+  //   A boolean set to false if any error occured during the process, and set
+  //   to true otherwise.
+  tensorflow::Status RenderLayered(int num_points, int num_layers,
+                                   absl::Span<float> result) override;
+  tensorflow::Status RenderLayered(int num_points, int num_layers,
+                                   absl::Span<Eigen::half> result) override;
+  tensorflow::Status RenderLayered(int num_points, int num_layers,
+                                   absl::Span<unsigned char> result) override;
+
+  // Reads a color attachment of the images rendered by the last call to
+  // Render or RenderLayered. See Rasterizer::ReadColorAttachment for details.
+  //
+  // Arguments:
+  // * attachment: index of the color attachment to read.
+  // * result: if the method succeeds, a buffer that stores the content of the
+  //   attachment.
+  //
+  // Returns:
+  //   A boolean set to false if any error occured during the process, and set
+  //   to true otherwise.
+  tensorflow::Status ReadColorAttachment(int attachment,
+                                         absl::Span<float> result) override;
+  tensorflow::Status ReadColorAttachment(
+      int attachment, absl::Span<Eigen::half> result) override;
+  tensorflow::Status ReadColorAttachment(
+      int attachment, absl::Span<unsigned char> result) override;
+  tensorflow::Status ReadColorAttachment(int attachment,
+                                         absl::Span<int> result) override;
+
+  // Reads the depth buffer of the images rendered by the last call to Render
+  // or RenderLayered. See Rasterizer::ReadDepth for details.
+  //
+  // Arguments:
+  // * result: if the method succeeds, a buffer that stores the depth of each
+  //   pixel.
+  //
+  // Returns:
+  //   A boolean set to false if any error occured during the process, and set
+  //   to true otherwise.
+  tensorflow::Status ReadDepth(absl::Span<float> result) override;
+
+  // Checks that ReadDepth is supported by the context of the rasterizer. See
+  // Rasterizer::CheckDepthReadable for details.
+  //
+  // Returns:
+  //   A boolean set to false if any error occured during the process, and set
+  //   to true otherwise.
+  tensorflow::Status CheckDepthReadable() override;
+
+  // Waits for the images rendered with pipelined readback to be copied into
+  // their result buffers. See Rasterizer::SetPipelinedReadback for details.
+  //
+  // Returns:
+  //   A boolean set to false if any error occured during the process, and set
+  //   to true otherwise.
+  tensorflow::Status FinishPendingRenders() override;
+
+  // Selects the size of the images rendered by subsequent calls to Render and
+  // RenderLayered. See Rasterizer::SetResolution for details.
+  //
+  // Arguments:
+  // * width: width of the render buffers.
+  // * height: height of the render buffers.
+  //
+  // Returns:
+  //   A boolean set to false if any error occured during the process, and set
+  //   to true otherwise.
+  tensorflow::Status SetResolution(int width, int height) override;
+
   // Uploads data to a shader storage buffer.
   //
   // Arguments:
@@ -79,6 +199,41 @@ class RasterizerWithContext : public Rasterizer {
   tensorflow::Status SetShaderStorageBuffer(const std::string& name,
                                             absl::Span<const T> data);
 
+  // Uses an existing buffer as a shader storage buffer. See
+  // Rasterizer::SetShaderStorageBuffer for details.
+  //
+  // Arguments:
+  // * name: name of the shader storage buffer.
+  // * shader_storage_buffer: the buffer, created in the share group of the
+  //   context of the rasterizer.
+  void SetShaderStorageBuffer(
+      const std::string& name,
+      std::shared_ptr<gl_utils::ShaderStorageBuffer> shader_storage_buffer);
+
+  // Uploads the values of a vertex attribute. See
+  // Rasterizer::SetVertexAttribute for details.
+  //
+  // Arguments:
+  // * name: name of the vertex attribute.
+  // * data: the values of the attribute.
+  //
+  // Returns:
+  //   A boolean set to false if any error occured during the process, and set
+  //   to true otherwise.
+  tensorflow::Status SetVertexAttribute(const std::string& name,
+                                        absl::Span<const float> data) override;
+
+  // Uploads the indices of the vertices of indexed triangles. See
+  // Rasterizer::SetIndexBuffer for details.
+  //
+  // Arguments:
+  // * indices: the indices of the vertices.
+  //
+  // Returns:
+  //   A boolean set to false if any error occured during the process, and set
+  //   to true otherwise.
+  tensorflow::Status SetIndexBuffer(absl::Span<const int> indices) override;
+
   // Specifies the value of a uniform matrix.
   //
   // Note: The input matrix is expected to be in column-major format. Both glm
@@ -103,6 +258,7 @@ class RasterizerWithContext : public Rasterizer {
   RasterizerWithContext() = delete;
   RasterizerWithContext(
       std::unique_ptr<EGLOffscreenContext>&& egl_context,
+      std::shared_ptr<const gl_utils::ProgramBinary> program_binary,
       std::unique_ptr<gl_utils::Program>&& program,
       std::unique_ptr<gl_utils::RenderTargets>&& render_targets, float clear_r,
       float clear_g, float clear_b, float clear_depth);
@@ -111,17 +267,26 @@ class RasterizerWithContext : public Rasterizer {
   RasterizerWithContext& operator=(const RasterizerWithContext&) = delete;
   RasterizerWithContext& operator=(RasterizerWithContext&&) = delete;
 
+  // Make the context current and release it, except within a session.
+  tensorflow::Status MakeContextCurrent() const;
+  tensorflow::Status ReleaseContext();
+
   std::unique_ptr<EGLOffscreenContext> egl_context_;
+  // Binary the program was loaded from, shared by the rasterizers created with
+  // shared contexts and the same shaders so that they can load it as well.
+  std::shared_ptr<const gl_utils::ProgramBinary> program_binary_;
+  // Number of nested sessions.
+  int session_depth_;
 };
 
 template <typename T>
 tensorflow::Status RasterizerWithContext::SetShaderStorageBuffer(
     const std::string& name, absl::Span<const T> data) {
-  TF_RETURN_IF_ERROR(egl_context_->MakeCurrent());
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
   auto context_cleanup =
-      MakeCleanup([this]() { return this->egl_context_->Release(); });
+      MakeCleanup([this]() { return this->ReleaseContext(); });
   TF_RETURN_IF_ERROR(Rasterizer::SetShaderStorageBuffer(name, data));
-  // context_cleanup calls EGLOffscreenContext::Release here.
+  // context_cleanup releases the context here, unless in a session.
   return tensorflow::Status::OK();
 }
 
@@ -129,12 +294,12 @@ template <typename T>
 tensorflow::Status RasterizerWithContext::SetUniformMatrix(
     const std::string& name, int num_columns, int num_rows, bool transpose,
     absl::Span<const T> matrix) {
-  TF_RETURN_IF_ERROR(egl_context_->MakeCurrent());
+  TF_RETURN_IF_ERROR(MakeContextCurrent());
   auto context_cleanup =
-      MakeCleanup([this]() { return this->egl_context_->Release(); });
+      MakeCleanup([this]() { return this->ReleaseContext(); });
   TF_RETURN_IF_ERROR(Rasterizer::SetUniformMatrix(name, num_columns, num_rows,
                                                   transpose, matrix));
-  // context_cleanup calls EGLOffscreenContext::Release here.
+  // context_cleanup releases the context here, unless in a session.
   return tensorflow::Status::OK();
 }
 
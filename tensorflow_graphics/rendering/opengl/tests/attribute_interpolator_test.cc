@@ -0,0 +1,203 @@
+/* Copyright 2019 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#include "tensorflow_graphics/rendering/opengl/attribute_interpolator.h"
+
+#include <memory>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/types/span.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace {
+
+// Projects the vertices with w = z, so that their attributes are interpolated
+// differently in screen space and in perspective.
+const std::vector<float> kPerspective = {1.0f, 0.0f, 0.0f, 0.0f,  //
+                                         0.0f, 1.0f, 0.0f, 0.0f,  //
+                                         0.0f, 0.0f, 1.0f, -1.0f,  //
+                                         0.0f, 0.0f, 1.0f, 0.0f};
+
+// Two triangles covering the screen, whose vertices are at different depths.
+const std::vector<float> kVertices = {-4.0f, -4.0f, 4.0f,  //
+                                      4.0f,  -2.0f, 2.0f,  //
+                                      0.0f,  3.0f,  3.0f,  //
+                                      -1.0f, 5.0f,  5.0f};
+const std::vector<int> kTriangles = {0, 1, 2, 0, 2, 3};
+
+// Attributes of 2 channels.
+const std::vector<float> kAttributes = {1.0f, -2.0f, 3.0f, 0.5f,
+                                        -1.0f, 4.0f, 2.0f, 2.0f};
+
+// Returns a 4x3 triangle index image alternating between the two triangles.
+std::vector<int> MakeTriangleIndex() {
+  std::vector<int> triangle_index(4 * 3);
+  for (int i = 0; i < triangle_index.size(); ++i) triangle_index[i] = i % 2;
+  return triangle_index;
+}
+
+// Returns the sum of the attributes interpolated over a 4x3 image, weighted by
+// a fixed gradient.
+double WeightedSum(const std::vector<float>& vertices,
+                   const std::vector<float>& attributes,
+                   const std::vector<float>& view_projection_matrix,
+                   const std::vector<float>& weights) {
+  std::unique_ptr<AttributeInterpolator> interpolator;
+  TF_CHECK_OK(AttributeInterpolator::Create(4, 3, 2, &interpolator));
+  std::vector<float> interpolated(4 * 3 * 2);
+  TF_CHECK_OK(interpolator->Interpolate(
+      MakeTriangleIndex(), vertices, kTriangles, attributes,
+      view_projection_matrix, 0, 4 * 3, absl::MakeSpan(interpolated)));
+  double sum = 0.0;
+  for (int i = 0; i < interpolated.size(); ++i)
+    sum += double{interpolated[i]} * weights[i];
+  return sum;
+}
+
+// Checks a gradient against central finite differences of WeightedSum with
+// respect to each of the values.
+void CheckGradient(const std::vector<float>& gradient,
+                   std::vector<float>* values,
+                   const std::vector<float>& weights,
+                   const std::vector<float>& vertices,
+                   const std::vector<float>& attributes,
+                   const std::vector<float>& view_projection_matrix) {
+  const float kEpsilon = 1e-2f;
+  for (int i = 0; i < values->size(); ++i) {
+    const float value = (*values)[i];
+    (*values)[i] = value + kEpsilon;
+    const double sum_plus =
+        WeightedSum(vertices, attributes, view_projection_matrix, weights);
+    (*values)[i] = value - kEpsilon;
+    const double sum_minus =
+        WeightedSum(vertices, attributes, view_projection_matrix, weights);
+    (*values)[i] = value;
+    EXPECT_NEAR(gradient[i], (sum_plus - sum_minus) / (2.0 * kEpsilon), 1e-2)
+        << "value " << i;
+  }
+}
+
+TEST(AttributeInterpolatorTest, TestCreate) {
+  std::unique_ptr<AttributeInterpolator> interpolator;
+  TF_EXPECT_OK(AttributeInterpolator::Create(4, 3, 2, &interpolator));
+  EXPECT_EQ(interpolator->num_pixels(), 12);
+  EXPECT_FALSE(AttributeInterpolator::Create(0, 3, 2, &interpolator).ok());
+  EXPECT_FALSE(AttributeInterpolator::Create(4, 3, 0, &interpolator).ok());
+}
+
+TEST(AttributeInterpolatorTest, TestInterpolatePerspectiveCorrect) {
+  // Interpolating the positions of the vertices yields the point of each
+  // triangle seen through the pixel centers.
+  const int width = 4;
+  const int height = 3;
+  std::unique_ptr<AttributeInterpolator> interpolator;
+  TF_ASSERT_OK(
+      AttributeInterpolator::Create(width, height, 3, &interpolator));
+  std::vector<float> interpolated(width * height * 3);
+  TF_ASSERT_OK(interpolator->Interpolate(
+      MakeTriangleIndex(), kVertices, kTriangles, kVertices, kPerspective, 0,
+      width * height, absl::MakeSpan(interpolated)));
+
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const float* point = interpolated.data() + (y * width + x) * 3;
+      EXPECT_NEAR(point[0] / point[2], 2.0f * (x + 0.5f) / width - 1.0f, 1e-5);
+      EXPECT_NEAR(point[1] / point[2], 2.0f * (y + 0.5f) / height - 1.0f,
+                  1e-5);
+    }
+  }
+}
+
+TEST(AttributeInterpolatorTest, TestInterpolateRange) {
+  std::unique_ptr<AttributeInterpolator> interpolator;
+  TF_ASSERT_OK(AttributeInterpolator::Create(4, 3, 2, &interpolator));
+  std::vector<float> interpolated(4 * 3 * 2, -1.0f);
+  std::vector<float> interpolated_by_ranges(4 * 3 * 2, -1.0f);
+  TF_ASSERT_OK(interpolator->Interpolate(
+      MakeTriangleIndex(), kVertices, kTriangles, kAttributes, kPerspective, 0,
+      12, absl::MakeSpan(interpolated)));
+  TF_ASSERT_OK(interpolator->Interpolate(
+      MakeTriangleIndex(), kVertices, kTriangles, kAttributes, kPerspective, 5,
+      12, absl::MakeSpan(interpolated_by_ranges)));
+  for (int i = 0; i < 5 * 2; ++i) EXPECT_EQ(interpolated_by_ranges[i], -1.0f);
+  TF_ASSERT_OK(interpolator->Interpolate(
+      MakeTriangleIndex(), kVertices, kTriangles, kAttributes, kPerspective, 0,
+      5, absl::MakeSpan(interpolated_by_ranges)));
+  EXPECT_EQ(interpolated_by_ranges, interpolated);
+}
+
+TEST(AttributeInterpolatorTest, TestInterpolateGrad) {
+  std::vector<float> weights(4 * 3 * 2);
+  for (int i = 0; i < weights.size(); ++i) weights[i] = 0.25f * (i % 7) - 0.5f;
+  std::vector<float> vertices = kVertices;
+  std::vector<float> attributes = kAttributes;
+  std::vector<float> view_projection_matrix = kPerspective;
+
+  std::unique_ptr<AttributeInterpolator> interpolator;
+  TF_ASSERT_OK(AttributeInterpolator::Create(4, 3, 2, &interpolator));
+  std::vector<float> vertices_grad(vertices.size(), 0.0f);
+  std::vector<float> attributes_grad(attributes.size(), 0.0f);
+  std::vector<float> view_projection_matrix_grad(16, 0.0f);
+  // The gradients of two ranges of pixels add up.
+  for (const auto& range : {std::make_pair(0, 7), std::make_pair(7, 12)}) {
+    TF_ASSERT_OK(interpolator->InterpolateGrad(
+        MakeTriangleIndex(), vertices, kTriangles, attributes,
+        view_projection_matrix, range.first, range.second, weights,
+        absl::MakeSpan(vertices_grad), absl::MakeSpan(attributes_grad),
+        absl::MakeSpan(view_projection_matrix_grad)));
+  }
+
+  CheckGradient(vertices_grad, &vertices, weights, vertices, attributes,
+                view_projection_matrix);
+  CheckGradient(attributes_grad, &attributes, weights, vertices, attributes,
+                view_projection_matrix);
+  CheckGradient(view_projection_matrix_grad, &view_projection_matrix, weights,
+                vertices, attributes, view_projection_matrix);
+}
+
+TEST(AttributeInterpolatorTest, TestInterpolateInvalidInputs) {
+  std::unique_ptr<AttributeInterpolator> interpolator;
+  TF_ASSERT_OK(AttributeInterpolator::Create(4, 3, 2, &interpolator));
+  std::vector<float> interpolated(4 * 3 * 2);
+  std::vector<int> triangle_index = MakeTriangleIndex();
+
+  // Triangle index out of range.
+  triangle_index[3] = 2;
+  EXPECT_FALSE(interpolator
+                   ->Interpolate(triangle_index, kVertices, kTriangles,
+                                 kAttributes, kPerspective, 0, 12,
+                                 absl::MakeSpan(interpolated))
+                   .ok());
+  // Vertex index out of range.
+  EXPECT_FALSE(interpolator
+                   ->Interpolate(MakeTriangleIndex(), kVertices,
+                                 {0, 1, 2, 0, 2, 4}, kAttributes, kPerspective,
+                                 0, 12, absl::MakeSpan(interpolated))
+                   .ok());
+  // Attributes of the wrong size.
+  EXPECT_FALSE(interpolator
+                   ->Interpolate(MakeTriangleIndex(), kVertices, kTriangles,
+                                 kVertices, kPerspective, 0, 12,
+                                 absl::MakeSpan(interpolated))
+                   .ok());
+  // Range of pixels outside of the image.
+  EXPECT_FALSE(interpolator
+                   ->Interpolate(MakeTriangleIndex(), kVertices, kTriangles,
+                                 kAttributes, kPerspective, 0, 13,
+                                 absl::MakeSpan(interpolated))
+                   .ok());
+}
+
+}  // namespace
@@ -0,0 +1,244 @@
+/* Copyright 2019 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#include "tensorflow_graphics/rendering/opengl/cpu_rasterizer.h"
+
+#include <array>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/types/span.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace {
+
+// Keeps the vertices in normalized device coordinates.
+const std::vector<float> kIdentity = {1.0f, 0.0f, 0.0f, 0.0f,  //
+                                      0.0f, 1.0f, 0.0f, 0.0f,  //
+                                      0.0f, 0.0f, 1.0f, 0.0f,  //
+                                      0.0f, 0.0f, 0.0f, 1.0f};
+
+// Perspective projection with a vertical field of view of 60 degrees, a near
+// plane at 0.5 and a far plane at 10, looking towards positive z.
+const std::vector<float> kPerspective = {
+    -1.7320508f, 0.0f,       0.0f,       0.0f,  //
+    0.0f,        1.7320508f, 0.0f,       0.0f,  //
+    0.0f,        0.0f,       1.1052632f, -1.0526316f,  //
+    0.0f,        0.0f,       1.0f,       0.0f};
+
+struct Images {
+  std::vector<int> triangle_index;
+  std::vector<float> barycentric_coordinates;
+  std::vector<float> depth;
+};
+
+void Rasterize(int width, int height, const std::vector<float>& vertices,
+               const std::vector<int>& triangles,
+               const std::vector<float>& view_projection_matrix,
+               Images* images) {
+  std::unique_ptr<CpuRasterizer> rasterizer;
+  TF_ASSERT_OK(CpuRasterizer::Create(width, height, &rasterizer));
+  images->triangle_index.assign(width * height, -1);
+  images->barycentric_coordinates.assign(width * height * 3, -1.0f);
+  images->depth.assign(width * height, -1.0f);
+  TF_ASSERT_OK(rasterizer->Rasterize(
+      vertices, triangles, view_projection_matrix,
+      absl::MakeSpan(images->triangle_index),
+      absl::MakeSpan(images->barycentric_coordinates),
+      absl::MakeSpan(images->depth)));
+}
+
+TEST(CpuRasterizerTest, TestCreate) {
+  std::unique_ptr<CpuRasterizer> rasterizer;
+  TF_EXPECT_OK(CpuRasterizer::Create(17, 9, &rasterizer));
+  EXPECT_EQ(rasterizer->num_tiles(), 3 * 2);
+  EXPECT_FALSE(CpuRasterizer::Create(0, 9, &rasterizer).ok());
+  EXPECT_FALSE(CpuRasterizer::Create(17, -1, &rasterizer).ok());
+}
+
+TEST(CpuRasterizerTest, TestRasterizeScreenFillingTriangle) {
+  // The image does not span a whole number of tiles.
+  const int width = 11;
+  const int height = 9;
+  const std::vector<float> vertices = {-3.0f, -3.0f, 0.0f,  //
+                                       3.0f,  -3.0f, 0.0f,  //
+                                       0.0f,  3.0f,  0.0f};
+  Images images;
+  Rasterize(width, height, vertices, {0, 1, 2}, kIdentity, &images);
+
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const int pixel = y * width + x;
+      EXPECT_EQ(images.triangle_index[pixel], 0);
+      EXPECT_FLOAT_EQ(images.depth[pixel], 0.5f);
+      // Barycentric coordinates of the pixel center in normalized device
+      // coordinates.
+      const float ndc_x = 2.0f * (x + 0.5f) / width - 1.0f;
+      const float ndc_y = 2.0f * (y + 0.5f) / height - 1.0f;
+      const float b2 = (ndc_y + 3.0f) / 6.0f;
+      const float b1 = (ndc_x + 3.0f - 3.0f * b2) / 6.0f;
+      EXPECT_NEAR(images.barycentric_coordinates[pixel * 3], 1.0f - b1 - b2,
+                  1e-5f);
+      EXPECT_NEAR(images.barycentric_coordinates[pixel * 3 + 1], b1, 1e-5f);
+      EXPECT_NEAR(images.barycentric_coordinates[pixel * 3 + 2], b2, 1e-5f);
+    }
+  }
+}
+
+TEST(CpuRasterizerTest, TestRasterizeBackFacingTriangle) {
+  const std::vector<float> vertices = {-3.0f, -3.0f, 0.0f,  //
+                                       0.0f,  3.0f,  0.0f,  //
+                                       3.0f,  -3.0f, 0.0f};
+  Images images;
+  Rasterize(8, 8, vertices, {0, 1, 2}, kIdentity, &images);
+
+  for (int pixel = 0; pixel < 8 * 8; ++pixel) {
+    EXPECT_EQ(images.triangle_index[pixel], 0);
+    EXPECT_EQ(images.depth[pixel], 1.0f);
+    EXPECT_EQ(images.barycentric_coordinates[pixel * 3], 0.0f);
+  }
+}
+
+TEST(CpuRasterizerTest, TestRasterizeDepthTest) {
+  // Screen-filling triangles at decreasing depths, the last two being at the
+  // same depth.
+  const std::vector<float> vertices = {
+      -3.0f, -3.0f, 0.5f,  3.0f, -3.0f, 0.5f,  0.0f, 3.0f, 0.5f,   //
+      -3.0f, -3.0f, 0.0f,  3.0f, -3.0f, 0.0f,  0.0f, 3.0f, 0.0f,   //
+      -3.0f, -3.0f, 0.0f,  3.0f, -3.0f, 0.0f,  0.0f, 3.0f, 0.0f,   //
+      -3.0f, -3.0f, 0.9f,  3.0f, -3.0f, 0.9f,  0.0f, 3.0f, 0.9f};
+  Images images;
+  Rasterize(16, 8, vertices, {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}, kIdentity,
+            &images);
+
+  // The first of the closest triangles is kept.
+  for (int pixel = 0; pixel < 16 * 8; ++pixel) {
+    EXPECT_EQ(images.triangle_index[pixel], 1);
+    EXPECT_FLOAT_EQ(images.depth[pixel], 0.5f);
+  }
+}
+
+TEST(CpuRasterizerTest, TestRasterizeSharedEdge) {
+  // Two triangles forming a quad covering the image, whose diagonal goes
+  // through the centers of the pixels of the diagonal of the image.
+  const int size = 12;
+  const std::vector<float> vertices = {-1.0f, -1.0f, 0.0f, 1.0f, -1.0f, 0.0f,
+                                       -1.0f, 1.0f,  0.0f, 1.0f, 1.0f,  0.0f};
+  const std::vector<int> lower_triangle = {0, 1, 3};
+  const std::vector<int> upper_triangle = {0, 3, 2};
+  Images lower_images, upper_images;
+  Rasterize(size, size, vertices, lower_triangle, kIdentity, &lower_images);
+  Rasterize(size, size, vertices, upper_triangle, kIdentity, &upper_images);
+
+  // Each pixel is covered by exactly one of the triangles.
+  for (int pixel = 0; pixel < size * size; ++pixel) {
+    const bool lower = lower_images.depth[pixel] < 1.0f;
+    const bool upper = upper_images.depth[pixel] < 1.0f;
+    EXPECT_NE(lower, upper) << "pixel " << pixel;
+  }
+}
+
+TEST(CpuRasterizerTest, TestRasterizeClipping) {
+  // Beyond the far plane, then in front of the near plane.
+  const std::vector<float> vertices = {
+      -3.0f, -3.0f, 1.5f,   3.0f, -3.0f, 1.5f,   0.0f, 3.0f, 1.5f,  //
+      -3.0f, -3.0f, -1.5f,  3.0f, -3.0f, -1.5f,  0.0f, 3.0f, -1.5f,  //
+      // Goes from beyond the far plane at the bottom of the image to in front
+      // of the near plane at the top.
+      -3.0f, -1.0f, 3.0f,   3.0f, -1.0f, 3.0f,   0.0f, 1.0f, -3.0f};
+  Images images;
+  Rasterize(8, 8, vertices, {0, 1, 2, 3, 4, 5, 6, 7, 8}, kIdentity, &images);
+
+  // Only the part of the last triangle within the depth range is visible.
+  for (int y = 0; y < 8; ++y) {
+    // Normalized device depth of the row.
+    const float z = -3.0f * (2.0f * (y + 0.5f) / 8.0f - 1.0f);
+    for (int x = 0; x < 8; ++x) {
+      const int pixel = y * 8 + x;
+      if (std::abs(z) <= 1.0f) {
+        EXPECT_EQ(images.triangle_index[pixel], 2);
+        EXPECT_NEAR(images.depth[pixel], 0.5f * z + 0.5f, 1e-5f);
+      } else {
+        EXPECT_EQ(images.depth[pixel], 1.0f);
+      }
+    }
+  }
+}
+
+TEST(CpuRasterizerTest, TestRasterizePerspective) {
+  // A triangle slanted in depth, with a vertex behind the camera.
+  const int width = 13;
+  const int height = 10;
+  const std::vector<float> vertices = {1.0f,  -1.0f, 2.0f,  //
+                                       -1.0f, -1.0f, 6.0f,  //
+                                       0.0f,  1.0f,  -1.0f};
+  const std::vector<int> triangles = {0, 2, 1};
+  Images images;
+  Rasterize(width, height, vertices, triangles, kPerspective, &images);
+
+  int num_covered = 0;
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const int pixel = y * width + x;
+      if (images.depth[pixel] == 1.0f) continue;
+      ++num_covered;
+      // The point interpolated with the barycentric coordinates projects onto
+      // the center of the pixel.
+      std::array<float, 4> point = {0.0f, 0.0f, 0.0f, 1.0f};
+      for (int i = 0; i < 3; ++i) {
+        const float weight = images.barycentric_coordinates[pixel * 3 + i];
+        EXPECT_GE(weight, 0.0f);
+        for (int j = 0; j < 3; ++j)
+          point[j] += weight * vertices[triangles[i] * 3 + j];
+      }
+      std::array<float, 4> clip = {0.0f, 0.0f, 0.0f, 0.0f};
+      for (int row = 0; row < 4; ++row) {
+        for (int column = 0; column < 4; ++column)
+          clip[row] += kPerspective[row * 4 + column] * point[column];
+      }
+      EXPECT_NEAR(clip[0] / clip[3], 2.0f * (x + 0.5f) / width - 1.0f, 1e-4f);
+      EXPECT_NEAR(clip[1] / clip[3], 2.0f * (y + 0.5f) / height - 1.0f, 1e-4f);
+      EXPECT_NEAR(images.depth[pixel], 0.5f * clip[2] / clip[3] + 0.5f, 1e-4f);
+    }
+  }
+  EXPECT_GT(num_covered, 0);
+}
+
+TEST(CpuRasterizerTest, TestRasterizeInvalidInputs) {
+  std::unique_ptr<CpuRasterizer> rasterizer;
+  TF_ASSERT_OK(CpuRasterizer::Create(4, 4, &rasterizer));
+  std::vector<int> triangle_index(4 * 4);
+  std::vector<float> barycentric_coordinates(4 * 4 * 3);
+  std::vector<float> depth(4 * 4);
+  const std::vector<float> vertices = {-1.0f, -1.0f, 0.0f, 1.0f, -1.0f, 0.0f,
+                                       0.0f,  1.0f,  0.0f};
+
+  // Vertex index out of range.
+  EXPECT_FALSE(rasterizer
+                   ->Rasterize(vertices, {0, 1, 3}, kIdentity,
+                               absl::MakeSpan(triangle_index),
+                               absl::MakeSpan(barycentric_coordinates),
+                               absl::MakeSpan(depth))
+                   .ok());
+  // Outputs of the wrong size.
+  EXPECT_FALSE(rasterizer
+                   ->Rasterize(vertices, {0, 1, 2}, kIdentity,
+                               absl::MakeSpan(triangle_index),
+                               absl::MakeSpan(depth), absl::MakeSpan(depth))
+                   .ok());
+}
+
+}  // namespace
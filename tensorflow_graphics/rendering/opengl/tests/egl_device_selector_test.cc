@@ -0,0 +1,157 @@
+/* Copyright 2019 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#include "tensorflow_graphics/rendering/opengl/egl_device_selector.h"
+
+#include <memory>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "tensorflow_graphics/rendering/opengl/egl_offscreen_context.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace {
+
+// Devices with a given number of contexts each.
+class FakeEGLDevices : public EGLDevices {
+ public:
+  explicit FakeEGLDevices(const std::vector<int>& num_contexts)
+      : num_contexts_(num_contexts) {}
+
+  int GetNumDevices() override {
+    ++num_enumerations_;
+    return num_contexts_.size();
+  }
+
+  int GetNumContexts(int device_index) override {
+    if (device_index < 0 ||
+        device_index >= static_cast<int>(num_contexts_.size()))
+      return -1;
+    return num_contexts_[device_index];
+  }
+
+  std::vector<int> num_contexts_;
+  int num_enumerations_ = 0;
+};
+
+// Devices which cannot be enumerated.
+class FailingEGLDevices : public EGLDevices {
+ public:
+  int GetNumDevices() override { return -1; }
+  int GetNumContexts(int device_index) override { return -1; }
+};
+
+TEST(EGLDeviceSelectorTest, TestPinned) {
+  FakeEGLDevices devices({0, 0, 0});
+  std::unique_ptr<EGLDeviceSelector> selector;
+  TF_ASSERT_OK(EGLDeviceSelector::Create(EGLDeviceSelector::Policy::kPinned, 1,
+                                         &devices, &selector));
+  // The devices are not enumerated.
+  EXPECT_EQ(selector->num_devices(), 0);
+  EXPECT_EQ(devices.num_enumerations_, 0);
+
+  for (int i = 0; i < 4; ++i) {
+    int device_index = -1;
+    TF_ASSERT_OK(selector->SelectDevice(&device_index));
+    EXPECT_EQ(device_index, 1);
+  }
+}
+
+TEST(EGLDeviceSelectorTest, TestRoundRobin) {
+  FakeEGLDevices devices({5, 0, 0});
+  std::unique_ptr<EGLDeviceSelector> selector;
+  TF_ASSERT_OK(EGLDeviceSelector::Create(
+      EGLDeviceSelector::Policy::kRoundRobin, 1, &devices, &selector));
+  EXPECT_EQ(selector->num_devices(), 3);
+
+  // The number of contexts of each device is ignored.
+  for (int expected_index : {1, 2, 0, 1, 2, 0}) {
+    int device_index = -1;
+    TF_ASSERT_OK(selector->SelectDevice(&device_index));
+    EXPECT_EQ(device_index, expected_index);
+  }
+}
+
+TEST(EGLDeviceSelectorTest, TestLeastLoaded) {
+  FakeEGLDevices devices({2, 1, 3});
+  std::unique_ptr<EGLDeviceSelector> selector;
+  TF_ASSERT_OK(EGLDeviceSelector::Create(
+      EGLDeviceSelector::Policy::kLeastLoaded, 0, &devices, &selector));
+
+  // Each selection creates a context on the selected device.
+  for (int expected_index : {1, 0, 1, 2, 0, 1}) {
+    int device_index = -1;
+    TF_ASSERT_OK(selector->SelectDevice(&device_index));
+    EXPECT_EQ(device_index, expected_index);
+    ++devices.num_contexts_[device_index];
+  }
+
+  // Ties are broken in turn, starting after the last selected device.
+  devices.num_contexts_ = {0, 0, 0};
+  for (int expected_index : {2, 0, 1, 2}) {
+    int device_index = -1;
+    TF_ASSERT_OK(selector->SelectDevice(&device_index));
+    EXPECT_EQ(device_index, expected_index);
+  }
+}
+
+TEST(EGLDeviceSelectorTest, TestInvalidDeviceIndex) {
+  FakeEGLDevices devices({0, 0});
+  std::unique_ptr<EGLDeviceSelector> selector;
+  EXPECT_FALSE(EGLDeviceSelector::Create(EGLDeviceSelector::Policy::kPinned,
+                                         -1, &devices, &selector)
+                   .ok());
+  EXPECT_FALSE(EGLDeviceSelector::Create(
+                   EGLDeviceSelector::Policy::kRoundRobin, 2, &devices,
+                   &selector)
+                   .ok());
+  EXPECT_FALSE(EGLDeviceSelector::Create(
+                   EGLDeviceSelector::Policy::kRoundRobin, -1, &devices,
+                   &selector)
+                   .ok());
+  // The pinned device is only validated when a context is created on it.
+  TF_EXPECT_OK(EGLDeviceSelector::Create(EGLDeviceSelector::Policy::kPinned, 2,
+                                         &devices, &selector));
+}
+
+TEST(EGLDeviceSelectorTest, TestNoDevices) {
+  FakeEGLDevices no_devices({});
+  FailingEGLDevices failing_devices;
+  std::unique_ptr<EGLDeviceSelector> selector;
+  EXPECT_FALSE(EGLDeviceSelector::Create(
+                   EGLDeviceSelector::Policy::kRoundRobin, 0, &no_devices,
+                   &selector)
+                   .ok());
+  EXPECT_FALSE(EGLDeviceSelector::Create(
+                   EGLDeviceSelector::Policy::kLeastLoaded, 0,
+                   &failing_devices, &selector)
+                   .ok());
+}
+
+TEST(EGLDeviceSelectorTest, TestDefaultDevices) {
+  // The machine running the test has at least one device.
+  EGLDevices* devices = EGLDevices::Default();
+  ASSERT_GE(devices->GetNumDevices(), 1);
+  EXPECT_EQ(devices->GetNumContexts(0), 0);
+  EXPECT_EQ(devices->GetNumContexts(-1), -1);
+
+  std::unique_ptr<EGLOffscreenContext> context;
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context, 0));
+  EXPECT_EQ(devices->GetNumContexts(0), 1);
+  context.reset();
+  EXPECT_EQ(devices->GetNumContexts(0), 0);
+}
+
+}  // namespace
@@ -15,9 +15,12 @@ limitations under the License.
 #include "tensorflow_graphics/rendering/opengl/egl_offscreen_context.h"
 
 #include <GLES3/gl32.h>
+#include <string>
+
 #include "gtest/gtest.h"
 
 #include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/test_benchmark.h"
 
 namespace {
 
@@ -75,6 +78,55 @@ TEST(EglOffscreenContextTest, TestRelease) {
   TF_EXPECT_OK(context->Release());
 }
 
+TEST(EglOffscreenContextTest, TestCreateShared) {
+  std::unique_ptr<EGLOffscreenContext> context1;
+  std::unique_ptr<EGLOffscreenContext> context2;
+  std::unique_ptr<EGLOffscreenContext> context3;
+  GLuint buffer;
+
+  TF_ASSERT_OK(EGLOffscreenContext::CreateShared(&context1));
+  TF_ASSERT_OK(EGLOffscreenContext::CreateShared(&context2));
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context3));
+  EXPECT_TRUE(context1->IsShared());
+  EXPECT_FALSE(context3->IsShared());
+
+  // Buffers created in a shared context exist in the other shared contexts
+  // only.
+  TF_ASSERT_OK(context1->MakeCurrent());
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glFinish();
+  TF_ASSERT_OK(context2->MakeCurrent());
+  EXPECT_EQ(glIsBuffer(buffer), GL_TRUE);
+  TF_ASSERT_OK(context3->MakeCurrent());
+  EXPECT_EQ(glIsBuffer(buffer), GL_FALSE);
+
+  // The share group outlives the context that created the buffer.
+  context1.reset();
+  TF_ASSERT_OK(context2->MakeCurrent());
+  EXPECT_EQ(glIsBuffer(buffer), GL_TRUE);
+  glDeleteBuffers(1, &buffer);
+  TF_EXPECT_OK(context2->Release());
+}
+
+TEST(EglOffscreenContextTest, TestCreateSurfaceless) {
+  std::unique_ptr<EGLOffscreenContext> context;
+  GLuint buffer;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  const std::string extensions =
+      eglQueryString(eglGetCurrentDisplay(), EGL_EXTENSIONS);
+  // The empty pixel buffer surface is not created if it is not needed.
+  if (extensions.find("EGL_KHR_surfaceless_context") != std::string::npos)
+    EXPECT_EQ(eglGetCurrentSurface(EGL_DRAW), EGL_NO_SURFACE);
+  glGenBuffers(1, &buffer);
+  glDeleteBuffers(1, &buffer);
+  EXPECT_EQ(glGetError(), GL_NO_ERROR);
+  TF_EXPECT_OK(context->Release());
+}
+
 TEST(EglOffscreenContextTest, TestRenderClear) {
   std::unique_ptr<EGLOffscreenContext> context;
   const float kRed = 0.1;
@@ -104,4 +156,31 @@ TEST(EglOffscreenContextTest, TestRenderClear) {
   TF_EXPECT_OK(context->Release());
 }
 
+// Creates and destroys contexts, the last one of a display being destroyed
+// each time.
+static void BM_CreateContext(int iters) {
+  for (int i = 0; i < iters; ++i) {
+    std::unique_ptr<EGLOffscreenContext> context;
+    TF_CHECK_OK(EGLOffscreenContext::Create(&context));
+    TF_CHECK_OK(context->MakeCurrent());
+    TF_CHECK_OK(context->Release());
+  }
+}
+BENCHMARK(BM_CreateContext);
+
+// Same, while another context keeps the display in use.
+static void BM_CreateContextWithDisplayInUse(int iters) {
+  tensorflow::testing::StopTiming();
+  std::unique_ptr<EGLOffscreenContext> context_in_use;
+  TF_CHECK_OK(EGLOffscreenContext::Create(&context_in_use));
+  tensorflow::testing::StartTiming();
+  for (int i = 0; i < iters; ++i) {
+    std::unique_ptr<EGLOffscreenContext> context;
+    TF_CHECK_OK(EGLOffscreenContext::Create(&context));
+    TF_CHECK_OK(context->MakeCurrent());
+    TF_CHECK_OK(context->Release());
+  }
+}
+BENCHMARK(BM_CreateContextWithDisplayInUse);
+
 }  // namespace
@@ -14,6 +14,11 @@ limitations under the License.
 ==============================================================================*/
 #include "tensorflow_graphics/rendering/opengl/gl_program.h"
 
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <fstream>
+
 #include "gtest/gtest.h"
 #include "tensorflow_graphics/rendering/opengl/egl_offscreen_context.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
@@ -127,4 +132,131 @@ TEST(ProgramTest, TestGetExistingResourceProperty) {
   TF_EXPECT_OK(context->Release());
 }
 
+TEST(ProgramTest, TestReflection) {
+  std::unique_ptr<EGLOffscreenContext> context;
+  std::unique_ptr<gl_utils::Program> program;
+  const std::string kStorageBlockShaderCode =
+      "#version 460\n"
+      "uniform mat3x2 matrices[2];\n"
+      "layout(std430, binding = 3) buffer values { vec4 data[4]; };\n"
+      "in layout(location = 2) vec3 normal;\n"
+      "void main() {\n"
+      "  data[0].xy = matrices[1][0];\n"
+      "  data[gl_VertexID].xyz = normal;\n"
+      "}\n";
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+
+  std::vector<std::pair<std::string, GLenum>> shaders{
+      std::make_pair(kStorageBlockShaderCode, GL_VERTEX_SHADER),
+      std::make_pair(geometry_shader_code, GL_GEOMETRY_SHADER)};
+  TF_ASSERT_OK(gl_utils::Program::Create(shaders, &program));
+
+  // The reflected properties match the ones queried from the program.
+  const GLenum kProperties[] = {GL_TYPE, GL_LOCATION};
+  GLint property_values[2];
+  TF_ASSERT_OK(program->GetResourceProperty("view_projection_matrix",
+                                            GL_UNIFORM, 2, kProperties, 2,
+                                            property_values));
+  const gl_utils::ProgramResource* uniform =
+      program->GetUniform("view_projection_matrix");
+  ASSERT_NE(uniform, nullptr);
+  EXPECT_EQ(uniform->type, GLenum(GL_FLOAT_MAT4));
+  EXPECT_EQ(uniform->type, GLenum(property_values[0]));
+  EXPECT_EQ(uniform->location, property_values[1]);
+  EXPECT_EQ(uniform->size, 1);
+
+  const gl_utils::ProgramResource* array_uniform =
+      program->GetUniform("matrices");
+  ASSERT_NE(array_uniform, nullptr);
+  EXPECT_EQ(array_uniform->type, GLenum(GL_FLOAT_MAT3x2));
+  EXPECT_EQ(array_uniform->size, 2);
+
+  const gl_utils::ProgramResource* block =
+      program->GetShaderStorageBlock("values");
+  ASSERT_NE(block, nullptr);
+  EXPECT_EQ(block->binding, 3);
+  EXPECT_EQ(block->size, 64);
+  EXPECT_EQ(program->GetShaderStorageBlocks().size(), 1);
+
+  // Built-in inputs are not reported.
+  const gl_utils::ProgramResource* attribute =
+      program->GetVertexAttribute("normal");
+  ASSERT_NE(attribute, nullptr);
+  EXPECT_EQ(attribute->type, GLenum(GL_FLOAT_VEC3));
+  EXPECT_EQ(attribute->location, 2);
+  EXPECT_EQ(program->GetVertexAttribute("gl_VertexID"), nullptr);
+
+  EXPECT_EQ(program->GetUniform("values"), nullptr);
+  EXPECT_EQ(program->GetShaderStorageBlock("view_projection_matrix"), nullptr);
+  TF_EXPECT_OK(context->Release());
+}
+
+TEST(ProgramTest, TestCreateProgramWithBinaryCache) {
+  std::unique_ptr<EGLOffscreenContext> context;
+  GLenum kProperty = GL_TYPE;
+  const std::string cache_directory =
+      ::testing::TempDir() + "/program_binary_cache";
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  mkdir(cache_directory.c_str(), 0755);
+
+  std::vector<std::pair<std::string, GLenum>> shaders{
+      std::make_pair(kEmptyShaderCode, GL_VERTEX_SHADER),
+      std::make_pair(geometry_shader_code, GL_GEOMETRY_SHADER)};
+  // The first program is compiled and cached, the second one is loaded from
+  // the cache, and the last one is compiled again as the cached binary has
+  // been corrupted.
+  for (int iteration = 0; iteration < 3; ++iteration) {
+    std::unique_ptr<gl_utils::Program> program;
+    GLint property_value;
+
+    TF_ASSERT_OK(gl_utils::Program::CreateWithBinaryCache(
+        shaders, cache_directory, &program));
+    TF_EXPECT_OK(program->GetResourceProperty("view_projection_matrix",
+                                              GL_UNIFORM, 1, &kProperty, 1,
+                                              &property_value));
+
+    if (iteration == 1) {
+      DIR* directory = opendir(cache_directory.c_str());
+      ASSERT_NE(directory, nullptr);
+      while (dirent* entry = readdir(directory)) {
+        if (entry->d_name[0] == '.') continue;
+        std::ofstream(cache_directory + "/" + entry->d_name,
+                      std::ios::binary | std::ios::trunc)
+            << "corrupted binary";
+      }
+      closedir(directory);
+    }
+  }
+  TF_EXPECT_OK(context->Release());
+}
+
+TEST(ProgramTest, TestCreateProgramFromBinary) {
+  std::unique_ptr<EGLOffscreenContext> context;
+  std::unique_ptr<gl_utils::Program> program;
+  std::unique_ptr<gl_utils::Program> loaded_program;
+  gl_utils::ProgramBinary binary;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+
+  std::vector<std::pair<std::string, GLenum>> shaders{
+      std::make_pair(kEmptyShaderCode, GL_VERTEX_SHADER),
+      std::make_pair(geometry_shader_code, GL_GEOMETRY_SHADER)};
+  TF_ASSERT_OK(gl_utils::Program::CreateRetrievable(shaders, &program));
+  TF_ASSERT_OK(program->GetBinary(&binary));
+  EXPECT_FALSE(binary.data.empty());
+  TF_ASSERT_OK(gl_utils::Program::CreateFromBinary(binary, &loaded_program));
+  EXPECT_NE(loaded_program->GetUniform("view_projection_matrix"), nullptr);
+
+  // A corrupted binary is rejected.
+  binary.data.assign(binary.data.size(), 0);
+  EXPECT_NE(gl_utils::Program::CreateFromBinary(binary, &loaded_program),
+            tensorflow::Status::OK());
+  TF_EXPECT_OK(context->Release());
+}
+
 }  // namespace
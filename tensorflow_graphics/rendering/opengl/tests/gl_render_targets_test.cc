@@ -14,6 +14,8 @@ limitations under the License.
 ==============================================================================*/
 #include "tensorflow_graphics/rendering/opengl/gl_render_targets.h"
 
+#include <array>
+
 #include "gtest/gtest.h"
 #include "tensorflow_graphics/rendering/opengl/egl_offscreen_context.h"
 #include "tensorflow_graphics/rendering/opengl/macros.h"
@@ -92,4 +94,328 @@ TYPED_TEST(RenderTargetsInterfaceTest, TestReadFails) {
             tensorflow::Status::OK());
 }
 
+TYPED_TEST(RenderTargetsInterfaceTest, TestLayeredRenderClear) {
+  std::unique_ptr<EGLOffscreenContext> context;
+  const float kRed = 0.5;
+  const int kWidth = 10;
+  const int kHeight = 5;
+  const int kNumLayers = 3;
+  float max_gl_value = 255.0f;
+
+  if (typeid(TypeParam) == typeid(float)) max_gl_value = 1.0f;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  std::unique_ptr<gl_utils::RenderTargets> render_targets;
+  TF_ASSERT_OK(gl_utils::RenderTargets::Create<TypeParam>(
+      kWidth, kHeight, kNumLayers, &render_targets));
+  EXPECT_EQ(render_targets->GetNumLayers(), kNumLayers);
+
+  // Clearing a layered frame buffer clears all its layers.
+  glClearColor(kRed, 0.0, 0.0, 0.0);
+  glClear(GL_COLOR_BUFFER_BIT);
+  ASSERT_EQ(glGetError(), GL_NO_ERROR);
+  std::vector<TypeParam> pixels(kWidth * kHeight * 4 * kNumLayers);
+  TF_ASSERT_OK(render_targets->CopyPixelsInto(absl::MakeSpan(pixels)));
+  for (int index = 0; index < kWidth * kHeight * kNumLayers; ++index)
+    EXPECT_NEAR(pixels[index * 4], kRed * max_gl_value, 1.0);
+
+  // A buffer sized for a single layer is rejected.
+  std::vector<TypeParam> single_layer_pixels(kWidth * kHeight * 4);
+  EXPECT_NE(
+      render_targets->CopyPixelsInto(absl::MakeSpan(single_layer_pixels)),
+      tensorflow::Status::OK());
+  TF_EXPECT_OK(context->Release());
+}
+
+TYPED_TEST(RenderTargetsInterfaceTest, TestCopyPixelsIntoAsync) {
+  std::unique_ptr<EGLOffscreenContext> context;
+  const std::vector<float> kReds = {0.0, 0.5, 1.0};
+  const int kWidth = 10;
+  const int kHeight = 5;
+  float max_gl_value = 255.0f;
+
+  if (typeid(TypeParam) == typeid(float)) max_gl_value = 1.0f;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  std::unique_ptr<gl_utils::RenderTargets> render_targets;
+  TF_ASSERT_OK(gl_utils::RenderTargets::Create<TypeParam>(kWidth, kHeight,
+                                                          &render_targets));
+
+  // Queue more copies than there are pixel buffers, with a different clear
+  // color for each of them.
+  std::vector<std::vector<TypeParam>> pixels(
+      kReds.size(), std::vector<TypeParam>(kWidth * kHeight * 4));
+  for (int index = 0; index < kReds.size(); ++index) {
+    glClearColor(kReds[index], 0.0, 0.0, 0.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    ASSERT_EQ(glGetError(), GL_NO_ERROR);
+    TF_ASSERT_OK(
+        render_targets->CopyPixelsIntoAsync(absl::MakeSpan(pixels[index])));
+  }
+  TF_ASSERT_OK(render_targets->FinishPendingCopies());
+
+  for (int index = 0; index < kReds.size(); ++index)
+    for (int pixel = 0; pixel < kWidth * kHeight; ++pixel)
+      EXPECT_NEAR(pixels[index][pixel * 4], kReds[index] * max_gl_value, 1.0);
+
+  std::vector<TypeParam> invalid_pixels(kWidth * kHeight * 3);
+  EXPECT_NE(
+      render_targets->CopyPixelsIntoAsync(absl::MakeSpan(invalid_pixels)),
+      tensorflow::Status::OK());
+  TF_EXPECT_OK(context->Release());
+}
+
+TYPED_TEST(RenderTargetsInterfaceTest, TestCopyPixelsIntoChannels) {
+  std::unique_ptr<EGLOffscreenContext> context;
+  const float kColor[] = {0.2, 0.4, 0.6, 1.0};
+  const int kWidth = 10;
+  const int kHeight = 5;
+  float max_gl_value = 255.0f;
+
+  if (typeid(TypeParam) == typeid(float)) max_gl_value = 1.0f;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  std::unique_ptr<gl_utils::RenderTargets> render_targets;
+  TF_ASSERT_OK(gl_utils::RenderTargets::Create<TypeParam>(kWidth, kHeight,
+                                                          &render_targets));
+  TF_ASSERT_OK(render_targets->Clear(kColor[0], kColor[1], kColor[2],
+                                     kColor[3], 1.0));
+
+  for (int num_channels = 1; num_channels <= 4; ++num_channels) {
+    std::vector<TypeParam> pixels(kWidth * kHeight * num_channels);
+    std::vector<TypeParam> async_pixels(kWidth * kHeight * num_channels);
+    TF_ASSERT_OK(
+        render_targets->CopyPixelsInto(absl::MakeSpan(pixels), num_channels));
+    TF_ASSERT_OK(render_targets->CopyPixelsIntoAsync(
+        absl::MakeSpan(async_pixels), num_channels));
+    TF_ASSERT_OK(render_targets->FinishPendingCopies());
+    for (int index = 0; index < pixels.size(); ++index) {
+      EXPECT_NEAR(pixels[index], kColor[index % num_channels] * max_gl_value,
+                  1.0);
+      EXPECT_EQ(async_pixels[index], pixels[index]);
+    }
+  }
+
+  std::vector<TypeParam> pixels(kWidth * kHeight * 5);
+  EXPECT_NE(render_targets->CopyPixelsInto(absl::MakeSpan(pixels), 5),
+            tensorflow::Status::OK());
+  EXPECT_NE(render_targets->CopyPixelsInto(absl::MakeSpan(pixels), 2),
+            tensorflow::Status::OK());
+  TF_EXPECT_OK(context->Release());
+}
+
+TEST(RenderTargetsTest, TestColorAttachments) {
+  std::unique_ptr<EGLOffscreenContext> context;
+  const int kWidth = 10;
+  const int kHeight = 5;
+  const int kNumPixels = kWidth * kHeight;
+  const std::vector<GLenum> kColorFormats = {GL_RGBA32F, GL_R32F, GL_RG8};
+  const std::vector<std::array<float, 4>> kClearColors = {
+      {0.25, 0.5, 0.75, 1.0}, {42.0, 0.0, 0.0, 0.0}, {0.0, 1.0, 0.0, 0.0}};
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+
+  for (const int num_layers : {1, 3}) {
+    std::unique_ptr<gl_utils::RenderTargets> render_targets;
+    TF_ASSERT_OK(gl_utils::RenderTargets::Create(
+        kWidth, kHeight, num_layers, kColorFormats, &render_targets));
+    EXPECT_EQ(render_targets->GetColorFormats(), kColorFormats);
+
+    // Clear each attachment with its own color.
+    for (int index = 0; index < kColorFormats.size(); ++index)
+      glClearBufferfv(GL_COLOR, index, kClearColors[index].data());
+    ASSERT_EQ(glGetError(), GL_NO_ERROR);
+
+    const int num_values = kNumPixels * num_layers;
+    std::vector<float> rgba(num_values * 4);
+    std::vector<float> red(num_values);
+    std::vector<unsigned char> red_green(num_values * 2);
+    TF_ASSERT_OK(render_targets->CopyColorAttachmentPixelsInto(
+        0, absl::MakeSpan(rgba)));
+    TF_ASSERT_OK(
+        render_targets->CopyColorAttachmentPixelsInto(1, absl::MakeSpan(red)));
+    TF_ASSERT_OK(render_targets->CopyColorAttachmentPixelsIntoAsync(
+        2, absl::MakeSpan(red_green)));
+    TF_ASSERT_OK(render_targets->FinishPendingCopies());
+
+    for (int index = 0; index < num_values; ++index) {
+      for (int channel = 0; channel < 4; ++channel)
+        EXPECT_EQ(rgba[index * 4 + channel], kClearColors[0][channel]);
+      EXPECT_EQ(red[index], kClearColors[1][0]);
+      EXPECT_EQ(red_green[index * 2], 0);
+      EXPECT_EQ(red_green[index * 2 + 1], 255);
+    }
+
+    // The buffer size must match the number of channels of the attachment.
+    EXPECT_NE(
+        render_targets->CopyColorAttachmentPixelsInto(1, absl::MakeSpan(rgba)),
+        tensorflow::Status::OK());
+    EXPECT_NE(
+        render_targets->CopyColorAttachmentPixelsInto(3, absl::MakeSpan(red)),
+        tensorflow::Status::OK());
+  }
+  TF_EXPECT_OK(context->Release());
+}
+
+TEST(RenderTargetsTest, TestColorAttachmentsAsyncFrames) {
+  std::unique_ptr<EGLOffscreenContext> context;
+  const int kWidth = 10;
+  const int kHeight = 5;
+  const int kNumPixels = kWidth * kHeight;
+  const int kNumFrames = 5;
+  // Attachments of different sizes, read in turn over several frames.
+  const std::vector<GLenum> kColorFormats = {GL_RGBA32F, GL_R32F, GL_RGBA32F};
+  const std::vector<int> kNumChannels = {4, 1, 4};
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  std::unique_ptr<gl_utils::RenderTargets> render_targets;
+  TF_ASSERT_OK(gl_utils::RenderTargets::Create(kWidth, kHeight, 1,
+                                               kColorFormats, &render_targets));
+
+  std::vector<std::vector<std::vector<float>>> pixels(kNumFrames);
+  for (int frame = 0; frame < kNumFrames; ++frame) {
+    for (int index = 0; index < kColorFormats.size(); ++index) {
+      const float value = frame * 10 + index;
+      const float clear_color[] = {value, value, value, value};
+      glClearBufferfv(GL_COLOR, index, clear_color);
+      ASSERT_EQ(glGetError(), GL_NO_ERROR);
+      pixels[frame].emplace_back(kNumPixels * kNumChannels[index]);
+      TF_ASSERT_OK(render_targets->CopyColorAttachmentPixelsIntoAsync(
+          index, absl::MakeSpan(pixels[frame][index])));
+    }
+  }
+  TF_ASSERT_OK(render_targets->FinishPendingCopies());
+
+  for (int frame = 0; frame < kNumFrames; ++frame) {
+    for (int index = 0; index < kColorFormats.size(); ++index) {
+      for (const float value : pixels[frame][index])
+        EXPECT_EQ(value, frame * 10 + index);
+    }
+  }
+  TF_EXPECT_OK(context->Release());
+}
+
+TEST(RenderTargetsTest, TestHalfColorBuffer) {
+  std::unique_ptr<EGLOffscreenContext> context;
+  const float kRed = 0.25;
+  const float kGreen = 1.5;
+  const int kWidth = 10;
+  const int kHeight = 5;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  std::unique_ptr<gl_utils::RenderTargets> render_targets;
+  TF_ASSERT_OK(gl_utils::RenderTargets::Create<Eigen::half>(kWidth, kHeight,
+                                                            &render_targets));
+  EXPECT_EQ(render_targets->GetColorFormats(), std::vector<GLenum>{GL_RGBA16F});
+  TF_ASSERT_OK(render_targets->Clear(kRed, kGreen, 0.0, 1.0, 1.0));
+
+  // Values outside of [0, 1] are preserved, as with float color buffers.
+  std::vector<Eigen::half> pixels(kWidth * kHeight * 4);
+  TF_ASSERT_OK(render_targets->CopyPixelsInto(absl::MakeSpan(pixels)));
+  for (int index = 0; index < kWidth * kHeight; ++index) {
+    EXPECT_EQ(static_cast<float>(pixels[index * 4]), kRed);
+    EXPECT_EQ(static_cast<float>(pixels[index * 4 + 1]), kGreen);
+  }
+  TF_EXPECT_OK(context->Release());
+}
+
+TEST(RenderTargetsTest, TestIntegerColorAttachment) {
+  std::unique_ptr<EGLOffscreenContext> context;
+  const int kWidth = 10;
+  const int kHeight = 5;
+  const int kNumPixels = kWidth * kHeight;
+  // Not representable exactly by a float.
+  const GLint kId = (1 << 24) + 1;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+
+  for (const int num_layers : {1, 3}) {
+    std::unique_ptr<gl_utils::RenderTargets> render_targets;
+    TF_ASSERT_OK(gl_utils::RenderTargets::Create(
+        kWidth, kHeight, num_layers, {GL_RGBA32F, GL_R32I}, &render_targets));
+
+    // Clear converts the clear color to integers for integer attachments.
+    TF_ASSERT_OK(render_targets->Clear(3.0, 0.0, 0.0, 1.0, 1.0));
+    std::vector<int> ids(kNumPixels * num_layers);
+    TF_ASSERT_OK(
+        render_targets->CopyColorAttachmentPixelsInto(1, absl::MakeSpan(ids)));
+    for (const int id : ids) EXPECT_EQ(id, 3);
+
+    const GLint kClearId[] = {kId, 0, 0, 0};
+    glClearBufferiv(GL_COLOR, 1, kClearId);
+    ASSERT_EQ(glGetError(), GL_NO_ERROR);
+    TF_ASSERT_OK(render_targets->CopyColorAttachmentPixelsIntoAsync(
+        1, absl::MakeSpan(ids)));
+    TF_ASSERT_OK(render_targets->FinishPendingCopies());
+    for (const int id : ids) EXPECT_EQ(id, kId);
+
+    // Integer attachments can only be read as integers, and conversely.
+    std::vector<float> float_ids(kNumPixels * num_layers);
+    EXPECT_NE(render_targets->CopyColorAttachmentPixelsInto(
+                  1, absl::MakeSpan(float_ids)),
+              tensorflow::Status::OK());
+    std::vector<int> rgba(kNumPixels * num_layers * 4);
+    EXPECT_NE(render_targets->CopyPixelsInto(absl::MakeSpan(rgba)),
+              tensorflow::Status::OK());
+  }
+  TF_EXPECT_OK(context->Release());
+}
+
+TEST(RenderTargetsTest, TestReadDepth) {
+  std::unique_ptr<EGLOffscreenContext> context;
+  const int kWidth = 10;
+  const int kHeight = 5;
+  const float kDepth = 0.75;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  // The default context uses desktop OpenGL.
+  TF_ASSERT_OK(gl_utils::RenderTargets::CheckDepthReadable());
+
+  for (const int num_layers : {1, 3}) {
+    std::unique_ptr<gl_utils::RenderTargets> render_targets;
+    TF_ASSERT_OK(gl_utils::RenderTargets::Create<float>(
+        kWidth, kHeight, num_layers, &render_targets));
+    TF_ASSERT_OK(render_targets->Clear(0.0, 0.0, 0.0, 0.0, kDepth));
+
+    std::vector<float> depth(kWidth * kHeight * num_layers);
+    std::vector<float> async_depth(kWidth * kHeight * num_layers);
+    TF_ASSERT_OK(render_targets->CopyDepthPixelsInto(absl::MakeSpan(depth)));
+    TF_ASSERT_OK(
+        render_targets->CopyDepthPixelsIntoAsync(absl::MakeSpan(async_depth)));
+    TF_ASSERT_OK(render_targets->FinishPendingCopies());
+    for (int index = 0; index < depth.size(); ++index) {
+      EXPECT_EQ(depth[index], kDepth);
+      EXPECT_EQ(async_depth[index], kDepth);
+    }
+
+    std::vector<float> invalid_depth(kWidth * kHeight * num_layers * 4);
+    EXPECT_NE(
+        render_targets->CopyDepthPixelsInto(absl::MakeSpan(invalid_depth)),
+        tensorflow::Status::OK());
+  }
+  TF_EXPECT_OK(context->Release());
+}
+
+TEST(RenderTargetsTest, TestCreateFailsWithInvalidColorFormats) {
+  std::unique_ptr<EGLOffscreenContext> context;
+  std::unique_ptr<gl_utils::RenderTargets> render_targets;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  EXPECT_NE(gl_utils::RenderTargets::Create(10, 5, 1, {}, &render_targets),
+            tensorflow::Status::OK());
+  EXPECT_NE(gl_utils::RenderTargets::Create(10, 5, 1, {GL_DEPTH_COMPONENT24},
+                                            &render_targets),
+            tensorflow::Status::OK());
+  TF_EXPECT_OK(context->Release());
+}
+
 }  // namespace
@@ -14,11 +14,49 @@ limitations under the License.
 ==============================================================================*/
 #include "tensorflow_graphics/rendering/opengl/gl_shader_storage_buffer.h"
 
+#include <cstring>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow_graphics/rendering/opengl/egl_offscreen_context.h"
 
 namespace {
 
+// Copies the range of the buffer bound to a shader storage binding point, as
+// seen by the shaders, into values; values is empty if nothing is bound.
+void ReadBoundRange(GLuint index, std::vector<float>* values) {
+  GLint buffer;
+  GLint64 start;
+  GLint64 size;
+  glGetIntegeri_v(GL_SHADER_STORAGE_BUFFER_BINDING, index, &buffer);
+  glGetInteger64i_v(GL_SHADER_STORAGE_BUFFER_START, index, &start);
+  glGetInteger64i_v(GL_SHADER_STORAGE_BUFFER_SIZE, index, &size);
+  ASSERT_EQ(glGetError(), GL_NO_ERROR);
+  values->clear();
+  if (buffer == 0) return;
+
+  // The persistently mapped buffer cannot be mapped again for reading, so the
+  // range is copied into another buffer.
+  GLuint copy;
+  glGenBuffers(1, &copy);
+  glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, copy);
+  glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_READ);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, start, 0,
+                      size);
+  const void* data =
+      glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, GL_MAP_READ_BIT);
+  ASSERT_NE(data, nullptr);
+  values->resize(size / sizeof(float));
+  std::memcpy(values->data(), data, size);
+  glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  glDeleteBuffers(1, &copy);
+  ASSERT_EQ(glGetError(), GL_NO_ERROR);
+}
+
 TEST(GLUtilsTest, TestShaderStorageBuffer) {
   std::unique_ptr<gl_utils::ShaderStorageBuffer> shader_storage_buffer;
 
@@ -36,4 +74,29 @@ TEST(GLUtilsTest, TestBindShaderStorageBuffer) {
   TF_EXPECT_OK(shader_storage_buffer->BindBufferBase(0));
 }
 
+TEST(GLUtilsTest, TestPersistentShaderStorageBuffer) {
+  std::unique_ptr<EGLOffscreenContext> context;
+  std::unique_ptr<gl_utils::ShaderStorageBuffer> shader_storage_buffer;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  TF_ASSERT_OK(gl_utils::ShaderStorageBuffer::CreatePersistent(
+      2, &shader_storage_buffer));
+  // Uploads go around the ring, and the data store grows when needed. The
+  // shaders only see the data of the last upload.
+  const std::vector<int> kSizes = {2, 1, 2, 5, 0, 3, 3, 1, 4};
+  for (int upload = 0; upload < kSizes.size(); ++upload) {
+    std::vector<float> data(kSizes[upload]);
+    for (int index = 0; index < data.size(); ++index)
+      data[index] = upload * 10 + index;
+    TF_ASSERT_OK(shader_storage_buffer->Upload(absl::MakeSpan(data)));
+    TF_ASSERT_OK(shader_storage_buffer->BindBufferBase(0));
+
+    std::vector<float> bound_data;
+    ReadBoundRange(0, &bound_data);
+    EXPECT_EQ(bound_data, data) << "upload " << upload;
+  }
+  TF_EXPECT_OK(context->Release());
+}
+
 }  // namespace
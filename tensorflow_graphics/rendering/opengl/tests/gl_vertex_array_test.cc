@@ -0,0 +1,50 @@
+/* Copyright 2020 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#include "tensorflow_graphics/rendering/opengl/gl_vertex_array.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow_graphics/rendering/opengl/egl_offscreen_context.h"
+
+namespace {
+
+TEST(GLUtilsTest, TestVertexArray) {
+  std::unique_ptr<EGLOffscreenContext> context;
+  std::unique_ptr<gl_utils::VertexArray> vertex_array;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  TF_ASSERT_OK(gl_utils::VertexArray::Create(&vertex_array));
+  EXPECT_FALSE(vertex_array->HasIndices());
+  // The buffers grow when needed.
+  for (const int num_vertices : {3, 1, 6}) {
+    std::vector<float> positions(3 * num_vertices, 1.0f);
+    std::vector<int> indices(num_vertices, 0);
+    TF_EXPECT_OK(
+        vertex_array->SetAttribute(0, 3, absl::MakeConstSpan(positions)));
+    TF_EXPECT_OK(vertex_array->SetIndices(absl::MakeConstSpan(indices)));
+  }
+  EXPECT_TRUE(vertex_array->HasIndices());
+  EXPECT_FALSE(
+      vertex_array->SetAttribute(1, 5, absl::Span<const float>()).ok());
+  TF_EXPECT_OK(vertex_array->Bind());
+  TF_EXPECT_OK(vertex_array->Unbind());
+  vertex_array.reset();
+  TF_EXPECT_OK(context->Release());
+}
+
+}  // namespace
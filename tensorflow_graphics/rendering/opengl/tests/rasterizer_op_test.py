@@ -110,6 +110,268 @@ void main() {
 }
 """
 
+# Fragment shader that additionally writes the depth and barycentric
+# coordinates of each pixel to two extra color attachments.
+test_attachments_fragment_shader = """
+#version 420
+
+in layout(location = 0) vec3 position;
+in layout(location = 1) vec3 normal;
+in layout(location = 2) vec2 bar_coord;
+in layout(location = 3) float tri_id;
+
+layout(location = 0) out vec4 output_color;
+layout(location = 1) out float output_depth;
+layout(location = 2) out vec2 output_bar_coord;
+
+void main() {
+  output_color = vec4(bar_coord, tri_id, position.z);
+  output_depth = position.z;
+  output_bar_coord = bar_coord;
+}
+"""
+
+# Fragment shader that writes the triangle index to an integer color
+# attachment, offset so that it cannot be represented exactly by a float.
+test_int32_attachment_fragment_shader = """
+#version 420
+
+in layout(location = 0) vec3 position;
+in layout(location = 1) vec3 normal;
+in layout(location = 2) vec2 bar_coord;
+in layout(location = 3) float tri_id;
+
+layout(location = 0) out vec4 output_color;
+layout(location = 1) out int output_tri_id;
+
+void main() {
+  output_color = vec4(bar_coord, tri_id, position.z);
+  output_tri_id = (1 << 24) + 1 + int(round(tri_id));
+}
+"""
+
+
+# Layered counterparts of the shaders above, where each instance of the draw
+# call renders one element of the batch into its own layer.
+test_layered_vertex_shader = """
+#version 460
+
+out int instance_id;
+
+void main() { instance_id = gl_InstanceID; }
+"""
+
+test_layered_geometry_shader = """
+#version 460
+
+uniform int num_layers;
+
+layout(points) in;
+layout(triangle_strip, max_vertices=3) out;
+
+in int instance_id[];
+out layout(location = 0) vec3 position;
+out layout(location = 1) vec3 normal;
+out layout(location = 2) vec2 bar_coord;
+out layout(location = 3) float tri_id;
+
+in int gl_PrimitiveIDIn;
+layout(binding=0) buffer triangular_mesh { float mesh_buffer[]; };
+layout(std430, row_major, binding=1) buffer view_projection_matrix {
+  mat4 view_projection_matrices[];
+};
+
+void main() {
+  int layer = instance_id[0];
+  int offset = layer * (mesh_buffer.length() / num_layers) +
+               gl_PrimitiveIDIn * 9;
+  vec3 positions[3];
+  for (int i = 0; i < 3; ++i) {
+    int o = offset + i * 3;
+    positions[i] = vec3(mesh_buffer[o], mesh_buffer[o + 1], mesh_buffer[o + 2]);
+  }
+  normal = normalize(cross(positions[1] - positions[0],
+                           positions[2] - positions[0]));
+
+  for (int i = 0; i < 3; ++i) {
+    gl_Position = view_projection_matrices[layer] * vec4(positions[i], 1);
+    gl_Layer = layer;
+    bar_coord = vec2(i==0 ? 1 : 0, i==1 ? 1 : 0);
+    tri_id = gl_PrimitiveIDIn;
+
+    position = positions[i];
+    EmitVertex();
+  }
+  EndPrimitive();
+}
+"""
+
+# Counterpart of the layered geometry shader for batch uploads, where each draw
+# call renders the batch element selected by element_index.
+test_batch_upload_geometry_shader = """
+#version 460
+
+uniform int element_index;
+uniform int num_elements;
+
+layout(points) in;
+layout(triangle_strip, max_vertices=3) out;
+
+out layout(location = 0) vec3 position;
+out layout(location = 1) vec3 normal;
+out layout(location = 2) vec2 bar_coord;
+out layout(location = 3) float tri_id;
+
+in int gl_PrimitiveIDIn;
+layout(binding=0) buffer triangular_mesh { float mesh_buffer[]; };
+layout(std430, row_major, binding=1) buffer view_projection_matrix {
+  mat4 view_projection_matrices[];
+};
+
+void main() {
+  int offset = element_index * (mesh_buffer.length() / num_elements) +
+               gl_PrimitiveIDIn * 9;
+  vec3 positions[3];
+  for (int i = 0; i < 3; ++i) {
+    int o = offset + i * 3;
+    positions[i] = vec3(mesh_buffer[o], mesh_buffer[o + 1], mesh_buffer[o + 2]);
+  }
+  normal = normalize(cross(positions[1] - positions[0],
+                           positions[2] - positions[0]));
+
+  for (int i = 0; i < 3; ++i) {
+    gl_Position =
+        view_projection_matrices[element_index] * vec4(positions[i], 1);
+    bar_coord = vec2(i==0 ? 1 : 0, i==1 ? 1 : 0);
+    tri_id = gl_PrimitiveIDIn;
+
+    position = positions[i];
+    EmitVertex();
+  }
+  EndPrimitive();
+}
+"""
+
+# Counterpart of the geometry shader above for indexed meshes, where the
+# vertices of each triangle are fetched through an index buffer.
+test_indexed_geometry_shader = """
+#version 460
+
+uniform mat4 view_projection_matrix;
+
+layout(points) in;
+layout(triangle_strip, max_vertices=3) out;
+
+out layout(location = 0) vec3 position;
+out layout(location = 1) vec3 normal;
+out layout(location = 2) vec2 bar_coord;
+out layout(location = 3) float tri_id;
+
+in int gl_PrimitiveIDIn;
+layout(binding=0) buffer mesh_vertices { float vertex_buffer[]; };
+layout(binding=1) buffer mesh_triangles { int index_buffer[]; };
+
+void main() {
+  vec3 positions[3];
+  for (int i = 0; i < 3; ++i) {
+    int o = index_buffer[gl_PrimitiveIDIn * 3 + i] * 3;
+    positions[i] =
+        vec3(vertex_buffer[o], vertex_buffer[o + 1], vertex_buffer[o + 2]);
+  }
+  normal = normalize(cross(positions[1] - positions[0],
+                           positions[2] - positions[0]));
+
+  for (int i = 0; i < 3; ++i) {
+    gl_Position = view_projection_matrix * vec4(positions[i], 1);
+    bar_coord = vec2(i==0 ? 1 : 0, i==1 ? 1 : 0);
+    tri_id = gl_PrimitiveIDIn;
+
+    position = positions[i];
+    EmitVertex();
+  }
+  EndPrimitive();
+}
+"""
+
+# Vertex and fragment shaders drawing triangles without geometry shader, the
+# vertices being fed as vertex attributes.
+test_triangles_vertex_shader = """
+#version 460
+
+uniform mat4 view_projection_matrix;
+
+in layout(location = 0) vec3 vertex_position;
+out layout(location = 0) vec3 position;
+
+void main() {
+  position = vertex_position;
+  gl_Position = view_projection_matrix * vec4(vertex_position, 1);
+}
+"""
+
+test_triangles_fragment_shader = """
+#version 460
+
+in layout(location = 0) vec3 position;
+
+out vec4 output_color;
+
+void main() {
+  // Cull back-facing triangles, as the geometry shaders above.
+  if (!gl_FrontFacing) {
+    discard;
+  }
+  output_color = vec4(0.0, 0.0, float(gl_PrimitiveID), position.z);
+}
+"""
+
+
+def _rasterize_triangle_batch(layered_batch,
+                              fragment_shader=test_fragment_shader,
+                              **kwargs):
+  """Rasterizes a batch of screen-filling triangles at increasing depths.
+
+  With flip_alternate_elements, the odd elements of the batch are mirrored
+  along x, which culls their triangle unless the batch is layered.
+  """
+  width, height = kwargs.pop("output_resolution", (8, 6))
+  flip_alternate_elements = kwargs.pop("flip_alternate_elements", False)
+  batch_size = 5
+  view_projection_matrix = glm.perspective_right_handed(
+      (60.0 * np.math.pi / 180,), (float(width) / float(height),), (1.0,),
+      (10.0,))
+  view_projection_matrix = tf.broadcast_to(
+      input=view_projection_matrix, shape=(batch_size, 4, 4))
+  if flip_alternate_elements:
+    flip = np.array([(-1.0 if idx % 2 else 1.0, 1.0, 1.0, 1.0)
+                     for idx in range(batch_size)],
+                    dtype=np.float32)
+    view_projection_matrix = view_projection_matrix * flip[:, :, np.newaxis]
+  tris = np.array([(100.0, 100.0, -idx - 2.0, -100.0, 100.0, -idx - 2.0, 0.0,
+                    -100.0, -idx - 2.0) for idx in range(batch_size)],
+                  dtype=np.float32)
+  if layered_batch:
+    vertex_shader = test_layered_vertex_shader
+    geometry_shader = test_layered_geometry_shader
+  elif kwargs.get("batch_upload", False):
+    vertex_shader = test_vertex_shader
+    geometry_shader = test_batch_upload_geometry_shader
+  else:
+    vertex_shader = test_vertex_shader
+    geometry_shader = test_geometry_shader
+
+  return rasterizer.rasterize(
+      num_points=1,
+      variable_names=("view_projection_matrix", "triangular_mesh"),
+      variable_kinds=("mat", "buffer"),
+      variable_values=(view_projection_matrix, tris),
+      output_resolution=(width, height),
+      vertex_shader=vertex_shader,
+      geometry_shader=geometry_shader,
+      fragment_shader=fragment_shader,
+      layered_batch=layered_batch,
+      **kwargs)
+
 
 class RasterizerOPTest(test_case.TestCase):
 
@@ -176,7 +438,7 @@ class RasterizerOPTest(test_case.TestCase):
           vertex_shader=test_vertex_shader,
           geometry_shader=test_geometry_shader,
           fragment_shader=test_fragment_shader,
-      )
+      ).rendered_image
 
     result = rasterize()
     self.assertAllClose(result[..., 2:4], gt)
@@ -191,6 +453,302 @@ class RasterizerOPTest(test_case.TestCase):
 
     check_lazy_shape()
 
+  def test_rasterize_layered_batch(self):
+    result = _rasterize_triangle_batch(layered_batch=False).rendered_image
+    layered_result = _rasterize_triangle_batch(
+        layered_batch=True).rendered_image
+
+    self.assertAllClose(layered_result, result)
+    self.assertAllLess(result[..., 3], 0.0)
+
+  def test_rasterize_index_buffer(self):
+    height = 6
+    width = 8
+    batch_size = 5
+    view_projection_matrix = glm.perspective_right_handed(
+        (60.0 * np.math.pi / 180,), (float(width) / float(height),), (1.0,),
+        (10.0,))
+    view_projection_matrix = tf.broadcast_to(
+        input=view_projection_matrix, shape=(batch_size, 4, 4))
+    # The vertices are stored in reverse order after an unused one.
+    vertices = np.array([(0.0, 0.0, 0.0, 0.0, -100.0, -idx - 2.0, -100.0, 100.0,
+                          -idx - 2.0, 100.0, 100.0, -idx - 2.0)
+                         for idx in range(batch_size)],
+                        dtype=np.float32)
+    triangles = np.array([(3, 2, 1)] * batch_size, dtype=np.int32)
+
+    result = _rasterize_triangle_batch(layered_batch=False).rendered_image
+    indexed_result = rasterizer.rasterize(
+        num_points=1,
+        variable_names=("view_projection_matrix", "mesh_vertices",
+                        "mesh_triangles"),
+        variable_kinds=("mat", "buffer", "index_buffer"),
+        variable_values=(view_projection_matrix, vertices, triangles),
+        output_resolution=(width, height),
+        vertex_shader=test_vertex_shader,
+        geometry_shader=test_indexed_geometry_shader,
+        fragment_shader=test_fragment_shader).rendered_image
+
+    self.assertAllClose(indexed_result, result)
+
+  @parameterized.parameters(("triangles",), ("indexed_triangles",))
+  def test_rasterize_draw_mode(self, draw_mode):
+    height = 6
+    width = 8
+    batch_size = 5
+    view_projection_matrix = glm.perspective_right_handed(
+        (60.0 * np.math.pi / 180,), (float(width) / float(height),), (1.0,),
+        (10.0,))
+    view_projection_matrix = tf.broadcast_to(
+        input=view_projection_matrix, shape=(batch_size, 4, 4))
+    vertices = np.array([(100.0, 100.0, -idx - 2.0, -100.0, 100.0, -idx - 2.0,
+                          0.0, -100.0, -idx - 2.0)
+                         for idx in range(batch_size)],
+                        dtype=np.float32)
+    triangles = np.array([(0, 1, 2)] * batch_size, dtype=np.int32)
+
+    result = _rasterize_triangle_batch(layered_batch=False).rendered_image
+    draw_mode_result = rasterizer.rasterize(
+        num_points=1,
+        variable_names=("view_projection_matrix", "vertex_position",
+                        "mesh_triangles"),
+        variable_kinds=("mat", "vertex_buffer", "index_buffer"),
+        variable_values=(view_projection_matrix, vertices, triangles),
+        output_resolution=(width, height),
+        vertex_shader=test_triangles_vertex_shader,
+        geometry_shader="",
+        fragment_shader=test_triangles_fragment_shader,
+        draw_mode=draw_mode).rendered_image
+
+    self.assertAllClose(draw_mode_result[..., 2:], result[..., 2:])
+
+  @parameterized.parameters((1, False), (3, False), (3, True))
+  def test_rasterize_batch_upload(self, parallelism, pipelined_readback):
+    result = _rasterize_triangle_batch(layered_batch=False).rendered_image
+    batch_upload_result = _rasterize_triangle_batch(
+        layered_batch=False, batch_upload=True, parallelism=parallelism,
+        pipelined_readback=pipelined_readback).rendered_image
+
+    self.assertAllClose(batch_upload_result, result)
+
+  @parameterized.parameters((False,), (True,))
+  def test_rasterize_output_resolution(self, layered_batch):
+    result = _rasterize_triangle_batch(layered_batch).rendered_image
+
+    # The same op renders each size, reusing the render targets of the sizes
+    # rendered before.
+    for width, height in ((4, 3), (8, 6), (5, 7), (4, 3)):
+      resized_result = _rasterize_triangle_batch(
+          layered_batch, output_resolution=(width, height)).rendered_image
+
+      self.assertAllEqual(resized_result.shape, (5, height, width, 4))
+      # The triangles fill the images, and their depth and index are constant.
+      self.assertAllClose(
+          resized_result[..., 2:],
+          tf.broadcast_to(
+              input=result[:, :1, :1, 2:], shape=(5, height, width, 2)))
+
+  def test_rasterize_invalid_output_resolution(self):
+    with self.assertRaisesRegexp(
+        (tf.errors.InvalidArgumentError, ValueError), "output_resolution"):
+      self.evaluate(
+          _rasterize_triangle_batch(
+              False, output_resolution=(8, 0)).rendered_image)
+
+  @parameterized.parameters((False,), (True,))
+  def test_rasterize_ragged_num_points(self, batch_upload):
+    height = 6
+    width = 8
+    batch_size = 5
+    view_projection_matrix = glm.perspective_right_handed(
+        (60.0 * np.math.pi / 180,), (float(width) / float(height),), (1.0,),
+        (10.0,))
+    view_projection_matrix = tf.broadcast_to(
+        input=view_projection_matrix, shape=(batch_size, 4, 4))
+    # The second triangle of each element is in front of the first one.
+    tris = np.array([(100.0, 100.0, -idx - 2.0, -100.0, 100.0, -idx - 2.0, 0.0,
+                      -100.0, -idx - 2.0, 100.0, 100.0, -1.5, -100.0, 100.0,
+                      -1.5, 0.0, -100.0, -1.5) for idx in range(batch_size)],
+                    dtype=np.float32)
+    num_points = np.array((1, 2, 1, 2, 1), dtype=np.int32)
+    if batch_upload:
+      geometry_shader = test_batch_upload_geometry_shader
+    else:
+      geometry_shader = test_geometry_shader
+
+    result = rasterizer.rasterize(
+        num_points=num_points,
+        variable_names=("view_projection_matrix", "triangular_mesh"),
+        variable_kinds=("mat", "buffer"),
+        variable_values=(view_projection_matrix, tris),
+        output_resolution=(width, height),
+        vertex_shader=test_vertex_shader,
+        geometry_shader=geometry_shader,
+        fragment_shader=test_fragment_shader,
+        batch_upload=batch_upload).rendered_image
+
+    # Each element only draws its own number of triangles.
+    self.assertAllEqual(
+        result[..., 2],
+        tf.broadcast_to(
+            input=tf.reshape(num_points - 1.0, (batch_size, 1, 1)),
+            shape=(batch_size, height, width)))
+
+  def test_rasterize_invalid_num_points(self):
+    with self.assertRaisesRegexp(tf.errors.InvalidArgumentError, "num_points"):
+      self.evaluate(
+          rasterizer.rasterize(
+              num_points=(1, 1),
+              variable_names=("triangular_mesh",),
+              variable_kinds=("buffer",),
+              variable_values=(((1.0,),),),
+              output_resolution=(1, 1),
+              vertex_shader=test_vertex_shader,
+              geometry_shader=test_geometry_shader,
+              fragment_shader=test_fragment_shader).rendered_image)
+
+  @parameterized.parameters((False,), (True,))
+  def test_rasterize_pipelined_readback(self, layered_batch):
+    result = _rasterize_triangle_batch(layered_batch).rendered_image
+    pipelined_result = _rasterize_triangle_batch(
+        layered_batch, pipelined_readback=True).rendered_image
+
+    self.assertAllEqual(pipelined_result, result)
+
+  @parameterized.parameters((False, 2), (False, 8), (True, 2))
+  def test_rasterize_parallelism(self, layered_batch, parallelism):
+    result = _rasterize_triangle_batch(layered_batch).rendered_image
+    parallel_result = _rasterize_triangle_batch(
+        layered_batch, parallelism=parallelism).rendered_image
+
+    self.assertAllEqual(parallel_result, result)
+
+  @parameterized.parameters((False, 1), (False, 2), (True, 1))
+  def test_rasterize_max_contexts(self, layered_batch, max_contexts):
+    result = _rasterize_triangle_batch(layered_batch).rendered_image
+    limited_result = _rasterize_triangle_batch(
+        layered_batch, parallelism=4, max_contexts=max_contexts,
+        acquire_timeout=60.0).rendered_image
+
+    self.assertAllEqual(limited_result, result)
+
+  @parameterized.parameters((False, 2), (False, 4), (True, 2))
+  def test_rasterize_shared_contexts(self, layered_batch, parallelism):
+    # Each element has a matrix of its own, so that an element rendered with
+    # the matrix of another rasterizer of the share group differs.
+    result = _rasterize_triangle_batch(
+        layered_batch, flip_alternate_elements=True).rendered_image
+    unflipped_result = _rasterize_triangle_batch(layered_batch).rendered_image
+    shared_result = _rasterize_triangle_batch(
+        layered_batch, parallelism=parallelism, shared_contexts=True,
+        flip_alternate_elements=True).rendered_image
+
+    self.assertAllEqual(shared_result, result)
+    for element in range(5):
+      if element % 2:
+        self.assertNotAllClose(shared_result[element],
+                               unflipped_result[element])
+      else:
+        self.assertAllEqual(shared_result[element], unflipped_result[element])
+
+  @parameterized.parameters(("pinned", False), ("round_robin", False),
+                            ("least_loaded", True))
+  def test_rasterize_device_policy(self, device_policy, layered_batch):
+    result = _rasterize_triangle_batch(layered_batch).rendered_image
+    placed_result = _rasterize_triangle_batch(
+        layered_batch, parallelism=4,
+        device_policy=device_policy).rendered_image
+
+    self.assertAllEqual(placed_result, result)
+
+  @parameterized.parameters(
+      ("pinned", tf.errors.InternalError, "no usable EGL device at index 1000"),
+      ("round_robin", tf.errors.InvalidArgumentError, "out of range"))
+  def test_rasterize_invalid_device_index(self, device_policy, error, message):
+    # The pinned device is only validated when its context is created.
+    with self.assertRaisesRegexp(error, message):
+      self.evaluate(
+          _rasterize_triangle_batch(
+              False, device_index=1000,
+              device_policy=device_policy).rendered_image)
+
+  @parameterized.parameters((False,), (True,))
+  def test_rasterize_attachments(self, layered_batch):
+    result = _rasterize_triangle_batch(
+        layered_batch,
+        fragment_shader=test_attachments_fragment_shader,
+        attachment_types=(tf.float32, tf.float32),
+        attachment_channels=(1, 2))
+    depth, bar_coord = result.attachments
+
+    self.assertAllEqual(depth, result.rendered_image[..., 3:4])
+    self.assertAllEqual(bar_coord, result.rendered_image[..., 0:2])
+
+  @parameterized.parameters((False,), (True,))
+  def test_rasterize_int32_attachment(self, layered_batch):
+    result = _rasterize_triangle_batch(
+        layered_batch,
+        fragment_shader=test_int32_attachment_fragment_shader,
+        attachment_types=(tf.int32,),
+        attachment_channels=(1,))
+    tri_id = result.attachments[0]
+
+    self.assertEqual(tri_id.dtype, tf.int32)
+    self.assertAllEqual(tri_id, tf.fill(tf.shape(input=tri_id), 2**24 + 1))
+
+  @parameterized.parameters((False,), (True,))
+  def test_rasterize_depth(self, layered_batch):
+    result = _rasterize_triangle_batch(layered_batch)
+    depth_result = _rasterize_triangle_batch(layered_batch, output_depth=True)
+    depth_only_result = _rasterize_triangle_batch(
+        layered_batch, depth_only=True)
+    depth = depth_result.depth
+
+    self.assertEqual(result.depth.shape[-1], 0)
+    self.assertEqual(depth_only_result.rendered_image.shape[-1], 0)
+    self.assertAllEqual(depth_result.rendered_image, result.rendered_image)
+    self.assertAllEqual(depth_only_result.depth, depth)
+    # The triangles are further away for each batch element.
+    self.assertAllGreater(depth, 0.0)
+    self.assertAllGreater(depth[1:] - depth[:-1], 0.0)
+
+  @parameterized.parameters((False, tf.float16, 1e-3), (False, tf.uint8, 1.0),
+                            (True, tf.float16, 1e-3), (True, tf.uint8, 1.0))
+  def test_rasterize_output_dtype(self, layered_batch, output_dtype, atol):
+    result = _rasterize_triangle_batch(layered_batch).rendered_image
+    typed_result = _rasterize_triangle_batch(
+        layered_batch, output_dtype=output_dtype).rendered_image
+
+    self.assertEqual(typed_result.dtype, output_dtype)
+    if output_dtype == tf.uint8:
+      result = tf.clip_by_value(result, 0.0, 1.0) * 255.0
+    else:
+      atol *= tf.reduce_max(input_tensor=tf.abs(result))
+    self.assertAllClose(
+        tf.cast(typed_result, tf.float32), result, rtol=1e-3, atol=atol)
+
+  @parameterized.parameters((False, 1), (False, 3), (True, 2))
+  def test_rasterize_num_channels(self, layered_batch, num_channels):
+    result = _rasterize_triangle_batch(layered_batch).rendered_image
+    channels_result = _rasterize_triangle_batch(
+        layered_batch, num_channels=num_channels).rendered_image
+
+    self.assertEqual(channels_result.shape[-1], num_channels)
+    self.assertAllEqual(channels_result, result[..., :num_channels])
+
+  def test_rasterize_invalid_attachment_channels(self):
+    if tf.executing_eagerly():
+      error = tf.errors.InvalidArgumentError
+    else:
+      error = ValueError
+    with self.assertRaisesRegexp(error, "attachment"):
+      self.evaluate(
+          _rasterize_triangle_batch(
+              False,
+              fragment_shader=test_attachments_fragment_shader,
+              attachment_types=(tf.float32,),
+              attachment_channels=(3,)).rendered_image)
+
   @parameterized.parameters(
       ("The variable names, kinds, and values must have the same size.",
        ["var1"], ["buffer", "buffer"], [[1.0], [1.0]],
@@ -207,6 +765,8 @@ class RasterizerOPTest(test_case.TestCase):
        tf.errors.InvalidArgumentError, ValueError),
       ("has an invalid", ["var1"], ["buffer"], [1.0],
        tf.errors.InvalidArgumentError, ValueError),
+      ("has an invalid type", ["var1"], ["index_buffer"], [[1.0]],
+       tf.errors.InvalidArgumentError, tf.errors.InvalidArgumentError),
   )
   def test_invalid_variable_inputs(self, error_msg, variable_names,
                                    variable_kinds, variable_values, error_eager,
@@ -228,7 +788,7 @@ class RasterizerOPTest(test_case.TestCase):
               output_resolution=(width, height),
               vertex_shader=empty_shader_code,
               geometry_shader=empty_shader_code,
-              fragment_shader=empty_shader_code))
+              fragment_shader=empty_shader_code).rendered_image)
 
 
 if __name__ == "__main__":
@@ -101,6 +101,112 @@ const std::string kGeometryShaderCode =
     "  EndPrimitive();\n"
     "}\n";
 
+const std::string kTriangleVertexShaderCode =
+    "#version 460\n"
+    "\n"
+    "uniform mat4 view_projection_matrix;\n"
+    "\n"
+    "in layout(location = 0) vec3 vertex_position;\n"
+    "out layout(location = 0) vec3 position;\n"
+    "\n"
+    "void main() {\n"
+    "  position = vertex_position;\n"
+    "  gl_Position = view_projection_matrix * vec4(vertex_position, 1);\n"
+    "}\n";
+
+const std::string kTriangleFragmentShaderCode =
+    "#version 460\n"
+    "\n"
+    "in layout(location = 0) vec3 position;\n"
+    "\n"
+    "out vec4 output_color;\n"
+    "\n"
+    "void main() { output_color = vec4(0.0, 0.0, 0.0, position.z); }\n";
+
+const std::string kLayeredVertexShaderCode =
+    "#version 460\n"
+    "\n"
+    "out int instance_id;\n"
+    "\n"
+    "void main() { instance_id = gl_InstanceID; }\n";
+
+const std::string kLayeredGeometryShaderCode =
+    "#version 460\n"
+    "\n"
+    "uniform int num_layers;\n"
+    "\n"
+    "layout(points) in;\n"
+    "layout(triangle_strip, max_vertices=3) out;\n"
+    "\n"
+    "in int instance_id[];\n"
+    "out layout(location = 0) vec3 position;\n"
+    "\n"
+    "in int gl_PrimitiveIDIn;\n"
+    "layout(binding=0) buffer triangular_mesh { float mesh_buffer[]; };\n"
+    "layout(std430, binding=1) buffer view_projection_matrix {\n"
+    "  mat4 view_projection_matrices[];\n"
+    "};\n"
+    "\n"
+    "void main() {\n"
+    "  int layer = instance_id[0];\n"
+    "  int offset = layer * (mesh_buffer.length() / num_layers) +\n"
+    "               gl_PrimitiveIDIn * 9;\n"
+    "  for (int i = 0; i < 3; ++i) {\n"
+    "    int o = offset + i * 3;\n"
+    "    position = vec3(mesh_buffer[o], mesh_buffer[o + 1], "
+    "mesh_buffer[o + 2]);\n"
+    "    gl_Position = view_projection_matrices[layer] * vec4(position, 1);\n"
+    "    gl_Layer = layer;\n"
+    "    EmitVertex();\n"
+    "  }\n"
+    "  EndPrimitive();\n"
+    "}\n";
+
+const std::string kLayeredFragmentShaderCode =
+    "#version 460\n"
+    "\n"
+    "in layout(location = 0) vec3 position;\n"
+    "\n"
+    "out vec4 output_color;\n"
+    "\n"
+    "void main() {\n"
+    "  output_color = vec4(0.0, 0.0, 0.0, position.z);\n"
+    "}\n";
+
+const std::string kColorAttachmentsFragmentShaderCode =
+    "#version 460\n"
+    "\n"
+    "in layout(location = 0) vec3 position;\n"
+    "in layout(location = 1) vec3 normal;\n"
+    "in layout(location = 2) vec2 bar_coord;\n"
+    "in layout(location = 3) float tri_id;\n"
+    "\n"
+    "layout(location = 0) out vec4 output_color;\n"
+    "layout(location = 1) out float output_depth;\n"
+    "layout(location = 2) out vec2 output_bar_coord;\n"
+    "\n"
+    "void main() {\n"
+    "  output_color = vec4(bar_coord, tri_id, position.z);\n"
+    "  output_depth = position.z;\n"
+    "  output_bar_coord = bar_coord;\n"
+    "}\n";
+
+const std::string kIntegerAttachmentFragmentShaderCode =
+    "#version 460\n"
+    "\n"
+    "in layout(location = 0) vec3 position;\n"
+    "in layout(location = 1) vec3 normal;\n"
+    "in layout(location = 2) vec2 bar_coord;\n"
+    "in layout(location = 3) float tri_id;\n"
+    "\n"
+    "layout(location = 0) out vec4 output_color;\n"
+    "layout(location = 1) out int output_id;\n"
+    "\n"
+    "void main() {\n"
+    "  output_color = vec4(bar_coord, tri_id, position.z);\n"
+    "  output_id = (1 << 24) + 1 + gl_PrimitiveID;\n"
+    "}\n";
+
 TEST(RasterizerTest, TestCreate) {
   std::unique_ptr<EGLOffscreenContext> context;
   std::unique_ptr<Rasterizer> rasterizer;
@@ -130,6 +236,58 @@ TEST(RasterizerTest, TestSetShaderStorageBuffer) {
                                                  absl::MakeSpan(geometry)));
 }
 
+TEST(RasterizerTest, TestSetShaderStorageBufferFingerprints) {
+  std::unique_ptr<EGLOffscreenContext> context;
+  std::unique_ptr<Rasterizer> rasterizer;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  TF_ASSERT_OK(
+      (Rasterizer::Create<float>(3, 2, kEmptyShaderCode, kEmptyShaderCode,
+                                 kEmptyShaderCode, &rasterizer)));
+
+  // Data larger than the hashed chunks, and a copy at another address.
+  std::vector<float> data(10000);
+  for (int i = 0; i < data.size(); ++i) data[i] = i;
+  const std::vector<float> copy = data;
+  const int64_t size = data.size() * sizeof(float);
+  TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+      "buffer", absl::MakeConstSpan(data)));
+  TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+      "buffer", absl::MakeConstSpan(data)));
+  EXPECT_EQ(rasterizer->GetSkippedUploadBytes(), size);
+  // By default, data at another address is uploaded.
+  TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+      "buffer", absl::MakeConstSpan(copy)));
+  EXPECT_EQ(rasterizer->GetSkippedUploadBytes(), size);
+  // A change of a hashed value is detected.
+  data.back() = -1.0f;
+  TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+      "buffer", absl::MakeConstSpan(data)));
+  EXPECT_EQ(rasterizer->GetSkippedUploadBytes(), size);
+
+  // With full hashing, identical data is skipped wherever it is, and any
+  // change is detected.
+  rasterizer->SetFullUploadHashing(true);
+  data.back() = copy.back();
+  TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+      "buffer", absl::MakeConstSpan(data)));
+  EXPECT_EQ(rasterizer->GetSkippedUploadBytes(), size);
+  TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+      "buffer", absl::MakeConstSpan(copy)));
+  EXPECT_EQ(rasterizer->GetSkippedUploadBytes(), 2 * size);
+  // Values between the chunks hashed by default.
+  for (const int i : {100, 1234, 5678}) {
+    data[i] = -1.0f;
+    TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+        "buffer", absl::MakeConstSpan(data)));
+    ASSERT_EQ(rasterizer->GetSkippedUploadBytes(), 2 * size) << i;
+    data[i] = copy[i];
+    TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+        "buffer", absl::MakeConstSpan(data)));
+  }
+}
+
 TEST(RasterizerTest, TestSetUniformMatrix) {
   std::unique_ptr<EGLOffscreenContext> context;
   std::unique_ptr<Rasterizer> rasterizer;
@@ -189,4 +347,426 @@ TYPED_TEST(RasterizerInterfaceTest, TestRender) {
   }
 }
 
+TYPED_TEST(RasterizerInterfaceTest, TestRenderTriangles) {
+  const std::vector<float> kViewProjectionMatrix = {
+      -1.73205, 0.0, 0.0,      0.0, 0.0, 1.73205, 0.0,         0.0,
+      0.0,      0.0, 1.002002, 1.0, 0.0, 0.0,     -0.02002002, 0.0};
+  std::unique_ptr<EGLOffscreenContext> context;
+  std::unique_ptr<Rasterizer> rasterizer;
+  const int kWidth = 3;
+  const int kHeight = 3;
+  float max_gl_value = 255.0f;
+
+  if (typeid(TypeParam) == typeid(float)) max_gl_value = 1.0f;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  // The program does not have a geometry shader.
+  TF_ASSERT_OK((Rasterizer::Create<TypeParam>(
+      kWidth, kHeight, kTriangleVertexShaderCode, "",
+      kTriangleFragmentShaderCode, &rasterizer)));
+  TF_ASSERT_OK(rasterizer->SetUniformMatrix("view_projection_matrix", 4, 4,
+                                           false, kViewProjectionMatrix));
+  EXPECT_FALSE(rasterizer
+                   ->SetVertexAttribute("position",
+                                        absl::Span<const float>())
+                   .ok());
+
+  std::vector<TypeParam> rendering_result(kWidth * kHeight * 4);
+  for (const bool indexed : {false, true}) {
+    for (float depth = 0.2; depth < 0.5; depth += 0.1) {
+      // The indexed triangle skips the first vertex.
+      std::vector<float> vertices = {-10.0, 10.0, depth, 10.0, 10.0,
+                                     depth, 0.0,  -10.0, depth};
+      const std::vector<int> indices = {1, 2, 3};
+      if (indexed) vertices.insert(vertices.begin(), {0.0, 0.0, 0.0});
+      rasterizer->SetDrawMode(indexed
+                                  ? Rasterizer::DrawMode::kIndexedTriangles
+                                  : Rasterizer::DrawMode::kTriangles);
+      TF_ASSERT_OK(rasterizer->SetVertexAttribute(
+          "vertex_position", absl::MakeConstSpan(vertices)));
+      TF_ASSERT_OK(rasterizer->SetIndexBuffer(absl::MakeConstSpan(indices)));
+      TF_ASSERT_OK(rasterizer->Render(1, absl::MakeSpan(rendering_result)));
+
+      for (int i = 0; i < kWidth * kHeight; ++i) {
+        EXPECT_EQ(rendering_result[4 * i + 3],
+                  TypeParam(depth * max_gl_value));
+      }
+    }
+  }
+}
+
+TYPED_TEST(RasterizerInterfaceTest, TestRenderUnchangedUploads) {
+  const std::vector<float> kViewProjectionMatrix = {
+      -1.73205, 0.0, 0.0,      0.0, 0.0, 1.73205, 0.0,         0.0,
+      0.0,      0.0, 1.002002, 1.0, 0.0, 0.0,     -0.02002002, 0.0};
+  std::unique_ptr<EGLOffscreenContext> context;
+  std::unique_ptr<Rasterizer> rasterizer;
+  const int kWidth = 3;
+  const int kHeight = 3;
+  float max_gl_value = 255.0f;
+
+  if (typeid(TypeParam) == typeid(float)) max_gl_value = 1.0f;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  TF_ASSERT_OK((Rasterizer::Create<TypeParam>(
+      kWidth, kHeight, kEmptyShaderCode, kGeometryShaderCode,
+      kFragmentShaderCode, &rasterizer)));
+  TF_ASSERT_OK(rasterizer->SetUniformMatrix("view_projection_matrix", 4, 4,
+                                           false, kViewProjectionMatrix));
+  EXPECT_EQ(rasterizer->GetSkippedUploadBytes(), 0);
+
+  std::vector<TypeParam> rendering_result(kWidth * kHeight * 4);
+  int64_t skipped_upload_bytes = 0;
+  float previous_depth = 0.0f;
+  // The data is kept at the same address, as the buffers of tensors reused
+  // across steps. Uploads repeating the previous one are skipped.
+  std::vector<float> geometry(9);
+  for (const float depth : {0.2f, 0.2f, 0.3f, 0.3f, 0.2f}) {
+    geometry = {-10.0, 10.0, depth, 10.0, 10.0, depth, 0.0, -10.0, depth};
+    TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+        "triangular_mesh", absl::MakeConstSpan(geometry)));
+    if (depth == previous_depth)
+      skipped_upload_bytes += geometry.size() * sizeof(float);
+    previous_depth = depth;
+    EXPECT_EQ(rasterizer->GetSkippedUploadBytes(), skipped_upload_bytes);
+    TF_ASSERT_OK(rasterizer->Render(1, absl::MakeSpan(rendering_result)));
+
+    for (int i = 0; i < kWidth * kHeight; ++i)
+      EXPECT_EQ(rendering_result[4 * i + 3], TypeParam(depth * max_gl_value));
+  }
+}
+
+TYPED_TEST(RasterizerInterfaceTest, TestRenderLayered) {
+  const std::vector<float> kViewProjectionMatrix = {
+      -1.73205, 0.0, 0.0,      0.0, 0.0, 1.73205, 0.0,         0.0,
+      0.0,      0.0, 1.002002, 1.0, 0.0, 0.0,     -0.02002002, 0.0};
+  std::unique_ptr<EGLOffscreenContext> context;
+  std::unique_ptr<Rasterizer> rasterizer;
+  const int kWidth = 3;
+  const int kHeight = 3;
+  const int kNumLayers = 3;
+  const int kNumPixels = kWidth * kHeight;
+  float max_gl_value = 255.0f;
+
+  if (typeid(TypeParam) == typeid(float)) max_gl_value = 1.0f;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  TF_ASSERT_OK((Rasterizer::Create<TypeParam>(
+      kWidth, kHeight, kLayeredVertexShaderCode, kLayeredGeometryShaderCode,
+      kLayeredFragmentShaderCode, &rasterizer)));
+
+  // Each layer contains a fronto-parallel triangle at a different depth.
+  std::vector<float> depths = {0.2, 0.3, 0.4};
+  std::vector<float> geometry;
+  std::vector<float> view_projection_matrices;
+  for (const float depth : depths) {
+    geometry.insert(geometry.end(), {-10.0, 10.0, depth, 10.0, 10.0, depth,
+                                     0.0, -10.0, depth});
+    view_projection_matrices.insert(view_projection_matrices.end(),
+                                    kViewProjectionMatrix.begin(),
+                                    kViewProjectionMatrix.end());
+  }
+  TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+      "triangular_mesh", absl::MakeConstSpan(geometry)));
+  TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+      "view_projection_matrix", absl::MakeConstSpan(view_projection_matrices)));
+
+  std::vector<TypeParam> rendering_result(kNumPixels * 4 * kNumLayers);
+  TF_ASSERT_OK(rasterizer->RenderLayered(1, kNumLayers,
+                                         absl::MakeSpan(rendering_result)));
+
+  for (int layer = 0; layer < kNumLayers; ++layer) {
+    for (int i = 0; i < kNumPixels; ++i) {
+      const int offset = (layer * kNumPixels + i) * 4;
+      EXPECT_EQ(rendering_result[offset + 2], TypeParam(0.0));
+      EXPECT_EQ(rendering_result[offset + 3],
+                TypeParam(depths[layer] * max_gl_value));
+    }
+  }
+}
+
+TYPED_TEST(RasterizerInterfaceTest, TestRenderLayeredReusedBuffers) {
+  const std::vector<float> kViewProjectionMatrix = {
+      -1.73205, 0.0, 0.0,      0.0, 0.0, 1.73205, 0.0,         0.0,
+      0.0,      0.0, 1.002002, 1.0, 0.0, 0.0,     -0.02002002, 0.0};
+  const int kWidth = 3;
+  const int kHeight = 3;
+  const int kNumPixels = kWidth * kHeight;
+  float max_gl_value = 255.0f;
+
+  if (typeid(TypeParam) == typeid(float)) max_gl_value = 1.0f;
+
+  for (const bool persistent_uploads : {false, true}) {
+    std::unique_ptr<EGLOffscreenContext> context;
+    std::unique_ptr<Rasterizer> rasterizer;
+
+    TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+    TF_ASSERT_OK(context->MakeCurrent());
+    TF_ASSERT_OK((Rasterizer::Create<TypeParam>(
+        kWidth, kHeight, kLayeredVertexShaderCode, kLayeredGeometryShaderCode,
+        kLayeredFragmentShaderCode, &rasterizer)));
+    rasterizer->SetPersistentUploads(persistent_uploads);
+
+    // The buffers shrink and grow between draws, and the shaders derive the
+    // number of vertices per layer from the length of the uploaded data.
+    const std::vector<std::vector<float>> batches = {
+        {0.2, 0.3, 0.4}, {0.5, 0.6}, {0.3}, {0.4, 0.2, 0.6, 0.5}};
+    for (const std::vector<float>& depths : batches) {
+      const int num_layers = depths.size();
+      std::vector<float> geometry;
+      std::vector<float> view_projection_matrices;
+      for (const float depth : depths) {
+        geometry.insert(geometry.end(), {-10.0, 10.0, depth, 10.0, 10.0, depth,
+                                         0.0, -10.0, depth});
+        view_projection_matrices.insert(view_projection_matrices.end(),
+                                        kViewProjectionMatrix.begin(),
+                                        kViewProjectionMatrix.end());
+      }
+      TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+          "triangular_mesh", absl::MakeConstSpan(geometry)));
+      TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+          "view_projection_matrix",
+          absl::MakeConstSpan(view_projection_matrices)));
+
+      std::vector<TypeParam> rendering_result(kNumPixels * 4 * num_layers);
+      TF_ASSERT_OK(rasterizer->RenderLayered(1, num_layers,
+                                             absl::MakeSpan(rendering_result)));
+
+      for (int layer = 0; layer < num_layers; ++layer) {
+        for (int i = 0; i < kNumPixels; ++i) {
+          const int offset = (layer * kNumPixels + i) * 4;
+          EXPECT_EQ(rendering_result[offset + 2], TypeParam(0.0));
+          EXPECT_NEAR(rendering_result[offset + 3],
+                      depths[layer] * max_gl_value, 1.0);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(RasterizerInterfaceTest, TestRenderPipelinedReadback) {
+  const std::vector<float> kViewProjectionMatrix = {
+      -1.73205, 0.0, 0.0,      0.0, 0.0, 1.73205, 0.0,         0.0,
+      0.0,      0.0, 1.002002, 1.0, 0.0, 0.0,     -0.02002002, 0.0};
+  std::unique_ptr<EGLOffscreenContext> context;
+  std::unique_ptr<Rasterizer> rasterizer;
+  const int kWidth = 3;
+  const int kHeight = 3;
+  float max_gl_value = 255.0f;
+
+  if (typeid(TypeParam) == typeid(float)) max_gl_value = 1.0f;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  TF_ASSERT_OK((Rasterizer::Create<TypeParam>(
+      kWidth, kHeight, kEmptyShaderCode, kGeometryShaderCode,
+      kFragmentShaderCode, &rasterizer)));
+  TF_ASSERT_OK(rasterizer->SetUniformMatrix("view_projection_matrix", 4, 4,
+                                           false, kViewProjectionMatrix));
+  rasterizer->SetPipelinedReadback(true);
+  rasterizer->SetPersistentUploads(true);
+
+  // Render more images than there are pixel buffers before reading them.
+  const std::vector<float> depths = {0.2, 0.3, 0.4, 0.5};
+  std::vector<std::vector<TypeParam>> rendering_results(
+      depths.size(), std::vector<TypeParam>(kWidth * kHeight * 4));
+  for (int index = 0; index < depths.size(); ++index) {
+    const float depth = depths[index];
+    std::vector<float> geometry = {-10.0, 10.0, depth, 10.0, 10.0,
+                                   depth, 0.0,  -10.0, depth};
+    TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+        "triangular_mesh", absl::MakeConstSpan(geometry)));
+    TF_ASSERT_OK(rasterizer->Render(
+        geometry.size() / 3, absl::MakeSpan(rendering_results[index])));
+  }
+  TF_ASSERT_OK(rasterizer->FinishPendingRenders());
+
+  for (int index = 0; index < depths.size(); ++index) {
+    for (int i = 0; i < kWidth * kHeight; ++i) {
+      EXPECT_EQ(rendering_results[index][4 * i + 2], TypeParam(0.0));
+      EXPECT_NEAR(rendering_results[index][4 * i + 3],
+                  depths[index] * max_gl_value, 1.0);
+    }
+  }
+}
+
+TEST(RasterizerTest, TestSetResolution) {
+  const std::vector<float> kViewProjectionMatrix = {
+      -1.73205, 0.0, 0.0,      0.0, 0.0, 1.73205, 0.0,         0.0,
+      0.0,      0.0, 1.002002, 1.0, 0.0, 0.0,     -0.02002002, 0.0};
+  const float kDepth = 0.3;
+  const std::vector<float> kGeometry = {-10.0, 10.0, kDepth, 10.0, 10.0,
+                                        kDepth, 0.0,  -10.0, kDepth};
+  std::unique_ptr<EGLOffscreenContext> context;
+  std::unique_ptr<Rasterizer> rasterizer;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  TF_ASSERT_OK((Rasterizer::Create<float>(3, 3, kEmptyShaderCode,
+                                          kGeometryShaderCode,
+                                          kFragmentShaderCode, &rasterizer)));
+  TF_ASSERT_OK(rasterizer->SetUniformMatrix("view_projection_matrix", 4, 4,
+                                           false, kViewProjectionMatrix));
+  TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+      "triangular_mesh", absl::MakeConstSpan(kGeometry)));
+  EXPECT_FALSE(rasterizer->SetResolution(0, 2).ok());
+
+  // Sizes are revisited after more than kMaxCachedRenderTargets others.
+  for (int width : {2, 5, 3, 2, 1, 4, 6, 7, 8, 9, 10, 11, 12, 2}) {
+    for (const int num_layers : {1, 2}) {
+      const int height = width + 1;
+      std::vector<float> rendering_result(width * height * num_layers * 4);
+      std::vector<float> depth(width * height * num_layers);
+
+      TF_ASSERT_OK(rasterizer->SetResolution(width, height));
+      if (num_layers == 1) {
+        TF_ASSERT_OK(rasterizer->Render(1, absl::MakeSpan(rendering_result)));
+      } else {
+        TF_ASSERT_OK(rasterizer->RenderLayered(
+            1, num_layers, absl::MakeSpan(rendering_result)));
+      }
+      TF_ASSERT_OK(rasterizer->ReadDepth(absl::MakeSpan(depth)));
+      // Only the first layer is drawn to by the geometry shader.
+      for (int i = 0; i < width * height; ++i) {
+        EXPECT_EQ(rendering_result[4 * i + 3], kDepth);
+        EXPECT_GT(depth[i], 0.0);
+        EXPECT_LT(depth[i], 1.0);
+      }
+    }
+  }
+}
+
+TEST(RasterizerTest, TestRenderColorAttachments) {
+  const std::vector<float> kViewProjectionMatrix = {
+      -1.73205, 0.0, 0.0,      0.0, 0.0, 1.73205, 0.0,         0.0,
+      0.0,      0.0, 1.002002, 1.0, 0.0, 0.0,     -0.02002002, 0.0};
+  std::unique_ptr<EGLOffscreenContext> context;
+  std::unique_ptr<Rasterizer> rasterizer;
+  const int kWidth = 3;
+  const int kHeight = 3;
+  const int kNumPixels = kWidth * kHeight;
+  const float kDepth = 0.25;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  TF_ASSERT_OK(Rasterizer::Create(kWidth, kHeight, kEmptyShaderCode,
+                                  kGeometryShaderCode,
+                                  kColorAttachmentsFragmentShaderCode,
+                                  {GL_RGBA32F, GL_R32F, GL_RG32F}, 0.0, 0.0,
+                                  0.0, 1.0, &rasterizer));
+  TF_ASSERT_OK(rasterizer->SetUniformMatrix("view_projection_matrix", 4, 4,
+                                           false, kViewProjectionMatrix));
+  std::vector<float> geometry = {-10.0, 10.0, kDepth, 10.0, 10.0,
+                                 kDepth, 0.0,  -10.0, kDepth};
+  TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+      "triangular_mesh", absl::MakeConstSpan(geometry)));
+
+  std::vector<float> rendering_result(kNumPixels * 4);
+  std::vector<float> depth(kNumPixels);
+  std::vector<float> bar_coord(kNumPixels * 2);
+  TF_ASSERT_OK(rasterizer->Render(geometry.size() / 3,
+                                  absl::MakeSpan(rendering_result)));
+  TF_ASSERT_OK(rasterizer->ReadColorAttachment(1, absl::MakeSpan(depth)));
+  TF_ASSERT_OK(rasterizer->ReadColorAttachment(2, absl::MakeSpan(bar_coord)));
+
+  // Each attachment holds the same values as the matching channels of the
+  // first one.
+  for (int i = 0; i < kNumPixels; ++i) {
+    EXPECT_EQ(depth[i], kDepth);
+    EXPECT_EQ(depth[i], rendering_result[4 * i + 3]);
+    EXPECT_EQ(bar_coord[2 * i], rendering_result[4 * i]);
+    EXPECT_EQ(bar_coord[2 * i + 1], rendering_result[4 * i + 1]);
+  }
+
+  // Attachments must be read with buffers of the right size.
+  EXPECT_NE(rasterizer->ReadColorAttachment(1, absl::MakeSpan(bar_coord)),
+            tensorflow::Status::OK());
+}
+
+TEST(RasterizerTest, TestRenderIntegerColorAttachment) {
+  const std::vector<float> kViewProjectionMatrix = {
+      -1.73205, 0.0, 0.0,      0.0, 0.0, 1.73205, 0.0,         0.0,
+      0.0,      0.0, 1.002002, 1.0, 0.0, 0.0,     -0.02002002, 0.0};
+  std::unique_ptr<EGLOffscreenContext> context;
+  std::unique_ptr<Rasterizer> rasterizer;
+  const int kWidth = 3;
+  const int kHeight = 3;
+  const int kNumPixels = kWidth * kHeight;
+  const float kDepth = 0.25;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  TF_ASSERT_OK(Rasterizer::Create(kWidth, kHeight, kEmptyShaderCode,
+                                  kGeometryShaderCode,
+                                  kIntegerAttachmentFragmentShaderCode,
+                                  {GL_RGBA32F, GL_R32I}, 0.0, 0.0, 0.0, 1.0,
+                                  &rasterizer));
+  TF_ASSERT_OK(rasterizer->SetUniformMatrix("view_projection_matrix", 4, 4,
+                                           false, kViewProjectionMatrix));
+  std::vector<float> geometry = {-10.0, 10.0, kDepth, 10.0, 10.0,
+                                 kDepth, 0.0,  -10.0, kDepth};
+  TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+      "triangular_mesh", absl::MakeConstSpan(geometry)));
+
+  std::vector<float> rendering_result(kNumPixels * 4);
+  std::vector<int> ids(kNumPixels);
+  TF_ASSERT_OK(rasterizer->Render(geometry.size() / 3,
+                                  absl::MakeSpan(rendering_result)));
+  TF_ASSERT_OK(rasterizer->ReadColorAttachment(1, absl::MakeSpan(ids)));
+
+  // Ids above 2^24 are not rounded, as they would be in a float attachment.
+  for (const int id : ids) EXPECT_EQ(id, (1 << 24) + 1);
+
+  std::vector<float> float_ids(kNumPixels);
+  EXPECT_NE(rasterizer->ReadColorAttachment(1, absl::MakeSpan(float_ids)),
+            tensorflow::Status::OK());
+}
+
+TEST(RasterizerTest, TestReadDepth) {
+  const std::vector<float> kViewProjectionMatrix = {
+      -1.73205, 0.0, 0.0,      0.0, 0.0, 1.73205, 0.0,         0.0,
+      0.0,      0.0, 1.002002, 1.0, 0.0, 0.0,     -0.02002002, 0.0};
+  std::unique_ptr<EGLOffscreenContext> context;
+  std::unique_ptr<Rasterizer> rasterizer;
+  const int kWidth = 3;
+  const int kHeight = 3;
+  const int kNumPixels = kWidth * kHeight;
+  const float kDepth = 0.25;
+  // Window-space depth of the triangle, obtained by projecting kDepth.
+  const float kWindowDepth =
+      ((1.002002 - 0.02002002 / kDepth) + 1.0) / 2.0;
+
+  TF_ASSERT_OK(EGLOffscreenContext::Create(&context));
+  TF_ASSERT_OK(context->MakeCurrent());
+  TF_ASSERT_OK(Rasterizer::Create<float>(kWidth, kHeight, kEmptyShaderCode,
+                                         kGeometryShaderCode,
+                                         kFragmentShaderCode, &rasterizer));
+  TF_ASSERT_OK(rasterizer->SetUniformMatrix("view_projection_matrix", 4, 4,
+                                           false, kViewProjectionMatrix));
+  std::vector<float> geometry = {-10.0, 10.0, kDepth, 10.0, 10.0,
+                                 kDepth, 0.0,  -10.0, kDepth};
+  TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+      "triangular_mesh", absl::MakeConstSpan(geometry)));
+
+  std::vector<float> rendering_result(kNumPixels * 4);
+  std::vector<float> depth(kNumPixels);
+  TF_ASSERT_OK(rasterizer->Render(geometry.size() / 3,
+                                  absl::MakeSpan(rendering_result)));
+  TF_ASSERT_OK(rasterizer->ReadDepth(absl::MakeSpan(depth)));
+  for (const float value : depth) EXPECT_NEAR(value, kWindowDepth, 1e-5);
+
+  // In depth-only mode, no color is read back.
+  std::vector<float> depth_only(kNumPixels);
+  rasterizer->SetDepthOnly(true);
+  EXPECT_NE(rasterizer->Render(geometry.size() / 3,
+                               absl::MakeSpan(rendering_result)),
+            tensorflow::Status::OK());
+  TF_ASSERT_OK(rasterizer->Render(geometry.size() / 3, absl::Span<float>()));
+  TF_ASSERT_OK(rasterizer->ReadDepth(absl::MakeSpan(depth_only)));
+  EXPECT_EQ(depth_only, depth);
+}
+
 }  // namespace
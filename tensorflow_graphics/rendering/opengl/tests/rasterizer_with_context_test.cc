@@ -140,6 +140,42 @@ TEST(RasterizerWithContextTest, TestRenderSingleThread) {
   }
 }
 
+TEST(RasterizerWithContextTest, TestRenderSession) {
+  constexpr int kWidth = 5;
+  constexpr int kHeight = 5;
+  constexpr float kClearRed = 0.1;
+  constexpr int kNumVertices = 0;
+  std::unique_ptr<RasterizerWithContext> rasterizer_with_context;
+  std::vector<float> rendering_result(kWidth * kHeight * 4);
+
+  TF_ASSERT_OK(RasterizerWithContext::Create(
+      kWidth, kHeight, kEmptyShaderCode, geometry_shader_code,
+      fragment_shader_code, &rasterizer_with_context, kClearRed));
+  EXPECT_EQ(eglGetCurrentContext(), EGL_NO_CONTEXT);
+  EXPECT_NE(rasterizer_with_context->EndSession(), tensorflow::Status::OK());
+
+  // The context stays current until the outermost session ends.
+  TF_ASSERT_OK(rasterizer_with_context->BeginSession());
+  const EGLContext context = eglGetCurrentContext();
+  EXPECT_NE(context, EGL_NO_CONTEXT);
+  TF_ASSERT_OK(rasterizer_with_context->BeginSession());
+  TF_ASSERT_OK(rasterizer_with_context->Render(
+      kNumVertices, absl::MakeSpan(rendering_result)));
+  TF_ASSERT_OK(rasterizer_with_context->EndSession());
+  EXPECT_EQ(eglGetCurrentContext(), context);
+  TF_ASSERT_OK(rasterizer_with_context->Render(
+      kNumVertices, absl::MakeSpan(rendering_result)));
+  EXPECT_EQ(eglGetCurrentContext(), context);
+  EXPECT_EQ(rendering_result[0], kClearRed);
+  TF_ASSERT_OK(rasterizer_with_context->EndSession());
+  EXPECT_EQ(eglGetCurrentContext(), EGL_NO_CONTEXT);
+
+  // Outside of a session, each call releases the context.
+  TF_ASSERT_OK(rasterizer_with_context->Render(
+      kNumVertices, absl::MakeSpan(rendering_result)));
+  EXPECT_EQ(eglGetCurrentContext(), EGL_NO_CONTEXT);
+}
+
 constexpr float kIncrementRed = 0.001;
 constexpr float kIncrementGreen = 0.002;
 constexpr float kIncrementBlue = 0.003;
@@ -238,4 +274,102 @@ TEST(RasterizerWithContextTest, TestRenderMultiThreadLoop) {
   }
 }
 
+TEST(RasterizerWithContextTest, TestRenderSharedContexts) {
+  constexpr int kNumThreads = 8;
+  constexpr int kNumLoops = 10;
+  constexpr int kWidth = 10;
+  constexpr int kHeight = 10;
+  const std::vector<float> kViewProjectionMatrix = {
+      -1.73205, 0.0, 0.0,      0.0, 0.0, 1.73205, 0.0,         0.0,
+      0.0,      0.0, 1.002002, 1.0, 0.0, 0.0,     -0.02002002, 0.0};
+  std::array<std::thread, kNumThreads> threads;
+  std::array<tensorflow::Status, kNumThreads> statuses;
+  std::array<std::unique_ptr<RasterizerWithContext>, kNumThreads> rasterizers;
+
+  for (int i = 0; i < kNumThreads; ++i) {
+    TF_ASSERT_OK(RasterizerWithContext::Create(
+        kWidth, kHeight, kEmptyShaderCode, geometry_shader_code,
+        fragment_shader_code, &rasterizers[i], 0.0, 0.0, 0.0, 1.0,
+        {GL_RGBA32F}, "", true));
+  }
+
+  // The rasterizers share their program, but each of them renders a triangle
+  // at a different depth, with its own uniforms and buffers. Half of them flip
+  // both the x axis and the winding of the triangle, which is culled if it is
+  // drawn with the matrix of another rasterizer.
+  auto render = [&](int index) -> tensorflow::Status {
+    const float depth = 0.2 + 0.05 * index;
+    const float x = index % 2 == 0 ? 10.0 : -10.0;
+    const std::vector<float> geometry = {-x, 10.0, depth, x, 10.0, depth, 0.0,
+                                         -10.0, depth};
+    std::vector<float> view_projection_matrix = kViewProjectionMatrix;
+    if (index % 2 == 1) view_projection_matrix[0] *= -1.0;
+    std::vector<float> rendering_result(kWidth * kHeight * 4);
+    for (int l = 0; l < kNumLoops; ++l) {
+      TF_RETURN_IF_ERROR(rasterizers[index]->SetUniformMatrix(
+          "view_projection_matrix", 4, 4, false,
+          absl::MakeConstSpan(view_projection_matrix)));
+      TF_RETURN_IF_ERROR(rasterizers[index]->SetShaderStorageBuffer(
+          "triangular_mesh", absl::MakeConstSpan(geometry)));
+      TF_RETURN_IF_ERROR(
+          rasterizers[index]->Render(3, absl::MakeSpan(rendering_result)));
+      for (int p = 0; p < kWidth * kHeight; ++p) {
+        if (std::abs(rendering_result[4 * p + 3] - depth) > 1e-6)
+          return tensorflow::errors::Internal("Unexpected depth ",
+                                              rendering_result[4 * p + 3]);
+      }
+    }
+    return tensorflow::Status::OK();
+  };
+  for (int i = 0; i < kNumThreads; ++i)
+    threads[i] = std::thread([&, i]() { statuses[i] = render(i); });
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads[i].join();
+    TF_EXPECT_OK(statuses[i]);
+  }
+}
+
+TEST(RasterizerWithContextTest, TestRenderSharedUniforms) {
+  constexpr int kWidth = 10;
+  constexpr int kHeight = 10;
+  constexpr float kDepth = 0.5;
+  const std::vector<float> kViewProjectionMatrix = {
+      -1.73205, 0.0, 0.0,      0.0, 0.0, 1.73205, 0.0,         0.0,
+      0.0,      0.0, 1.002002, 1.0, 0.0, 0.0,     -0.02002002, 0.0};
+  std::vector<float> flipped_matrix = kViewProjectionMatrix;
+  flipped_matrix[0] *= -1.0;
+  const std::vector<float> geometry = {-10.0, 10.0,  kDepth, 10.0, 10.0,
+                                       kDepth, 0.0, -10.0, kDepth};
+  const std::vector<float> flipped_geometry = {
+      10.0, 10.0, kDepth, -10.0, 10.0, kDepth, 0.0, -10.0, kDepth};
+  std::array<std::unique_ptr<RasterizerWithContext>, 2> rasterizers;
+  std::vector<float> rendering_result(kWidth * kHeight * 4);
+
+  for (auto& rasterizer : rasterizers) {
+    TF_ASSERT_OK(RasterizerWithContext::Create(
+        kWidth, kHeight, kEmptyShaderCode, geometry_shader_code,
+        fragment_shader_code, &rasterizer, 0.0, 0.0, 0.0, 1.0, {GL_RGBA32F},
+        "", true));
+  }
+  auto render = [&](RasterizerWithContext* rasterizer,
+                    const std::vector<float>& matrix,
+                    const std::vector<float>& mesh) {
+    TF_ASSERT_OK(rasterizer->SetUniformMatrix(
+        "view_projection_matrix", 4, 4, false, absl::MakeConstSpan(matrix)));
+    TF_ASSERT_OK(rasterizer->SetShaderStorageBuffer(
+        "triangular_mesh", absl::MakeConstSpan(mesh)));
+    TF_ASSERT_OK(rasterizer->Render(3, absl::MakeSpan(rendering_result)));
+    // The triangle is culled if drawn with a stale matrix.
+    EXPECT_NEAR(rendering_result[4 * (kWidth * kHeight / 2) + 3], kDepth,
+                1e-6);
+  };
+
+  // The second rasterizer sets the uniform of the shared program to the value
+  // the first one sets next, which must still reach the context of the first
+  // one.
+  render(rasterizers[0].get(), flipped_matrix, flipped_geometry);
+  render(rasterizers[1].get(), kViewProjectionMatrix, geometry);
+  render(rasterizers[0].get(), kViewProjectionMatrix, geometry);
+}
+
 }  // namespace
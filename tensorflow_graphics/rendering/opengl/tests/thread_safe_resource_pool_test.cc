@@ -17,8 +17,13 @@ limitations under the License.
 #include <array>
 #include <memory>
 #include <thread>
+#include <vector>
 
 #include "gtest/gtest.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
 
@@ -120,6 +125,182 @@ TEST(ThreadSafeResourcePoolTest, TestMultiThread) {
   EXPECT_TRUE(local_resources[0]->GetValue() <= kNumThreads * kDummyIncrements);
 }
 
+TEST(ThreadSafeResourcePoolTest, TestMaximumNumResources) {
+  DummyClass::ResetCounter();
+  constexpr int kPoolSize = 1;
+  constexpr int kMaximumNumResources = 2;
+  auto resource_pool = std::unique_ptr<ThreadSafeResourcePool<DummyClass>>(
+      new ThreadSafeResourcePool<DummyClass>(
+          dummy_resource_creator, kPoolSize, kMaximumNumResources,
+          absl::Milliseconds(10)));
+  std::unique_ptr<DummyClass> resource_1;
+  std::unique_ptr<DummyClass> resource_2;
+  std::unique_ptr<DummyClass> resource_3;
+
+  TF_ASSERT_OK(resource_pool->AcquireResource(&resource_1));
+  TF_ASSERT_OK(resource_pool->AcquireResource(&resource_2));
+  EXPECT_TRUE(tensorflow::errors::IsDeadlineExceeded(
+      resource_pool->AcquireResource(&resource_3)));
+
+  // A returned resource is acquired again.
+  TF_ASSERT_OK(resource_pool->ReturnResource(resource_1));
+  TF_ASSERT_OK(resource_pool->AcquireResource(&resource_3));
+  EXPECT_EQ(resource_3->GetValue(), kDummyIncrements);
+
+  // A discarded resource makes room for a new one.
+  resource_pool->DiscardResource(resource_2);
+  TF_ASSERT_OK(resource_pool->AcquireResource(&resource_1));
+  EXPECT_EQ(resource_1->GetValue(), 3 * kDummyIncrements);
+}
+
+TEST(ThreadSafeResourcePoolTest, TestBlockingAcquisition) {
+  DummyClass::ResetCounter();
+  constexpr int kPoolSize = 1;
+  constexpr int kMaximumNumResources = 1;
+  auto resource_pool = std::shared_ptr<ThreadSafeResourcePool<DummyClass>>(
+      new ThreadSafeResourcePool<DummyClass>(
+          dummy_resource_creator, kPoolSize, kMaximumNumResources));
+  std::unique_ptr<DummyClass> resource;
+  std::unique_ptr<DummyClass> waiting_resource;
+
+  TF_ASSERT_OK(resource_pool->AcquireResource(&resource));
+  resource->SetValue(1);
+  // The thread waits until the only resource is returned.
+  std::thread waiting_thread(
+      &ThreadSafeResourcePool<DummyClass>::AcquireResource, resource_pool,
+      &waiting_resource);
+  absl::SleepFor(absl::Milliseconds(10));
+  TF_ASSERT_OK(resource_pool->ReturnResource(resource));
+  waiting_thread.join();
+  ASSERT_NE(waiting_resource, nullptr);
+  EXPECT_EQ(waiting_resource->GetValue(), 1);
+}
+
+TEST(ThreadSafeResourcePoolTest, TestCreationWithoutLock) {
+  DummyClass::ResetCounter();
+  constexpr int kPoolSize = 1;
+  int num_creations = 0;
+  absl::Notification creation_started;
+  absl::Notification resource_returned;
+  // The second creation waits for the first resource to be returned.
+  std::function<tensorflow::Status(std::unique_ptr<DummyClass> *)>
+      slow_resource_creator = [&](std::unique_ptr<DummyClass> *resource) {
+        if (++num_creations == 2) {
+          creation_started.Notify();
+          resource_returned.WaitForNotification();
+        }
+        return dummy_resource_creator(resource);
+      };
+  auto resource_pool = std::shared_ptr<ThreadSafeResourcePool<DummyClass>>(
+      new ThreadSafeResourcePool<DummyClass>(slow_resource_creator,
+                                             kPoolSize));
+  std::unique_ptr<DummyClass> resource;
+  std::unique_ptr<DummyClass> slow_resource;
+
+  TF_ASSERT_OK(resource_pool->AcquireResource(&resource));
+  resource->SetValue(1);
+  std::thread creating_thread(
+      &ThreadSafeResourcePool<DummyClass>::AcquireResource, resource_pool,
+      &slow_resource);
+  creation_started.WaitForNotification();
+  // The pool is not locked by the pending creation.
+  TF_ASSERT_OK(resource_pool->ReturnResource(resource));
+  TF_ASSERT_OK(resource_pool->AcquireResource(&resource));
+  EXPECT_EQ(resource->GetValue(), 1);
+  resource_returned.Notify();
+  creating_thread.join();
+  ASSERT_NE(slow_resource, nullptr);
+}
+
+TEST(ThreadSafeResourcePoolTest, TestConcurrentCreations) {
+  DummyClass::ResetCounter();
+  constexpr int kPoolSize = 2;
+  absl::Mutex mutex;
+  int num_started = 0;
+  bool all_started = false;
+  // Each creation waits for the other one to start, which only happens if the
+  // creations overlap in time.
+  std::function<tensorflow::Status(std::unique_ptr<DummyClass> *)>
+      slow_resource_creator = [&](std::unique_ptr<DummyClass> *resource) {
+        absl::MutexLock lock(&mutex);
+        if (++num_started == 2) all_started = true;
+        if (!mutex.AwaitWithTimeout(absl::Condition(&all_started),
+                                    absl::Seconds(10)))
+          return tensorflow::errors::DeadlineExceeded(
+              "The creations did not overlap.");
+        return dummy_resource_creator(resource);
+      };
+  auto resource_pool = std::shared_ptr<ThreadSafeResourcePool<DummyClass>>(
+      new ThreadSafeResourcePool<DummyClass>(slow_resource_creator,
+                                             kPoolSize));
+  std::array<std::unique_ptr<DummyClass>, 2> resources;
+  std::array<tensorflow::Status, 2> statuses;
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 2; ++i) {
+    threads.emplace_back([&, i]() {
+      statuses[i] = resource_pool->AcquireResource(&resources[i]);
+    });
+  }
+  for (auto &thread : threads) thread.join();
+  for (int i = 0; i < 2; ++i) {
+    TF_EXPECT_OK(statuses[i]);
+    EXPECT_NE(resources[i], nullptr);
+  }
+}
+
+TEST(ThreadSafeResourcePoolTest, TestPrewarm) {
+  DummyClass::ResetCounter();
+  constexpr int kPoolSize = 2;
+  auto resource_pool = std::unique_ptr<ThreadSafeResourcePool<DummyClass>>(
+      new ThreadSafeResourcePool<DummyClass>(dummy_resource_creator,
+                                             kPoolSize));
+  std::unique_ptr<DummyClass> resource_1;
+  std::unique_ptr<DummyClass> resource_2;
+  std::unique_ptr<DummyClass> resource_3;
+
+  // No more resources than the pool can store are created.
+  TF_ASSERT_OK(resource_pool->Prewarm(3));
+  TF_ASSERT_OK(resource_pool->Prewarm(2));
+  TF_ASSERT_OK(resource_pool->AcquireResource(&resource_1));
+  TF_ASSERT_OK(resource_pool->AcquireResource(&resource_2));
+  EXPECT_LE(resource_1->GetValue(), 2 * kDummyIncrements);
+  EXPECT_LE(resource_2->GetValue(), 2 * kDummyIncrements);
+  TF_ASSERT_OK(resource_pool->AcquireResource(&resource_3));
+  EXPECT_EQ(resource_3->GetValue(), 3 * kDummyIncrements);
+}
+
+TEST(ThreadSafeResourcePoolTest, TestThreadAffinity) {
+  DummyClass::ResetCounter();
+  constexpr int kPoolSize = 3;
+  auto resource_pool = std::unique_ptr<ThreadSafeResourcePool<DummyClass>>(
+      new ThreadSafeResourcePool<DummyClass>(dummy_resource_creator,
+                                             kPoolSize));
+  std::unique_ptr<DummyClass> resource_1;
+  std::unique_ptr<DummyClass> resource_2;
+  std::unique_ptr<DummyClass> resource_3;
+
+  TF_ASSERT_OK(resource_pool->Prewarm(3));
+  TF_ASSERT_OK(resource_pool->AcquireResource(&resource_1));
+  TF_ASSERT_OK(resource_pool->AcquireResource(&resource_2));
+  resource_1->SetValue(1);
+  resource_2->SetValue(2);
+  TF_ASSERT_OK(resource_pool->ReturnResource(resource_1));
+  std::thread other_thread([&resource_pool, &resource_2]() {
+    TF_ASSERT_OK(resource_pool->ReturnResource(resource_2));
+  });
+  other_thread.join();
+
+  // The resource returned by this thread is preferred, then the one not used
+  // yet, and last the one returned by another thread.
+  TF_ASSERT_OK(resource_pool->AcquireResource(&resource_1));
+  TF_ASSERT_OK(resource_pool->AcquireResource(&resource_2));
+  TF_ASSERT_OK(resource_pool->AcquireResource(&resource_3));
+  EXPECT_EQ(resource_1->GetValue(), 1);
+  EXPECT_EQ(resource_2->GetValue(), kDummyIncrements);
+  EXPECT_EQ(resource_3->GetValue(), 2);
+}
+
 TEST(ThreadSafeResourcePoolTest, TestInvalidResourceCreator) {
   constexpr int kPoolSize = 1;
   std::function<tensorflow::Status(std::unique_ptr<DummyClass> *)>
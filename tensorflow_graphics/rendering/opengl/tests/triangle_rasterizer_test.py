@@ -22,6 +22,7 @@ from absl.testing import parameterized
 import numpy as np
 import tensorflow.compat.v2 as tf
 
+from tensorflow_graphics.rendering.opengl import math as glm
 from tensorflow_graphics.rendering.opengl import triangle_rasterizer
 from tensorflow_graphics.util import test_case
 
@@ -63,6 +64,20 @@ class TriangleRasterizerTest(test_case.TestCase):
         background_geometry, background_attribute, background_triangle,
         camera_origin, look_at, camera_up, field_of_view, image_size,
         (near_plane,), (far_plane,), bottom_left)
+    self.rasterizer_without_geometry_shader = (
+        triangle_rasterizer.TriangleRasterizer(
+            background_geometry, background_attribute, background_triangle,
+            camera_origin, look_at, camera_up, field_of_view, image_size,
+            (near_plane,), (far_plane,), bottom_left,
+            use_geometry_shader=False))
+    self.rasterizer_cpu = triangle_rasterizer.TriangleRasterizer(
+        background_geometry, background_attribute, background_triangle,
+        camera_origin, look_at, camera_up, field_of_view, image_size,
+        (near_plane,), (far_plane,), bottom_left, backend="cpu")
+    self.rasterizer_in_shader = triangle_rasterizer.TriangleRasterizer(
+        background_geometry, background_attribute, background_triangle,
+        camera_origin, look_at, camera_up, field_of_view, image_size,
+        (near_plane,), (far_plane,), bottom_left, interpolate_in_shader=True)
 
   @parameterized.parameters(
       (((1, 3), (1, 7), (3,), (3,), (3,), (3,), (1,), (1,), (1,), (2,)),
@@ -91,6 +106,32 @@ class TriangleRasterizerTest(test_case.TestCase):
     """Tests that the shape exceptions are properly raised."""
     self.assert_exception_is_raised(_proxy_rasterizer, error_msg, shapes)
 
+  def test_rasterizer_init_unknown_backend_raised(self):
+    """Tests that an unknown backend raises an exception."""
+    with self.assertRaisesRegexp(ValueError, "Unknown rasterizer backend"):
+      triangle_rasterizer.TriangleRasterizer(
+          np.zeros((3, 3), np.float32), np.zeros((3, 3), np.float32),
+          np.array((0, 1, 2), np.int32), (0.0, 0.0, 0.0), (0.0, 0.0, 1.0),
+          (0.0, 1.0, 0.0), (1.0,), (3, 5), (0.01,), (400.0,), backend="vulkan")
+
+  def test_rasterizer_init_interpolate_in_shader_raised(self):
+    """Tests that interpolating in the shader requires the OpenGL backend."""
+    with self.assertRaisesRegexp(ValueError, "requires the 'opengl' backend"):
+      triangle_rasterizer.TriangleRasterizer(
+          np.zeros((3, 3), np.float32), np.zeros((3, 3), np.float32),
+          np.array((0, 1, 2), np.int32), (0.0, 0.0, 0.0), (0.0, 0.0, 1.0),
+          (0.0, 1.0, 0.0), (1.0,), (3, 5), (0.01,), (400.0,), backend="cpu",
+          interpolate_in_shader=True)
+
+  def test_rasterizer_init_interpolate_in_shader_bottom_left_raised(self):
+    """Tests that interpolating in the shader requires a zero bottom_left."""
+    with self.assertRaisesRegexp(ValueError, "bottom_left to be zero"):
+      triangle_rasterizer.TriangleRasterizer(
+          np.zeros((3, 3), np.float32), np.zeros((3, 3), np.float32),
+          np.array((0, 1, 2), np.int32), (0.0, 0.0, 0.0), (0.0, 0.0, 1.0),
+          (0.0, 1.0, 0.0), (1.0,), (3, 5), (0.01,), (400.0,),
+          bottom_left=(1.0, 0.0), interpolate_in_shader=True)
+
   @parameterized.parameters(
       (((1, 3, 3), (1, 3, 3), (3,)), (tf.float32, tf.float32, tf.int32)),
       (((8, 5, 7, 3), (8, 5, 7, 3), (3,)), (tf.float32, tf.float32, tf.int32)),
@@ -109,8 +150,13 @@ class TriangleRasterizerTest(test_case.TestCase):
     self.assert_exception_is_raised(self.rasterizer.rasterize, error_msg,
                                     shapes)
 
-  @parameterized.parameters(((2, 1, 3),), ((1,),))
-  def test_rasterizer_rasterize_preset(self, batch_shape):
+  @parameterized.parameters(((2, 1, 3), True, "opengl"), ((1,), True, "opengl"),
+                            ((2, 1, 3), False, "opengl"),
+                            ((1,), False, "opengl"), ((2, 1, 3), True, "cpu"),
+                            ((1,), True, "cpu"), ((2, 1, 3), True, "shader"),
+                            ((1,), True, "shader"))
+  def test_rasterizer_rasterize_preset(self, batch_shape, use_geometry_shader,
+                                       backend):
     """Tests that the rasterizer yields expected results.
 
     Args:
@@ -120,6 +166,10 @@ class TriangleRasterizerTest(test_case.TestCase):
         attributes that are a function of the depth of the triangle. A
         batched-call to the rasterization OP is performed and the output is
         checked against ground-truth.
+      use_geometry_shader: whether the rasterizer draws the triangles with a
+        geometry shader.
+      backend: the backend rasterizing the triangles, either 'opengl' or 'cpu',
+        or 'shader' to interpolate the attributes in the OpenGL shaders.
     """
     start_depth = 20
     depth_increment = 20
@@ -151,10 +201,85 @@ class TriangleRasterizerTest(test_case.TestCase):
     groundtruth = np.reshape(groundtruth,
                              batch_shape + self.image_size_int + (3,))
 
-    prediction = self.rasterizer.rasterize(geometry, attributes, triangles)
+    if backend == "cpu":
+      rasterizer = self.rasterizer_cpu
+    elif backend == "shader":
+      rasterizer = self.rasterizer_in_shader
+    elif use_geometry_shader:
+      rasterizer = self.rasterizer
+    else:
+      rasterizer = self.rasterizer_without_geometry_shader
+    prediction = rasterizer.rasterize(geometry, attributes, triangles)
 
     self.assertAllClose(prediction, groundtruth)
 
+  @parameterized.parameters(("opengl",), ("cpu",))
+  def test_rasterizer_rasterize_bottom_left(self, backend):
+    """Tests the interpolation of the attributes with a bottom_left offset.
+
+    The native interpolation op is compared to
+    glm.perspective_correct_interpolation, for a scene whose single triangle is
+    tilted with respect to the image plane and covers the whole image.
+
+    Args:
+      backend: the backend rasterizing the triangles, either 'opengl' or 'cpu'.
+    """
+    camera_origin = (0.0, 0.0, 0.0)
+    look_at = (0.0, 0.0, 1.0)
+    camera_up = (0.0, 1.0, 0.0)
+    field_of_view = (60 * np.math.pi / 180,)
+    height, width = self.image_size_int
+    near_plane = (0.01,)
+    far_plane = (400.0,)
+    bottom_left = (1.0, -0.5)
+    rasterizer = triangle_rasterizer.TriangleRasterizer(
+        np.zeros((3, 3), np.float32), np.zeros((3, 4), np.float32),
+        np.array((0, 1, 2), np.int32), camera_origin, look_at, camera_up,
+        field_of_view, (float(height), float(width)), near_plane, far_plane,
+        bottom_left, backend=backend)
+    geometry = np.array(((-100.0, 100.0, 10.0), (100.0, 100.0, 50.0),
+                         (0.0, -100.0, 30.0)),
+                        dtype=np.float32)
+    attributes = np.random.uniform(size=(3, 4)).astype(np.float32)
+    triangles = np.array((0, 1, 2), np.int32)
+
+    prediction = rasterizer.rasterize(geometry[np.newaxis, ...],
+                                      attributes[np.newaxis, ...], triangles)
+
+    pixel_x, pixel_y = np.meshgrid(
+        np.arange(width) + 0.5, np.arange(height) + 0.5)
+    pixel_position = np.stack((pixel_x, pixel_y), axis=-1).astype(np.float32)
+    groundtruth = glm.perspective_correct_interpolation(
+        np.broadcast_to(geometry, (height, width, 3, 3)),
+        np.broadcast_to(attributes, (height, width, 3, 4)), pixel_position,
+        camera_origin, look_at, camera_up, field_of_view,
+        (float(width), float(height)), near_plane, far_plane, bottom_left)
+    self.assertAllClose(prediction, groundtruth)
+
+  @parameterized.parameters(("opengl",), ("cpu",), ("shader",))
+  def test_rasterizer_rasterize_jacobian(self, backend):
+    """Tests the Jacobian of the rasterized attributes and vertices."""
+    depth = 20.0
+    geometry = np.array(
+        ((((-self.triangle_size, self.triangle_size, depth),
+           (self.triangle_size, self.triangle_size, depth),
+           (0.0, -self.triangle_size, depth)),),),
+        dtype=np.float32)
+    attributes_init = np.random.uniform(size=(1, 1, 3, 3)).astype(np.float32)
+    triangles = np.array((0, 1, 2), np.int32)
+    if backend == "cpu":
+      rasterizer = self.rasterizer_cpu
+    elif backend == "shader":
+      rasterizer = self.rasterizer_in_shader
+    else:
+      rasterizer = self.rasterizer
+
+    def rasterize(vertices, attributes):
+      return rasterizer.rasterize(vertices, attributes, triangles)
+
+    self.assert_jacobian_is_correct_fn(
+        rasterize, [geometry, attributes_init], atol=1e-3, delta=1e-2)
+
 
 if __name__ == "__main__":
   test_case.main()
@@ -18,10 +18,13 @@ limitations under the License.
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <thread>
 #include <vector>
 
 #include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 #include "tensorflow_graphics/rendering/opengl/macros.h"
+#include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
 
 template <typename T>
@@ -33,12 +36,32 @@ class ThreadSafeResourcePool
   // resource.
   // * maximum_pool_size: the maximum number of resources stored at once in the
   // pool.
+  // * maximum_num_resources: the maximum number of resources alive at once,
+  // whether they are stored in the pool or acquired, or 0 for no limit.
+  // * acquire_timeout: how long AcquireResource waits for a resource when
+  // maximum_num_resources are alive and none is stored in the pool.
   ThreadSafeResourcePool(
       std::function<tensorflow::Status(std::unique_ptr<T>*)> resource_creator,
-      unsigned int maximum_pool_size = 5);
+      unsigned int maximum_pool_size = 5,
+      unsigned int maximum_num_resources = 0,
+      absl::Duration acquire_timeout = absl::InfiniteDuration());
 
   // Acquires a unique_ptr on a resource.
   //
+  // Resources stored in the pool are acquired first, preferably one last
+  // returned by the calling thread, then one not used yet, so that resources
+  // bound to a thread, e.g. an EGL context, rarely migrate between threads.
+  // Otherwise, a new
+  // resource is created if fewer than maximum_num_resources are alive, and
+  // AcquireResource waits for one to be returned or discarded if not. The
+  // resources are created without holding the lock protecting the pool, so
+  // several threads can create resources concurrently, and a slow creation
+  // does not block the threads acquiring or returning the other resources. The
+  // resource creator must thus be thread-safe.
+  //
+  // Note: acquired resources must be given back with ReturnResource or
+  // DiscardResource, so that the pool can count the resources alive.
+  //
   // Arguments:
   // * resource: if the resource aquisition is successful, stores a pointer on
   // the acquired resource.
@@ -59,56 +82,185 @@ class ThreadSafeResourcePool
   //   and an object of type tensorflow::errors otherwise.
   tensorflow::Status ReturnResource(std::unique_ptr<T>& resource);
 
+  // Deletes an acquired resource instead of returning it to the pool, e.g.
+  // because an error left it in an unknown state.
+  //
+  // Arguments:
+  // * resource: the resource to delete; does nothing if it is empty.
+  void DiscardResource(std::unique_ptr<T>& resource);
+
+  // Creates resources until the pool stores num_resources of them, so that
+  // later acquisitions do not pay for their creation. Fewer resources are
+  // created if the pool is smaller, or if maximum_num_resources would be
+  // exceeded.
+  //
+  // Arguments:
+  // * num_resources: the number of resources to store in the pool.
+  //
+  // Returns:
+  //   A tensorflow::Status object storing tensorflow::Status::OK() on success,
+  //   and an object of type tensorflow::errors otherwise.
+  tensorflow::Status Prewarm(unsigned int num_resources);
+
  private:
+  // Returns whether a resource can be acquired without waiting.
+  bool CanAcquire() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Creates a resource, which num_resources_ must already account for.
+  tensorflow::Status CreateResource(std::unique_ptr<T>* resource)
+      ABSL_LOCKS_EXCLUDED(mutex_);
+  // Takes the resource of the pool preferred by the calling thread; the pool
+  // must not be empty.
+  std::unique_ptr<T> TakeFromPool() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Resource stored in the pool, and the thread which returned it, or the
+  // default id if it was never acquired.
+  struct PooledResource {
+    std::thread::id thread_id;
+    std::unique_ptr<T> resource;
+  };
+
   unsigned int maximum_pool_size_;
+  unsigned int maximum_num_resources_;
+  absl::Duration acquire_timeout_;
   absl::Mutex mutex_;
   std::function<tensorflow::Status(std::unique_ptr<T>*)> resource_creator_;
-  std::vector<std::unique_ptr<T>> resource_pool_;
+  std::vector<PooledResource> resource_pool_ ABSL_GUARDED_BY(mutex_);
+  // Number of resources stored in the pool, acquired, or being created.
+  unsigned int num_resources_ ABSL_GUARDED_BY(mutex_);
 };
 
 template <typename T>
 ThreadSafeResourcePool<T>::ThreadSafeResourcePool(
     const std::function<tensorflow::Status(std::unique_ptr<T>*)>
         resource_creator,
-    const unsigned int maximum_pool_size)
+    const unsigned int maximum_pool_size,
+    const unsigned int maximum_num_resources,
+    const absl::Duration acquire_timeout)
     : maximum_pool_size_(maximum_pool_size),
-      resource_creator_(resource_creator) {
+      maximum_num_resources_(maximum_num_resources),
+      acquire_timeout_(acquire_timeout),
+      resource_creator_(resource_creator),
+      num_resources_(0) {
   resource_pool_.reserve(maximum_pool_size);
 }
 
 template <typename T>
 tensorflow::Status ThreadSafeResourcePool<T>::AcquireResource(
     std::unique_ptr<T>* resource) {
-  absl::MutexLock lock(&mutex_);
+  {
+    absl::MutexLock lock(&mutex_);
 
-  // Creates a new resource or get it from the pool.
-  if (resource_pool_.empty()) {
-    TF_RETURN_IF_ERROR(resource_creator_(resource));
-    if (resource->get() == nullptr) {
-      return TFG_INTERNAL_ERROR(
-          "The resource creator returned an empty resource.");
+    if (!mutex_.AwaitWithTimeout(
+            absl::Condition(this, &ThreadSafeResourcePool<T>::CanAcquire),
+            acquire_timeout_)) {
+      return tensorflow::errors::DeadlineExceeded(
+          "Timed out waiting for one of the ", maximum_num_resources_,
+          " resources of the pool.");
     }
-  } else {
-    *resource = std::move(resource_pool_.back());
-    resource_pool_.pop_back();
+    // Gets a resource from the pool, or reserves room for a new one.
+    if (!resource_pool_.empty()) {
+      *resource = TakeFromPool();
+      return tensorflow::Status::OK();
+    }
+    ++num_resources_;
   }
-  return tensorflow::Status::OK();
+  return CreateResource(resource);
 }
 
 template <typename T>
 tensorflow::Status ThreadSafeResourcePool<T>::ReturnResource(
     std::unique_ptr<T>& resource) {
-  absl::MutexLock lock(&mutex_);
-
   if (resource.get() == nullptr)
     return TFG_INTERNAL_ERROR("Attempting to return an empty resource");
 
   // Adds the resource to the pool if not full, release it otherwise.
-  if (resource_pool_.size() < maximum_pool_size_)
-    resource_pool_.push_back(std::move(resource));
-  else
-    resource.reset();
+  std::unique_ptr<T> released_resource;
+  {
+    absl::MutexLock lock(&mutex_);
+
+    if (resource_pool_.size() < maximum_pool_size_) {
+      resource_pool_.push_back(
+          PooledResource{std::this_thread::get_id(), std::move(resource)});
+    } else {
+      released_resource = std::move(resource);
+      --num_resources_;
+    }
+  }
+  // released_resource is deleted here, without holding the lock.
   return tensorflow::Status::OK();
 }
 
+template <typename T>
+void ThreadSafeResourcePool<T>::DiscardResource(std::unique_ptr<T>& resource) {
+  if (resource.get() == nullptr) return;
+  resource.reset();
+  absl::MutexLock lock(&mutex_);
+  --num_resources_;
+}
+
+template <typename T>
+tensorflow::Status ThreadSafeResourcePool<T>::Prewarm(
+    unsigned int num_resources) {
+  if (num_resources > maximum_pool_size_) num_resources = maximum_pool_size_;
+
+  while (true) {
+    {
+      absl::MutexLock lock(&mutex_);
+
+      if (resource_pool_.size() >= num_resources ||
+          (maximum_num_resources_ != 0 &&
+           num_resources_ >= maximum_num_resources_))
+        return tensorflow::Status::OK();
+      ++num_resources_;
+    }
+    std::unique_ptr<T> resource;
+    TF_RETURN_IF_ERROR(CreateResource(&resource));
+    absl::MutexLock lock(&mutex_);
+    // Unlike returned resources, prewarmed ones are not bound to a thread.
+    resource_pool_.push_back(
+        PooledResource{std::thread::id(), std::move(resource)});
+  }
+}
+
+template <typename T>
+bool ThreadSafeResourcePool<T>::CanAcquire() const {
+  return !resource_pool_.empty() || maximum_num_resources_ == 0 ||
+         num_resources_ < maximum_num_resources_;
+}
+
+template <typename T>
+tensorflow::Status ThreadSafeResourcePool<T>::CreateResource(
+    std::unique_ptr<T>* resource) {
+  tensorflow::Status status = resource_creator_(resource);
+  if (status.ok() && resource->get() == nullptr) {
+    status = TFG_INTERNAL_ERROR(
+        "The resource creator returned an empty resource.");
+  }
+  if (!status.ok()) {
+    resource->reset();
+    absl::MutexLock lock(&mutex_);
+    --num_resources_;
+  }
+  return status;
+}
+
+template <typename T>
+std::unique_ptr<T> ThreadSafeResourcePool<T>::TakeFromPool() {
+  const std::thread::id thread_id = std::this_thread::get_id();
+  // Defaults to the most recently returned resource.
+  auto selected = resource_pool_.end() - 1;
+  for (auto it = resource_pool_.rbegin(); it != resource_pool_.rend(); ++it) {
+    if (it->thread_id == thread_id) {
+      selected = it.base() - 1;
+      break;
+    }
+    if (it->thread_id == std::thread::id() &&
+        selected->thread_id != std::thread::id())
+      selected = it.base() - 1;
+  }
+  std::unique_ptr<T> resource = std::move(selected->resource);
+  resource_pool_.erase(selected);
+  return resource;
+}
+
 #endif  // THIRD_PARTY_PY_TENSORFLOW_GRAPHICS_RENDERING_OPENGL_THREAD_SAFE_RESOURCE_POOL_H_
@@ -25,16 +25,69 @@ from __future__ import print_function
 
 import tensorflow.compat.v2 as tf
 
+from tensorflow_graphics.rendering.opengl import gen_cpu_rasterizer_op as cpu_render_ops
+from tensorflow_graphics.rendering.opengl import gen_interpolate_attributes_op as interpolation_ops
 from tensorflow_graphics.rendering.opengl import gen_rasterizer_op as render_ops
 from tensorflow_graphics.rendering.opengl import math as glm
 from tensorflow_graphics.util import export_api
 from tensorflow_graphics.util import shape
 
 
+@tf.RegisterGradient("InterpolateAttributes")
+def _interpolate_attributes_grad(op, grad):
+  """Returns the gradients of InterpolateAttributes with respect to its inputs.
+
+  Args:
+    op: The InterpolateAttributes operation.
+    grad: The gradient of the interpolated attributes.
+
+  Returns:
+    The gradients of the inputs of `op`, which are None for the integer ones.
+  """
+  vertices_grad, attributes_grad, view_projection_matrix_grad = (
+      interpolation_ops.interpolate_attributes_grad(*op.inputs, grad))
+  return (None, vertices_grad, None, attributes_grad,
+          view_projection_matrix_grad)
+
+
 def _dim_value(dim):
   return 1 if dim is None else tf.compat.v1.dimension_value(dim)
 
 
+def _index_meshes(vertices, attributes, triangles):
+  """Returns the vertices, attributes, and int32 triangles of indexed meshes.
+
+  Triangles of shape `[3]` hold a single triangle, which is used by each of the
+  meshes stored along the last batch dimension of `vertices` and `attributes`,
+  as when gathering the vertices of the triangle. These meshes are merged into
+  one, which has one triangle per original mesh.
+
+  Args:
+    vertices: A tensor of shape `[A1, ..., An, V, 3]`.
+    attributes: A tensor of shape `[A1, ..., An, V, K]`.
+    triangles: An integer tensor of shape `[T, 3]` or `[3]`.
+
+  Returns:
+    The vertices and attributes, of shapes `[A1, ..., An, V, 3]` and
+    `[A1, ..., An, V, K]`, and the triangles indexing them, of shape `[T, 3]`.
+  """
+  triangles = tf.cast(triangles, tf.int32)
+  if triangles.shape.ndims != 1:
+    return vertices, attributes, triangles
+
+  batch_shape = [_dim_value(dim) for dim in vertices.shape[:-3]]
+  num_meshes = _dim_value(vertices.shape[-3])
+  num_vertices = _dim_value(vertices.shape[-2])
+  vertices = tf.reshape(
+      vertices, batch_shape + [num_meshes * num_vertices, 3])
+  attributes = tf.reshape(
+      attributes,
+      batch_shape + [num_meshes * num_vertices, attributes.shape[-1]])
+  triangles = (tf.expand_dims(triangles, axis=0) +
+               tf.expand_dims(tf.range(num_meshes) * num_vertices, axis=-1))
+  return vertices, attributes, triangles
+
+
 # TODO(b/149683925): Put the shaders in separate files for reusability &
 # code cleanliness.
 
@@ -56,17 +109,19 @@ layout(triangle_strip, max_vertices=3) out;
 
 out layout(location = 0) vec3 vertex_position;
 out layout(location = 1) vec2 barycentric_coordinates;
-out layout(location = 2) float triangle_index;
+layout(location = 2) flat out int triangle_index;
 
 in int gl_PrimitiveIDIn;
-layout(binding=0) buffer triangular_mesh { float mesh_buffer[]; };
+layout(binding=0) buffer mesh_vertices { float vertex_buffer[]; };
+layout(binding=1) buffer mesh_triangles { int index_buffer[]; };
 
 
 vec3 get_vertex_position(int vertex_index) {
-  // Triangles are packed as 3 consecuitve vertices, each with 3 coordinates.
-  int offset = gl_PrimitiveIDIn * 9 + vertex_index * 3;
-  return vec3(mesh_buffer[offset], mesh_buffer[offset + 1],
-    mesh_buffer[offset + 2]);
+  // Triangles are packed as 3 consecutive vertex indices, and vertices as 3
+  // consecutive coordinates.
+  int offset = index_buffer[gl_PrimitiveIDIn * 3 + vertex_index] * 3;
+  return vec3(vertex_buffer[offset], vertex_buffer[offset + 1],
+    vertex_buffer[offset + 2]);
 }
 
 // Note that this function can cause artifacts for triangles that cross the eye
@@ -110,22 +165,228 @@ void main() {
 
 # TODO(b/151133955): add support to render a foreground / background mask.
 
-# Fragment shader that packs barycentric coordinates, triangle index, and depth
-# map in a resulting vec4 per pixel.
+# Fragment shader that writes the index of the rasterized triangle to an
+# integer color attachment, which keeps indices exact beyond 2^24 triangles.
 fragment_shader = """
 #version 430
 
 in layout(location = 0) vec3 vertex_position;
 in layout(location = 1) vec2 barycentric_coordinates;
-in layout(location = 2) float triangle_index;
+layout(location = 2) flat in int triangle_index;
+
+layout(location = 0) out vec4 output_color;
+layout(location = 1) out int output_triangle_index;
+
+void main() {
+  output_color = vec4(barycentric_coordinates, 0.0, 0.0);
+  output_triangle_index = triangle_index;
+}
+"""
+
+# Vertex shader that projects the vertices of the mesh onto the image plane,
+# which are drawn as indexed triangles without geometry shader.
+indexed_vertex_shader = """
+#version 430
+
+uniform mat4 view_projection_matrix;
 
-out vec4 output_color;
+in layout(location = 0) vec3 vertex_position;
 
 void main() {
-  output_color = vec4(round(triangle_index), 0.0, 0.0, 0.0);
+  gl_Position = view_projection_matrix * vec4(vertex_position, 1.0);
+}
+"""
+
+# Fragment shader matching the geometry and fragment shaders above, for
+# triangles drawn without geometry shader.
+indexed_fragment_shader = """
+#version 430
+
+layout(location = 0) out vec4 output_color;
+layout(location = 1) out int output_triangle_index;
+
+void main() {
+  // Cull back-facing triangles.
+  if (!gl_FrontFacing) {
+    discard;
+  }
+  output_color = vec4(0.0);
+  output_triangle_index = gl_PrimitiveID;
 }
 """
 
+# Shaders interpolating the attributes of the vertices in the fragment stage,
+# where the K attributes of each fragment are packed into NUM_TARGETS = ceil(K /
+# 4) vec4 color attachments. NUM_ATTRIBUTES and NUM_TARGETS are substituted
+# before compiling the shaders.
+
+# Geometry shader that projects the vertices of visible triangles onto the image
+# plane, and fetches their attributes.
+attribute_geometry_shader = """
+#version 430
+
+const int num_attributes = NUM_ATTRIBUTES;
+
+uniform mat4 view_projection_matrix;
+
+layout(points) in;
+layout(triangle_strip, max_vertices=3) out;
+
+layout(location = 0) flat out int triangle_index;
+out layout(location = 1) vec4 vertex_attributes[NUM_TARGETS];
+
+in int gl_PrimitiveIDIn;
+layout(binding=0) buffer mesh_vertices { float vertex_buffer[]; };
+layout(binding=1) buffer mesh_triangles { int index_buffer[]; };
+layout(binding=2) buffer mesh_attributes { float attribute_buffer[]; };
+
+bool is_back_facing(vec4 projected_vertex_0, vec4 projected_vertex_1,
+                    vec4 projected_vertex_2) {
+  projected_vertex_0 /= projected_vertex_0.w;
+  projected_vertex_1 /= projected_vertex_1.w;
+  projected_vertex_2 /= projected_vertex_2.w;
+  vec2 a = (projected_vertex_1.xy - projected_vertex_0.xy);
+  vec2 b = (projected_vertex_2.xy - projected_vertex_0.xy);
+  return (a.x * b.y - b.x * a.y) <= 0;
+}
+
+void main() {
+  int vertex_indices[3] = {index_buffer[gl_PrimitiveIDIn * 3],
+                           index_buffer[gl_PrimitiveIDIn * 3 + 1],
+                           index_buffer[gl_PrimitiveIDIn * 3 + 2]};
+  vec4 projected_vertices[3];
+  for (int i = 0; i < 3; ++i) {
+    int offset = vertex_indices[i] * 3;
+    projected_vertices[i] = view_projection_matrix * vec4(
+        vertex_buffer[offset], vertex_buffer[offset + 1],
+        vertex_buffer[offset + 2], 1.0);
+  }
+
+  // Cull back-facing triangles.
+  if (is_back_facing(projected_vertices[0], projected_vertices[1],
+      projected_vertices[2])) {
+    return;
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    gl_Position = projected_vertices[i];
+    triangle_index = gl_PrimitiveIDIn;
+
+    // Attributes are packed as num_attributes consecutive values per vertex.
+    vec4 attributes[NUM_TARGETS];
+    for (int target = 0; target < NUM_TARGETS; ++target) {
+      attributes[target] = vec4(0.0);
+    }
+    for (int k = 0; k < num_attributes; ++k) {
+      attributes[k / 4][k % 4] =
+          attribute_buffer[vertex_indices[i] * num_attributes + k];
+    }
+    vertex_attributes = attributes;
+    EmitVertex();
+  }
+  EndPrimitive();
+}
+"""
+
+# Fragment shader writing the index of the triangle and the
+# perspective-correct interpolation of its attributes. The color output is not
+# read back.
+attribute_fragment_shader = """
+#version 430
+
+layout(location = 0) flat in int triangle_index;
+in layout(location = 1) vec4 vertex_attributes[NUM_TARGETS];
+
+layout(location = 0) out vec4 output_color;
+layout(location = 1) out int output_triangle_index;
+layout(location = 2) out vec4 output_attributes[NUM_TARGETS];
+
+void main() {
+  output_color = vec4(0.0);
+  output_triangle_index = triangle_index;
+  output_attributes = vertex_attributes;
+}
+"""
+
+# Vertex shader matching the geometry shader above, for triangles drawn without
+# geometry shader. The attributes are fed as NUM_TARGETS vec4 vertex attributes.
+indexed_attribute_vertex_shader = """
+#version 430
+
+uniform mat4 view_projection_matrix;
+
+in layout(location = 0) vec3 vertex_position;
+VERTEX_ATTRIBUTES_DECLARATIONS
+out layout(location = 1) vec4 vertex_attributes[NUM_TARGETS];
+
+void main() {
+  gl_Position = view_projection_matrix * vec4(vertex_position, 1.0);
+VERTEX_ATTRIBUTES_ASSIGNMENTS
+}
+"""
+
+# Fragment shader matching the vertex shader above.
+indexed_attribute_fragment_shader = """
+#version 430
+
+in layout(location = 1) vec4 vertex_attributes[NUM_TARGETS];
+
+layout(location = 0) out vec4 output_color;
+layout(location = 1) out int output_triangle_index;
+layout(location = 2) out vec4 output_attributes[NUM_TARGETS];
+
+void main() {
+  // Cull back-facing triangles.
+  if (!gl_FrontFacing) {
+    discard;
+  }
+  output_color = vec4(0.0);
+  output_triangle_index = gl_PrimitiveID;
+  output_attributes = vertex_attributes;
+}
+"""
+
+
+def _attribute_shaders(num_attributes, use_geometry_shader):
+  """Returns the shaders interpolating attributes in the fragment stage.
+
+  Args:
+    num_attributes: The number of attributes K of each vertex.
+    use_geometry_shader: Whether the triangles are drawn as points expanded by a
+      geometry shader, or as indexed triangles.
+
+  Returns:
+    A dictionary with the vertex, geometry and fragment shaders of the program.
+  """
+  num_targets = (num_attributes + 3) // 4
+  if use_geometry_shader:
+    shaders = {
+        "vertex_shader": vertex_shader,
+        "geometry_shader": attribute_geometry_shader,
+        "fragment_shader": attribute_fragment_shader,
+    }
+  else:
+    declarations = "\n".join(
+        "in layout(location = %d) vec4 vertex_attributes_%d;" % (target + 1,
+                                                                 target)
+        for target in range(num_targets))
+    assignments = "\n".join(
+        "  vertex_attributes[%d] = vertex_attributes_%d;" % (target, target)
+        for target in range(num_targets))
+    shaders = {
+        "vertex_shader":
+            indexed_attribute_vertex_shader.replace(
+                "VERTEX_ATTRIBUTES_DECLARATIONS", declarations).replace(
+                    "VERTEX_ATTRIBUTES_ASSIGNMENTS", assignments),
+        "geometry_shader": "",
+        "fragment_shader": indexed_attribute_fragment_shader,
+    }
+  return {
+      name: shader.replace("NUM_ATTRIBUTES", str(num_attributes)).replace(
+          "NUM_TARGETS", str(num_targets))
+      for name, shader in shaders.items()
+  }
+
 
 class TriangleRasterizer(object):
   """A class allowing to rasterize triangular meshes.
@@ -149,6 +410,9 @@ class TriangleRasterizer(object):
                near_plane,
                far_plane,
                bottom_left=(0.0, 0.0),
+               use_geometry_shader=True,
+               backend="opengl",
+               interpolate_in_shader=False,
                name=None):
     """Initializes TriangleRasterizer with OpenGL parameters and the background.
 
@@ -189,8 +453,33 @@ class TriangleRasterizer(object):
       bottom_left: A Tensor of shape `[A1, ..., An, 2]`, where the last axis
         captures the position (in pixels) of the lower left corner of the
         screen. Defaults to (0.0, 0.0).
+      use_geometry_shader: If True, each triangle is drawn as a point expanded
+        by a geometry shader. Otherwise, the triangles are drawn as indexed
+        triangles, the vertices being fed to the vertex shader as vertex
+        attributes. Both yield the same images. Defaults to True. Ignored by
+        the 'cpu' backend.
+      backend: A string selecting how triangles are rasterized, either
+        'opengl' to render with EGL, or 'cpu' to rasterize with a native
+        multithreaded kernel that does not require EGL. Both yield the same
+        images. Defaults to 'opengl'.
+      interpolate_in_shader: If True, the attributes are interpolated by the
+        fragment shader in the same render pass as the triangle indices, and
+        are read back from ceil(K / 4) additional float color attachments,
+        whose number is limited by the OpenGL implementation. The gradients
+        are those of the native interpolation op. Requires the 'opengl'
+        backend, and a `bottom_left` statically known to be zero. Defaults to
+        False.
         name: A name for this op. Defaults to 'triangle_rasterizer_init'.
+
+    Raises:
+      ValueError: if `backend` is neither 'opengl' nor 'cpu', or if
+        `interpolate_in_shader` is set with the 'cpu' backend or with a
+        `bottom_left` that is not statically known to be zero.
     """
+    if backend not in ("opengl", "cpu"):
+      raise ValueError("Unknown rasterizer backend: %s" % backend)
+    if interpolate_in_shader and backend != "opengl":
+      raise ValueError("interpolate_in_shader requires the 'opengl' backend.")
     with tf.compat.v1.name_scope(
         name, "triangle_rasterizer_init",
         (background_vertices, background_attributes, background_triangles,
@@ -227,10 +516,15 @@ class TriangleRasterizer(object):
       height = float(image_size[0])
       width = float(image_size[1])
 
-      self._background_geometry = tf.gather(
-          background_vertices, background_triangles, axis=-2)
-      self._background_attribute = tf.gather(
-          background_attributes, background_triangles, axis=-2)
+      # The background is stored as an indexed mesh, which is merged with the
+      # scene in every rasterized image.
+      background_vertices, background_attributes, background_triangles = (
+          _index_meshes(background_vertices, background_attributes,
+                        background_triangles))
+      self._background_vertices = tf.reshape(background_vertices, (-1, 3))
+      self._background_attributes = tf.reshape(
+          background_attributes, (-1, background_attributes.shape[-1]))
+      self._background_triangles = background_triangles
 
       self._camera_origin = tf.convert_to_tensor(value=camera_origin)
       self._look_at = tf.convert_to_tensor(value=look_at)
@@ -241,13 +535,16 @@ class TriangleRasterizer(object):
       self._near_plane = tf.convert_to_tensor(value=near_plane)
       self._far_plane = tf.convert_to_tensor(value=far_plane)
       self._bottom_left = tf.convert_to_tensor(value=bottom_left)
-
-      # Construct the pixel grid. Note that OpenGL uses half-integer pixel
-      # centers.
-      px = tf.linspace(0.5, width - 0.5, num=int(width))
-      py = tf.linspace(0.5, height - 0.5, num=int(height))
-      xv, yv = tf.meshgrid(px, py)
-      self._pixel_position = tf.stack((xv, yv), axis=-1)
+      # The shaders interpolate the attributes at the pixel centers of the
+      # rendered image, which cannot be offset by `bottom_left`.
+      if interpolate_in_shader:
+        static_bottom_left = tf.get_static_value(self._bottom_left)
+        if static_bottom_left is None or static_bottom_left.any():
+          raise ValueError(
+              "interpolate_in_shader requires bottom_left to be zero.")
+      self._use_geometry_shader = use_geometry_shader
+      self._backend = backend
+      self._interpolate_in_shader = interpolate_in_shader
 
       # Construct the view projection matrix.
       world_to_camera = glm.look_at_right_handed(camera_origin, look_at,
@@ -259,6 +556,17 @@ class TriangleRasterizer(object):
       self._view_projection_matrix = tf.linalg.matmul(perspective_matrix,
                                                       world_to_camera)
 
+      # The attributes are interpolated at the pixel centers of a screen whose
+      # lower left corner is at `bottom_left`, which shifts the vertices in
+      # normalized device coordinates.
+      ndc_offset = 2.0 * self._bottom_left / self._image_size_glm
+      matrix = self._view_projection_matrix
+      self._interpolation_matrix = tf.stack(
+          (matrix[..., 0, :] + ndc_offset[..., 0:1] * matrix[..., 3, :],
+           matrix[..., 1, :] + ndc_offset[..., 1:2] * matrix[..., 3, :],
+           matrix[..., 2, :], matrix[..., 3, :]),
+          axis=-2)
+
   def rasterize(self,
                 scene_vertices=None,
                 scene_attributes=None,
@@ -267,12 +575,14 @@ class TriangleRasterizer(object):
     """Rasterizes the scene.
 
     This rasterizer estimates which triangle is associated with each pixel using
-    OpenGL. Then the value of attributes are estimated using Tensorflow,
-    allowing to get gradients flowing through the attributes. Attributes can be
-    depth, appearance, or more generally, any K-dimensional representation. Note
-    that similarly to algorithms like Iterative Closest Point (ICP), not having
-    gradients through correspondence does not prevent from optimizing the scene
-    geometry. Custom gradients can be defined to alleviate this property.
+    OpenGL, or a native CPU kernel when the rasterizer was created with the
+    'cpu' backend. Then the value of attributes are interpolated by a single
+    native op, allowing to get gradients flowing through the attributes and the
+    geometry of the triangles. Attributes can be depth, appearance, or more
+    generally, any K-dimensional representation. Note that similarly to
+    algorithms like Iterative Closest Point (ICP), not having gradients through
+    correspondence does not prevent from optimizing the scene geometry. Custom
+    gradients can be defined to alleviate this property.
 
     Note:
       In the following, A1 to An are optional batch dimensions.
@@ -313,53 +623,168 @@ class TriangleRasterizer(object):
           tensor_name="scene_triangles",
           has_dim_equals=((-1, 3)))
 
-      batch_dims_triangles = len(scene_triangles.shape[:-2])
-      scene_attributes = tf.gather(
-          scene_attributes,
-          scene_triangles,
-          axis=-2,
-          batch_dims=batch_dims_triangles)
-      scene_geometry = tf.gather(
-          scene_vertices,
-          scene_triangles,
-          axis=-2,
-          batch_dims=batch_dims_triangles)
-
-      batch_shape = scene_geometry.shape[:-3]
-      batch_shape = [_dim_value(dim) for dim in batch_shape]
+      # The vertices are uploaded once along with the triangles indexing them,
+      # rather than once per triangle using them.
+      scene_vertices, scene_attributes, scene_triangles = _index_meshes(
+          scene_vertices, scene_attributes, scene_triangles)
 
-      background_geometry = tf.broadcast_to(
-          self._background_geometry,
-          batch_shape + self._background_geometry.shape)
-      background_attribute = tf.broadcast_to(
-          self._background_attribute,
-          batch_shape + self._background_attribute.shape)
-      geometry = tf.concat((background_geometry, scene_geometry), axis=-3)
-      attributes = tf.concat((background_attribute, scene_attributes), axis=-3)
+      batch_shape = scene_vertices.shape[:-2]
+      batch_shape = [_dim_value(dim) for dim in batch_shape]
+      num_background_vertices = _dim_value(
+          self._background_vertices.shape[-2])
+      num_background_triangles = _dim_value(
+          self._background_triangles.shape[-2])
+      num_scene_triangles = _dim_value(scene_triangles.shape[-2])
+
+      background_vertices = tf.broadcast_to(
+          self._background_vertices,
+          batch_shape + self._background_vertices.shape)
+      background_attributes = tf.broadcast_to(
+          self._background_attributes,
+          batch_shape + self._background_attributes.shape)
+      background_triangles = tf.broadcast_to(
+          self._background_triangles,
+          batch_shape + [num_background_triangles, 3])
+      scene_triangles = tf.broadcast_to(
+          scene_triangles + num_background_vertices,
+          batch_shape + [num_scene_triangles, 3])
+      vertices = tf.concat((background_vertices, scene_vertices), axis=-2)
+      attributes = tf.concat((background_attributes, scene_attributes),
+                             axis=-2)
+      triangles = tf.concat((background_triangles, scene_triangles), axis=-2)
 
       view_projection_matrix = tf.broadcast_to(
           input=self._view_projection_matrix,
           shape=batch_shape + self._view_projection_matrix.shape)
-      rasterized_face = render_ops.rasterize(
-          num_points=geometry.shape[-3],
-          variable_names=("view_projection_matrix", "triangular_mesh"),
-          variable_kinds=("mat", "buffer"),
-          variable_values=(view_projection_matrix,
-                           tf.reshape(geometry, shape=batch_shape + [-1])),
+      if self._interpolate_in_shader:
+        return self._rasterize_and_interpolate(vertices, attributes, triangles,
+                                               view_projection_matrix,
+                                               batch_shape)
+      if self._backend == "cpu":
+        triangle_index = cpu_render_ops.rasterize_triangles(
+            vertices=vertices,
+            triangles=triangles,
+            view_projection_matrix=view_projection_matrix,
+            output_resolution=self._image_size_int).triangle_index[..., 0]
+      else:
+        if self._use_geometry_shader:
+          draw_kwargs = {
+              "vertex_shader": vertex_shader,
+              "geometry_shader": geometry_shader,
+              "fragment_shader": fragment_shader,
+              "draw_mode": "points",
+          }
+          vertices_name = "mesh_vertices"
+          vertices_kind = "buffer"
+        else:
+          draw_kwargs = {
+              "vertex_shader": indexed_vertex_shader,
+              "geometry_shader": "",
+              "fragment_shader": indexed_fragment_shader,
+              "draw_mode": "indexed_triangles",
+          }
+          vertices_name = "vertex_position"
+          vertices_kind = "vertex_buffer"
+        rasterized = render_ops.rasterize(
+            num_points=num_background_triangles + num_scene_triangles,
+            variable_names=("view_projection_matrix", vertices_name,
+                            "mesh_triangles"),
+            variable_kinds=("mat", vertices_kind, "index_buffer"),
+            variable_values=(view_projection_matrix,
+                             tf.reshape(vertices, shape=batch_shape + [-1]),
+                             tf.reshape(triangles, shape=batch_shape + [-1])),
+            output_resolution=self._image_size_int,
+            num_channels=1,
+            attachment_types=(tf.int32,),
+            attachment_channels=(1,),
+            **draw_kwargs)
+        triangle_index = rasterized.attachments[0][..., 0]
+      interpolation_matrix = tf.broadcast_to(
+          input=self._interpolation_matrix,
+          shape=batch_shape + self._interpolation_matrix.shape)
+      return interpolation_ops.interpolate_attributes(
+          triangle_index=triangle_index,
+          vertices=vertices,
+          triangles=triangles,
+          attributes=attributes,
+          view_projection_matrix=interpolation_matrix)
+
+  def _rasterize_and_interpolate(self, vertices, attributes, triangles,
+                                 view_projection_matrix, batch_shape):
+    """Rasterizes the triangles and interpolates their attributes with OpenGL.
+
+    Args:
+      vertices: A tensor of shape `[A1, ..., An, V, 3]` containing the vertices
+        of the meshes, including the background.
+      attributes: A tensor of shape `[A1, ..., An, V, K]` containing the
+        attributes of the vertices.
+      triangles: An int32 tensor of shape `[A1, ..., An, T, 3]` containing the
+        triangles of the meshes.
+      view_projection_matrix: A tensor of shape `[A1, ..., An, 4, 4]`.
+      batch_shape: The list of batch dimensions `[A1, ..., An]`.
+
+    Returns:
+      A tensor of shape `[A1, ..., An, H, W, K]` containing the attributes
+      interpolated at each pixel.
+    """
+    num_attributes = _dim_value(attributes.shape[-1])
+    num_targets = (num_attributes + 3) // 4
+    num_triangles = _dim_value(triangles.shape[-2])
+
+    @tf.custom_gradient
+    def interpolate(vertices, attributes, view_projection_matrix):
+      """Renders the interpolated attributes, with the gradient of the op."""
+      if self._use_geometry_shader:
+        attribute_variables = (
+            ("mesh_attributes", "buffer",
+             tf.reshape(attributes, shape=batch_shape + [-1])),)
+        vertices_name = "mesh_vertices"
+        vertices_kind = "buffer"
+        draw_mode = "points"
+      else:
+        # Each vertex attribute holds 4 channels, the last one being padded.
+        padded_attributes = tf.pad(
+            attributes, [[0, 0]] * (len(batch_shape) + 1) +
+            [[0, num_targets * 4 - num_attributes]])
+        attribute_variables = tuple(
+            ("vertex_attributes_%d" % target, "vertex_buffer",
+             tf.reshape(
+                 padded_attributes[..., target * 4:(target + 1) * 4],
+                 shape=batch_shape + [-1])) for target in range(num_targets))
+        vertices_name = "vertex_position"
+        vertices_kind = "vertex_buffer"
+        draw_mode = "indexed_triangles"
+      variables = (
+          ("view_projection_matrix", "mat", view_projection_matrix),
+          (vertices_name, vertices_kind,
+           tf.reshape(vertices, shape=batch_shape + [-1])),
+          ("mesh_triangles", "index_buffer",
+           tf.reshape(triangles, shape=batch_shape + [-1])),
+      ) + attribute_variables
+      rasterized = render_ops.rasterize(
+          num_points=num_triangles,
+          variable_names=[variable[0] for variable in variables],
+          variable_kinds=[variable[1] for variable in variables],
+          variable_values=[variable[2] for variable in variables],
           output_resolution=self._image_size_int,
-          vertex_shader=vertex_shader,
-          geometry_shader=geometry_shader,
-          fragment_shader=fragment_shader)
-      triangle_index = tf.cast(rasterized_face[..., 0], tf.int32)
-      vertices_per_pixel = tf.gather(
-          geometry, triangle_index, axis=-3, batch_dims=len(batch_shape))
-      attributes_per_pixel = tf.gather(
-          attributes, triangle_index, axis=-3, batch_dims=len(batch_shape))
-      return glm.perspective_correct_interpolation(
-          vertices_per_pixel, attributes_per_pixel, self._pixel_position,
-          self._camera_origin, self._look_at, self._camera_up,
-          self._field_of_view, self._image_size_glm, self._near_plane,
-          self._far_plane, self._bottom_left)
+          num_channels=1,
+          attachment_types=(tf.int32,) + (tf.float32,) * num_targets,
+          attachment_channels=(1,) + (4,) * num_targets,
+          draw_mode=draw_mode,
+          **_attribute_shaders(num_attributes, self._use_geometry_shader))
+      triangle_index = rasterized.attachments[0][..., 0]
+      interpolated_attributes = tf.concat(
+          rasterized.attachments[1:], axis=-1)[..., :num_attributes]
+
+      def grad(interpolated_attributes_grad):
+        return list(
+            interpolation_ops.interpolate_attributes_grad(
+                triangle_index, vertices, triangles, attributes,
+                view_projection_matrix, interpolated_attributes_grad))
+
+      return interpolated_attributes, grad
+
+    return interpolate(vertices, attributes, view_projection_matrix)
 
 
 # API contains all public functions and classes.